@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Replays a skewed key stream against a cache of each policy, missing
+ * into cache_put(), and reports the hit ratio and time per request.
+ * Every so often a scan of keys which are never seen again is mixed
+ * in, which LRU and CLOCK admit at the expense of the working set.
+ *
+ * Usage: bench_cache [capacity] [number of distinct keys] [number of
+ * requests]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/cache.h>
+
+static const char* policy_names[] = { "LRU", "CLOCK", "S3-FIFO" };
+
+int
+main(int argc, char** argv)
+{
+    size_t   capacity   = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t   n_distinct = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    size_t   n          = argc > 3 ? strtoul(argv[3], NULL, 10) : 10000000;
+    void**   keys       = malloc(sizeof(*keys) * n);
+    uint64_t state      = 0x9e3779b97f4a7c15ULL;
+    uint64_t scan_key   = n_distinct;
+
+    for (size_t i = 0; i < n; i++) {
+        if (i % 100000 < 10000) {
+            /* one-off scan */
+            keys[i] = (void*)(uintptr_t)(++scan_key);
+        }
+        else {
+            /* the product of two uniform draws favours small keys */
+            uint64_t a = bench_rand(&state) % n_distinct;
+            uint64_t b = bench_rand(&state) % n_distinct;
+
+            keys[i] = (void*)(uintptr_t)(a * b / n_distinct + 1);
+        }
+    }
+
+    printf("%-8s %11s %11s %11s\n",
+           "policy",
+           "requests",
+           "hit ratio",
+           "ns/req");
+
+    for (int p = CACHE_POLICY_LRU; p <= CACHE_POLICY_S3FIFO; p++) {
+        struct cache cache;
+        double       start;
+
+        cache_init(&cache, p, capacity, bench_hash_int, bench_compare_int);
+
+        start = bench_now();
+        for (size_t i = 0; i < n; i++) {
+            void* value;
+
+            if (!cache_get(&cache, keys[i], &value)) {
+                cache_put(&cache, keys[i], keys[i], 1);
+            }
+        }
+
+        printf("%-8s %11zu %11.4f %11.1f\n",
+               policy_names[p],
+               n,
+               (double)cache.counters.n_hits / n,
+               (bench_now() - start) / n);
+
+        cache_destroy(&cache);
+    }
+
+    free(keys);
+
+    return 0;
+}
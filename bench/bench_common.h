@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static inline double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift64*, good enough for shuffling benchmark inputs */
+static inline uint64_t
+bench_rand(uint64_t* state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline void
+bench_shuffle(void** items, size_t n, uint64_t seed)
+{
+    uint64_t state = seed | 1;
+
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t j    = bench_rand(&state) % (i + 1);
+        void*  temp = items[i];
+
+        items[i] = items[j];
+        items[j] = temp;
+    }
+}
+
+/* Integer keys are stored directly in the key pointer */
+static inline uint64_t
+bench_hash_int(const void* a)
+{
+    uint64_t x = (uintptr_t)(*(void* const*)a);
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+static inline int
+bench_compare_int(const void* a, const void* b)
+{
+    return *(void* const*)a != *(void* const*)b;
+}
+
+/* Keeps the compiler from discarding results we don't otherwise use */
+static volatile uintptr_t bench_sink;
+
+#endif /* BENCH_COMMON_H */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures the throughput of a concurrent_hashmap shared between 1 to N
+ * threads at several read/write ratios, against a struct hashmap
+ * behind a single mutex.
+ *
+ * Usage: bench_concurrent_hashmap [max threads]
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include <magpie/collections/concurrent_hashmap.h>
+#include <magpie/collections/hashmap.h>
+
+#define N_KEYS         (1 << 20)
+#define OPS_PER_THREAD (1 << 20)
+
+struct impl {
+    const char* name;
+    void (*init)(void);
+    void (*destroy)(void);
+    void (*set)(void* key, void* value);
+    void (*get)(void* key);
+    void (*remove)(void* key);
+};
+
+struct worker {
+    const struct impl* impl;
+    unsigned           read_percent;
+    uint64_t           seed;
+    pthread_barrier_t* barrier;
+};
+
+static struct concurrent_hashmap concurrent;
+static struct hashmap            locked;
+static pthread_mutex_t           locked_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+concurrent_init(void)
+{
+    concurrent_hashmap_init(&concurrent, 0, bench_hash_int, bench_compare_int);
+}
+
+static void
+concurrent_destroy(void)
+{
+    concurrent_hashmap_destroy(&concurrent);
+}
+
+static void
+concurrent_set(void* key, void* value)
+{
+    concurrent_hashmap_set(&concurrent, key, value);
+}
+
+static void
+concurrent_get(void* key)
+{
+    void* value;
+
+    concurrent_hashmap_get(&concurrent, key, &value);
+    bench_sink += (uintptr_t)value;
+}
+
+static void
+concurrent_remove(void* key)
+{
+    concurrent_hashmap_remove(&concurrent, key);
+}
+
+static void
+locked_init(void)
+{
+    hashmap_init(&locked, bench_hash_int, bench_compare_int);
+}
+
+static void
+locked_destroy(void)
+{
+    hashmap_destroy(&locked);
+}
+
+static void
+locked_set(void* key, void* value)
+{
+    pthread_mutex_lock(&locked_mutex);
+    hashmap_set(&locked, key, value);
+    pthread_mutex_unlock(&locked_mutex);
+}
+
+static void
+locked_get(void* key)
+{
+    void* value;
+
+    pthread_mutex_lock(&locked_mutex);
+    hashmap_get(&locked, key, &value);
+    pthread_mutex_unlock(&locked_mutex);
+
+    bench_sink += (uintptr_t)value;
+}
+
+static void
+locked_remove(void* key)
+{
+    pthread_mutex_lock(&locked_mutex);
+    hashmap_remove(&locked, key);
+    pthread_mutex_unlock(&locked_mutex);
+}
+
+static const struct impl impls[] = {
+    {
+        .name    = "concurrent",
+        .init    = concurrent_init,
+        .destroy = concurrent_destroy,
+        .set     = concurrent_set,
+        .get     = concurrent_get,
+        .remove  = concurrent_remove,
+    },
+    {
+        .name    = "mutex",
+        .init    = locked_init,
+        .destroy = locked_destroy,
+        .set     = locked_set,
+        .get     = locked_get,
+        .remove  = locked_remove,
+    },
+};
+
+static void*
+work(void* arg)
+{
+    struct worker* w     = arg;
+    uint64_t       state = w->seed;
+
+    pthread_barrier_wait(w->barrier);
+
+    for (size_t i = 0; i < OPS_PER_THREAD; i++) {
+        uint64_t r   = bench_rand(&state);
+        void*    key = (void*)(uintptr_t)(1 + (r >> 8) % N_KEYS);
+
+        /* writes are an even mix of updates and removals, so the map
+         * stays around the same size throughout */
+        if (r % 100 < w->read_percent) {
+            w->impl->get(key);
+        }
+        else if (r & 0x80) {
+            w->impl->set(key, key);
+        }
+        else {
+            w->impl->remove(key);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+run(const struct impl* impl, unsigned n_threads, unsigned read_percent)
+{
+    pthread_t*        threads = malloc(sizeof(*threads) * n_threads);
+    struct worker*    workers = malloc(sizeof(*workers) * n_threads);
+    pthread_barrier_t barrier;
+    double            start;
+    double            elapsed;
+
+    impl->init();
+
+    for (uintptr_t k = 1; k <= N_KEYS; k++) {
+        impl->set((void*)k, (void*)k);
+    }
+
+    pthread_barrier_init(&barrier, NULL, n_threads + 1);
+
+    for (unsigned i = 0; i < n_threads; i++) {
+        workers[i] = (struct worker) {
+            .impl         = impl,
+            .read_percent = read_percent,
+            .seed         = 0x9E3779B97F4A7C15ULL * (i + 1),
+            .barrier      = &barrier,
+        };
+
+        pthread_create(&threads[i], NULL, work, &workers[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    start = bench_now();
+
+    for (unsigned i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    elapsed = bench_now() - start;
+
+    printf("%-11s %7u %6u%% %12.2f\n",
+           impl->name,
+           n_threads,
+           read_percent,
+           (double)n_threads * OPS_PER_THREAD / elapsed * 1e3);
+
+    pthread_barrier_destroy(&barrier);
+    impl->destroy();
+
+    free(threads);
+    free(workers);
+}
+
+int
+main(int argc, char** argv)
+{
+    const unsigned read_percents[] = { 100, 90, 50 };
+    long           max_threads     = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (argc > 1) {
+        max_threads = strtol(argv[1], NULL, 10);
+    }
+
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+
+    printf("%-11s %7s %7s %12s\n", "map", "threads", "reads", "Mops/s");
+
+    for (size_t r = 0; r < sizeof(read_percents) / sizeof(read_percents[0]);
+         r++) {
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            for (long t = 1; t <= max_threads; t *= 2) {
+                run(&impls[i], t, read_percents[r]);
+
+                /* always finish on the requested maximum */
+                if (t < max_threads && t * 2 > max_threads) {
+                    run(&impls[i], max_threads, read_percents[r]);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares the lookup latency distribution of the cuckoo hashmap with
+ * the other hashmaps, timing every lookup separately and reporting
+ * percentiles, for hits and misses.
+ *
+ * Usage: bench_cuckoo_hashmap [number of keys]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/cuckoo_hashmap.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/robin_hashmap.h>
+
+struct map_ops {
+    const char* name;
+    void (*init)(void* map);
+    void (*set)(void* map, void* key, void* value);
+    int (*get)(void* map, void* key, void** value);
+    void (*destroy)(void* map);
+};
+
+static void
+init_hashmap(void* map)
+{
+    hashmap_init(map, bench_hash_int, bench_compare_int);
+}
+
+static void
+init_robin(void* map)
+{
+    robin_hashmap_init(map, bench_hash_int, bench_compare_int);
+}
+
+static void
+init_cuckoo(void* map)
+{
+    cuckoo_hashmap_init(map, bench_hash_int, bench_compare_int);
+}
+
+static const struct map_ops maps[] = {
+    {
+        .name    = "hashmap",
+        .init    = init_hashmap,
+        .set     = (void (*)(void*, void*, void*))hashmap_set,
+        .get     = (int (*)(void*, void*, void**))hashmap_get,
+        .destroy = (void (*)(void*))hashmap_destroy,
+    },
+    {
+        .name    = "robin",
+        .init    = init_robin,
+        .set     = (void (*)(void*, void*, void*))robin_hashmap_set,
+        .get     = (int (*)(void*, void*, void**))robin_hashmap_get,
+        .destroy = (void (*)(void*))robin_hashmap_destroy,
+    },
+    {
+        .name    = "cuckoo",
+        .init    = init_cuckoo,
+        .set     = (void (*)(void*, void*, void*))cuckoo_hashmap_set,
+        .get     = (int (*)(void*, void*, void**))cuckoo_hashmap_get,
+        .destroy = (void (*)(void*))cuckoo_hashmap_destroy,
+    },
+};
+
+static int
+compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+measure(const struct map_ops* ops,
+        void*                 map,
+        void**                keys,
+        size_t                n,
+        const char*           kind,
+        double*               latencies)
+{
+    for (size_t i = 0; i < n; i++) {
+        void*  value;
+        double start = bench_now();
+
+        bench_sink += ops->get(map, keys[i], &value);
+        latencies[i] = bench_now() - start;
+    }
+
+    qsort(latencies, n, sizeof(*latencies), compare_double);
+
+    printf("%-8s %-5s %9zu %9.0f %9.0f %9.0f %9.0f\n",
+           ops->name,
+           kind,
+           n,
+           latencies[n / 2],
+           latencies[n - n / 100 - 1],
+           latencies[n - n / 1000 - 1],
+           latencies[n - 1]);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t   n         = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    void**   present   = malloc(sizeof(*present) * n);
+    void**   absent    = malloc(sizeof(*absent) * n);
+    double*  latencies = malloc(sizeof(*latencies) * n);
+    uint64_t state     = 0x9e3779b97f4a7c15ULL;
+
+    /* big enough for any of the maps */
+    union {
+        struct hashmap        hashmap;
+        struct robin_hashmap  robin;
+        struct cuckoo_hashmap cuckoo;
+    } map;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = (void*)(uintptr_t)(bench_rand(&state) | 1);
+        absent[i]  = (void*)(uintptr_t)(bench_rand(&state) & ~1ULL);
+    }
+
+    printf("%-8s %-5s %9s %9s %9s %9s %9s\n",
+           "map",
+           "kind",
+           "lookups",
+           "p50 ns",
+           "p99 ns",
+           "p99.9 ns",
+           "max ns");
+
+    for (size_t m = 0; m < sizeof(maps) / sizeof(maps[0]); m++) {
+        maps[m].init(&map);
+
+        for (size_t i = 0; i < n; i++) {
+            maps[m].set(&map, present[i], present[i]);
+        }
+
+        bench_shuffle(present, n, m + 1);
+
+        measure(&maps[m], &map, present, n, "hit", latencies);
+        measure(&maps[m], &map, absent, n, "miss", latencies);
+
+        maps[m].destroy(&map);
+    }
+
+    free(present);
+    free(absent);
+    free(latencies);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares starting up from a frozen hashmap image with rebuilding the
+ * map from its rows, and the lookup speed of the two.
+ *
+ * Usage: bench_frozen_hashmap [number of keys]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include <magpie/collections/frozen_hashmap.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+int
+main(int argc, char** argv)
+{
+    size_t   n = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    char**   keys   = malloc(sizeof(*keys) * n);
+    char**   values = malloc(sizeof(*values) * n);
+    char     path[] = "/tmp/bench_frozen_XXXXXX";
+    uint64_t state  = 42;
+    FILE*    stream;
+    double   start;
+    double   build;
+    double   freeze;
+    double   open;
+    double   lookup;
+    double   frozen_lookup;
+
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_entry entry;
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i]   = malloc(24);
+        values[i] = malloc(24);
+        snprintf(keys[i], 24, "row:%016llx",
+                 (unsigned long long)bench_rand(&state));
+        snprintf(values[i], 24, "%zu", i);
+    }
+
+    start = bench_now();
+    hashmap_init(&map, hash_str, compare_str);
+    for (size_t i = 0; i < n; i++) {
+        hashmap_set(&map, keys[i], values[i]);
+    }
+    build = bench_now() - start;
+
+    stream = fdopen(mkstemp(path), "wb");
+    start  = bench_now();
+    hashmap_freeze(&map,
+                   stream,
+                   frozen_hashmap_encode_str,
+                   frozen_hashmap_encode_str);
+    fclose(stream);
+    freeze = bench_now() - start;
+
+    start = bench_now();
+    frozen_hashmap_open(&frozen, path);
+    open = bench_now() - start;
+
+    bench_shuffle((void**)keys, n, 7);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&map, keys[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    lookup = bench_now() - start;
+
+    /* The first pass over the image also faults its pages in */
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        frozen_hashmap_get(&frozen, keys[i], strlen(keys[i]), &entry);
+        bench_sink += entry.value_length;
+    }
+    frozen_lookup = bench_now() - start;
+
+    printf("%zu keys, %zu byte image\n", n, frozen.size);
+    printf("  rebuild with hashmap_set: %10.1f ms\n", build / 1e6);
+    printf("  hashmap_freeze:           %10.1f ms\n", freeze / 1e6);
+    printf("  frozen_hashmap_open:      %10.3f ms\n", open / 1e6);
+    printf("  lookup, hashmap:          %10.1f ns/key\n", lookup / n);
+    printf("  lookup, frozen:           %10.1f ns/key\n", frozen_lookup / n);
+
+    frozen_hashmap_close(&frozen);
+    unlink(path);
+    hashmap_destroy(&map);
+
+    for (size_t i = 0; i < n; i++) {
+        free(keys[i]);
+        free(values[i]);
+    }
+
+    free(keys);
+    free(values);
+
+    return 0;
+}
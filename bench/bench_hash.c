@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares the specialized key hashes against hashing the same bytes
+ * with hash_bytes() (XXH64), both alone and as the hash function of a
+ * hashmap.
+ *
+ * Usage: bench_hash [number of keys]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#define N_HASHES  (1 << 24)
+#define N_QUERIES (1 << 22)
+
+static uint64_t
+bytes_uint(const void* a)
+{
+    return hash_bytes(a, sizeof(void*));
+}
+
+static uint64_t
+bytes_fixed16(const void* a)
+{
+    return hash_bytes(*(const void* const*)a, 16);
+}
+
+static uint64_t
+bytes_fixed32(const void* a)
+{
+    return hash_bytes(*(const void* const*)a, 32);
+}
+
+struct key_kind {
+    const char* name;
+    uint64_t (*hash)(const void*);
+    uint64_t (*baseline)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
+static const struct key_kind kinds[] = {
+    { "uint", hash_uint, bytes_uint, compare_uint },
+    { "ptr", hash_ptr, bytes_uint, compare_ptr },
+    { "fixed16", hash_fixed16, bytes_fixed16, compare_fixed16 },
+    { "fixed32", hash_fixed32, bytes_fixed32, compare_fixed32 },
+};
+
+/* Hashes are taken through a function pointer, as the maps take them */
+static double
+run_hash(uint64_t (*hash)(const void*), void** keys, size_t n)
+{
+    uint64_t sum   = 0;
+    double   start = bench_now();
+
+    for (size_t i = 0; i < N_HASHES; i++) {
+        sum += hash(&keys[i & (n - 1)]);
+    }
+
+    bench_sink += sum;
+    return (bench_now() - start) / N_HASHES;
+}
+
+static double
+run_get(uint64_t (*hash)(const void*),
+        int (*compare)(const void*, const void*),
+        void** keys,
+        void** queries,
+        size_t n)
+{
+    struct hashmap map;
+    double         start;
+
+    hashmap_init_with_capacity(&map, hash, compare, n);
+    hashmap_set_many(&map, keys, keys, n);
+
+    start = bench_now();
+
+    for (size_t i = 0; i < N_QUERIES; i++) {
+        void* value;
+
+        hashmap_get(&map, queries[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+
+    start = (bench_now() - start) / N_QUERIES;
+    hashmap_destroy(&map);
+
+    return start;
+}
+
+static void
+run(const struct key_kind* kind, size_t n, uint8_t* objects)
+{
+    void**   keys    = malloc(sizeof(*keys) * n);
+    void**   queries = malloc(sizeof(*queries) * N_QUERIES);
+    uint64_t state   = n | 1;
+    double   hash, baseline, get, baseline_get;
+
+    for (size_t i = 0; i < n; i++) {
+        /* Integers are sparse; everything else points at a 32-byte
+         * object */
+        if (kind->hash == hash_uint) {
+            keys[i] = (void*)(uintptr_t)bench_rand(&state);
+        }
+        else {
+            keys[i] = objects + i * 32;
+        }
+    }
+
+    for (size_t i = 0; i < N_QUERIES; i++) {
+        queries[i] = keys[bench_rand(&state) % n];
+    }
+
+    hash         = run_hash(kind->hash, keys, n);
+    baseline     = run_hash(kind->baseline, keys, n);
+    get          = run_get(kind->hash, kind->compare, keys, queries, n);
+    baseline_get = run_get(kind->baseline, kind->compare, keys, queries, n);
+
+    printf("%-8s %9zu %9.2f %9.2f %7.2fx %9.1f %9.1f %7.2fx\n",
+           kind->name,
+           n,
+           hash,
+           baseline,
+           baseline / hash,
+           get,
+           baseline_get,
+           baseline_get / get);
+
+    free(keys);
+    free(queries);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t   n = 1 << 20;
+    uint8_t* objects;
+    uint64_t state = 1;
+
+    if (argc > 1) {
+        n = strtoull(argv[1], NULL, 10);
+    }
+
+    /* run_hash() cycles through the keys by masking */
+    while (n & (n - 1)) {
+        n &= n - 1;
+    }
+
+    objects = malloc(n * 32);
+
+    for (size_t i = 0; i < n * 32; i += 8) {
+        uint64_t word = bench_rand(&state);
+
+        memcpy(objects + i, &word, 8);
+    }
+
+    printf("%-8s %9s %9s %9s %8s %9s %9s %8s\n",
+           "keys",
+           "n",
+           "hash(ns)",
+           "xxh64(ns)",
+           "speedup",
+           "get(ns)",
+           "xxh64(ns)",
+           "speedup");
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        run(&kinds[k], n, objects);
+    }
+
+    free(objects);
+    return 0;
+}
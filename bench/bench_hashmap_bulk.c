@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares ways of bulk loading a hashmap: one hashmap_set() per key
+ * into a default-sized map, the same into a pre-sized map, a single
+ * hashmap_set_many() call, and hashmap_build_parallel() on every CPU.
+ *
+ * Usage: bench_hashmap_bulk [number of keys]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+enum load_method {
+    LOAD_SET,
+    LOAD_RESERVE_SET,
+    LOAD_SET_MANY,
+    LOAD_BUILD_PARALLEL,
+};
+
+static const char* method_names[] = {
+    [LOAD_SET]            = "set",
+    [LOAD_RESERVE_SET]    = "reserve+set",
+    [LOAD_SET_MANY]       = "set_many",
+    [LOAD_BUILD_PARALLEL] = "parallel",
+};
+
+static double
+load(enum load_method method,
+     void**           keys,
+     size_t           n,
+     uint64_t (*hash)(const void*),
+     int (*compare)(const void*, const void*))
+{
+    struct hashmap map;
+    struct array   array = { .elements = keys, .capacity = n, .length = n };
+    double         start = bench_now();
+    double         elapsed;
+
+    switch (method) {
+        case LOAD_SET:
+            hashmap_init(&map, hash, compare);
+            for (size_t i = 0; i < n; i++) {
+                hashmap_set(&map, keys[i], keys[i]);
+            }
+            break;
+
+        case LOAD_RESERVE_SET:
+            hashmap_init_with_capacity(&map, hash, compare, n);
+            for (size_t i = 0; i < n; i++) {
+                hashmap_set(&map, keys[i], keys[i]);
+            }
+            break;
+
+        case LOAD_SET_MANY:
+            hashmap_init(&map, hash, compare);
+            hashmap_set_many(&map, keys, keys, n);
+            break;
+
+        case LOAD_BUILD_PARALLEL:
+            hashmap_build_parallel(&map, hash, compare, &array, &array, 0);
+            break;
+    }
+
+    elapsed = bench_now() - start;
+    bench_sink += map.n_entries;
+
+    hashmap_destroy(&map);
+
+    return elapsed;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t n = 5 * 1000 * 1000;
+    void** int_keys;
+    void** str_keys;
+
+    if (argc > 1) {
+        n = strtoull(argv[1], NULL, 10);
+    }
+
+    int_keys = malloc(sizeof(*int_keys) * n);
+    str_keys = malloc(sizeof(*str_keys) * n);
+
+    for (size_t i = 0; i < n; i++) {
+        int_keys[i] = (void*)(uintptr_t)(i + 1);
+        str_keys[i] = malloc(32);
+        snprintf(str_keys[i], 32, "key:%zu", i);
+    }
+
+    bench_shuffle(int_keys, n, n);
+    bench_shuffle(str_keys, n, n);
+
+    printf("%-4s %-12s %9s %11s %11s\n",
+           "keys",
+           "method",
+           "n",
+           "ms",
+           "ns/key");
+
+    for (enum load_method m = LOAD_SET; m <= LOAD_BUILD_PARALLEL; m++) {
+        double t = load(m, int_keys, n, bench_hash_int, bench_compare_int);
+
+        printf("%-4s %-12s %9zu %11.1f %11.1f\n",
+               "int",
+               method_names[m],
+               n,
+               t / 1e6,
+               t / n);
+    }
+
+    for (enum load_method m = LOAD_SET; m <= LOAD_BUILD_PARALLEL; m++) {
+        double t = load(m, str_keys, n, hash_str, compare_str);
+
+        printf("%-4s %-12s %9zu %11.1f %11.1f\n",
+               "str",
+               method_names[m],
+               n,
+               t / 1e6,
+               t / n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(str_keys[i]);
+    }
+
+    free(int_keys);
+    free(str_keys);
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares resolving batches of keys through individual hashmap_get()
+ * calls against hashmap_get_many(), for maps much larger than cache.
+ *
+ * Usage: bench_hashmap_get_many [number of keys]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#define BATCH     256
+#define N_QUERIES (1 << 22)
+
+struct key_set {
+    const char* name;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+    void* (*make_key)(size_t i);
+};
+
+static void*
+make_int_key(size_t i)
+{
+    return (void*)(uintptr_t)(i + 1);
+}
+
+static void*
+make_str_key(size_t i)
+{
+    char* key = malloc(32);
+
+    snprintf(key, 32, "key:%zu", i);
+    return key;
+}
+
+static const struct key_set key_sets[] = {
+    { "int", bench_hash_int, bench_compare_int, make_int_key },
+    { "str", hash_str, compare_str, make_str_key },
+};
+
+static double
+run_get(struct hashmap* map, void** queries)
+{
+    double start = bench_now();
+
+    for (size_t i = 0; i < N_QUERIES; i++) {
+        void* value;
+
+        hashmap_get(map, queries[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+
+    return (bench_now() - start) / N_QUERIES;
+}
+
+static double
+run_get_many(struct hashmap* map, void** queries)
+{
+    void*  values[BATCH];
+    double start = bench_now();
+
+    for (size_t i = 0; i < N_QUERIES; i += BATCH) {
+        hashmap_get_many(map, queries + i, values, BATCH);
+        bench_sink += (uintptr_t)values[0];
+    }
+
+    return (bench_now() - start) / N_QUERIES;
+}
+
+static void
+run(const struct key_set* keys, size_t n)
+{
+    struct hashmap map;
+    void**         present = malloc(sizeof(*present) * n);
+    void**         absent  = malloc(sizeof(*absent) * n);
+    void**         hits    = malloc(sizeof(*hits) * N_QUERIES);
+    void**         misses  = malloc(sizeof(*misses) * N_QUERIES);
+    uint64_t       state   = n | 1;
+    double         get_hit, many_hit;
+    double         get_miss, many_miss;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = keys->make_key(i);
+        absent[i]  = keys->make_key(n + i);
+    }
+
+    for (size_t i = 0; i < N_QUERIES; i++) {
+        hits[i]   = present[bench_rand(&state) % n];
+        misses[i] = absent[bench_rand(&state) % n];
+    }
+
+    hashmap_init_with_capacity(&map, keys->hash, keys->compare, n);
+    hashmap_set_many(&map, present, present, n);
+
+    get_hit   = run_get(&map, hits);
+    many_hit  = run_get_many(&map, hits);
+    get_miss  = run_get(&map, misses);
+    many_miss = run_get_many(&map, misses);
+
+    printf("%-4s %9zu %-5s %10.1f %10.1f %8.2fx\n",
+           keys->name,
+           n,
+           "hit",
+           get_hit,
+           many_hit,
+           get_hit / many_hit);
+    printf("%-4s %9zu %-5s %10.1f %10.1f %8.2fx\n",
+           keys->name,
+           n,
+           "miss",
+           get_miss,
+           many_miss,
+           get_miss / many_miss);
+
+    hashmap_destroy(&map);
+
+    if (keys->make_key == make_str_key) {
+        for (size_t i = 0; i < n; i++) {
+            free(present[i]);
+            free(absent[i]);
+        }
+    }
+
+    free(present);
+    free(absent);
+    free(hits);
+    free(misses);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t n = 1 << 22;
+
+    if (argc > 1) {
+        n = strtoull(argv[1], NULL, 10);
+    }
+
+    printf("%-4s %9s %-5s %10s %10s %9s\n",
+           "keys",
+           "n",
+           "query",
+           "get(ns)",
+           "many(ns)",
+           "speedup");
+
+    for (size_t k = 0; k < sizeof(key_sets) / sizeof(key_sets[0]); k++) {
+        run(&key_sets[k], n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares the cost of inserting into and looking up keys in a hashmap
+ * for each `enum hashmap_index` strategy.
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+#include <magpie/strview.h>
+
+struct key_set {
+    const char* name;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+    void* (*make_key)(size_t i);
+};
+
+static const char* strategy_names[] = {
+    [HASHMAP_INDEX_MASK]      = "mask",
+    [HASHMAP_INDEX_FASTRANGE] = "fastrange",
+    [HASHMAP_INDEX_PRIME]     = "prime",
+};
+
+static uint64_t
+hash_int(const void* a)
+{
+    /* Fibonacci hashing: cheap, with well mixed high bits but poorly
+     * mixed low bits, like many hand-written integer hashes */
+    return (uintptr_t)(*(void* const*)a) * 0x9E3779B97F4A7C15ULL;
+}
+
+static void*
+make_int_key(size_t i)
+{
+    return (void*)(uintptr_t)(i + 1);
+}
+
+static void*
+make_str_key(size_t i)
+{
+    char* key = malloc(32);
+
+    snprintf(key, 32, "key:%zu", i);
+    return key;
+}
+
+static void*
+make_view_key(size_t i)
+{
+    struct strview* view = malloc(sizeof(*view));
+
+    strview_init_cstr(view, make_str_key(i));
+    return view;
+}
+
+static void
+free_key(void* key, void* (*make_key)(size_t i))
+{
+    if (make_key == make_view_key) {
+        free((char*)((struct strview*)key)->ptr);
+    }
+
+    if (make_key != make_int_key) {
+        free(key);
+    }
+}
+
+static const struct key_set key_sets[] = {
+    { "int", hash_int, bench_compare_int, make_int_key },
+    { "str", hash_str, compare_str, make_str_key },
+    { "view", hash_strview, compare_strview, make_view_key },
+};
+
+static void
+run(const struct key_set* keys, enum hashmap_index strategy, size_t n)
+{
+    struct hashmap map;
+    void**         present = malloc(sizeof(*present) * n);
+    void**         absent  = malloc(sizeof(*absent) * n);
+    double         start;
+    double         insert_ns;
+    double         hit_ns;
+    double         miss_ns;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = keys->make_key(i);
+        absent[i]  = keys->make_key(n + i);
+    }
+
+    hashmap_init(&map, keys->hash, keys->compare);
+    hashmap_set_index(&map, strategy);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        hashmap_set(&map, present[i], present[i]);
+    }
+    insert_ns = (bench_now() - start) / n;
+
+    /* look keys up in a different order than they were inserted in */
+    bench_shuffle(present, n, n);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&map, present[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    hit_ns = (bench_now() - start) / n;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        bench_sink += hashmap_get(&map, absent[i], &value);
+    }
+    miss_ns = (bench_now() - start) / n;
+
+    printf("%-4s %-10s %9zu %11.1f %11.1f %11.1f\n",
+           keys->name,
+           strategy_names[strategy],
+           n,
+           insert_ns,
+           hit_ns,
+           miss_ns);
+
+    hashmap_destroy(&map);
+
+    for (size_t i = 0; i < n; i++) {
+        free_key(present[i], keys->make_key);
+        free_key(absent[i], keys->make_key);
+    }
+
+    free(present);
+    free(absent);
+}
+
+int
+main(void)
+{
+    const size_t sizes[] = { 1 << 10, 1 << 16, 1 << 20 };
+
+    printf("%-4s %-10s %9s %11s %11s %11s\n",
+           "keys",
+           "index",
+           "n",
+           "insert(ns)",
+           "hit(ns)",
+           "miss(ns)");
+
+    for (size_t k = 0; k < sizeof(key_sets) / sizeof(key_sets[0]); k++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            run(&key_sets[k], HASHMAP_INDEX_MASK, sizes[s]);
+            run(&key_sets[k], HASHMAP_INDEX_FASTRANGE, sizes[s]);
+            run(&key_sets[k], HASHMAP_INDEX_PRIME, sizes[s]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Reports the number of allocations, peak RSS and time taken to build
+ * a hashmap with integer keys, and the time taken to iterate over it.
+ *
+ * Usage: bench_hashmap_memory [number of keys]
+ */
+
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+
+#if defined(__GLIBC__)
+/* Count allocations made by the library by interposing on glibc's
+ * allocator entry points */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static size_t n_allocs;
+
+void*
+malloc(size_t size)
+{
+    n_allocs++;
+    return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+    n_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* ptr, size_t size)
+{
+    n_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#else
+static size_t n_allocs;
+#endif
+
+static long
+peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t         n = 10 * 1000 * 1000;
+    struct hashmap map;
+    long           base_rss;
+    size_t         base_allocs;
+    double         start;
+    double         elapsed;
+    double         iter_elapsed;
+
+    if (argc > 1) {
+        n = strtoull(argv[1], NULL, 10);
+    }
+
+    base_rss    = peak_rss_kb();
+    base_allocs = n_allocs;
+
+    start = bench_now();
+
+    hashmap_init(&map, bench_hash_int, bench_compare_int);
+    for (uintptr_t k = 1; k <= n; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    elapsed = bench_now() - start;
+
+    start = bench_now();
+
+    for (struct hashmap_iter it = hashmap_iter(&map); hashmap_iter_next(&it);) {
+        bench_sink += (uintptr_t)hashmap_iter_get(&it)->value;
+    }
+
+    iter_elapsed = bench_now() - start;
+
+    printf("keys:         %zu\n", n);
+    printf("allocations:  %zu\n", n_allocs - base_allocs);
+    printf("peak rss:     %ld KiB\n", peak_rss_kb() - base_rss);
+    printf("build time:   %.1f ms (%.1f ns/key)\n",
+           elapsed / 1e6,
+           elapsed / n);
+    printf("iterate time: %.1f ms (%.1f ns/key)\n",
+           iter_elapsed / 1e6,
+           iter_elapsed / n);
+
+    hashmap_destroy(&map);
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares maps generated by MAGPIE_HASHMAP_DEFINE against the generic
+ * struct hashmap, for uint64_t -> uint64_t and string -> uint64_t maps.
+ *
+ * Usage: bench_hashmap_template [number of keys]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/hashmap_template.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#define HASH_U64(KEY) (KEY)
+#define EQ_U64(A, B)  ((A) == (B))
+
+static inline uint64_t
+hash_string(const char* key)
+{
+    return hash_str(&key);
+}
+
+static inline int
+eq_string(const char* a, const char* b)
+{
+    return strcmp(a, b) == 0;
+}
+
+MAGPIE_HASHMAP_DEFINE(u64map, uint64_t, uint64_t, HASH_U64, EQ_U64);
+MAGPIE_HASHMAP_DEFINE(strmap, const char*, uint64_t, hash_string, eq_string);
+
+struct timings {
+    double insert;
+    double hit;
+    double miss;
+};
+
+static void
+report(const char* keys, const char* map, size_t n, struct timings* t)
+{
+    printf("%-4s %-8s %9zu %11.1f %11.1f %11.1f\n",
+           keys,
+           map,
+           n,
+           t->insert / n,
+           t->hit / n,
+           t->miss / n);
+}
+
+static void
+run_u64(size_t n)
+{
+    uint64_t*      present = malloc(sizeof(*present) * n);
+    uint64_t*      absent  = malloc(sizeof(*absent) * n);
+    uint64_t       state   = n | 1;
+    struct u64map  typed;
+    struct hashmap generic;
+    struct timings t;
+    double         start;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = bench_rand(&state);
+        absent[i]  = bench_rand(&state);
+    }
+
+    u64map_init(&typed);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        u64map_set(&typed, present[i], i);
+    }
+    t.insert = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        uint64_t value = 0;
+
+        u64map_get(&typed, present[n - i - 1], &value);
+        bench_sink += value;
+    }
+    t.hit = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        bench_sink += u64map_lookup(&typed, absent[i]) != NULL;
+    }
+    t.miss = bench_now() - start;
+
+    report("u64", "typed", n, &t);
+    u64map_destroy(&typed);
+
+    hashmap_init(&generic, bench_hash_int, bench_compare_int);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        hashmap_set(&generic, (void*)(uintptr_t)present[i], (void*)i);
+    }
+    t.insert = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&generic, (void*)(uintptr_t)present[n - i - 1], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    t.hit = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* key = (void*)(uintptr_t)absent[i];
+        void* value;
+
+
+        bench_sink += hashmap_get(&generic, key, &value);
+    }
+    t.miss = bench_now() - start;
+
+    report("u64", "generic", n, &t);
+    hashmap_destroy(&generic);
+
+    free(present);
+    free(absent);
+}
+
+static void
+run_str(size_t n)
+{
+    char**         present = malloc(sizeof(*present) * n);
+    char**         absent  = malloc(sizeof(*absent) * n);
+    struct strmap  typed;
+    struct hashmap generic;
+    struct timings t;
+    double         start;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = malloc(32);
+        absent[i]  = malloc(32);
+        snprintf(present[i], 32, "key:%zu", i);
+        snprintf(absent[i], 32, "key:%zu", n + i);
+    }
+
+    strmap_init(&typed);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        strmap_set(&typed, present[i], i);
+    }
+    t.insert = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        uint64_t value = 0;
+
+        strmap_get(&typed, present[n - i - 1], &value);
+        bench_sink += value;
+    }
+    t.hit = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        bench_sink += strmap_lookup(&typed, absent[i]) != NULL;
+    }
+    t.miss = bench_now() - start;
+
+    report("str", "typed", n, &t);
+    strmap_destroy(&typed);
+
+    hashmap_init(&generic, hash_str, compare_str);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        hashmap_set(&generic, present[i], (void*)i);
+    }
+    t.insert = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&generic, present[n - i - 1], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    t.hit = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        bench_sink += hashmap_get(&generic, absent[i], &value);
+    }
+    t.miss = bench_now() - start;
+
+    report("str", "generic", n, &t);
+    hashmap_destroy(&generic);
+
+    for (size_t i = 0; i < n; i++) {
+        free(present[i]);
+        free(absent[i]);
+    }
+
+    free(present);
+    free(absent);
+}
+
+int
+main(int argc, char** argv)
+{
+    const size_t sizes[] = { 1 << 10, 1 << 16, 1 << 20 };
+
+    printf("%-4s %-8s %9s %11s %11s %11s\n",
+           "keys",
+           "map",
+           "n",
+           "insert(ns)",
+           "hit(ns)",
+           "miss(ns)");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : sizes[s];
+
+        run_u64(n);
+        run_str(n);
+
+        if (argc > 1) {
+            break;
+        }
+    }
+
+    return 0;
+}
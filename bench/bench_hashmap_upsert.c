@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Counts occurrences of keys drawn at random from a fixed set, the way
+ * a word count or aggregation would, comparing a hashmap_get() and
+ * hashmap_set() pair per key with hashmap_entry_or_insert() and
+ * hashmap_upsert().
+ *
+ * Usage: bench_hashmap_upsert [number of distinct keys] [number of keys]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+
+static void
+count(struct hashmap_entry* entry, int inserted, void* ctx)
+{
+    (void)inserted;
+    (void)ctx;
+
+    entry->value = (void*)((uintptr_t)entry->value + 1);
+}
+
+static void
+report(const char* method, size_t n, double elapsed, struct hashmap* map)
+{
+    printf("%-16s %11zu %11zu %11.1f\n",
+           method,
+           n,
+           map->n_entries,
+           elapsed / n);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t         n_distinct = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t         n          = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+    void**         keys       = malloc(sizeof(*keys) * n);
+    uint64_t       state      = 0x9e3779b97f4a7c15ULL;
+    struct hashmap map;
+    double         start;
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (void*)(uintptr_t)(bench_rand(&state) % n_distinct + 1);
+    }
+
+    printf("%-16s %11s %11s %11s\n", "method", "keys", "distinct", "ns/key");
+
+    hashmap_init(&map, bench_hash_int, bench_compare_int);
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&map, keys[i], &value);
+        hashmap_set(&map, keys[i], (void*)((uintptr_t)value + 1));
+    }
+    report("get + set", n, bench_now() - start, &map);
+    hashmap_destroy(&map);
+
+    hashmap_init(&map, bench_hash_int, bench_compare_int);
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        struct hashmap_entry* e
+            = hashmap_entry_or_insert(&map, keys[i], NULL);
+
+        e->value = (void*)((uintptr_t)e->value + 1);
+    }
+    report("entry_or_insert", n, bench_now() - start, &map);
+    hashmap_destroy(&map);
+
+    hashmap_init(&map, bench_hash_int, bench_compare_int);
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        hashmap_upsert(&map, keys[i], count, NULL);
+    }
+    report("upsert", n, bench_now() - start, &map);
+    hashmap_destroy(&map);
+
+    free(keys);
+
+    return 0;
+}
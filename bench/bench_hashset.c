@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Set algebra on two large sets of integer keys which half overlap.
+ * Intersecting hashmaps used as sets (with NULL values), by iterating
+ * one and probing the other, is timed for comparison with the hashset
+ * operations, and the memory taken per key by each is reported.
+ *
+ * Usage: bench_hashset [number of keys in the larger set] [number of
+ * keys in the smaller set]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/hashset.h>
+
+static void
+report(const char* operation, size_t n, double elapsed)
+{
+    printf("%-22s %11zu %11.1f\n", operation, n, elapsed / 1e6);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t         n_large = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000;
+    size_t         n_small = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    struct array   large_keys;
+    struct array   small_keys;
+    struct hashset large, small, out;
+    struct hashmap large_map, small_map, out_map;
+    double         start;
+
+    array_init_with_capacity(&large_keys, n_large);
+    array_init_with_capacity(&small_keys, n_small);
+
+    /* half of the smaller set's keys are in the larger */
+    for (size_t i = 0; i < n_large; i++) {
+        array_push(&large_keys, (void*)(uintptr_t)(i * 2 + 1));
+    }
+
+    for (size_t i = 0; i < n_small; i++) {
+        array_push(&small_keys, (void*)(uintptr_t)(i * 2 + 1 + i % 2));
+    }
+
+    bench_shuffle(large_keys.elements, n_large, 1);
+    bench_shuffle(small_keys.elements, n_small, 2);
+
+    printf("%-22s %11s %11s\n", "operation", "result", "ms");
+
+    hashset_init(&large, bench_hash_int, bench_compare_int);
+    hashset_init(&small, bench_hash_int, bench_compare_int);
+
+    start = bench_now();
+    hashset_insert_array(&large, &large_keys);
+    hashset_insert_array(&small, &small_keys);
+    report("hashset insert_array",
+           large.n_entries + small.n_entries,
+           bench_now() - start);
+
+    start = bench_now();
+    hashset_union(&out, &large, &small);
+    report("hashset union", out.n_entries, bench_now() - start);
+    hashset_destroy(&out);
+
+    start = bench_now();
+    hashset_intersection(&out, &large, &small);
+    report("hashset intersection", out.n_entries, bench_now() - start);
+    hashset_destroy(&out);
+
+    start = bench_now();
+    hashset_difference(&out, &small, &large);
+    report("hashset difference", out.n_entries, bench_now() - start);
+    hashset_destroy(&out);
+
+    start = bench_now();
+    hashset_difference(&out, &large, &small);
+    report("hashset difference 2", out.n_entries, bench_now() - start);
+    hashset_destroy(&out);
+
+    start = bench_now();
+    report("hashset is_subset",
+           hashset_is_subset(&small, &large),
+           bench_now() - start);
+
+    hashmap_init(&large_map, bench_hash_int, bench_compare_int);
+    hashmap_init(&small_map, bench_hash_int, bench_compare_int);
+    hashmap_init(&out_map, bench_hash_int, bench_compare_int);
+
+    for (size_t i = 0; i < n_large; i++) {
+        hashmap_set(&large_map, large_keys.elements[i], NULL);
+    }
+
+    for (size_t i = 0; i < n_small; i++) {
+        hashmap_set(&small_map, small_keys.elements[i], NULL);
+    }
+
+    start = bench_now();
+    {
+        struct hashmap_iter it = hashmap_iter(&small_map);
+
+        while (hashmap_iter_next(&it)) {
+            struct hashmap_entry* e = hashmap_iter_get(&it);
+
+            if (hashmap_lookup(&large_map, e->key) != NULL) {
+                hashmap_set(&out_map, e->key, NULL);
+            }
+        }
+    }
+    report("hashmap intersection", out_map.n_entries, bench_now() - start);
+
+    printf("\nbytes per key: hashset %.1f, hashmap %.1f\n",
+           (double)large.capacity
+               * (sizeof(struct hashset_entry) + 1) / large.n_entries,
+           (double)(large_map.entries_capacity * sizeof(struct hashmap_entry)
+                    + large_map.table.capacity
+                          * (large_map.table.slot_width + 1))
+               / large_map.n_entries);
+
+    hashset_destroy(&large);
+    hashset_destroy(&small);
+    hashmap_destroy(&large_map);
+    hashmap_destroy(&small_map);
+    hashmap_destroy(&out_map);
+    array_destroy(&large_keys);
+    array_destroy(&small_keys);
+
+    return 0;
+}
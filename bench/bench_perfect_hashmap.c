@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures building a perfect hashmap over a static key set, its size
+ * and its lookup speed, against a hashmap holding the same keys.
+ *
+ * Usage: bench_perfect_hashmap [number of keys]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/array.h>
+#include <magpie/collections/frozen_hashmap.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/perfect_hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+static void
+run(size_t n)
+{
+    struct array           keys;
+    struct perfect_hashmap perfect;
+    struct hashmap         map;
+    char**                 lookups = malloc(sizeof(*lookups) * n);
+    uint64_t               state   = n | 1;
+    double                 start;
+    double                 build;
+    double                 perfect_lookup;
+    double                 map_lookup;
+
+    array_init_with_capacity(&keys, n);
+
+    for (size_t i = 0; i < n; i++) {
+        char* key = malloc(24);
+
+        snprintf(key, 24, "key:%016llx",
+                 (unsigned long long)bench_rand(&state));
+        array_push(&keys, key);
+        lookups[i] = key;
+    }
+
+    bench_shuffle((void**)lookups, n, 3);
+
+    start = bench_now();
+    perfect_hashmap_build(&perfect, &keys, &keys, frozen_hashmap_encode_str);
+    build = bench_now() - start;
+
+    hashmap_init_with_capacity(&map, hash_str, compare_str, n);
+    for (size_t i = 0; i < n; i++) {
+        hashmap_set(&map, keys.elements[i], keys.elements[i]);
+    }
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        perfect_hashmap_get(&perfect, lookups[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    perfect_lookup = bench_now() - start;
+
+    start = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        void* value;
+
+        hashmap_get(&map, lookups[i], &value);
+        bench_sink += (uintptr_t)value;
+    }
+    map_lookup = bench_now() - start;
+
+    printf("%9zu %10.1f %9.2f %12.1f %12.1f\n",
+           n,
+           build / n,
+           perfect_hashmap_bits_per_key(&perfect),
+           perfect_lookup / n,
+           map_lookup / n);
+
+    perfect_hashmap_destroy(&perfect);
+    hashmap_destroy(&map);
+
+    for (size_t i = 0; i < n; i++) {
+        free(keys.elements[i]);
+    }
+
+    array_destroy(&keys);
+    free(lookups);
+}
+
+int
+main(int argc, char** argv)
+{
+    const size_t sizes[] = { 1 << 10, 1 << 16, 1 << 20, 1 << 22 };
+
+    printf("%9s %10s %9s %12s %12s\n",
+           "n",
+           "build(ns)",
+           "bits/key",
+           "perfect(ns)",
+           "hashmap(ns)");
+
+    if (argc > 1) {
+        run(strtoull(argv[1], NULL, 10));
+        return 0;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        run(sizes[s]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Simulates a session table: every tick, a batch of sessions is opened
+ * with a random lifetime, and expired sessions are reclaimed. Compares
+ * sweeping a plain hashmap with hashmap_retain() on every tick against
+ * ttl_hashmap_expire_tick().
+ *
+ * Usage: bench_ttl_hashmap [sessions opened per tick] [maximum
+ * lifetime in ticks] [number of ticks]
+ */
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/ttl_hashmap.h>
+
+static int
+alive(struct hashmap_entry* entry, void* ctx)
+{
+    return (uintptr_t)entry->value > *(uint64_t*)ctx;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t   per_tick = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    size_t   lifetime = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    size_t   n_ticks  = argc > 3 ? strtoul(argv[3], NULL, 10) : 2000;
+    uint64_t state    = 0x9e3779b97f4a7c15ULL;
+    uint64_t key      = 0;
+    double   start;
+
+    struct hashmap     map;
+    struct ttl_hashmap ttl_map;
+
+    printf("%-14s %11s %11s %11s\n", "method", "ticks", "live", "us/tick");
+
+    hashmap_init(&map, bench_hash_int, bench_compare_int);
+    start = bench_now();
+    for (uint64_t now = 0; now < n_ticks; now++) {
+        for (size_t i = 0; i < per_tick; i++) {
+            uint64_t deadline = now + 1 + bench_rand(&state) % lifetime;
+
+            hashmap_set(&map, (void*)(uintptr_t)++key, (void*)deadline);
+        }
+
+        hashmap_retain(&map, alive, &now);
+    }
+    printf("%-14s %11zu %11zu %11.2f\n",
+           "hashmap sweep",
+           n_ticks,
+           map.n_entries,
+           (bench_now() - start) / n_ticks / 1000);
+    hashmap_destroy(&map);
+
+    state = 0x9e3779b97f4a7c15ULL;
+    key   = 0;
+
+    ttl_hashmap_init(&ttl_map, bench_hash_int, bench_compare_int);
+    start = bench_now();
+    for (uint64_t now = 0; now < n_ticks; now++) {
+        for (size_t i = 0; i < per_tick; i++) {
+            uint64_t deadline = now + 1 + bench_rand(&state) % lifetime;
+
+            ttl_hashmap_set(&ttl_map, (void*)(uintptr_t)++key, NULL, deadline);
+        }
+
+        ttl_hashmap_expire_tick(&ttl_map, now, SIZE_MAX);
+    }
+    printf("%-14s %11zu %11zu %11.2f\n",
+           "timer wheel",
+           n_ticks,
+           ttl_map.n_entries,
+           (bench_now() - start) / n_ticks / 1000);
+    ttl_hashmap_destroy(&ttl_map);
+
+    return 0;
+}
@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/cache.h>
+#include <magpie/ebuf.h>
+
+#define INITIAL_NODES 16
+
+enum {
+    QUEUE_MAIN = 0,
+    QUEUE_SMALL,
+    QUEUE_GHOST,
+};
+
+/* Hit counts saturate here, so a promoted S3-FIFO entry survives at
+ * most this many passes through the main queue without being hit */
+#define MAX_FREQ 3
+
+static uint64_t
+ghost_hash(const void* key)
+{
+    /* ghost keys are already hashes */
+    return (uint64_t)(uintptr_t) * (void* const*)key;
+}
+
+static int
+ghost_compare(const void* a, const void* b)
+{
+    return *(void* const*)a != *(void* const*)b;
+}
+
+static inline void*
+index_value(size_t index)
+{
+    return (void*)(uintptr_t)index;
+}
+
+static inline size_t
+value_index(void* value)
+{
+    return (size_t)(uintptr_t)value;
+}
+
+static size_t
+node_alloc(struct cache* cache)
+{
+    size_t index;
+
+    if (cache->free_node != CACHE_NIL) {
+        index            = cache->free_node;
+        cache->free_node = cache->nodes[index].next;
+        return index;
+    }
+
+    if (cache->nodes_length == cache->nodes_capacity) {
+        size_t capacity = cache->nodes_capacity > 0
+                            ? cache->nodes_capacity * 2
+                            : INITIAL_NODES;
+        struct cache_node* nodes
+            = realloc(cache->nodes, capacity * sizeof(*nodes));
+
+        if (nodes == NULL) {
+            EBUF_PUSH("failed to allocate cache nodes", cache);
+            return CACHE_NIL;
+        }
+
+        cache->nodes          = nodes;
+        cache->nodes_capacity = capacity;
+    }
+
+    return cache->nodes_length++;
+}
+
+static void
+node_free(struct cache* cache, size_t index)
+{
+    cache->nodes[index].next = cache->free_node;
+    cache->free_node         = index;
+}
+
+static void
+queue_push(struct cache* cache, int queue, size_t index)
+{
+    struct cache_queue* q    = &cache->queues[queue];
+    struct cache_node*  node = &cache->nodes[index];
+
+    node->queue = (uint8_t)queue;
+    node->prev  = CACHE_NIL;
+    node->next  = q->head;
+
+    if (q->head != CACHE_NIL) {
+        cache->nodes[q->head].prev = index;
+    }
+    else {
+        q->tail = index;
+    }
+
+    q->head = index;
+    q->length++;
+    q->charge += node->charge;
+}
+
+static void
+queue_unlink(struct cache* cache, size_t index)
+{
+    struct cache_node*  node = &cache->nodes[index];
+    struct cache_queue* q    = &cache->queues[node->queue];
+
+    if (node->prev != CACHE_NIL) {
+        cache->nodes[node->prev].next = node->next;
+    }
+    else {
+        q->head = node->next;
+    }
+
+    if (node->next != CACHE_NIL) {
+        cache->nodes[node->next].prev = node->prev;
+    }
+    else {
+        q->tail = node->prev;
+    }
+
+    q->length--;
+    q->charge -= node->charge;
+}
+
+static void
+queue_move(struct cache* cache, int queue, size_t index)
+{
+    queue_unlink(cache, index);
+    queue_push(cache, queue, index);
+}
+
+static void
+drop_ghost(struct cache* cache)
+{
+    size_t index = cache->queues[QUEUE_GHOST].tail;
+
+    hashmap_remove(&cache->ghosts, index_value(cache->nodes[index].hash));
+    queue_unlink(cache, index);
+    node_free(cache, index);
+}
+
+/* Remembers the hash of an entry evicted from the small queue, reusing
+ * its node. The ghost queue holds at most as many hashes as there are
+ * entries in the cache. */
+static void
+add_ghost(struct cache* cache, size_t index)
+{
+    struct cache_node*    node = &cache->nodes[index];
+    struct hashmap_entry* entry;
+    int                   inserted;
+
+    node->key    = NULL;
+    node->value  = NULL;
+    node->charge = 0;
+
+    entry = hashmap_entry_or_insert(
+        &cache->ghosts, index_value(node->hash), &inserted);
+
+    if (entry == NULL || !inserted) {
+        /* out of memory, or the hash is already a ghost */
+        node_free(cache, index);
+        return;
+    }
+
+    entry->value = index_value(index);
+    queue_push(cache, QUEUE_GHOST, index);
+
+    while (cache->queues[QUEUE_GHOST].length > cache->n_entries) {
+        drop_ghost(cache);
+    }
+}
+
+/* Takes an entry out of the cache and passes it to the evict callback.
+ * If `ghost` is set, the entry's hash is kept in the ghost queue. */
+static void
+drop_entry(struct cache* cache, size_t index, int ghost)
+{
+    struct cache_node* node  = &cache->nodes[index];
+    void*              key   = node->key;
+    void*              value = node->value;
+
+    hashmap_remove_prehashed(&cache->map, key, node->hash);
+    queue_unlink(cache, index);
+
+    cache->charge -= node->charge;
+    cache->n_entries--;
+
+    if (ghost) {
+        add_ghost(cache, index);
+    }
+    else {
+        node_free(cache, index);
+    }
+
+    if (cache->on_evict != NULL) {
+        cache->on_evict(key, value, cache->ctx);
+    }
+}
+
+static void
+evict_lru(struct cache* cache)
+{
+    drop_entry(cache, cache->queues[QUEUE_MAIN].tail, 0);
+}
+
+static void
+evict_clock(struct cache* cache)
+{
+    /* the tail is under the hand: entries referenced since it last
+     * passed get a second chance and go back to the head */
+    for (;;) {
+        size_t index = cache->queues[QUEUE_MAIN].tail;
+
+        if (cache->nodes[index].freq == 0) {
+            drop_entry(cache, index, 0);
+            return;
+        }
+
+        cache->nodes[index].freq = 0;
+        queue_move(cache, QUEUE_MAIN, index);
+    }
+}
+
+static void
+evict_main(struct cache* cache)
+{
+    for (;;) {
+        size_t index = cache->queues[QUEUE_MAIN].tail;
+
+        if (cache->nodes[index].freq == 0) {
+            drop_entry(cache, index, 0);
+            return;
+        }
+
+        cache->nodes[index].freq--;
+        queue_move(cache, QUEUE_MAIN, index);
+    }
+}
+
+static void
+evict_s3fifo(struct cache* cache)
+{
+    size_t small_target
+        = cache->capacity / 100 * MAGPIE_CACHE_S3FIFO_SMALL_PERCENT
+        + cache->capacity % 100 * MAGPIE_CACHE_S3FIFO_SMALL_PERCENT / 100;
+
+    while (cache->queues[QUEUE_SMALL].length > 0
+           && (cache->queues[QUEUE_SMALL].charge > small_target
+               || cache->queues[QUEUE_MAIN].length == 0)) {
+        size_t index = cache->queues[QUEUE_SMALL].tail;
+
+        if (cache->nodes[index].freq == 0) {
+            drop_entry(cache, index, 1);
+            return;
+        }
+
+        /* hit since it was inserted, so promote it */
+        cache->nodes[index].freq = 0;
+        queue_move(cache, QUEUE_MAIN, index);
+    }
+
+    evict_main(cache);
+}
+
+/* Evicts entries until `charge` more fits */
+static void
+make_room(struct cache* cache, size_t charge)
+{
+    while (cache->n_entries > 0 && cache->charge + charge > cache->capacity) {
+        cache->counters.n_evictions++;
+
+        switch (cache->policy) {
+        case CACHE_POLICY_LRU:
+            evict_lru(cache);
+            break;
+        case CACHE_POLICY_CLOCK:
+            evict_clock(cache);
+            break;
+        case CACHE_POLICY_S3FIFO:
+            evict_s3fifo(cache);
+            break;
+        }
+    }
+}
+
+static void
+touch(struct cache* cache, size_t index)
+{
+    struct cache_node* node = &cache->nodes[index];
+
+    switch (cache->policy) {
+    case CACHE_POLICY_LRU:
+        if (cache->queues[QUEUE_MAIN].head != index) {
+            queue_move(cache, QUEUE_MAIN, index);
+        }
+        break;
+    case CACHE_POLICY_CLOCK:
+        node->freq = 1;
+        break;
+    case CACHE_POLICY_S3FIFO:
+        if (node->freq < MAX_FREQ) {
+            node->freq++;
+        }
+        break;
+    }
+}
+
+int
+cache_init(struct cache*     cache,
+           enum cache_policy policy,
+           size_t            capacity,
+           uint64_t (*hash)(const void*),
+           int (*compare)(const void*, const void*))
+{
+    int i;
+
+    cache->policy         = policy;
+    cache->capacity       = capacity;
+    cache->charge         = 0;
+    cache->n_entries      = 0;
+    cache->nodes          = NULL;
+    cache->nodes_length   = 0;
+    cache->nodes_capacity = 0;
+    cache->free_node      = CACHE_NIL;
+    cache->counters       = (struct cache_counters){0};
+    cache->on_evict       = NULL;
+    cache->ctx            = NULL;
+
+    for (i = 0; i < 3; i++) {
+        cache->queues[i] = (struct cache_queue){
+            .head   = CACHE_NIL,
+            .tail   = CACHE_NIL,
+            .length = 0,
+            .charge = 0,
+        };
+    }
+
+    if (!hashmap_init(&cache->map, hash, compare)) {
+        EBUF_PUSH("failed to initialize cache map", cache);
+        return 0;
+    }
+
+    if (!hashmap_init(&cache->ghosts, ghost_hash, ghost_compare)) {
+        EBUF_PUSH("failed to initialize cache ghost map", cache);
+        hashmap_destroy(&cache->map);
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+cache_set_evict_callback(struct cache* cache,
+                         void (*on_evict)(void* key, void* value, void* ctx),
+                         void* ctx)
+{
+    cache->on_evict = on_evict;
+    cache->ctx      = ctx;
+}
+
+void
+cache_destroy(struct cache* cache)
+{
+    int queue;
+
+    if (cache->on_evict != NULL) {
+        for (queue = QUEUE_MAIN; queue <= QUEUE_SMALL; queue++) {
+            size_t index = cache->queues[queue].head;
+
+            while (index != CACHE_NIL) {
+                struct cache_node* node = &cache->nodes[index];
+
+                cache->on_evict(node->key, node->value, cache->ctx);
+                index = node->next;
+            }
+        }
+    }
+
+    hashmap_destroy(&cache->map);
+    hashmap_destroy(&cache->ghosts);
+    free(cache->nodes);
+
+    cache->nodes     = NULL;
+    cache->n_entries = 0;
+    cache->charge    = 0;
+}
+
+int
+cache_get(struct cache* cache, void* key, void** value)
+{
+    struct hashmap_entry* entry = hashmap_lookup(&cache->map, key);
+    size_t                index;
+
+    if (entry == NULL) {
+        cache->counters.n_misses++;
+        *value = NULL;
+        return 0;
+    }
+
+    index = value_index(entry->value);
+    cache->counters.n_hits++;
+    touch(cache, index);
+
+    *value = cache->nodes[index].value;
+    return 1;
+}
+
+/* Replaces the key, value and charge of an entry already present */
+static void
+replace(struct cache* cache,
+        struct hashmap_entry* entry,
+        void*                 key,
+        void*                 value,
+        size_t                charge)
+{
+    size_t             index     = value_index(entry->value);
+    struct cache_node* node      = &cache->nodes[index];
+    void*              old_key   = node->key;
+    void*              old_value = node->value;
+
+    cache->queues[node->queue].charge -= node->charge;
+    cache->queues[node->queue].charge += charge;
+    cache->charge -= node->charge;
+    cache->charge += charge;
+
+    entry->key   = key;
+    node->key    = key;
+    node->value  = value;
+    node->charge = charge;
+    touch(cache, index);
+
+    if (cache->on_evict != NULL) {
+        cache->on_evict(old_key, old_value, cache->ctx);
+    }
+
+    /* the entry may have grown */
+    make_room(cache, 0);
+}
+
+int
+cache_put(struct cache* cache, void* key, void* value, size_t charge)
+{
+    uint64_t              hash = cache->map.hash(&key);
+    struct hashmap_entry* entry;
+    struct cache_node*    node;
+    size_t                index;
+    int                   queue = QUEUE_MAIN;
+
+    if (charge > cache->capacity) {
+        cache_remove(cache, key);
+
+        if (cache->on_evict != NULL) {
+            cache->on_evict(key, value, cache->ctx);
+        }
+
+        return 1;
+    }
+
+    entry = hashmap_lookup_prehashed(&cache->map, key, hash);
+
+    if (entry != NULL) {
+        replace(cache, entry, key, value, charge);
+        return 1;
+    }
+
+    make_room(cache, charge);
+
+    if (cache->policy == CACHE_POLICY_S3FIFO) {
+        struct hashmap_entry* ghost
+            = hashmap_lookup(&cache->ghosts, index_value(hash));
+
+        queue = QUEUE_SMALL;
+
+        if (ghost != NULL) {
+            /* evicted recently: admit it straight to the main queue */
+            size_t ghost_index = value_index(ghost->value);
+
+            hashmap_remove(&cache->ghosts, index_value(hash));
+            queue_unlink(cache, ghost_index);
+            node_free(cache, ghost_index);
+            queue = QUEUE_MAIN;
+        }
+    }
+
+    index = node_alloc(cache);
+
+    if (index == CACHE_NIL) {
+        return 0;
+    }
+
+    entry = hashmap_entry_or_insert_prehashed(&cache->map, key, hash, NULL);
+
+    if (entry == NULL) {
+        EBUF_PUSH("failed to insert cache entry", cache);
+        node_free(cache, index);
+        return 0;
+    }
+
+    entry->value = index_value(index);
+
+    node         = &cache->nodes[index];
+    node->key    = key;
+    node->value  = value;
+    node->charge = charge;
+    node->hash   = hash;
+    node->freq   = 0;
+
+    queue_push(cache, queue, index);
+    cache->charge += charge;
+    cache->n_entries++;
+
+    return 1;
+}
+
+int
+cache_remove(struct cache* cache, void* key)
+{
+    struct hashmap_entry* entry = hashmap_lookup(&cache->map, key);
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    drop_entry(cache, value_index(entry->value), 0);
+    return 1;
+}
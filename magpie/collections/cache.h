@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_CACHE_H
+#define MAGPIE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magpie/collections/hashmap.h>
+
+/* Share of a S3-FIFO cache's capacity given to its small queue, in
+ * percent */
+#ifndef MAGPIE_CACHE_S3FIFO_SMALL_PERCENT
+#    define MAGPIE_CACHE_S3FIFO_SMALL_PERCENT 10
+#endif
+
+/* Marks the end of a queue */
+#define CACHE_NIL SIZE_MAX
+
+/**
+ * Eviction policies. Used in `cache_init()`.
+ *
+ * - `CACHE_POLICY_LRU` :: Evicts the least recently used entry. Every
+ *   hit moves the entry to the front of the queue.
+ * - `CACHE_POLICY_CLOCK` :: Approximates LRU with a reference bit set
+ *   on each hit; eviction sweeps the queue, giving entries with the
+ *   bit set a second chance. Hits don't reorder anything.
+ * - `CACHE_POLICY_S3FIFO` :: Scan-resistant FIFO queues (Yang et al.,
+ *   "FIFO Queues are All You Need for Cache Eviction", 2023). New
+ *   entries go into a small queue, and only those hit while there are
+ *   promoted to the main queue, so a burst of one-off keys can't flush
+ *   the working set. A ghost queue remembers the hashes of recently
+ *   evicted keys, which are admitted straight into the main queue if
+ *   they return.
+ */
+enum cache_policy {
+    CACHE_POLICY_LRU = 0,
+    CACHE_POLICY_CLOCK,
+    CACHE_POLICY_S3FIFO,
+};
+
+/**
+ * An entry of a cache, or a ghost left behind by an evicted one.
+ *
+ * - `charge` :: The entry's share of the cache's capacity
+ * - `hash` :: Hash of the key
+ * - `prev`, `next` :: Neighbours in the entry's queue, or `CACHE_NIL`
+ * - `queue` :: The queue the entry is in
+ * - `freq` :: Reference bit (CLOCK) or hit count up to 3 (S3-FIFO)
+ */
+struct cache_node {
+    void*    key;
+    void*    value;
+    size_t   charge;
+    uint64_t hash;
+    size_t   prev;
+    size_t   next;
+    uint8_t  queue;
+    uint8_t  freq;
+};
+
+/**
+ * A doubly-linked queue of nodes, most recently inserted at `head`.
+ */
+struct cache_queue {
+    size_t head;
+    size_t tail;
+    size_t length;
+    size_t charge;
+};
+
+/**
+ * - `n_hits` :: Number of `cache_get()` calls which found their key
+ * - `n_misses` :: Number of `cache_get()` calls which didn't
+ * - `n_evictions` :: Number of entries evicted to make room
+ */
+struct cache_counters {
+    uint64_t n_hits;
+    uint64_t n_misses;
+    uint64_t n_evictions;
+};
+
+/**
+ * A bounded key-value cache.
+ *
+ * Every entry has a charge, given when it is inserted, and the total
+ * charge never exceeds `capacity`: charge each entry 1 to bound the
+ * number of entries, or its size in bytes to bound memory. Inserting
+ * past the capacity evicts entries according to the cache's policy.
+ *
+ * Keys are looked up through a `struct hashmap` whose values are
+ * indices into a pool of nodes, which are linked into the policy's
+ * queues. Both recency updates and evictions take constant time
+ * (amortized, for CLOCK and S3-FIFO), and nothing is allocated per
+ * entry once the pool has grown to the cache's working size.
+ *
+ * - `policy` :: Eviction policy
+ * - `capacity` :: Maximum total charge
+ * - `charge` :: Total charge of the entries in the cache
+ * - `n_entries` :: Number of entries in the cache
+ * - `map` :: Maps keys to node indices
+ * - `ghosts` :: Maps the hashes of ghost keys to node indices (S3-FIFO)
+ * - `nodes` :: Node pool
+ * - `nodes_length` :: Number of nodes ever used in the pool
+ * - `nodes_capacity` :: Number of nodes the pool has room for
+ * - `free_node` :: Head of the list of free nodes, linked by `next`
+ * - `queues` :: The main queue, and for S3-FIFO the small and ghost
+ *   queues
+ * - `counters` :: Hit, miss and eviction counts
+ * - `on_evict` :: Called with each key and value leaving the cache
+ * - `ctx` :: Passed to `on_evict`
+ */
+struct cache {
+    enum cache_policy     policy;
+    size_t                capacity;
+    size_t                charge;
+    size_t                n_entries;
+    struct hashmap        map;
+    struct hashmap        ghosts;
+    struct cache_node*    nodes;
+    size_t                nodes_length;
+    size_t                nodes_capacity;
+    size_t                free_node;
+    struct cache_queue    queues[3];
+    struct cache_counters counters;
+    void (*on_evict)(void* key, void* value, void* ctx);
+    void* ctx;
+};
+
+/**
+ * Initializes an empty cache.
+ *
+ * @param `cache` :: Pointer to the cache.
+ * @param `policy` :: Eviction policy.
+ * @param `capacity` :: Maximum total charge of the entries.
+ * @param `hash` :: Hash function for keys (as for `struct hashmap`).
+ * @param `compare` :: Comparison function for keys.
+ * @return 0 on error.
+ */
+int cache_init(struct cache*     cache,
+               enum cache_policy policy,
+               size_t            capacity,
+               uint64_t (*hash)(const void*),
+               int (*compare)(const void*, const void*));
+
+/**
+ * Sets the function called with each key and value leaving the cache,
+ * whether evicted, removed, replaced by `cache_put()` or dropped by
+ * `cache_destroy()`. Every pair successfully passed to `cache_put()` is
+ * passed to it exactly once, so it can free them.
+ *
+ * @param `cache` :: Pointer to the cache.
+ * @param `on_evict` :: The callback, or `NULL` for none.
+ * @param `ctx` :: Passed to `on_evict`.
+ */
+void cache_set_evict_callback(struct cache* cache,
+                              void (*on_evict)(void* key,
+                                               void* value,
+                                               void* ctx),
+                              void* ctx);
+
+/**
+ * Passes every entry to the evict callback and deallocates the cache.
+ *
+ * @param `cache` :: Pointer to the cache.
+ */
+void cache_destroy(struct cache* cache);
+
+/**
+ * Looks up `key`, counting a hit or a miss and updating the entry's
+ * recency.
+ *
+ * @param `cache` :: Pointer to the cache.
+ * @param `key` :: Key to look up.
+ * @param `value` :: Set to the value, or `NULL` on a miss.
+ * @return 0 on a miss.
+ */
+int cache_get(struct cache* cache, void* key, void** value);
+
+/**
+ * Inserts or replaces the entry for `key`, evicting entries as needed
+ * to keep the total charge within the capacity. An entry whose charge
+ * alone exceeds the capacity is passed straight to the evict callback
+ * instead, along with any entry it would have replaced.
+ *
+ * @param `cache` :: Pointer to the cache.
+ * @param `key` :: Key to insert.
+ * @param `value` :: Value to associate with `key`.
+ * @param `charge` :: The entry's share of the capacity.
+ * @return 0 on error, in which case the pair was not inserted and is
+ * not passed to the evict callback.
+ */
+int cache_put(struct cache* cache, void* key, void* value, size_t charge);
+
+/**
+ * Removes the entry for `key`, passing it to the evict callback.
+ *
+ * @param `cache` :: Pointer to the cache.
+ * @param `key` :: Key to remove.
+ * @return 0 if there was no entry for `key`.
+ */
+int cache_remove(struct cache* cache, void* key);
+
+#endif /* MAGPIE_CACHE_H */
@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/concurrent_hashmap.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/ebuf.h>
+
+#define CACHE_LINE 64
+
+/* Times a reader spins on an odd sequence counter before yielding */
+#define SPINS_BEFORE_YIELD 64
+
+enum slot_state {
+    SLOT_EMPTY = 0,
+    SLOT_FULL,
+};
+
+/*
+ * Every field of a slot is atomic, since readers load them while a
+ * writer may be storing to them. Readers only trust what they loaded
+ * if the shard's sequence counter didn't change in the meantime.
+ */
+struct slot {
+    _Atomic uint8_t  state;
+    _Atomic uint64_t hash;
+    void* _Atomic    key;
+    void* _Atomic    value;
+};
+
+struct table {
+    struct table* retired;
+    size_t        capacity;
+    struct slot   slots[];
+};
+
+/*
+ * `seq` is odd while a writer is modifying the current table. Shards
+ * are cache line aligned so that writers to different shards don't
+ * contend on the same line.
+ */
+struct concurrent_hashmap_shard {
+    _Alignas(CACHE_LINE) _Atomic unsigned seq;
+    struct table* _Atomic table;
+    _Atomic size_t        n_entries;
+    pthread_mutex_t       lock;
+};
+
+static inline size_t
+max_load(size_t capacity)
+{
+    size_t load = capacity * MAGPIE_CONCURRENT_HASHMAP_LOAD_THRESHOLD;
+    return load < capacity ? load : capacity - 1;
+}
+
+/* Writers hold the shard lock, so relaxed loads are enough for them.
+ * Readers use these too, but validate what they read afterwards. */
+static inline uint8_t
+slot_state(struct slot* s)
+{
+    return atomic_load_explicit(&s->state, memory_order_relaxed);
+}
+
+static inline uint64_t
+slot_hash(struct slot* s)
+{
+    return atomic_load_explicit(&s->hash, memory_order_relaxed);
+}
+
+static inline void*
+slot_key(struct slot* s)
+{
+    return atomic_load_explicit(&s->key, memory_order_relaxed);
+}
+
+static inline void*
+slot_value(struct slot* s)
+{
+    return atomic_load_explicit(&s->value, memory_order_relaxed);
+}
+
+static struct table*
+table_alloc(size_t capacity)
+{
+    struct table* table
+        = calloc(1, sizeof(*table) + sizeof(table->slots[0]) * capacity);
+
+    if (table == NULL) {
+        EBUF_PUSH("failed to allocate hashmap table", NULL);
+        return NULL;
+    }
+
+    table->capacity = capacity;
+
+    return table;
+}
+
+/*
+ * Slots store the user's hash, but shards and home slots are picked by
+ * its finalized form (`mixed` below), so that weak hashes such as small
+ * integers or aligned pointers still spread over every shard and don't
+ * form long probe clusters.
+ */
+static inline struct concurrent_hashmap_shard*
+shard_for(struct concurrent_hashmap* map, uint64_t mixed)
+{
+    /* the low bits pick a slot within the shard, so shard by the high
+     * bits */
+    size_t shard = map->shard_shift >= 64 ? 0 : mixed >> map->shard_shift;
+    return &map->shards[shard];
+}
+
+static inline size_t
+home_slot(struct table* table, uint64_t mixed)
+{
+    return mixed & (table->capacity - 1);
+}
+
+static inline size_t
+next_slot(struct table* table, size_t slot)
+{
+    return (slot + 1) & (table->capacity - 1);
+}
+
+/* Tells the CPU we're in a spin-wait loop, which saves power and lets
+ * a sibling hyperthread (possibly the writer) make progress */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void
+write_begin(struct concurrent_hashmap_shard* shard)
+{
+    unsigned seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+write_end(struct concurrent_hashmap_shard* shard)
+{
+    unsigned seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_release);
+}
+
+/*
+ * Looks for `key` in a table. Safe to call concurrently with a writer,
+ * but the result is only meaningful if the shard's sequence counter is
+ * unchanged afterwards.
+ */
+static ssize_t
+table_find(struct concurrent_hashmap* map,
+           struct table*              table,
+           void*                      key,
+           uint64_t                   key_hash,
+           uint64_t                   mixed,
+           void**                     value)
+{
+    size_t slot = home_slot(table, mixed);
+
+    for (size_t probed = 0; probed < table->capacity; probed++) {
+        struct slot* s = &table->slots[slot];
+        uint8_t state  = atomic_load_explicit(&s->state, memory_order_acquire);
+
+        if (state == SLOT_EMPTY) {
+            break;
+        }
+
+        if (slot_hash(s) == key_hash) {
+            void* k = slot_key(s);
+
+            if (map->compare(&k, &key) == 0) {
+                *value = slot_value(s);
+                return slot;
+            }
+        }
+
+        slot = next_slot(table, slot);
+    }
+
+    return -1;
+}
+
+static void
+slot_store(struct slot* s, void* key, uint64_t key_hash, void* value)
+{
+    atomic_store_explicit(&s->key, key, memory_order_relaxed);
+    atomic_store_explicit(&s->hash, key_hash, memory_order_relaxed);
+    atomic_store_explicit(&s->value, value, memory_order_relaxed);
+
+    /* a reader which sees the slot as full must also see its key */
+    atomic_store_explicit(&s->state, SLOT_FULL, memory_order_release);
+}
+
+static struct slot*
+table_free_slot(struct table* table, uint64_t mixed)
+{
+    size_t slot = home_slot(table, mixed);
+
+    while (slot_state(&table->slots[slot]) != SLOT_EMPTY) {
+        slot = next_slot(table, slot);
+    }
+
+    return &table->slots[slot];
+}
+
+/*
+ * Replaces a shard's table with one twice the size. Readers carry on
+ * using the old table, which stays valid (and unchanged, since the
+ * caller holds the shard lock) until the map is destroyed.
+ */
+static int
+shard_grow(struct concurrent_hashmap_shard* shard)
+{
+    struct table* old;
+    struct table* table;
+
+    old   = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    table = table_alloc(old->capacity * 2);
+
+    if (table == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < old->capacity; i++) {
+        struct slot* s = &old->slots[i];
+
+        if (slot_state(s) == SLOT_FULL) {
+            slot_store(table_free_slot(table, hashmap_mix64(slot_hash(s))),
+                       slot_key(s),
+                       slot_hash(s),
+                       slot_value(s));
+        }
+    }
+
+    table->retired = old;
+    atomic_store_explicit(&shard->table, table, memory_order_release);
+
+    return 1;
+}
+
+/*
+ * Backward-shift deletion for linear probing: moves later entries of
+ * the probe sequence into the hole unless that would put them before
+ * their home slot. Leaves no tombstones, so a shard only ever needs a
+ * new table when it grows.
+ */
+static void
+table_erase(struct table* table, size_t hole)
+{
+    size_t next = hole;
+
+    for (;;) {
+        struct slot* s;
+        size_t       home;
+
+        next = next_slot(table, next);
+        s    = &table->slots[next];
+
+        if (slot_state(s) == SLOT_EMPTY) {
+            break;
+        }
+
+        home = home_slot(table, hashmap_mix64(slot_hash(s)));
+
+        /* leave the entry alone if its home is cyclically in (hole, next] */
+        if (hole <= next ? (hole < home && home <= next)
+                         : (hole < home || home <= next)) {
+            continue;
+        }
+
+        slot_store(
+            &table->slots[hole], slot_key(s), slot_hash(s), slot_value(s));
+        hole = next;
+    }
+
+    atomic_store_explicit(
+        &table->slots[hole].state, SLOT_EMPTY, memory_order_relaxed);
+}
+
+int
+concurrent_hashmap_init(struct concurrent_hashmap* map,
+                        size_t                     n_shards,
+                        uint64_t (*hash)(const void*),
+                        int (*compare)(const void*, const void*))
+{
+    size_t   shards = 1;
+    unsigned bits   = 0;
+
+    if (n_shards == 0) {
+        n_shards = MAGPIE_CONCURRENT_HASHMAP_SHARDS;
+    }
+
+    while (shards < n_shards) {
+        shards *= 2;
+        bits++;
+    }
+
+    map->shards = aligned_alloc(CACHE_LINE, sizeof(*map->shards) * shards);
+
+    if (map->shards == NULL) {
+        EBUF_PUSH("failed to allocate hashmap shards", map);
+        return 0;
+    }
+
+    map->n_shards    = shards;
+    map->shard_shift = 64 - bits;
+    map->hash        = hash;
+    map->compare     = compare;
+
+    for (size_t i = 0; i < shards; i++) {
+        struct concurrent_hashmap_shard* shard = &map->shards[i];
+        struct table*                    table;
+
+        table = table_alloc(MAGPIE_CONCURRENT_HASHMAP_INITIAL_CAPACITY);
+
+        if (table == NULL) {
+            map->n_shards = i;
+            concurrent_hashmap_destroy(map);
+            return 0;
+        }
+
+        atomic_init(&shard->seq, 0);
+        atomic_init(&shard->table, table);
+        atomic_init(&shard->n_entries, 0);
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+
+    return 1;
+}
+
+void
+concurrent_hashmap_destroy(struct concurrent_hashmap* map)
+{
+    for (size_t i = 0; i < map->n_shards; i++) {
+        struct concurrent_hashmap_shard* shard = &map->shards[i];
+        struct table* table = atomic_load(&shard->table);
+
+        while (table != NULL) {
+            struct table* retired = table->retired;
+
+            free(table);
+            table = retired;
+        }
+
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    free(map->shards);
+
+    map->shards   = NULL;
+    map->n_shards = 0;
+}
+
+int
+concurrent_hashmap_set(struct concurrent_hashmap* map, void* key, void* value)
+{
+    uint64_t                         key_hash = map->hash(&key);
+    uint64_t                         mixed    = hashmap_mix64(key_hash);
+    struct concurrent_hashmap_shard* shard    = shard_for(map, mixed);
+    struct table*                    table;
+    ssize_t                          slot;
+    size_t                           n_entries;
+    void*                            current;
+
+    pthread_mutex_lock(&shard->lock);
+
+    table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    slot  = table_find(map, table, key, key_hash, mixed, &current);
+
+    if (slot >= 0) {
+        write_begin(shard);
+        atomic_store_explicit(
+            &table->slots[slot].value, value, memory_order_relaxed);
+        write_end(shard);
+
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+
+    n_entries = atomic_load_explicit(&shard->n_entries, memory_order_relaxed);
+
+    if (n_entries + 1 > max_load(table->capacity)) {
+        if (!shard_grow(shard)) {
+            pthread_mutex_unlock(&shard->lock);
+            EBUF_PUSH("failed to insert hashmap entry", map);
+            return 0;
+        }
+
+        table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    }
+
+    write_begin(shard);
+    slot_store(table_free_slot(table, mixed), key, key_hash, value);
+    write_end(shard);
+
+    atomic_store_explicit(
+        &shard->n_entries, n_entries + 1, memory_order_relaxed);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return 1;
+}
+
+int
+concurrent_hashmap_get(struct concurrent_hashmap* map, void* key, void** value)
+{
+    uint64_t                         key_hash = map->hash(&key);
+    uint64_t                         mixed    = hashmap_mix64(key_hash);
+    struct concurrent_hashmap_shard* shard    = shard_for(map, mixed);
+    unsigned                         spins    = 0;
+
+    for (;;) {
+        unsigned      seq;
+        struct table* table;
+        ssize_t       slot;
+        void*         found = NULL;
+
+        seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+
+        if (seq & 1) {
+            /* a writer is part way through an update, which may be a
+             * whole resize; back off rather than hammering the
+             * counter's cache line */
+            if (++spins < SPINS_BEFORE_YIELD) {
+                cpu_relax();
+            }
+            else {
+                sched_yield();
+            }
+
+            continue;
+        }
+
+        table = atomic_load_explicit(&shard->table, memory_order_acquire);
+        slot  = table_find(map, table, key, key_hash, mixed, &found);
+
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&shard->seq, memory_order_relaxed) == seq) {
+            *value = slot >= 0 ? found : NULL;
+            return slot >= 0;
+        }
+    }
+}
+
+void
+concurrent_hashmap_remove(struct concurrent_hashmap* map, void* key)
+{
+    uint64_t                         key_hash = map->hash(&key);
+    uint64_t                         mixed    = hashmap_mix64(key_hash);
+    struct concurrent_hashmap_shard* shard    = shard_for(map, mixed);
+    struct table*                    table;
+    ssize_t                          slot;
+    void*                            current;
+
+    pthread_mutex_lock(&shard->lock);
+
+    table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    slot  = table_find(map, table, key, key_hash, mixed, &current);
+
+    if (slot >= 0) {
+        write_begin(shard);
+        table_erase(table, slot);
+        write_end(shard);
+
+        atomic_fetch_sub_explicit(&shard->n_entries, 1, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+size_t
+concurrent_hashmap_size(struct concurrent_hashmap* map)
+{
+    size_t n_entries = 0;
+
+    for (size_t i = 0; i < map->n_shards; i++) {
+        n_entries += concurrent_hashmap_shard_size(map, i);
+    }
+
+    return n_entries;
+}
+
+size_t
+concurrent_hashmap_shard_size(struct concurrent_hashmap* map, size_t shard)
+{
+    return atomic_load_explicit(&map->shards[shard].n_entries,
+                                memory_order_relaxed);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_CONCURRENT_HASHMAP_H
+#define MAGPIE_CONCURRENT_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MAGPIE_CONCURRENT_HASHMAP_SHARDS
+#    define MAGPIE_CONCURRENT_HASHMAP_SHARDS 64
+#endif
+
+#ifndef MAGPIE_CONCURRENT_HASHMAP_INITIAL_CAPACITY
+#    define MAGPIE_CONCURRENT_HASHMAP_INITIAL_CAPACITY 16
+#endif
+
+#ifndef MAGPIE_CONCURRENT_HASHMAP_LOAD_THRESHOLD
+#    define MAGPIE_CONCURRENT_HASHMAP_LOAD_THRESHOLD 0.75
+#endif
+
+struct concurrent_hashmap_shard;
+
+/**
+ * A hashmap which may be shared between threads without external
+ * locking.
+ *
+ * Keys are spread over `n_shards` independent shards by the high bits
+ * of their hash, and each shard is an open-addressing table of its
+ * own. The hash is passed through a finalizer first, so as for `struct
+ * hashmap` it needn't be well mixed. Writers to a shard serialize on a
+ * per-shard mutex; readers take no locks at all, and instead use the
+ * shard's sequence counter to detect (and retry after) a concurrent
+ * write. Each shard grows independently, without blocking readers:
+ * tables replaced by a resize are kept until the map is destroyed,
+ * since a reader may still be probing them.
+ *
+ * Keys are compared by readers without synchronisation, so a key must
+ * remain valid for as long as any thread may be looking it up, even
+ * after it is removed.
+ *
+ * - `shards` :: Array of `n_shards` shards
+ * - `n_shards` :: Number of shards (always a power of two)
+ * - `shard_shift` :: Shift applied to a hash to find its shard
+ */
+struct concurrent_hashmap {
+    struct concurrent_hashmap_shard* shards;
+    size_t                           n_shards;
+    unsigned                         shard_shift;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
+/**
+ * Initializes an empty concurrent hashmap. Must not race with any
+ * other use of the map.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `n_shards` :: Number of shards, rounded up to a power of two.
+ * If 0, `MAGPIE_CONCURRENT_HASHMAP_SHARDS` is used.
+ * @param `hash` :: Function for hashing a key. Receives a pointer to
+ * the key.
+ * @param `compare` :: Function for comparing two keys. Receives
+ * pointers to the keys and returns zero if they are equal.
+ * @return 0 on error.
+ */
+int concurrent_hashmap_init(struct concurrent_hashmap* map,
+                            size_t                     n_shards,
+                            uint64_t (*hash)(const void*),
+                            int (*compare)(const void*, const void*));
+
+/**
+ * Deallocates a concurrent hashmap. Must not race with any other use
+ * of the map. Keys and values are not freed.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ */
+void concurrent_hashmap_destroy(struct concurrent_hashmap* map);
+
+/**
+ * Associates `value` with `key`, replacing any existing value.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to insert.
+ * @param `value` :: Value to associate with `key`.
+ * @return 0 on error.
+ */
+int concurrent_hashmap_set(struct concurrent_hashmap* map,
+                           void*                      key,
+                           void*                      value);
+
+/**
+ * Retrieves the value associated with `key` without taking any locks.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @param `value` :: Pointer to a `void*` to store the value into. Set
+ * to `NULL` if the key is not present.
+ * @return 0 if the key is not present.
+ */
+int concurrent_hashmap_get(struct concurrent_hashmap* map,
+                           void*                      key,
+                           void**                     value);
+
+/**
+ * Removes the entry for `key`, if there is one.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to remove.
+ */
+void concurrent_hashmap_remove(struct concurrent_hashmap* map, void* key);
+
+/**
+ * Counts the entries in the map. If other threads are modifying the
+ * map, the result is only a snapshot of each shard at some point
+ * during the call.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @return The number of entries.
+ */
+size_t concurrent_hashmap_size(struct concurrent_hashmap* map);
+
+/**
+ * Counts the entries in one shard, with the same caveat as
+ * `concurrent_hashmap_size()`. Useful for checking how evenly a hash
+ * function spreads keys over the shards.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `shard` :: Index of the shard, less than `map->n_shards`.
+ * @return The number of entries in the shard.
+ */
+size_t concurrent_hashmap_shard_size(struct concurrent_hashmap* map,
+                                     size_t                     shard);
+
+#endif /* MAGPIE_CONCURRENT_HASHMAP_H */
@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/cuckoo_hashmap.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/ebuf.h>
+#include <magpie/hash.h>
+
+#define BUCKET_SIZE CUCKOO_HASHMAP_BUCKET_SIZE
+
+/* Number of seeds an insertion will try when rehashing into a table
+ * of twice the size, looking for one which lets every key fit */
+#define MAX_RESEEDS 4
+
+/* A bucket visited by the displacement search. `slot` is the slot of
+ * the parent bucket whose entry would move into this one. */
+struct path_node {
+    size_t  bucket;
+    ssize_t parent;
+    uint8_t slot;
+    uint8_t depth;
+};
+
+static size_t
+buckets_for(size_t n)
+{
+    size_t n_buckets = 2;
+
+    while (n_buckets * BUCKET_SIZE < n) {
+        n_buckets *= 2;
+    }
+
+    return n_buckets;
+}
+
+static inline size_t
+max_load(size_t n_buckets)
+{
+    return n_buckets * BUCKET_SIZE * MAGPIE_CUCKOO_HASHMAP_LOAD_THRESHOLD;
+}
+
+static inline size_t
+min_grow_load(size_t n_buckets)
+{
+    return n_buckets * BUCKET_SIZE * MAGPIE_CUCKOO_HASHMAP_MIN_GROW_LOAD;
+}
+
+/*
+ * Entries store the user's hash, but buckets and tags are derived from
+ * its finalized form (`mixed` below), so that weak hashes such as small
+ * integers or aligned pointers still spread over the table and have
+ * distinct tags.
+ */
+static inline uint8_t
+hash_tag(uint64_t mixed)
+{
+    uint8_t tag = mixed >> 56;
+    return tag != 0 ? tag : 1;
+}
+
+static inline size_t
+first_bucket(const struct cuckoo_hashmap* map, uint64_t mixed)
+{
+    return mixed & (map->n_buckets - 1);
+}
+
+static inline size_t
+second_bucket(const struct cuckoo_hashmap* map, uint64_t mixed)
+{
+    size_t first  = first_bucket(map, mixed);
+    size_t second = hashmap_mix64(mixed ^ map->seed) & (map->n_buckets - 1);
+
+    /* the two buckets must differ, or the key has only one */
+    return second != first ? second : first ^ 1;
+}
+
+static inline size_t
+other_bucket(const struct cuckoo_hashmap* map, size_t bucket, uint64_t mixed)
+{
+    size_t first = first_bucket(map, mixed);
+    return bucket != first ? first : second_bucket(map, mixed);
+}
+
+static int
+free_slot(const struct cuckoo_hashmap_bucket* bucket)
+{
+    for (int slot = 0; slot < BUCKET_SIZE; slot++) {
+        if (bucket->tags[slot] == 0) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+static struct cuckoo_hashmap_entry*
+bucket_find(struct cuckoo_hashmap*        map,
+            struct cuckoo_hashmap_bucket* bucket,
+            void*                         key,
+            uint64_t                      key_hash,
+            uint8_t                       want,
+            uint8_t*                      slot_out)
+{
+    for (int slot = 0; slot < BUCKET_SIZE; slot++) {
+        struct cuckoo_hashmap_entry* entry = &bucket->entries[slot];
+
+        if (bucket->tags[slot] == want && entry->hash == key_hash
+            && map->compare(&entry->key, &key) == 0) {
+            if (slot_out != NULL) {
+                *slot_out = slot;
+            }
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct cuckoo_hashmap_entry*
+find(struct cuckoo_hashmap* map,
+     void*                  key,
+     uint64_t               key_hash,
+     size_t*                bucket,
+     uint8_t*               slot)
+{
+    uint64_t                     mixed = hashmap_mix64(key_hash);
+    uint8_t                      tag   = hash_tag(mixed);
+    size_t                       index = first_bucket(map, mixed);
+    struct cuckoo_hashmap_entry* entry
+        = bucket_find(map, &map->buckets[index], key, key_hash, tag, slot);
+
+    if (entry == NULL) {
+        index = second_bucket(map, mixed);
+        entry
+            = bucket_find(map, &map->buckets[index], key, key_hash, tag, slot);
+    }
+
+    if (bucket != NULL) {
+        *bucket = index;
+    }
+
+    return entry;
+}
+
+/* Whether both of a hash's buckets are full of entries which can't be
+ * in any other bucket, because their own pair of buckets is the same.
+ * No amount of moving makes room for another such key. */
+static int
+pinned(const struct cuckoo_hashmap* map, uint64_t key_hash)
+{
+    uint64_t mixed = hashmap_mix64(key_hash);
+    size_t   buckets[2]
+        = { first_bucket(map, mixed), second_bucket(map, mixed) };
+
+    for (int b = 0; b < 2; b++) {
+        const struct cuckoo_hashmap_bucket* bucket = &map->buckets[buckets[b]];
+
+        for (int slot = 0; slot < BUCKET_SIZE; slot++) {
+            uint64_t other;
+
+            if (bucket->tags[slot] == 0) {
+                return 0;
+            }
+
+            other = hashmap_mix64(bucket->entries[slot].hash);
+
+            if (other_bucket(map, buckets[b], other) != buckets[!b]) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void
+move_entry(struct cuckoo_hashmap* map,
+           size_t                 from_bucket,
+           int                    from_slot,
+           size_t                 to_bucket,
+           int                    to_slot)
+{
+    struct cuckoo_hashmap_bucket* from = &map->buckets[from_bucket];
+    struct cuckoo_hashmap_bucket* to   = &map->buckets[to_bucket];
+
+    to->entries[to_slot]  = from->entries[from_slot];
+    to->tags[to_slot]     = from->tags[from_slot];
+    from->tags[from_slot] = 0;
+}
+
+static int
+on_path(const struct path_node* nodes, ssize_t node, size_t bucket)
+{
+    for (; node >= 0; node = nodes[node].parent) {
+        if (nodes[node].bucket == bucket) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Frees a slot in one of the buckets for `key_hash`, moving entries to
+ * their other buckets if need be. The search is breadth-first, so the
+ * chain of moves found is the shortest one. Buckets already on a chain
+ * are not revisited by it, which keeps every slot on the chain
+ * distinct, so the moves can be made one after another from the free
+ * end without disturbing each other. */
+static int
+make_room(struct cuckoo_hashmap* map,
+          uint64_t               key_hash,
+          size_t*                bucket,
+          int*                   slot)
+{
+    struct path_node nodes[MAGPIE_CUCKOO_HASHMAP_MAX_SEARCH];
+    uint64_t         mixed = hashmap_mix64(key_hash);
+    size_t           head  = 0;
+    size_t           tail  = 0;
+
+    nodes[tail++] = (struct path_node){
+        .bucket = first_bucket(map, mixed),
+        .parent = -1,
+    };
+    nodes[tail++] = (struct path_node){
+        .bucket = second_bucket(map, mixed),
+        .parent = -1,
+    };
+
+    for (size_t i = 0; i < tail; i++) {
+        *slot = free_slot(&map->buckets[nodes[i].bucket]);
+
+        if (*slot >= 0) {
+            *bucket = nodes[i].bucket;
+            return 1;
+        }
+    }
+
+    while (head < tail) {
+        ssize_t                       node  = head++;
+        size_t                        index = nodes[node].bucket;
+        struct cuckoo_hashmap_bucket* current = &map->buckets[index];
+
+        for (int s = 0; s < BUCKET_SIZE; s++) {
+            uint64_t moved = hashmap_mix64(current->entries[s].hash);
+            size_t   other = other_bucket(map, index, moved);
+            int      free  = free_slot(&map->buckets[other]);
+
+            if (free >= 0) {
+                move_entry(map, index, s, other, free);
+
+                while (nodes[node].parent >= 0) {
+                    ssize_t parent = nodes[node].parent;
+
+                    move_entry(map,
+                               nodes[parent].bucket,
+                               nodes[node].slot,
+                               nodes[node].bucket,
+                               s);
+
+                    s    = nodes[node].slot;
+                    node = parent;
+                }
+
+                *bucket = nodes[node].bucket;
+                *slot   = s;
+                return 1;
+            }
+
+            if (nodes[node].depth + 1 < MAGPIE_CUCKOO_HASHMAP_MAX_PATH
+                && tail < MAGPIE_CUCKOO_HASHMAP_MAX_SEARCH
+                && !on_path(nodes, node, other)) {
+                nodes[tail++] = (struct path_node){
+                    .bucket = other,
+                    .parent = node,
+                    .slot   = s,
+                    .depth  = nodes[node].depth + 1,
+                };
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+place(struct cuckoo_hashmap* map, const struct cuckoo_hashmap_entry* entry)
+{
+    size_t bucket;
+    int    slot;
+
+    if (!make_room(map, entry->hash, &bucket, &slot)) {
+        return 0;
+    }
+
+    map->buckets[bucket].entries[slot] = *entry;
+    map->buckets[bucket].tags[slot]    = hash_tag(hashmap_mix64(entry->hash));
+
+    return 1;
+}
+
+/* Moves every entry into a new table of `n_buckets` buckets, with a new
+ * seed. The map is left as it was if any entry can't be placed. */
+static int
+resize_to(struct cuckoo_hashmap* map, size_t n_buckets, uint64_t seed)
+{
+    struct cuckoo_hashmap_bucket* old_buckets   = map->buckets;
+    size_t                        old_n_buckets = map->n_buckets;
+    uint64_t                      old_seed      = map->seed;
+    struct cuckoo_hashmap_bucket* buckets
+        = calloc(n_buckets, sizeof(*buckets));
+
+    if (buckets == NULL) {
+        EBUF_PUSH("failed to allocate hashmap buckets", map);
+        return 0;
+    }
+
+    map->buckets   = buckets;
+    map->n_buckets = n_buckets;
+    map->seed      = seed;
+
+    for (size_t b = 0; b < old_n_buckets; b++) {
+        for (int slot = 0; slot < BUCKET_SIZE; slot++) {
+            if (old_buckets[b].tags[slot] == 0) {
+                continue;
+            }
+
+            if (!place(map, &old_buckets[b].entries[slot])) {
+                free(buckets);
+                map->buckets   = old_buckets;
+                map->n_buckets = old_n_buckets;
+                map->seed      = old_seed;
+                return 0;
+            }
+        }
+    }
+
+    free(old_buckets);
+
+    return 1;
+}
+
+/* Doubles the table, which is then kept even if `entry` still doesn't
+ * fit; only the rehash is retried, so an insertion at most doubles the
+ * table's size */
+static int
+grow_and_place(struct cuckoo_hashmap*             map,
+               const struct cuckoo_hashmap_entry* entry)
+{
+    size_t n_buckets = map->n_buckets * 2;
+
+    for (int attempt = 0; attempt < MAX_RESEEDS; attempt++) {
+        uint64_t seed = hashmap_mix64(map->seed + n_buckets + attempt);
+
+        if (resize_to(map, n_buckets, seed)) {
+            return place(map, entry);
+        }
+    }
+
+    return 0;
+}
+
+int
+cuckoo_hashmap_init(struct cuckoo_hashmap* map,
+                    uint64_t (*hash)(const void*),
+                    int (*compare)(const void*, const void*))
+{
+    size_t n_buckets = buckets_for(MAGPIE_CUCKOO_HASHMAP_INITIAL_CAPACITY);
+
+    map->buckets   = NULL;
+    map->n_buckets = 0;
+    map->n_entries = 0;
+    map->seed      = hash_get_seed();
+    map->hash      = hash;
+    map->compare   = compare;
+
+    return resize_to(map, n_buckets, hashmap_mix64(map->seed + n_buckets));
+}
+
+void
+cuckoo_hashmap_destroy(struct cuckoo_hashmap* map)
+{
+    free(map->buckets);
+
+    map->buckets   = NULL;
+    map->n_buckets = 0;
+    map->n_entries = 0;
+}
+
+void
+cuckoo_hashmap_set(struct cuckoo_hashmap* map, void* key, void* value)
+{
+    uint64_t                     key_hash = map->hash(&key);
+    struct cuckoo_hashmap_entry* existing
+        = find(map, key, key_hash, NULL, NULL);
+
+    struct cuckoo_hashmap_entry entry = {
+        .key   = key,
+        .value = value,
+        .hash  = key_hash,
+    };
+
+    if (existing != NULL) {
+        existing->value = value;
+        return;
+    }
+
+    if (map->n_entries + 1 > max_load(map->n_buckets)) {
+        if (!grow_and_place(map, &entry)) {
+            EBUF_PUSH("failed to insert hashmap entry", map);
+            return;
+        }
+    }
+    else if (!place(map, &entry)) {
+        if (pinned(map, key_hash)) {
+            EBUF_PUSH("too many hashmap keys share a pair of buckets", map);
+            return;
+        }
+
+        if (map->n_entries < min_grow_load(map->n_buckets)) {
+            EBUF_PUSH("hashmap keys are crowding too few buckets", map);
+            return;
+        }
+
+        if (!grow_and_place(map, &entry)) {
+            EBUF_PUSH("failed to insert hashmap entry", map);
+            return;
+        }
+    }
+
+    map->n_entries++;
+}
+
+struct cuckoo_hashmap_entry*
+cuckoo_hashmap_lookup(struct cuckoo_hashmap* map, void* key)
+{
+    return find(map, key, map->hash(&key), NULL, NULL);
+}
+
+int
+cuckoo_hashmap_get(struct cuckoo_hashmap* map, void* key, void** value)
+{
+    struct cuckoo_hashmap_entry* entry = cuckoo_hashmap_lookup(map, key);
+
+    if (entry == NULL) {
+        *value = NULL;
+        return 0;
+    }
+
+    *value = entry->value;
+    return 1;
+}
+
+void
+cuckoo_hashmap_remove(struct cuckoo_hashmap* map, void* key)
+{
+    size_t  bucket;
+    uint8_t slot;
+
+    if (find(map, key, map->hash(&key), &bucket, &slot) == NULL) {
+        return;
+    }
+
+    map->buckets[bucket].tags[slot] = 0;
+    map->n_entries--;
+}
+
+struct cuckoo_hashmap_iter
+cuckoo_hashmap_iter(struct cuckoo_hashmap* map)
+{
+    struct cuckoo_hashmap_iter iter = {
+        .map  = map,
+        .slot = -1,
+    };
+
+    return iter;
+}
+
+int
+cuckoo_hashmap_iter_next(struct cuckoo_hashmap_iter* iter)
+{
+    struct cuckoo_hashmap* map     = iter->map;
+    size_t                 n_slots = map->n_buckets * BUCKET_SIZE;
+
+    while ((size_t)++iter->slot < n_slots) {
+        size_t bucket = iter->slot / BUCKET_SIZE;
+
+        if (map->buckets[bucket].tags[iter->slot % BUCKET_SIZE] != 0) {
+            return 1;
+        }
+    }
+
+    iter->slot = n_slots;
+    return 0;
+}
+
+struct cuckoo_hashmap_entry*
+cuckoo_hashmap_iter_get(struct cuckoo_hashmap_iter* iter)
+{
+    struct cuckoo_hashmap* map = iter->map;
+
+    if (iter->slot < 0
+        || (size_t)iter->slot >= map->n_buckets * BUCKET_SIZE) {
+        return NULL;
+    }
+
+    return &map->buckets[iter->slot / BUCKET_SIZE]
+                .entries[iter->slot % BUCKET_SIZE];
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_CUCKOO_HASHMAP_H
+#define MAGPIE_CUCKOO_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef MAGPIE_CUCKOO_HASHMAP_INITIAL_CAPACITY
+#    define MAGPIE_CUCKOO_HASHMAP_INITIAL_CAPACITY 256
+#endif
+
+#ifndef MAGPIE_CUCKOO_HASHMAP_LOAD_THRESHOLD
+#    define MAGPIE_CUCKOO_HASHMAP_LOAD_THRESHOLD 0.9
+#endif
+
+/* Longest chain of displacements an insertion will make before giving
+ * up and growing the table */
+#ifndef MAGPIE_CUCKOO_HASHMAP_MAX_PATH
+#    define MAGPIE_CUCKOO_HASHMAP_MAX_PATH 5
+#endif
+
+/* Most buckets the search for a displacement chain will visit */
+#ifndef MAGPIE_CUCKOO_HASHMAP_MAX_SEARCH
+#    define MAGPIE_CUCKOO_HASHMAP_MAX_SEARCH 512
+#endif
+
+/* Load below which an insertion with no displacement chain fails
+ * rather than growing the table */
+#ifndef MAGPIE_CUCKOO_HASHMAP_MIN_GROW_LOAD
+#    define MAGPIE_CUCKOO_HASHMAP_MIN_GROW_LOAD 0.5
+#endif
+
+#define CUCKOO_HASHMAP_BUCKET_SIZE 4
+
+struct cuckoo_hashmap_entry {
+    void*    key;
+    void*    value;
+    uint64_t hash;
+};
+
+/**
+ * A bucket of a cuckoo hashmap.
+ *
+ * - `tags` :: Top byte of each entry's finalized hash, never 0, or 0
+ *   if the slot is empty
+ */
+struct cuckoo_hashmap_bucket {
+    uint8_t                     tags[CUCKOO_HASHMAP_BUCKET_SIZE];
+    struct cuckoo_hashmap_entry entries[CUCKOO_HASHMAP_BUCKET_SIZE];
+};
+
+/**
+ * A bucketized cuckoo hashmap.
+ *
+ * Every key has two candidate buckets of `CUCKOO_HASHMAP_BUCKET_SIZE`
+ * slots: the first is picked by the low bits of the key's hash, passed
+ * through a finalizer so that it needn't be well mixed, and the second
+ * by that mixed with the map's `seed`. A key is always in one of its
+ * two buckets, so a lookup examines at most eight slots whatever the
+ * load or insertion history, which bounds its worst case instead of
+ * just its average.
+ *
+ * When both of a new key's buckets are full, insertion searches
+ * breadth-first for the shortest chain of entries which can each be
+ * moved to their other bucket, ending at a free slot, and then moves
+ * them back to front. If there is no chain of up to
+ * `MAGPIE_CUCKOO_HASHMAP_MAX_PATH` moves, the table doubles in size and
+ * is rehashed with a new seed. Below `MAGPIE_CUCKOO_HASHMAP_MIN_GROW_LOAD`
+ * the insertion fails instead: at such a load the keys must be crowding
+ * a few buckets, typically by sharing hashes, and a bigger table would
+ * only waste memory.
+ *
+ * Since both buckets are derived from the hash, no more than
+ * `2 * CUCKOO_HASHMAP_BUCKET_SIZE` keys may share a hash, or more
+ * generally a pair of buckets; inserting more fails.
+ *
+ * - `buckets` :: Bucket storage, `n_buckets` buckets long
+ * - `n_buckets` :: Number of buckets (always a power of two)
+ * - `n_entries` :: Number of live entries
+ * - `seed` :: Mixed into hashes to pick each key's second bucket
+ */
+struct cuckoo_hashmap {
+    struct cuckoo_hashmap_bucket* buckets;
+    size_t                        n_buckets;
+    size_t                        n_entries;
+    uint64_t                      seed;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
+struct cuckoo_hashmap_iter {
+    struct cuckoo_hashmap* map;
+    ssize_t                slot;
+};
+
+/**
+ * Initializes an empty cuckoo hashmap.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hash` :: Function for hashing a key. Receives a pointer to
+ * the key.
+ * @param `compare` :: Function for comparing two keys. Receives
+ * pointers to the keys and returns zero if they are equal.
+ * @return 0 on error.
+ */
+int cuckoo_hashmap_init(struct cuckoo_hashmap* map,
+                        uint64_t (*hash)(const void*),
+                        int (*compare)(const void*, const void*));
+
+/**
+ * Deallocates a cuckoo hashmap. Keys and values are not freed.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ */
+void cuckoo_hashmap_destroy(struct cuckoo_hashmap* map);
+
+/**
+ * Associates `value` with `key`, replacing any existing value. Pushes
+ * an error to the ebuf if there is no room for `key`, as described
+ * for `struct cuckoo_hashmap`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to insert.
+ * @param `value` :: Value to associate with `key`.
+ */
+void cuckoo_hashmap_set(struct cuckoo_hashmap* map, void* key, void* value);
+
+/**
+ * Looks up the entry for `key`.
+ *
+ * The returned pointer refers to storage owned by the map and is only
+ * valid until the next call which inserts into the map, since
+ * insertion may move entries between buckets.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @return The entry for `key`, or `NULL` if there is none.
+ */
+struct cuckoo_hashmap_entry* cuckoo_hashmap_lookup(struct cuckoo_hashmap* map,
+                                                   void*                  key);
+
+/**
+ * Retrieves the value associated with `key`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @param `value` :: Pointer to a `void*` to store the value into. Set
+ * to `NULL` if the key is not present.
+ * @return 0 if the key is not present.
+ */
+int cuckoo_hashmap_get(struct cuckoo_hashmap* map, void* key, void** value);
+
+/**
+ * Removes the entry for `key`, if there is one.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to remove.
+ */
+void cuckoo_hashmap_remove(struct cuckoo_hashmap* map, void* key);
+
+struct cuckoo_hashmap_iter cuckoo_hashmap_iter(struct cuckoo_hashmap* map);
+
+int cuckoo_hashmap_iter_next(struct cuckoo_hashmap_iter* iter);
+
+struct cuckoo_hashmap_entry*
+cuckoo_hashmap_iter_get(struct cuckoo_hashmap_iter* iter);
+
+#endif /* MAGPIE_CUCKOO_HASHMAP_H */
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/frozen_hashmap.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/ebuf.h>
+#include <magpie/hash.h>
+
+/* Control bytes past the end of the table which mirror its first few,
+ * enough for the widest group any reader might load */
+#define CTRL_PADDING 15
+
+#define MIN_CAPACITY 16
+#define ALIGNMENT    8
+
+static inline uint64_t
+align_up(uint64_t n)
+{
+    return (n + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+}
+
+static inline size_t
+get_slot(const struct frozen_hashmap* map, size_t slot)
+{
+    if (map->header->slot_width == 4) {
+        return ((const uint32_t*)map->slots)[slot];
+    }
+
+    return ((const uint64_t*)map->slots)[slot];
+}
+
+/* Writes `length` bytes, followed by NUL padding up to the alignment */
+static int
+write_padded(FILE* stream, const void* data, uint64_t length, uint64_t size)
+{
+    static const uint8_t zeros[ALIGNMENT] = { 0 };
+
+    if (length > 0 && fwrite(data, 1, length, stream) != length) {
+        return 0;
+    }
+
+    for (uint64_t n = size - length; n > 0;) {
+        uint64_t chunk = n < ALIGNMENT ? n : ALIGNMENT;
+
+        if (fwrite(zeros, 1, chunk, stream) != chunk) {
+            return 0;
+        }
+
+        n -= chunk;
+    }
+
+    return 1;
+}
+
+size_t
+frozen_hashmap_encode_str(const void* item, const void** bytes)
+{
+    const char* str = *(const char* const*)item;
+
+    *bytes = str;
+    return strlen(str);
+}
+
+size_t
+frozen_hashmap_encode_ptr(const void* item, const void** bytes)
+{
+    *bytes = item;
+    return sizeof(void*);
+}
+
+int
+hashmap_freeze(struct hashmap* map,
+               FILE*           stream,
+               size_t (*encode_key)(const void*, const void**),
+               size_t (*encode_value)(const void*, const void**))
+{
+    struct frozen_hashmap_header header    = { .magic = FROZEN_HASHMAP_MAGIC };
+    uint8_t*                     ctrl      = NULL;
+    void*                        slots     = NULL;
+    uint64_t*                    hashes    = NULL;
+    uint64_t                     capacity  = MIN_CAPACITY;
+    uint64_t                     blob_size = 0;
+    uint64_t                     offset    = 0;
+    size_t                       n         = 0;
+    int                          ok        = 0;
+
+    while (hashmap_max_load(capacity) < map->n_entries) {
+        capacity *= 2;
+    }
+
+    header.version    = FROZEN_HASHMAP_VERSION;
+    header.byte_order = FROZEN_HASHMAP_BYTE_ORDER;
+    header.seed       = hash_get_seed();
+    header.n_entries  = map->n_entries;
+    header.capacity   = capacity;
+    header.slot_width = map->n_entries <= UINT32_MAX ? 4 : 8;
+
+    ctrl   = malloc(capacity + CTRL_PADDING);
+    slots  = calloc(capacity, header.slot_width);
+    hashes = malloc(sizeof(*hashes) * (map->n_entries + 1));
+
+    if (ctrl == NULL || slots == NULL || hashes == NULL) {
+        EBUF_PUSH("failed to allocate frozen hashmap table", map);
+        goto out;
+    }
+
+    memset(ctrl, HASHMAP_CTRL_EMPTY, capacity + CTRL_PADDING);
+
+    /* Index every live entry, in insertion order. The table is never
+     * deleted from, so placing each entry in the first empty slot from
+     * its start position lets readers probe it with any group width. */
+    for (size_t i = 0; i < map->entries_length; i++) {
+        struct hashmap_entry* entry = &map->entries[i];
+        const void*           bytes;
+        size_t                key_length;
+        size_t                value_length;
+        uint64_t              hash;
+        size_t                slot;
+
+        if (!entry->alive) {
+            continue;
+        }
+
+        key_length   = encode_key(&entry->key, &bytes);
+        hashes[n]    = hash_bytes_seeded(bytes, key_length, header.seed);
+        value_length = encode_value(&entry->value, &bytes);
+        blob_size += align_up(key_length + 1) + align_up(value_length + 1);
+
+        hash = hashmap_mix64(hashes[n]);
+        slot = (hash >> 7) & (capacity - 1);
+
+        while (ctrl[slot] != HASHMAP_CTRL_EMPTY) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+
+        ctrl[slot] = hashmap_hash_tag(hash);
+        if (slot < CTRL_PADDING) {
+            ctrl[capacity + slot] = ctrl[slot];
+        }
+
+        if (header.slot_width == 4) {
+            ((uint32_t*)slots)[slot] = n;
+        }
+        else {
+            ((uint64_t*)slots)[slot] = n;
+        }
+
+        n++;
+    }
+
+    header.ctrl_offset    = align_up(sizeof(header));
+    header.slots_offset   = align_up(header.ctrl_offset + capacity
+                                     + CTRL_PADDING);
+    header.records_offset = align_up(header.slots_offset
+                                     + capacity * header.slot_width);
+    header.blob_offset    = header.records_offset
+                         + n * sizeof(struct frozen_hashmap_record);
+    header.size           = header.blob_offset + blob_size;
+
+    if (!write_padded(stream, &header, sizeof(header), header.ctrl_offset)
+        || !write_padded(stream,
+                         ctrl,
+                         capacity + CTRL_PADDING,
+                         header.slots_offset - header.ctrl_offset)
+        || !write_padded(stream,
+                         slots,
+                         capacity * header.slot_width,
+                         header.records_offset - header.slots_offset)) {
+        EBUF_PUSH("failed to write frozen hashmap", map);
+        goto out;
+    }
+
+    /* Records lay the blob out in the same order as it is written */
+    n = 0;
+    for (size_t i = 0; i < map->entries_length; i++) {
+        struct hashmap_entry*        entry = &map->entries[i];
+        struct frozen_hashmap_record record;
+        const void*                  bytes;
+
+        if (!entry->alive) {
+            continue;
+        }
+
+        record.hash         = hashes[n++];
+        record.key_offset   = offset;
+        record.key_length   = encode_key(&entry->key, &bytes);
+        record.value_offset = offset + align_up(record.key_length + 1);
+        record.value_length = encode_value(&entry->value, &bytes);
+        offset = record.value_offset + align_up(record.value_length + 1);
+
+        if (fwrite(&record, sizeof(record), 1, stream) != 1) {
+            EBUF_PUSH("failed to write frozen hashmap", map);
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < map->entries_length; i++) {
+        struct hashmap_entry* entry = &map->entries[i];
+        const void*           bytes;
+        size_t                length;
+
+        if (!entry->alive) {
+            continue;
+        }
+
+        length = encode_key(&entry->key, &bytes);
+        if (!write_padded(stream, bytes, length, align_up(length + 1))) {
+            EBUF_PUSH("failed to write frozen hashmap", map);
+            goto out;
+        }
+
+        length = encode_value(&entry->value, &bytes);
+        if (!write_padded(stream, bytes, length, align_up(length + 1))) {
+            EBUF_PUSH("failed to write frozen hashmap", map);
+            goto out;
+        }
+    }
+
+    ok = 1;
+
+out:
+    free(ctrl);
+    free(slots);
+    free(hashes);
+
+    return ok;
+}
+
+/* Checks that a section of `length` bytes at `offset` lies within the
+ * image, without overflowing */
+static int
+section_fits(uint64_t offset, uint64_t length, uint64_t size)
+{
+    return offset % ALIGNMENT == 0 && offset <= size
+           && length <= size - offset;
+}
+
+int
+frozen_hashmap_init(struct frozen_hashmap* map,
+                    const void*            data,
+                    size_t                 size)
+{
+    const struct frozen_hashmap_header* header = data;
+    uint64_t                            capacity;
+
+    map->base   = data;
+    map->size   = size;
+    map->mapped = 0;
+    map->header = header;
+
+    if (size < sizeof(*header)
+        || memcmp(header->magic, FROZEN_HASHMAP_MAGIC, sizeof(header->magic))
+               != 0) {
+        EBUF_PUSH("not a frozen hashmap image", map);
+        return 0;
+    }
+
+    if (header->version != FROZEN_HASHMAP_VERSION
+        || header->byte_order != FROZEN_HASHMAP_BYTE_ORDER) {
+        EBUF_PUSH("unsupported frozen hashmap version or byte order", map);
+        return 0;
+    }
+
+    capacity = header->capacity;
+
+    if (header->size > size || capacity > header->size
+        || capacity < MIN_CAPACITY
+        || (capacity & (capacity - 1)) != 0
+        || header->n_entries > hashmap_max_load(capacity)
+        || (header->slot_width != 4 && header->slot_width != 8)
+        || !section_fits(header->ctrl_offset,
+                         capacity + CTRL_PADDING,
+                         header->size)
+        || !section_fits(header->slots_offset,
+                         capacity * header->slot_width,
+                         header->size)
+        || !section_fits(header->records_offset,
+                         header->n_entries
+                             * sizeof(struct frozen_hashmap_record),
+                         header->size)
+        || !section_fits(header->blob_offset, 0, header->size)) {
+        EBUF_PUSH("corrupt frozen hashmap image", map);
+        return 0;
+    }
+
+    map->ctrl    = map->base + header->ctrl_offset;
+    map->slots   = map->base + header->slots_offset;
+    map->records = (const void*)(map->base + header->records_offset);
+    map->blob    = map->base + header->blob_offset;
+
+    return 1;
+}
+
+int
+frozen_hashmap_open(struct frozen_hashmap* map, const char* path)
+{
+    struct stat st;
+    void*       data;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        EBUF_PUSH("failed to open frozen hashmap image", map);
+        return 0;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        EBUF_PUSH("failed to stat frozen hashmap image", map);
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        EBUF_PUSH("failed to map frozen hashmap image", map);
+        return 0;
+    }
+
+    if (!frozen_hashmap_init(map, data, st.st_size)) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    map->mapped = 1;
+
+    return 1;
+}
+
+void
+frozen_hashmap_close(struct frozen_hashmap* map)
+{
+    if (map->mapped) {
+        munmap((void*)map->base, map->size);
+    }
+
+    map->base   = NULL;
+    map->size   = 0;
+    map->mapped = 0;
+}
+
+static void
+get_entry(const struct frozen_hashmap*        map,
+          const struct frozen_hashmap_record* record,
+          struct frozen_hashmap_entry*        entry)
+{
+    entry->key          = map->blob + record->key_offset;
+    entry->key_length   = record->key_length;
+    entry->value        = map->blob + record->value_offset;
+    entry->value_length = record->value_length;
+}
+
+int
+frozen_hashmap_get(const struct frozen_hashmap* map,
+                   const void*                  key,
+                   size_t                       key_length,
+                   struct frozen_hashmap_entry* entry)
+{
+    const uint64_t capacity = map->header->capacity;
+    const uint64_t key_hash
+        = hash_bytes_seeded(key, key_length, map->header->seed);
+    const uint64_t hash = hashmap_mix64(key_hash);
+    const uint8_t  tag  = hashmap_hash_tag(hash);
+    size_t         pos  = (hash >> 7) & (capacity - 1);
+
+    for (size_t probed = 0; probed < capacity;
+         probed += HASHMAP_GROUP_WIDTH) {
+        hashmap_group      g = hashmap_group_load(map->ctrl + pos);
+        hashmap_group_mask m = hashmap_group_match(g, tag);
+
+        while (m) {
+            size_t slot = (pos + hashmap_mask_first(m)) & (capacity - 1);
+            const struct frozen_hashmap_record* record
+                = &map->records[get_slot(map, slot)];
+
+            if (record->hash == key_hash && record->key_length == key_length
+                && memcmp(map->blob + record->key_offset, key, key_length)
+                       == 0) {
+                get_entry(map, record, entry);
+                return 1;
+            }
+
+            m = hashmap_mask_next(m);
+        }
+
+        if (hashmap_group_match_empty(g)) {
+            break;
+        }
+
+        pos = (pos + HASHMAP_GROUP_WIDTH) & (capacity - 1);
+    }
+
+    return 0;
+}
+
+struct frozen_hashmap_iter
+frozen_hashmap_iter(const struct frozen_hashmap* map)
+{
+    struct frozen_hashmap_iter iter = {
+        .map   = map,
+        .index = -1,
+    };
+
+    return iter;
+}
+
+int
+frozen_hashmap_iter_next(struct frozen_hashmap_iter* iter)
+{
+    if ((uint64_t)(iter->index + 1) >= iter->map->header->n_entries) {
+        iter->index = iter->map->header->n_entries;
+        return 0;
+    }
+
+    iter->index++;
+    return 1;
+}
+
+int
+frozen_hashmap_iter_get(struct frozen_hashmap_iter*  iter,
+                        struct frozen_hashmap_entry* entry)
+{
+    const struct frozen_hashmap* map = iter->map;
+
+    if (iter->index < 0 || (uint64_t)iter->index >= map->header->n_entries) {
+        return 0;
+    }
+
+    get_entry(map, &map->records[iter->index], entry);
+    return 1;
+}
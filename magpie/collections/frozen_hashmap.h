@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_FROZEN_HASHMAP_H
+#define MAGPIE_FROZEN_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <magpie/collections/hashmap.h>
+
+#define FROZEN_HASHMAP_MAGIC      "MPFROZEN"
+#define FROZEN_HASHMAP_VERSION    1
+#define FROZEN_HASHMAP_BYTE_ORDER 0x01020304
+
+/**
+ * The header at the start of a frozen hashmap image.
+ *
+ * An image is a single relocatable block containing no pointers: every
+ * section is located by its offset from the start of the image, and is
+ * aligned to 8 bytes. Integers are stored in the byte order of the
+ * machine which wrote the image, recorded in `byte_order`.
+ *
+ * - `magic` :: `FROZEN_HASHMAP_MAGIC`
+ * - `version` :: `FROZEN_HASHMAP_VERSION`
+ * - `byte_order` :: `FROZEN_HASHMAP_BYTE_ORDER` in native byte order
+ * - `seed` :: Seed used to hash the keys (see `hash_bytes_seeded()`)
+ * - `n_entries` :: Number of entries
+ * - `capacity` :: Number of slots in the table, a power of two
+ * - `slot_width` :: Size of each slot's record index, 4 or 8 bytes
+ * - `ctrl_offset` :: Control bytes, `capacity` plus 15 mirrored bytes
+ * - `slots_offset` :: Record indices, one per slot
+ * - `records_offset` :: Records, one per entry, in insertion order
+ * - `blob_offset` :: Key and value bytes
+ * - `size` :: Total size of the image in bytes
+ */
+struct frozen_hashmap_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t seed;
+    uint64_t n_entries;
+    uint64_t capacity;
+    uint64_t slot_width;
+    uint64_t ctrl_offset;
+    uint64_t slots_offset;
+    uint64_t records_offset;
+    uint64_t blob_offset;
+    uint64_t size;
+};
+
+/**
+ * Describes one entry of a frozen hashmap. Offsets are relative to
+ * the start of the blob section. Every key and value in the blob is
+ * followed by at least one NUL byte, so string data can be used in
+ * place.
+ */
+struct frozen_hashmap_record {
+    uint64_t hash;
+    uint64_t key_offset;
+    uint64_t key_length;
+    uint64_t value_offset;
+    uint64_t value_length;
+};
+
+/**
+ * A read-only hashmap backed by a frozen image, either mapped from a
+ * file with `frozen_hashmap_open()` or already in memory.
+ *
+ * Nothing is copied or rebuilt when an image is opened: lookups probe
+ * the image's table directly, so opening takes constant time and a
+ * mapped image's pages are shared by every process which maps it.
+ *
+ * - `base` :: Start of the image
+ * - `size` :: Size of the image in bytes
+ * - `mapped` :: Whether `base` was mapped by `frozen_hashmap_open()`
+ * - `header` :: The image's header
+ * - `ctrl` :: Control bytes
+ * - `slots` :: Record indices
+ * - `records` :: Entry records
+ * - `blob` :: Key and value bytes
+ */
+struct frozen_hashmap {
+    const uint8_t*                      base;
+    size_t                              size;
+    int                                 mapped;
+    const struct frozen_hashmap_header* header;
+    const uint8_t*                      ctrl;
+    const void*                         slots;
+    const struct frozen_hashmap_record* records;
+    const uint8_t*                      blob;
+};
+
+/**
+ * An entry of a frozen hashmap. The pointers refer into the image.
+ */
+struct frozen_hashmap_entry {
+    const void* key;
+    size_t      key_length;
+    const void* value;
+    size_t      value_length;
+};
+
+struct frozen_hashmap_iter {
+    const struct frozen_hashmap* map;
+    ssize_t                      index;
+};
+
+/**
+ * Encoder for NUL-terminated string keys or values: `item` points to a
+ * `char*`, and the encoding is the string's bytes without the NUL.
+ */
+size_t frozen_hashmap_encode_str(const void* item, const void** bytes);
+
+/**
+ * Encoder for keys or values which are plain integers or pointers
+ * stored in a `void*`: the encoding is the bytes of the `void*`
+ * itself.
+ */
+size_t frozen_hashmap_encode_ptr(const void* item, const void** bytes);
+
+/**
+ * Writes a frozen image of `map` to `stream`.
+ *
+ * Keys and values are opaque to a hashmap, so each is converted to a
+ * run of bytes by an encoder. An encoder is passed a pointer to the
+ * key or value (as the hash function is), sets `*bytes` to its
+ * encoding and returns the encoding's length; it must give the same
+ * result every time it is called on the same item. Encoded keys are
+ * rehashed with `hash_bytes()`, using the seed currently set by
+ * `hash_seed()`, which is recorded in the image. Entries keep their
+ * insertion order.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `stream` :: Stream to write the image to.
+ * @param `encode_key` :: Encoder for keys.
+ * @param `encode_value` :: Encoder for values.
+ * @return 0 on error.
+ */
+int hashmap_freeze(struct hashmap* map,
+                   FILE*           stream,
+                   size_t (*encode_key)(const void*, const void**),
+                   size_t (*encode_value)(const void*, const void**));
+
+/**
+ * Maps the frozen image in the file at `path` read-only.
+ *
+ * The header and section bounds are validated, but records are
+ * trusted, so images should only be loaded from trusted sources.
+ *
+ * @param `map` :: Pointer to the frozen hashmap.
+ * @param `path` :: Path to the image.
+ * @return 0 on error.
+ */
+int frozen_hashmap_open(struct frozen_hashmap* map, const char* path);
+
+/**
+ * Initializes a frozen hashmap from an image already in memory, which
+ * must be aligned to 8 bytes and outlive the map.
+ *
+ * @param `map` :: Pointer to the frozen hashmap.
+ * @param `data` :: The image.
+ * @param `size` :: Size of the image in bytes.
+ * @return 0 on error.
+ */
+int frozen_hashmap_init(struct frozen_hashmap* map,
+                        const void*            data,
+                        size_t                 size);
+
+/**
+ * Unmaps the image if it was opened with `frozen_hashmap_open()`.
+ */
+void frozen_hashmap_close(struct frozen_hashmap* map);
+
+/**
+ * Looks up the entry whose encoded key is the `key_length` bytes at
+ * `key`.
+ *
+ * @param `map` :: Pointer to the frozen hashmap.
+ * @param `key` :: Encoded key.
+ * @param `key_length` :: Length of the encoded key.
+ * @param `entry` :: Filled in with the entry, if found.
+ * @return 0 if there is no entry for `key`.
+ */
+int frozen_hashmap_get(const struct frozen_hashmap* map,
+                       const void*                  key,
+                       size_t                       key_length,
+                       struct frozen_hashmap_entry* entry);
+
+struct frozen_hashmap_iter
+frozen_hashmap_iter(const struct frozen_hashmap* map);
+
+int frozen_hashmap_iter_next(struct frozen_hashmap_iter* iter);
+
+int frozen_hashmap_iter_get(struct frozen_hashmap_iter*  iter,
+                            struct frozen_hashmap_entry* entry);
+
+#endif /* MAGPIE_FROZEN_HASHMAP_H */
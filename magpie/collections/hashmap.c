@@ -19,252 +19,1700 @@
  * IN THE SOFTWARE.
  */
 
-#include "collections/array.h"
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAGPIE_INTERNAL 1
 #include <magpie/collections/hashmap.h>
-#include <magpie/collections/list.h>
+#include <magpie/collections/hashmap_group.h>
 #include <magpie/ebuf.h>
 #include <magpie/math/prime.h>
 
+/* hashmap_set_many() hashes keys this many at a time, and prefetches
+ * the slots for the key this far ahead of the one being inserted */
+#define BATCH_SIZE        256
+#define PREFETCH_DISTANCE 8
+
+/* hashmap_get_many() keeps this many lookups in flight at once */
+#define LOOKUP_BATCH_SIZE 32
+
+/* hashmap_build_parallel() gives each thread at least this many keys,
+ * and splits the table into about this many regions per thread, none
+ * smaller than BUILD_MIN_REGION slots, so partitions balance out and
+ * few probes run off the end of a region */
+#define BUILD_MIN_KEYS_PER_THREAD   16384
+#define BUILD_PARTITIONS_PER_THREAD 4
+#define BUILD_MIN_REGION            4096
+
+#if MAGPIE_HASHMAP_SMALL_CAPACITY > 16
+#    error "MAGPIE_HASHMAP_SMALL_CAPACITY must be at most 16"
+#endif
+
+/* Results of probe_first() which aren't pool indices */
+#define PROBE_MISS    SIZE_MAX
+#define PROBE_UNKNOWN (SIZE_MAX - 1)
+
+/* Operation counters are compiled out unless MAGPIE_HASHMAP_STATS is
+ * set. The disabled form still evaluates its argument (which must not
+ * have side effects) so that variables used only for counting don't
+ * trigger unused warnings. */
+#if MAGPIE_HASHMAP_STATS
+#    define STATS_COUNT(map, counter, n) ((map)->counters.counter += (n))
+#    define STATS_CLOCK()                stats_clock()
+#else
+#    define STATS_COUNT(map, counter, n) ((void)(n))
+#    define STATS_CLOCK()                0
+#endif
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+#if MAGPIE_HASHMAP_STATS
+static uint64_t
+stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static inline size_t
+ctrl_bytes(size_t capacity)
+{
+    return capacity + HASHMAP_GROUP_WIDTH - 1;
+}
+
+static size_t
+capacity_for(enum hashmap_index index, size_t buckets)
+{
+    size_t capacity = HASHMAP_GROUP_WIDTH;
+
+    switch (index) {
+        case HASHMAP_INDEX_FASTRANGE:
+            capacity = buckets > capacity ? buckets : capacity;
+            break;
+
+        case HASHMAP_INDEX_PRIME:
+            capacity = prime_at_least(buckets > capacity ? buckets : capacity);
+            break;
+
+        default:
+            while (capacity < buckets) {
+                capacity *= 2;
+            }
+            break;
+    }
+
+    return capacity;
+}
+
+/* The smallest capacity whose load threshold allows `n_entries` */
+static size_t
+capacity_for_entries(enum hashmap_index index, size_t n_entries)
+{
+    size_t capacity
+        = capacity_for(index, n_entries / MAGPIE_HASHMAP_LOAD_THRESHOLD);
+
+    while (hashmap_max_load(capacity) < n_entries) {
+        capacity = capacity_for(index, capacity + 1);
+    }
+
+    return capacity;
+}
+
+/* Multiplier for fastmod32(); 0 if the capacity is too large for it */
+static uint64_t
+prime_magic(size_t capacity)
+{
+#if defined(__SIZEOF_INT128__)
+    if (capacity <= UINT32_MAX) {
+        return UINT64_MAX / capacity + 1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * x % d without a division, given magic = ceil(2^64 / d). See Lemire,
+ * Kaser & Kurz, "Faster Remainder by Direct Computation" (2019).
+ */
+static inline size_t
+fastmod32(uint32_t x, uint64_t magic, size_t d)
+{
+#if defined(__SIZEOF_INT128__)
+    if (magic != 0) {
+        return ((uint128)(magic * x) * d) >> 64;
+    }
+#endif
+
+    return x % d;
+}
+
+static inline size_t
+fastrange(uint64_t x, size_t range)
+{
+#if defined(__SIZEOF_INT128__)
+    return ((uint128)x * range) >> 64;
+#else
+    return ((x >> 32) * range) >> 32;
+#endif
+}
+
+/* The hash the table actually indexes by; entries store the original */
+static inline uint64_t
+table_hash(const struct hashmap_table* table, uint64_t key_hash)
+{
+    return table->index == HASHMAP_INDEX_MASK ? hashmap_mix64(key_hash)
+                                              : key_hash;
+}
+
+static inline size_t
+probe_start(const struct hashmap_table* table, uint64_t hash)
+{
+    switch (table->index) {
+        case HASHMAP_INDEX_FASTRANGE: return fastrange(hash, table->capacity);
+
+        case HASHMAP_INDEX_PRIME:
+            return fastmod32(hash >> 7, table->index_magic, table->capacity);
+
+        default: return (hash >> 7) & (table->capacity - 1);
+    }
+}
+
+static inline size_t
+probe_next(struct hashmap_table* table, size_t pos)
+{
+    pos += HASHMAP_GROUP_WIDTH;
+    return pos >= table->capacity ? pos - table->capacity : pos;
+}
+
+static inline size_t
+slot_index(struct hashmap_table* table, size_t pos, size_t offset)
+{
+    size_t slot = pos + offset;
+    return slot >= table->capacity ? slot - table->capacity : slot;
+}
+
+static inline size_t
+get_slot(const struct hashmap_table* table, size_t slot)
+{
+    switch (table->slot_width) {
+        case 1: return ((const uint8_t*)table->slots)[slot];
+        case 2: return ((const uint16_t*)table->slots)[slot];
+        case 4: return ((const uint32_t*)table->slots)[slot];
+        default: return ((const uint64_t*)table->slots)[slot];
+    }
+}
+
+static inline void
+set_slot(struct hashmap_table* table, size_t slot, size_t index)
+{
+    switch (table->slot_width) {
+        case 1: ((uint8_t*)table->slots)[slot] = index; break;
+        case 2: ((uint16_t*)table->slots)[slot] = index; break;
+        case 4: ((uint32_t*)table->slots)[slot] = index; break;
+        default: ((uint64_t*)table->slots)[slot] = index; break;
+    }
+}
+
+/* The narrowest index able to address `n_entries` pool entries */
+static size_t
+slot_width_for(size_t n_entries)
+{
+    if (n_entries <= (size_t)UINT8_MAX + 1) {
+        return 1;
+    }
+
+    if (n_entries <= (size_t)UINT16_MAX + 1) {
+        return 2;
+    }
+
+    if (n_entries <= (size_t)UINT32_MAX + 1) {
+        return 4;
+    }
+
+    return 8;
+}
+
+static inline void
+set_ctrl(struct hashmap_table* table, size_t slot, uint8_t ctrl)
+{
+    hashmap_ctrl_set(table->ctrl, table->capacity, slot, ctrl);
+}
+
+/* Finds the slot indexing the entry for `key`. If `free_slot` isn't
+ * NULL, it is set to the slot find_free_slot() would pick for the key,
+ * if the probe passes one, so a miss can be followed by an insertion
+ * without probing the table again. */
+static ssize_t
+table_find(struct hashmap*       map,
+           struct hashmap_table* table,
+           void*                 key,
+           uint64_t              key_hash,
+           ssize_t*              free_slot)
+{
+    const uint64_t hash = table_hash(table, key_hash);
+    const uint8_t  tag  = hashmap_hash_tag(hash);
+    size_t         pos  = probe_start(table, hash);
+
+    for (size_t probed = 0; probed < table->capacity;
+         probed += HASHMAP_GROUP_WIDTH) {
+        hashmap_group      g = hashmap_group_load(table->ctrl + pos);
+        hashmap_group_mask m = hashmap_group_match(g, tag);
+
+        STATS_COUNT(map, n_probes, 1);
+
+        if (free_slot != NULL && *free_slot < 0) {
+            hashmap_group_mask f = hashmap_group_match_free(g);
+
+            if (f) {
+                *free_slot = slot_index(table, pos, hashmap_mask_first(f));
+            }
+        }
+
+        while (m) {
+            size_t slot  = slot_index(table, pos, hashmap_mask_first(m));
+            size_t index = get_slot(table, slot);
+            struct hashmap_entry* entry = &map->entries[index];
+
+            if (entry->hash == key_hash) {
+                STATS_COUNT(map, n_compares, 1);
+
+                if (map->compare(&entry->key, &key) == 0) {
+                    return slot;
+                }
+            }
+
+            m = hashmap_mask_next(m);
+        }
+
+        if (hashmap_group_match_empty(g)) {
+            break;
+        }
+
+        pos = probe_next(table, pos);
+    }
+
+    return -1;
+}
+
+static size_t
+find_free_slot(struct hashmap_table* table, uint64_t hash)
+{
+    size_t pos = probe_start(table, hash);
+
+    /* hashmap_max_load() guarantees there is always a free slot */
+    for (;;) {
+        hashmap_group      g = hashmap_group_load(table->ctrl + pos);
+        hashmap_group_mask m = hashmap_group_match_free(g);
+
+        if (m) {
+            return slot_index(table, pos, hashmap_mask_first(m));
+        }
+
+        pos = probe_next(table, pos);
+    }
+}
+
+static int
+table_alloc(struct hashmap_table* table,
+            enum hashmap_index    index,
+            size_t                capacity)
+{
+    size_t   width = slot_width_for(hashmap_max_load(capacity));
+    uint8_t* ctrl  = malloc(ctrl_bytes(capacity));
+    void*    slots = malloc(width * capacity);
+
+    if (ctrl == NULL || slots == NULL) {
+        EBUF_PUSH("failed to allocate hashmap table", table);
+        free(ctrl);
+        free(slots);
+        return 0;
+    }
+
+    memset(ctrl, HASHMAP_CTRL_EMPTY, ctrl_bytes(capacity));
+
+    table->ctrl         = ctrl;
+    table->slots        = slots;
+    table->slot_width   = width;
+    table->capacity     = capacity;
+    table->index        = index;
+    table->index_magic  = index == HASHMAP_INDEX_PRIME ? prime_magic(capacity)
+                                                       : 0;
+    table->n_entries    = 0;
+    table->n_tombstones = 0;
+
+    return 1;
+}
+
+static void
+table_free(struct hashmap_table* table)
+{
+    free(table->ctrl);
+    free(table->slots);
+
+    table->ctrl      = NULL;
+    table->slots     = NULL;
+    table->capacity  = 0;
+    table->n_entries = 0;
+}
+
+/* Indexes the entry at `index` in the pool, which is known not to be
+ * in the table already. A table never indexes more distinct pool
+ * entries than hashmap_max_load() allows, so there is always a free slot. */
+static void
+table_place_at(struct hashmap_table* table,
+               size_t                slot,
+               size_t                index,
+               uint64_t              key_hash)
+{
+    if (table->ctrl[slot] == HASHMAP_CTRL_DELETED) {
+        table->n_tombstones--;
+    }
+
+    set_ctrl(table, slot, hashmap_hash_tag(table_hash(table, key_hash)));
+    set_slot(table, slot, index);
+    table->n_entries++;
+}
+
+static void
+table_place(struct hashmap_table* table, size_t index, uint64_t key_hash)
+{
+    size_t slot = find_free_slot(table, table_hash(table, key_hash));
+    table_place_at(table, slot, index, key_hash);
+}
+
+static void
+table_erase(struct hashmap_table* table, size_t slot)
+{
+    if (hashmap_ctrl_can_empty(table->ctrl, table->capacity, slot)) {
+        set_ctrl(table, slot, HASHMAP_CTRL_EMPTY);
+    }
+    else {
+        set_ctrl(table, slot, HASHMAP_CTRL_DELETED);
+        table->n_tombstones++;
+    }
+
+    table->n_entries--;
+}
+
+static inline int
+is_migrating(struct hashmap* map)
+{
+    return map->old.capacity != 0;
+}
+
+static inline int
+is_small(const struct hashmap* map)
+{
+    return map->table.capacity == 0;
+}
+
+static inline uint8_t
+small_tag(const struct hashmap* map, uint64_t key_hash)
+{
+    return hashmap_hash_tag(table_hash(&map->table, key_hash));
+}
+
+/* Finds the pool index of the entry for `key` in a small map. Only
+ * live entries have tags, so every match is a live entry. */
+static ssize_t
+small_find(struct hashmap* map, void* key, uint64_t key_hash)
+{
+    const uint8_t tag = small_tag(map, key_hash);
+
+    STATS_COUNT(map, n_lookups, 1);
+
+    for (size_t base = 0; base < MAGPIE_HASHMAP_SMALL_CAPACITY;
+         base += HASHMAP_GROUP_WIDTH) {
+        hashmap_group      g = hashmap_group_load(map->small_tags + base);
+        hashmap_group_mask m = hashmap_group_match(g, tag);
+
+        STATS_COUNT(map, n_probes, 1);
+
+        while (m) {
+            size_t                index = base + hashmap_mask_first(m);
+            struct hashmap_entry* entry = &map->entries[index];
+
+            if (entry->hash == key_hash) {
+                STATS_COUNT(map, n_compares, 1);
+
+                if (map->compare(&entry->key, &key) == 0) {
+                    return index;
+                }
+            }
+
+            m = hashmap_mask_next(m);
+        }
+    }
+
+    return -1;
+}
+
+/* Resizes the entry pool. Shrinking it never fails; if the allocator
+ * can't shrink the block the excess is simply left unused. */
+static int
+resize_entries(struct hashmap* map, size_t capacity)
+{
+    struct hashmap_entry* entries;
+
+    entries = realloc(map->entries, sizeof(*entries) * capacity);
+
+    if (entries == NULL) {
+        if (capacity > map->entries_capacity) {
+            EBUF_PUSH("failed to allocate hashmap entry pool", map);
+            return 0;
+        }
+
+        entries = map->entries;
+    }
+
+    map->entries          = entries;
+    map->entries_capacity = capacity;
+
+    return 1;
+}
+
+/* Squeezes the holes out of the pool, preserving insertion order */
+static void
+compact_entries(struct hashmap* map)
+{
+    size_t length = 0;
+
+    if (map->entries_length == map->n_entries) {
+        return;
+    }
+
+    for (size_t i = 0; i < map->entries_length; i++) {
+        if (map->entries[i].alive) {
+            map->entries[length++] = map->entries[i];
+        }
+    }
+
+    map->entries_length = length;
+}
+
+/* Compacts the pool of a small map and retags it */
+static void
+small_compact(struct hashmap* map)
+{
+    compact_entries(map);
+
+    memset(map->small_tags, HASHMAP_CTRL_EMPTY, sizeof(map->small_tags));
+    for (size_t i = 0; i < map->entries_length; i++) {
+        map->small_tags[i] = small_tag(map, map->entries[i].hash);
+    }
+}
+
+/* Drops the table(s) of a map whose entries fit in a small pool */
+static int
+make_small(struct hashmap* map)
+{
+    compact_entries(map);
+
+    if (map->entries_capacity < MAGPIE_HASHMAP_SMALL_CAPACITY
+        && !resize_entries(map, MAGPIE_HASHMAP_SMALL_CAPACITY)) {
+        return 0;
+    }
+
+    table_free(&map->table);
+    if (is_migrating(map)) {
+        table_free(&map->old);
+        map->migrate_pos = 0;
+    }
+
+    resize_entries(map, MAGPIE_HASHMAP_SMALL_CAPACITY);
+    small_compact(map);
+
+    return 1;
+}
+
+/* Replaces the map's table (and any table being migrated) with a new
+ * one indexing every entry in the compacted pool */
+static int
+table_rebuild(struct hashmap* map, enum hashmap_index index, size_t capacity)
+{
+    struct hashmap_table old              = map->table;
+    size_t               entries_capacity = map->entries_capacity;
+    size_t               n_entries        = hashmap_max_load(capacity);
+    uint64_t             start            = STATS_CLOCK();
+
+    if (n_entries > entries_capacity && !resize_entries(map, n_entries)) {
+        return 0;
+    }
+
+    if (!table_alloc(&map->table, index, capacity)) {
+        map->table = old;
+        resize_entries(map, entries_capacity);
+        return 0;
+    }
+
+    compact_entries(map);
+
+    /* A sequential sweep over the pool finds every live entry; the old
+     * table isn't consulted at all. Keys are known to be unique, so
+     * there is no need to compare them. */
+    for (size_t i = 0; i < map->entries_length; i++) {
+        table_place(&map->table, i, map->entries[i].hash);
+    }
+
+    table_free(&old);
+
+    if (is_migrating(map)) {
+        table_free(&map->old);
+        map->migrate_pos = 0;
+    }
+
+    if (n_entries < map->entries_capacity) {
+        resize_entries(map, n_entries);
+    }
+
+    map->counters.n_rehashes++;
+    STATS_COUNT(map, rehash_ns, STATS_CLOCK() - start);
+
+    return 1;
+}
+
 static size_t
-initial_buckets(void)
+grown_capacity(struct hashmap* map)
+{
+    struct hashmap_table* table = &map->table;
+
+    /* If most of the pool is holes, compacting it at the same capacity
+     * is enough to make room */
+    if (map->n_entries <= hashmap_max_load(table->capacity) / 2) {
+        return table->capacity;
+    }
+
+    return capacity_for(table->index, table->capacity * 2);
+}
+
+static void
+migrate(struct hashmap* map, size_t n_slots)
+{
+    struct hashmap_table* old   = &map->old;
+    size_t                end   = map->migrate_pos + n_slots;
+    uint64_t              start = STATS_CLOCK();
+
+    if (end > old->capacity) {
+        end = old->capacity;
+    }
+
+    for (size_t i = map->migrate_pos; i < end && old->n_entries > 0; i++) {
+        if (hashmap_ctrl_is_full(old->ctrl[i])) {
+            size_t index = get_slot(old, i);
+            table_place(&map->table, index, map->entries[index].hash);
+
+            /* Leave a tombstone so probes in the old table for keys
+             * which haven't been migrated yet still get past it */
+            set_ctrl(old, i, HASHMAP_CTRL_DELETED);
+            old->n_entries--;
+        }
+    }
+
+    map->migrate_pos = end;
+
+    if (map->migrate_pos >= old->capacity || old->n_entries == 0) {
+        table_free(old);
+        map->migrate_pos = 0;
+    }
+
+    STATS_COUNT(map, rehash_ns, STATS_CLOCK() - start);
+}
+
+static void
+migrate_step(struct hashmap* map)
+{
+    size_t headroom;
+    size_t step;
+
+    if (!is_migrating(map)) {
+        return;
+    }
+
+    /* Migrate at least enough slots per operation that the old table
+     * is drained before the pool fills up, even if every operation from
+     * here on is an insertion. */
+    headroom = map->entries_capacity > map->entries_length
+                   ? map->entries_capacity - map->entries_length
+                   : 1;
+    step = (map->old.capacity - map->migrate_pos + headroom - 1) / headroom;
+
+    migrate(map, step > map->rehash_budget ? step : map->rehash_budget);
+}
+
+/* Rebuilds the table at a smaller capacity once the load has dropped
+ * below the shrink threshold. The new capacity leaves the remaining
+ * entries well below the load threshold, so that alternating removals
+ * and insertions near the boundary don't rebuild over and over. */
+static void
+maybe_shrink(struct hashmap* map)
+{
+    struct hashmap_table* table = &map->table;
+    size_t                minimum;
+    size_t                capacity;
+
+    if (map->shrink_threshold <= 0 || is_migrating(map)
+        || map->n_entries >= table->capacity * map->shrink_threshold) {
+        return;
+    }
+
+    minimum  = capacity_for(table->index, MAGPIE_HASHMAP_INITIAL_BUCKETS);
+    capacity = capacity_for_entries(table->index, map->n_entries * 2);
+    if (capacity < minimum) {
+        capacity = minimum;
+    }
+
+    /* Shrinking is an optimisation; if it fails the map is still
+     * perfectly usable at its current size */
+    if (capacity < table->capacity) {
+        table_rebuild(map, table->index, capacity);
+    }
+}
+
+/* Drops the table slots of entries which retain() marked dead */
+static void
+table_drop_dead(struct hashmap* map, struct hashmap_table* table)
+{
+    for (size_t i = 0; i < table->capacity && table->n_entries > 0; i++) {
+        if (hashmap_ctrl_is_full(table->ctrl[i])
+            && !map->entries[get_slot(table, i)].alive) {
+            table_erase(table, i);
+        }
+    }
+}
+
+/* Makes room in the pool of a small map: allocates it on the first
+ * insertion, squeezes out holes if there are any, and otherwise builds
+ * a table */
+static int
+small_make_room(struct hashmap* map)
+{
+    size_t capacity;
+
+    if (map->entries_capacity < MAGPIE_HASHMAP_SMALL_CAPACITY) {
+        return resize_entries(map, MAGPIE_HASHMAP_SMALL_CAPACITY);
+    }
+
+    if (map->n_entries < map->entries_length) {
+        small_compact(map);
+        return 1;
+    }
+
+    capacity = capacity_for_entries(map->table.index,
+                                    2 * MAGPIE_HASHMAP_SMALL_CAPACITY);
+
+    return table_rebuild(map, map->table.index, capacity);
+}
+
+static int
+make_room(struct hashmap* map)
+{
+    struct hashmap_table* table = &map->table;
+    size_t                capacity;
+
+    if (is_small(map)) {
+        return small_make_room(map);
+    }
+
+    capacity = grown_capacity(map);
+
+    /* Compacting the pool can't be spread out, since the old table
+     * refers to entries by position. migrate_step() paces migrations
+     * so that the pool shouldn't fill up before the old table is
+     * drained; if it somehow does, finish with a rebuild too. */
+    if (map->rehash_budget == 0 || is_migrating(map)
+        || capacity == table->capacity) {
+        return table_rebuild(map, table->index, capacity);
+    }
+
+    if (!resize_entries(map, hashmap_max_load(capacity))) {
+        return 0;
+    }
+
+    map->old = *table;
+    if (!table_alloc(table, map->old.index, capacity)) {
+        *table = map->old;
+        map->old.capacity = 0;
+        resize_entries(map, hashmap_max_load(table->capacity));
+        return 0;
+    }
+
+    map->migrate_pos = 0;
+    map->counters.n_rehashes++;
+    migrate_step(map);
+
+    return 1;
+}
+
+/* Appends a new entry to the pool and indexes it. `free_slot` is a
+ * free slot of the current table found while probing for the key, or
+ * -1 to look for one. */
+static struct hashmap_entry*
+insert(struct hashmap* map,
+       void*           key,
+       uint64_t        key_hash,
+       void*           value,
+       ssize_t         free_slot)
+{
+    struct hashmap_entry* entry;
+    size_t                index;
+
+    if (map->entries_length == map->entries_capacity) {
+        if (!make_room(map)) {
+            return NULL;
+        }
+
+        /* the table the slot was found in may have been replaced */
+        free_slot = -1;
+    }
+
+    index        = map->entries_length++;
+    entry        = &map->entries[index];
+    entry->key   = key;
+    entry->value = value;
+    entry->hash  = key_hash;
+    entry->alive = 1;
+
+    if (is_small(map)) {
+        map->small_tags[index] = small_tag(map, key_hash);
+    }
+    else if (free_slot >= 0) {
+        table_place_at(&map->table, free_slot, index, key_hash);
+    }
+    else {
+        table_place(&map->table, index, key_hash);
+    }
+
+    map->n_entries++;
+
+    return entry;
+}
+
+static ssize_t
+lookup_slot(struct hashmap*        map,
+            void*                  key,
+            uint64_t               key_hash,
+            struct hashmap_table** table,
+            ssize_t*               free_slot)
+{
+    ssize_t slot = table_find(map, &map->table, key, key_hash, free_slot);
+
+    STATS_COUNT(map, n_lookups, 1);
+    *table = &map->table;
+
+    if (slot < 0 && is_migrating(map)) {
+        slot   = table_find(map, &map->old, key, key_hash, NULL);
+        *table = &map->old;
+    }
+
+    return slot;
+}
+
+static struct hashmap_entry*
+lookup(struct hashmap* map, void* key, uint64_t key_hash)
 {
-    static size_t n = 0;
+    struct hashmap_table* table;
+    ssize_t               slot;
+
+    if (is_small(map)) {
+        slot = small_find(map, key, key_hash);
+        return slot < 0 ? NULL : &map->entries[slot];
+    }
+
+    slot = lookup_slot(map, key, key_hash, &table, NULL);
+
+    return slot < 0 ? NULL : &map->entries[get_slot(table, slot)];
+}
+
+/* Finds the entry for `key`, or inserts one with a NULL value, probing
+ * the table only once either way */
+static struct hashmap_entry*
+entry_or_insert(struct hashmap* map,
+                void*           key,
+                uint64_t        key_hash,
+                int*            inserted)
+{
+    struct hashmap_table* table;
+    struct hashmap_entry* entry;
+    ssize_t               free_slot = -1;
+    ssize_t               slot;
+
+    if (is_small(map)) {
+        slot = small_find(map, key, key_hash);
+
+        if (slot >= 0) {
+            *inserted = 0;
+            return &map->entries[slot];
+        }
+    }
+    else {
+        migrate_step(map);
+
+        slot = lookup_slot(map, key, key_hash, &table, &free_slot);
+
+        if (slot >= 0) {
+            *inserted = 0;
+            return &map->entries[get_slot(table, slot)];
+        }
+    }
+
+    entry = insert(map, key, key_hash, NULL, free_slot);
+
+    if (entry == NULL) {
+        EBUF_PUSH("failed to insert hashmap entry", map);
+        return NULL;
+    }
+
+    *inserted = 1;
+    return entry;
+}
+
+static int
+set(struct hashmap* map, void* key, uint64_t key_hash, void* value)
+{
+    int                   inserted;
+    struct hashmap_entry* entry
+        = entry_or_insert(map, key, key_hash, &inserted);
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    entry->value = value;
+    return 1;
+}
+
+/* Starts pulling in the first group a lookup for `key_hash` probes */
+static inline void
+prefetch_probe(struct hashmap* map, uint64_t key_hash)
+{
+    struct hashmap_table* table = &map->table;
+    size_t                pos;
+
+    if (is_small(map)) {
+        return;
+    }
+
+    pos = probe_start(table, table_hash(table, key_hash));
+
+    __builtin_prefetch(table->ctrl + pos);
+    __builtin_prefetch((char*)table->slots + pos * table->slot_width);
+}
+
+/* Matches `key_hash` against the first group it probes, which should
+ * already have been prefetched. Returns the pool index of the first
+ * candidate entry, PROBE_MISS if the group proves the key absent, or
+ * PROBE_UNKNOWN if it takes further probing to find out. */
+static size_t
+probe_first(struct hashmap* map, uint64_t key_hash)
+{
+    struct hashmap_table* table = &map->table;
+    uint64_t              hash  = table_hash(table, key_hash);
+    size_t                pos   = probe_start(table, hash);
+    uint8_t               tag   = hashmap_hash_tag(hash);
+    hashmap_group         g     = hashmap_group_load(table->ctrl + pos);
+    hashmap_group_mask    m     = hashmap_group_match(g, tag);
+
+    STATS_COUNT(map, n_probes, 1);
+
+    if (m) {
+        return get_slot(table, slot_index(table, pos, hashmap_mask_first(m)));
+    }
+
+    if (hashmap_group_match_empty(g) && !is_migrating(map)) {
+        return PROBE_MISS;
+    }
+
+    return PROBE_UNKNOWN;
+}
+
+int
+hashmap_init(struct hashmap* map,
+             uint64_t (*hash)(const void*),
+             int (*compare)(const void*, const void*))
+{
+    return hashmap_init_with_capacity(map, hash, compare, 0);
+}
+
+int
+hashmap_init_with_capacity(struct hashmap* map,
+                           uint64_t (*hash)(const void*),
+                           int (*compare)(const void*, const void*),
+                           size_t n_entries)
+{
+    size_t capacity;
+
+    map->table            = (struct hashmap_table){ 0 };
+    map->old.capacity     = 0;
+    map->migrate_pos      = 0;
+    map->rehash_budget    = MAGPIE_HASHMAP_REHASH_BUDGET;
+    map->shrink_threshold = MAGPIE_HASHMAP_SHRINK_THRESHOLD;
+    map->n_entries        = 0;
+    map->counters         = (struct hashmap_counters){ 0 };
+    map->hash             = hash;
+    map->compare          = compare;
+    map->entries          = NULL;
+    map->entries_length   = 0;
+    map->entries_capacity = 0;
+
+    memset(map->small_tags, HASHMAP_CTRL_EMPTY, sizeof(map->small_tags));
+
+    /* Small maps allocate their pool on the first insertion */
+    if (n_entries == 0) {
+        return 1;
+    }
+
+    if (n_entries <= MAGPIE_HASHMAP_SMALL_CAPACITY) {
+        return resize_entries(map, MAGPIE_HASHMAP_SMALL_CAPACITY);
+    }
+
+    capacity = capacity_for_entries(HASHMAP_INDEX_MASK, n_entries);
+    map->entries_capacity = hashmap_max_load(capacity);
+    map->entries = malloc(sizeof(*map->entries) * map->entries_capacity);
+
+    if (map->entries == NULL) {
+        EBUF_PUSH("failed to allocate hashmap entry pool", map);
+        return 0;
+    }
+
+    if (!table_alloc(&map->table, HASHMAP_INDEX_MASK, capacity)) {
+        free(map->entries);
+        map->entries          = NULL;
+        map->entries_capacity = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+hashmap_destroy(struct hashmap* map)
+{
+    table_free(&map->table);
+
+    if (is_migrating(map)) {
+        table_free(&map->old);
+    }
+
+    free(map->entries);
+    map->entries          = NULL;
+    map->entries_length   = 0;
+    map->entries_capacity = 0;
+    map->n_entries        = 0;
+
+    memset(map->small_tags, HASHMAP_CTRL_EMPTY, sizeof(map->small_tags));
+}
+
+void
+hashmap_set_rehash_budget(struct hashmap* map, size_t budget)
+{
+    map->rehash_budget = budget;
+
+    /* Without a budget there's no later operation to finish an
+     * outstanding migration, so do it now */
+    if (budget == 0 && is_migrating(map)) {
+        migrate(map, map->old.capacity);
+    }
+}
+
+void
+hashmap_set_shrink_threshold(struct hashmap* map, double threshold)
+{
+    map->shrink_threshold = threshold;
+}
+
+int
+hashmap_reserve(struct hashmap* map, size_t n_entries)
+{
+    size_t capacity;
+
+    if (n_entries <= map->n_entries) {
+        return 1;
+    }
+
+    if (is_small(map) && n_entries <= MAGPIE_HASHMAP_SMALL_CAPACITY) {
+        if (map->entries_capacity < MAGPIE_HASHMAP_SMALL_CAPACITY
+            && !resize_entries(map, MAGPIE_HASHMAP_SMALL_CAPACITY)) {
+            return 0;
+        }
+
+        if (map->entries_length + (n_entries - map->n_entries)
+            > MAGPIE_HASHMAP_SMALL_CAPACITY) {
+            small_compact(map);
+        }
+
+        return 1;
+    }
+
+    /* The new entries are appended after any holes in the pool */
+    if (map->entries_length + (n_entries - map->n_entries)
+        <= map->entries_capacity) {
+        return 1;
+    }
 
-    if (n == 0) {
-        n = next_prime(MAGPIE_HASHMAP_INITIAL_BUCKETS);
+    capacity = capacity_for_entries(map->table.index, n_entries);
+    if (capacity < map->table.capacity) {
+        capacity = map->table.capacity;
     }
 
-    return n;
+    return table_rebuild(map, map->table.index, capacity);
 }
 
-static inline size_t
-bucket_for_hash(struct hashmap* map, uint64_t key_hash)
+int
+hashmap_shrink_to_fit(struct hashmap* map)
 {
-    return key_hash % map->buckets.length;
+    enum hashmap_index index    = map->table.index;
+    size_t             capacity = capacity_for_entries(index, map->n_entries);
+
+    if (map->n_entries <= MAGPIE_HASHMAP_SMALL_CAPACITY) {
+        return make_small(map);
+    }
+
+    if (capacity >= map->table.capacity
+        && map->entries_capacity == hashmap_max_load(capacity)) {
+        return hashmap_compact(map);
+    }
+
+    return table_rebuild(map, index, capacity);
 }
 
-static struct hashmap_entry*
-lookup(struct hashmap* map, void* key, uint64_t key_hash)
+int
+hashmap_compact(struct hashmap* map)
 {
-    size_t bucket = bucket_for_hash(map, key_hash);
+    if (is_small(map)) {
+        small_compact(map);
+        return 1;
+    }
 
-    struct list*     head = map->buckets.elements[bucket];
-    struct list_iter it   = list_iter(head);
+    if (!is_migrating(map) && map->table.n_tombstones == 0
+        && map->entries_length == map->n_entries) {
+        return 1;
+    }
+
+    return table_rebuild(map, map->table.index, map->table.capacity);
+}
 
-    /* the head always contains NULL, skip it */
-    list_iter_next(&it);
+size_t
+hashmap_retain(struct hashmap* map,
+               int (*pred)(struct hashmap_entry* entry, void* ctx),
+               void* ctx)
+{
+    size_t removed = 0;
 
-    while (list_iter_next(&it)) {
-        struct list*          item  = list_iter_get(&it);
-        struct hashmap_entry* entry = item->data;
+    for (size_t i = 0; i < map->entries_length; i++) {
+        struct hashmap_entry* entry = &map->entries[i];
 
-        if (entry->hash == key_hash && map->compare(&entry->key, &key) == 0) {
-            return entry;
+        if (entry->alive && !pred(entry, ctx)) {
+            entry->alive = 0;
+            removed++;
         }
     }
 
-    return NULL;
+    if (removed == 0) {
+        return 0;
+    }
+
+    map->n_entries -= removed;
+
+    if (is_small(map)) {
+        small_compact(map);
+        return removed;
+    }
+
+    table_drop_dead(map, &map->table);
+    if (is_migrating(map)) {
+        table_drop_dead(map, &map->old);
+    }
+
+    maybe_shrink(map);
+
+    return removed;
 }
 
-static inline float
-load_factor(struct hashmap* map)
+int
+hashmap_set_index(struct hashmap* map, enum hashmap_index index)
 {
-    return ((float)map->n_entries) / ((float)map->buckets.length);
+    size_t capacity;
+
+    /* The strategy also decides how small maps derive their tags */
+    if (is_small(map)) {
+        map->table.index = index;
+        small_compact(map);
+        return 1;
+    }
+
+    capacity = capacity_for(index, map->table.capacity);
+    return table_rebuild(map, index, capacity);
 }
 
-static int
-insert(struct hashmap* map, void* key, uint64_t key_hash, void* value)
+void
+hashmap_set(struct hashmap* map, void* key, void* value)
+{
+    set(map, key, map->hash(&key), value);
+}
+
+void
+hashmap_set_prehashed(struct hashmap* map,
+                      void*           key,
+                      uint64_t        key_hash,
+                      void*           value)
 {
-    size_t bucket = bucket_for_hash(map, key_hash);
+    set(map, key, key_hash, value);
+}
 
-    struct hashmap_entry* entry = NULL;
-    struct list*          head  = map->buckets.elements[bucket];
-    struct list_iter      it    = list_iter(head);
+int
+hashmap_set_many(struct hashmap* map, void** keys, void** values, size_t n)
+{
+    uint64_t hashes[BATCH_SIZE];
 
-    /* skip the head */
-    list_iter_next(&it);
+    /* Reserving as though every key were new guarantees the table isn't
+     * rebuilt part way through, so prefetched slots stay put */
+    if (!hashmap_reserve(map, map->n_entries + n)) {
+        return 0;
+    }
 
-    /* Look for a tombstone to place the item in first */
-    while (list_iter_next(&it)) {
-        struct list*          l = list_iter_get(&it);
-        struct hashmap_entry* e = l->data;
+    for (size_t base = 0; base < n; base += BATCH_SIZE) {
+        size_t batch = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
 
-        if (!e->alive) {
-            entry = e;
-            break;
+        for (size_t i = 0; i < batch; i++) {
+            hashes[i] = map->hash(&keys[base + i]);
         }
-    }
 
-    if (entry == NULL) {
-        struct list* entry_item;
+        for (size_t i = 0; i < batch && i < PREFETCH_DISTANCE; i++) {
+            prefetch_probe(map, hashes[i]);
+        }
 
-        entry      = malloc(sizeof(*entry));
-        entry_item = list_alloc(entry);
+        for (size_t i = 0; i < batch; i++) {
+            if (i + PREFETCH_DISTANCE < batch) {
+                prefetch_probe(map, hashes[i + PREFETCH_DISTANCE]);
+            }
 
-        list_append(head, entry_item);
+            if (!set(map, keys[base + i], hashes[i], values[base + i])) {
+                return 0;
+            }
+        }
     }
 
-    entry->key   = key;
-    entry->value = value;
-    entry->hash  = key_hash;
-    entry->alive = 1;
+    return 1;
+}
+
+/*
+ * State shared by the threads of hashmap_build_parallel(). Partition
+ * `p` covers the table's slots from `p << partition_shift` up to the
+ * start of the next.
+ *
+ * - `counts` :: Keys per partition found by each thread, then where
+ *   each thread scatters its keys of each partition in `order`
+ * - `order` :: Pool indices of the keys, grouped by partition in input
+ *   order; deferred keys are moved to the front of their partition
+ * - `partition_start` :: Start of each partition in `order`
+ * - `n_deferred` :: Number of keys set aside in each partition
+ * - `n_indexed` :: Number of keys indexed in each partition
+ */
+struct build {
+    struct hashmap* map;
+    struct array*   keys;
+    struct array*   values;
+    size_t          n;
+    size_t          n_threads;
+    size_t          n_partitions;
+    int             partition_shift;
+    size_t*         counts;
+    size_t*         order;
+    size_t*         partition_start;
+    size_t*         n_deferred;
+    size_t*         n_indexed;
+};
+
+struct build_worker {
+    struct build* build;
+    size_t        id;
+    void (*phase)(struct build* build, size_t id);
+};
+
+/* Result of region_find() for a probe which would leave the region */
+#define REGION_OVERFLOW (-2)
+
+static inline size_t
+build_partition(const struct build* b, uint64_t key_hash)
+{
+    const struct hashmap_table* table = &b->map->table;
+    size_t                      pos
+        = probe_start(table, table_hash(table, key_hash));
 
-    return load_factor(map) > MAGPIE_HASHMAP_LOAD_THRESHOLD;
+    return pos >> b->partition_shift;
 }
 
-static inline void
-clean_bucket(struct list* root)
+static inline size_t
+build_chunk_start(const struct build* b, size_t id)
 {
-    struct list_iter it;
-    struct list*     first_child = root->next;
+    return b->n * id / b->n_threads;
+}
 
-    if (first_child == NULL) {
-        return;
-    }
+/* Hashes a chunk of the keys into the pool and counts its partitions */
+static void
+build_hash(struct build* b, size_t id)
+{
+    size_t* counts = &b->counts[id * b->n_partitions];
+    size_t  end    = build_chunk_start(b, id + 1);
 
-    it = list_iter(first_child);
-    while (list_iter_next(&it)) {
-        struct list* item = list_iter_get(&it);
-        free(item);
-    }
+    for (size_t i = build_chunk_start(b, id); i < end; i++) {
+        struct hashmap_entry* entry = &b->map->entries[i];
+
+        entry->key   = b->keys->elements[i];
+        entry->value = b->values != NULL ? b->values->elements[i] : NULL;
+        entry->hash  = b->map->hash(&entry->key);
+        entry->alive = 1;
 
-    root->next = NULL;
+        counts[build_partition(b, entry->hash)]++;
+    }
 }
 
-static int
-resize_to(struct hashmap* map, size_t capacity)
+static void
+build_scatter(struct build* b, size_t id)
 {
-    struct array        entries;
-    struct hashmap_iter it;
+    size_t* offsets = &b->counts[id * b->n_partitions];
+    size_t  end     = build_chunk_start(b, id + 1);
 
-    if (capacity <= map->buckets.length) {
-        return 0;
+    for (size_t i = build_chunk_start(b, id); i < end; i++) {
+        size_t p = build_partition(b, b->map->entries[i].hash);
+        b->order[offsets[p]++] = i;
     }
+}
+
+/* table_find() confined to the slots below `region_end`, for a table
+ * with no tombstones. On a miss, `*free_slot` is set to the slot the
+ * key would be placed in. Returns REGION_OVERFLOW if the probe would
+ * read past the region, which may be being filled by another thread. */
+static ssize_t
+region_find(struct hashmap*       map,
+            struct hashmap_table* table,
+            struct hashmap_entry* entry,
+            size_t                region_end,
+            size_t*               free_slot)
+{
+    const uint64_t hash = table_hash(table, entry->hash);
+    const uint8_t  tag  = hashmap_hash_tag(hash);
+    size_t         pos  = probe_start(table, hash);
+
+    for (; pos + HASHMAP_GROUP_WIDTH <= region_end;
+         pos += HASHMAP_GROUP_WIDTH) {
+        hashmap_group      g = hashmap_group_load(table->ctrl + pos);
+        hashmap_group_mask m = hashmap_group_match(g, tag);
+        hashmap_group_mask f;
+
+        while (m) {
+            size_t                slot  = pos + hashmap_mask_first(m);
+            struct hashmap_entry* other = &map->entries[get_slot(table, slot)];
+
+            if (other->hash == entry->hash
+                && map->compare(&other->key, &entry->key) == 0) {
+                return slot;
+            }
+
+            m = hashmap_mask_next(m);
+        }
 
-    array_init_with_capacity(&entries, map->n_entries);
-    it = hashmap_iter(map);
+        if ((f = hashmap_group_match_empty(g))) {
+            *free_slot = pos + hashmap_mask_first(f);
+            return -1;
+        }
+    }
 
-    /* save all the current entries for re-insertion */
-    while (hashmap_iter_next(&it)) {
-        struct hashmap_entry* entry = hashmap_iter_get(&it);
+    return REGION_OVERFLOW;
+}
 
-        /* don't preserve tombstones */
-        if (entry->alive) {
-            array_push(&entries, entry);
+/* Indexes the keys of one partition into its region of the table */
+static void
+build_index_partition(struct build* b, size_t p)
+{
+    struct hashmap*       map        = b->map;
+    struct hashmap_table* table      = &map->table;
+    size_t                region_end = (p + 1) << b->partition_shift;
+    size_t                start      = b->partition_start[p];
+    size_t                end        = b->partition_start[p + 1];
+    size_t                deferred   = start;
+    size_t                n_indexed  = 0;
+
+    for (size_t k = start; k < end; k++) {
+        size_t                i         = b->order[k];
+        struct hashmap_entry* entry     = &map->entries[i];
+        size_t                free_slot = 0;
+        ssize_t               slot;
+
+        slot = region_find(map, table, entry, region_end, &free_slot);
+
+        if (slot == REGION_OVERFLOW) {
+            b->order[deferred++] = i;
+        }
+        else if (slot >= 0) {
+            /* a repeated key: the first entry takes the later value */
+            map->entries[get_slot(table, slot)].value = entry->value;
+            entry->alive                              = 0;
         }
         else {
-            free(entry);
+            set_ctrl(table,
+                     free_slot,
+                     hashmap_hash_tag(table_hash(table, entry->hash)));
+            set_slot(table, free_slot, i);
+            n_indexed++;
         }
     }
 
-    /* purge the currently allocated buckets */
-    for (size_t i = 0; i < map->buckets.length; i++) {
-        struct list* root = map->buckets.elements[i];
-        clean_bucket(root);
+    b->n_deferred[p] = deferred - start;
+    b->n_indexed[p]  = n_indexed;
+}
+
+static void
+build_index(struct build* b, size_t id)
+{
+    for (size_t p = id; p < b->n_partitions; p += b->n_threads) {
+        build_index_partition(b, p);
+    }
+}
+
+static void*
+build_worker_main(void* arg)
+{
+    struct build_worker* worker = arg;
+
+    worker->phase(worker->build, worker->id);
+    return NULL;
+}
+
+/* Runs `phase` on every thread and waits for them. A thread which can't
+ * be started has its share run by the calling thread instead. */
+static void
+build_run(struct build*        b,
+          struct build_worker* workers,
+          pthread_t*           threads,
+          void (*phase)(struct build* build, size_t id))
+{
+    for (size_t t = 0; t < b->n_threads; t++) {
+        workers[t] = (struct build_worker){
+            .build = b,
+            .id    = t,
+            .phase = phase,
+        };
     }
 
-    /* allocate new buckets */
-    for (size_t i = map->n_entries; i < capacity; i++) {
-        array_push(&map->buckets, list_alloc(NULL));
+    for (size_t t = 1; t < b->n_threads; t++) {
+        if (pthread_create(&threads[t], NULL, build_worker_main, &workers[t])
+            != 0) {
+            workers[t].build = NULL;
+        }
     }
 
-    /* re-insert entries */
-    for (size_t i = 0; i < entries.length; i++) {
-        struct hashmap_entry* entry        = entries.elements[i];
-        size_t                bucket_index = bucket_for_hash(map, entry->hash);
-        struct list*          root = map->buckets.elements[bucket_index];
+    phase(b, 0);
 
-        list_append(root, list_alloc(entry));
+    for (size_t t = 1; t < b->n_threads; t++) {
+        if (workers[t].build != NULL) {
+            pthread_join(threads[t], NULL);
+        }
+        else {
+            phase(b, t);
+        }
     }
+}
 
-    array_destroy(&entries);
+/* Indexes the keys set aside by build_index_partition(), now that no
+ * other thread is touching the table */
+static void
+build_index_deferred(struct build* b)
+{
+    struct hashmap*       map   = b->map;
+    struct hashmap_table* table = &map->table;
 
-    return 1;
+    for (size_t p = 0; p < b->n_partitions; p++) {
+        size_t start = b->partition_start[p];
+
+        table->n_entries += b->n_indexed[p];
+
+        for (size_t k = start; k < start + b->n_deferred[p]; k++) {
+            size_t                i         = b->order[k];
+            struct hashmap_entry* entry     = &map->entries[i];
+            ssize_t               free_slot = -1;
+            ssize_t               slot;
+
+            slot = table_find(map, table, entry->key, entry->hash, &free_slot);
+
+            if (slot >= 0) {
+                map->entries[get_slot(table, slot)].value = entry->value;
+                entry->alive                              = 0;
+                continue;
+            }
+
+            if (free_slot < 0) {
+                free_slot
+                    = find_free_slot(table, table_hash(table, entry->hash));
+            }
+
+            table_place_at(table, free_slot, i, entry->hash);
+        }
+    }
 }
 
 int
-hashmap_init(struct hashmap* map,
-             uint64_t (*hash)(const void*),
-             int (*compare)(const void*, const void*))
+hashmap_build_parallel(struct hashmap* map,
+                       uint64_t (*hash)(const void*),
+                       int (*compare)(const void*, const void*),
+                       struct array* keys,
+                       struct array* values,
+                       size_t        n_threads)
 {
-    const size_t buckets = initial_buckets();
-    array_init_with_capacity(&map->buckets, buckets);
+    struct build         b = { .map = map, .keys = keys, .values = values };
+    struct build_worker* workers;
+    pthread_t*           threads;
+    int                  ok = 0;
+
+    b.n = keys->length;
 
-    for (size_t i = 0; i < buckets; i++) {
-        array_push(&map->buckets, list_alloc(NULL));
+    if (n_threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads   = n_cpus > 0 ? (size_t)n_cpus : 1;
     }
 
-    map->n_entries = 0;
-    map->hash      = hash;
-    map->compare   = compare;
+    if (n_threads > b.n / BUILD_MIN_KEYS_PER_THREAD) {
+        n_threads = b.n / BUILD_MIN_KEYS_PER_THREAD;
+    }
 
-    return 1;
-}
+    if (!hashmap_init_with_capacity(map, hash, compare, b.n)) {
+        return 0;
+    }
 
-void
-hashmap_destroy(struct hashmap* map)
-{
-    for (size_t i = 0; i < map->buckets.length; i++) {
-        struct list*     head = map->buckets.elements[i];
-        struct list_iter it   = list_iter(head);
+    /* Not worth the threads: build it the ordinary way */
+    if (n_threads <= 1) {
+        for (size_t i = 0; i < b.n; i++) {
+            void* key   = keys->elements[i];
+            void* value = values != NULL ? values->elements[i] : NULL;
+
+            if (!set(map, key, map->hash(&key), value)) {
+                hashmap_destroy(map);
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    b.n_threads       = n_threads;
+    b.n_partitions    = 1;
+    b.partition_shift = __builtin_ctzll(map->table.capacity);
+
+    while (b.n_partitions < n_threads * BUILD_PARTITIONS_PER_THREAD
+           && map->table.capacity / b.n_partitions / 2 >= BUILD_MIN_REGION) {
+        b.n_partitions *= 2;
+        b.partition_shift--;
+    }
+
+    b.counts = calloc(n_threads * b.n_partitions, sizeof(*b.counts));
+    b.order  = malloc(sizeof(*b.order) * b.n);
+    b.partition_start
+        = malloc(sizeof(*b.partition_start) * (b.n_partitions + 1));
+    b.n_deferred = malloc(sizeof(*b.n_deferred) * b.n_partitions);
+    b.n_indexed  = malloc(sizeof(*b.n_indexed) * b.n_partitions);
+    workers      = malloc(sizeof(*workers) * n_threads);
+    threads      = malloc(sizeof(*threads) * n_threads);
+
+    if (b.counts == NULL || b.order == NULL || b.partition_start == NULL
+        || b.n_deferred == NULL || b.n_indexed == NULL || workers == NULL
+        || threads == NULL) {
+        EBUF_PUSH("failed to allocate hashmap build state", map);
+        hashmap_destroy(map);
+        goto out;
+    }
 
-        while (list_iter_next(&it)) {
-            struct list* item = list_iter_get(&it);
-            free(item->data);
-            free(item);
+    build_run(&b, workers, threads, build_hash);
+
+    /* Turn the counts into each thread's offsets into each partition,
+     * threads in order, so that `order` keeps the input order */
+    {
+        size_t offset = 0;
+
+        for (size_t p = 0; p < b.n_partitions; p++) {
+            b.partition_start[p] = offset;
+
+            for (size_t t = 0; t < n_threads; t++) {
+                size_t count = b.counts[t * b.n_partitions + p];
+
+                b.counts[t * b.n_partitions + p] = offset;
+                offset += count;
+            }
         }
 
-        map->buckets.elements[i] = NULL;
+        b.partition_start[b.n_partitions] = offset;
     }
 
-    array_destroy(&map->buckets);
+    build_run(&b, workers, threads, build_scatter);
+    build_run(&b, workers, threads, build_index);
+    build_index_deferred(&b);
+
+    map->entries_length = b.n;
+    map->n_entries      = map->table.n_entries;
+    ok                  = 1;
+
+out:
+    free(b.counts);
+    free(b.order);
+    free(b.partition_start);
+    free(b.n_deferred);
+    free(b.n_indexed);
+    free(workers);
+    free(threads);
+
+    return ok;
 }
 
-void
-hashmap_set(struct hashmap* map, void* key, void* value)
+struct hashmap_entry*
+hashmap_entry_or_insert(struct hashmap* map, void* key, int* inserted)
+{
+    return hashmap_entry_or_insert_prehashed(
+        map, key, map->hash(&key), inserted);
+}
+
+struct hashmap_entry*
+hashmap_entry_or_insert_prehashed(struct hashmap* map,
+                                  void*           key,
+                                  uint64_t        key_hash,
+                                  int*            inserted)
 {
-    int      needs_resize = 0;
-    uint64_t key_hash     = map->hash(&key);
+    int ignored;
 
-    /* Check whether the hashmap already contains an entry for this key */
-    struct hashmap_entry* entry = lookup(map, key, key_hash);
+    return entry_or_insert(
+        map, key, key_hash, inserted != NULL ? inserted : &ignored);
+}
+
+int
+hashmap_upsert(struct hashmap* map,
+               void*           key,
+               void (*update)(struct hashmap_entry* entry,
+                                  int                   inserted,
+                                  void*                 ctx),
+               void* ctx)
+{
+    int                   inserted;
+    struct hashmap_entry* entry
+        = entry_or_insert(map, key, map->hash(&key), &inserted);
 
     if (entry == NULL) {
-        needs_resize = insert(map, key, key_hash, value);
-        map->n_entries++;
-    }
-    else {
-        entry->value = value;
-        entry->alive = 1;
+        return 0;
     }
 
-    if (needs_resize) {
-        size_t next_size = next_prime(map->buckets.length * 2);
-        resize_to(map, next_size);
-    }
+    update(entry, inserted, ctx);
+    return 1;
 }
 
 struct hashmap_entry*
 hashmap_lookup(struct hashmap* map, void* key)
 {
-    uint64_t              key_hash = map->hash(&key);
-    struct hashmap_entry* entry    = lookup(map, key, key_hash);
+    uint64_t key_hash = map->hash(&key);
+    return lookup(map, key, key_hash);
+}
 
-    if (entry == NULL || !entry->alive) {
-        return NULL;
+struct hashmap_entry*
+hashmap_lookup_prehashed(struct hashmap* map, void* key, uint64_t key_hash)
+{
+    return lookup(map, key, key_hash);
+}
+
+size_t
+hashmap_get_many(struct hashmap* map, void** keys, void** values, size_t n)
+{
+    uint64_t hashes[LOOKUP_BATCH_SIZE];
+    size_t   candidates[LOOKUP_BATCH_SIZE];
+    size_t   n_found = 0;
+
+    /* A small map's tags are a single group already in cache, so there
+     * are no misses to overlap */
+    if (is_small(map)) {
+        for (size_t i = 0; i < n; i++) {
+            n_found += hashmap_get(map, keys[i], &values[i]);
+        }
+
+        return n_found;
     }
 
-    return entry;
+    /*
+     * Lookups are resolved a batch at a time in three passes, so that
+     * the cache misses of every lookup in the batch overlap instead of
+     * forming one long chain (group prefetching, as in Chen et al.,
+     * "Improving Hash Join Performance through Prefetching", 2004).
+     */
+    for (size_t base = 0; base < n; base += LOOKUP_BATCH_SIZE) {
+        size_t batch = n - base < LOOKUP_BATCH_SIZE ? n - base
+                                                    : LOOKUP_BATCH_SIZE;
+
+        /* Hash every key and start fetching the first group it probes */
+        for (size_t i = 0; i < batch; i++) {
+            hashes[i] = map->hash(&keys[base + i]);
+            prefetch_probe(map, hashes[i]);
+        }
+
+        /* Match each key against its group and start fetching the
+         * entry it most likely refers to */
+        for (size_t i = 0; i < batch; i++) {
+            candidates[i] = probe_first(map, hashes[i]);
+
+            if (candidates[i] < PROBE_UNKNOWN) {
+                __builtin_prefetch(&map->entries[candidates[i]]);
+            }
+        }
+
+        /* Confirm the candidates. Anything the first group and
+         * candidate didn't settle takes the ordinary path. */
+        for (size_t i = 0; i < batch; i++) {
+            void*                 key   = keys[base + i];
+            struct hashmap_entry* entry = NULL;
+
+            if (candidates[i] < PROBE_UNKNOWN) {
+                entry = &map->entries[candidates[i]];
+                STATS_COUNT(map, n_compares, entry->hash == hashes[i]);
+
+                if (entry->hash != hashes[i]
+                    || map->compare(&entry->key, &key) != 0) {
+                    entry = lookup(map, key, hashes[i]);
+                }
+                else {
+                    STATS_COUNT(map, n_lookups, 1);
+                }
+            }
+            else if (candidates[i] == PROBE_UNKNOWN) {
+                entry = lookup(map, key, hashes[i]);
+            }
+            else {
+                STATS_COUNT(map, n_lookups, 1);
+            }
+
+            values[base + i] = entry == NULL ? NULL : entry->value;
+            n_found += entry != NULL;
+        }
+    }
+
+    return n_found;
 }
 
 int
 hashmap_get(struct hashmap* map, void* key, void** value)
 {
-    struct hashmap_entry* entry = hashmap_lookup(map, key);
+    return hashmap_get_prehashed(map, key, map->hash(&key), value);
+}
+
+int
+hashmap_get_prehashed(struct hashmap* map,
+                      void*           key,
+                      uint64_t        key_hash,
+                      void**          value)
+{
+    struct hashmap_entry* entry = lookup(map, key, key_hash);
 
     if (entry == NULL) {
         *value = NULL;
@@ -278,75 +1726,225 @@ hashmap_get(struct hashmap* map, void* key, void** value)
 void
 hashmap_remove(struct hashmap* map, void* key)
 {
-    struct hashmap_entry* entry = hashmap_lookup(map, key);
+    hashmap_remove_prehashed(map, key, map->hash(&key));
+}
 
-    if (entry == NULL) {
+void
+hashmap_remove_prehashed(struct hashmap* map, void* key, uint64_t key_hash)
+{
+    struct hashmap_table* table;
+    ssize_t               slot;
+    size_t                index;
+
+    if (is_small(map)) {
+        slot = small_find(map, key, key_hash);
+
+        if (slot < 0) {
+            return;
+        }
+
+        map->small_tags[slot]    = HASHMAP_CTRL_EMPTY;
+        map->entries[slot].alive = 0;
+        map->n_entries--;
+
+        /* Holes at the end of the pool can simply be dropped */
+        while (map->entries_length > 0
+               && !map->entries[map->entries_length - 1].alive) {
+            map->entries_length--;
+        }
+
+        return;
+    }
+
+    migrate_step(map);
+
+    slot = lookup_slot(map, key, key_hash, &table, NULL);
+
+    if (slot < 0) {
         return;
     }
 
-    entry->alive = 0;
+    index = get_slot(table, slot);
+    table_erase(table, slot);
+
+    map->entries[index].alive = 0;
     map->n_entries--;
+
+    maybe_shrink(map);
 }
 
-struct hashmap_iter
-hashmap_iter(struct hashmap* map)
+static size_t
+table_bytes(const struct hashmap_table* table)
 {
-    struct hashmap_iter iter = {
-        .buckets      = &map->buckets,
-        .bucket       = 0,
-        .current_iter = {.i = -1, .current = NULL, .pending = NULL},
-    };
+    if (table->capacity == 0) {
+        return 0;
+    }
 
-    return iter;
+    return ctrl_bytes(table->capacity) + table->capacity * table->slot_width;
 }
 
-int
-hashmap_iter_next(struct hashmap_iter* iter)
+/* Adds the probe length of every entry in `table` to `stats` */
+static void
+table_stats(const struct hashmap*       map,
+            const struct hashmap_table* table,
+            struct hashmap_stats*       stats,
+            size_t*                     total_probe_length)
 {
-    int has_next = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        const struct hashmap_entry* entry;
+        size_t                      start;
+        size_t                      length;
 
-    while (!has_next) {
-        struct list*          list_entry;
-        struct hashmap_entry* entry;
+        if (table->ctrl[i] == HASHMAP_CTRL_DELETED) {
+            stats->n_tombstones++;
+        }
 
-        if (iter->current_iter.i < 0) {
-            if (iter->bucket >= iter->buckets->length) {
-                break;
-            }
+        if (!hashmap_ctrl_is_full(table->ctrl[i])) {
+            continue;
+        }
 
-            iter->current_iter
-                = list_iter(iter->buckets->elements[iter->bucket++]);
+        /* Probes step a group at a time from the start position, so the
+         * distance to the slot says how many groups were examined */
+        entry  = &map->entries[get_slot(table, i)];
+        start  = probe_start(table, table_hash(table, entry->hash));
+        length = (i >= start ? i - start : i + table->capacity - start)
+                     / HASHMAP_GROUP_WIDTH
+                 + 1;
 
-            /* skip list head */
-            list_iter_next(&iter->current_iter);
-        }
+        stats->probe_lengths[length < MAGPIE_HASHMAP_STATS_BUCKETS
+                                 ? length - 1
+                                 : MAGPIE_HASHMAP_STATS_BUCKETS - 1]++;
 
-        if (!list_iter_next(&iter->current_iter)) {
-            iter->current_iter.i = -1;
-            continue;
+        if (length > stats->max_probe_length) {
+            stats->max_probe_length = length;
         }
 
-        list_entry = list_iter_get(&iter->current_iter);
-        entry      = list_entry->data;
+        *total_probe_length += length;
+    }
+}
 
-        if (!entry->alive) {
-            continue;
+void
+hashmap_stats(const struct hashmap* map, struct hashmap_stats* stats)
+{
+    size_t total_probe_length = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    stats->n_entries       = map->n_entries;
+    stats->capacity        = map->table.capacity;
+    stats->load            = is_small(map) ? 0
+                                           : (double)map->n_entries
+                                                 / map->table.capacity;
+    stats->n_holes         = map->entries_length - map->n_entries;
+    stats->bytes_allocated = map->entries_capacity * sizeof(*map->entries)
+                             + table_bytes(&map->table)
+                             + table_bytes(&map->old);
+    stats->counters        = map->counters;
+
+    table_stats(map, &map->table, stats, &total_probe_length);
+    table_stats(map, &map->old, stats, &total_probe_length);
+
+    /* A small map finds every entry with its single group */
+    if (is_small(map) && map->n_entries > 0) {
+        stats->probe_lengths[0] = map->n_entries;
+        stats->max_probe_length = 1;
+        total_probe_length      = map->n_entries;
+    }
+
+    if (map->n_entries > 0) {
+        stats->mean_probe_length
+            = (double)total_probe_length / map->n_entries;
+    }
+}
+
+void
+hashmap_stats_print(const struct hashmap_stats* stats, FILE* stream)
+{
+    size_t last = 0;
+    size_t peak = 1;
+
+    fprintf(stream,
+            "entries: %zu, capacity: %zu, load: %.3f\n"
+            "tombstones: %zu, pool holes: %zu, bytes allocated: %zu\n"
+            "probe length: mean %.3f, max %zu\n",
+            stats->n_entries,
+            stats->capacity,
+            stats->load,
+            stats->n_tombstones,
+            stats->n_holes,
+            stats->bytes_allocated,
+            stats->mean_probe_length,
+            stats->max_probe_length);
+
+    fprintf(stream,
+            "lookups: %llu, probes: %llu, compares: %llu\n"
+            "rehashes: %llu, rehash time: %.3f ms\n",
+            (unsigned long long)stats->counters.n_lookups,
+            (unsigned long long)stats->counters.n_probes,
+            (unsigned long long)stats->counters.n_compares,
+            (unsigned long long)stats->counters.n_rehashes,
+            stats->counters.rehash_ns / 1e6);
+
+    for (size_t i = 0; i < MAGPIE_HASHMAP_STATS_BUCKETS; i++) {
+        if (stats->probe_lengths[i] > 0) {
+            last = i;
         }
 
-        has_next = 1;
+        if (stats->probe_lengths[i] > peak) {
+            peak = stats->probe_lengths[i];
+        }
+    }
+
+    /* One row per probe length, with a bar scaled to the largest
+     * bucket. The final bucket also counts longer probes. */
+    for (size_t i = 0; i <= last; i++) {
+        int width = (int)(stats->probe_lengths[i] * 50 / peak);
+
+        fprintf(stream,
+                "%4zu%s %10zu |%.*s\n",
+                i + 1,
+                i == MAGPIE_HASHMAP_STATS_BUCKETS - 1 ? "+" : " ",
+                stats->probe_lengths[i],
+                width,
+                "##################################################");
+    }
+}
+
+struct hashmap_iter
+hashmap_iter(struct hashmap* map)
+{
+    struct hashmap_iter iter = {
+        .map   = map,
+        .index = -1,
+    };
+
+    return iter;
+}
+
+int
+hashmap_iter_next(struct hashmap_iter* iter)
+{
+    struct hashmap* map = iter->map;
+
+    while ((size_t)++iter->index < map->entries_length) {
+        if (map->entries[iter->index].alive) {
+            return 1;
+        }
     }
 
-    return has_next;
+    iter->index = map->entries_length;
+    return 0;
 }
 
 struct hashmap_entry*
 hashmap_iter_get(struct hashmap_iter* iter)
 {
-    struct list* list_entry = list_iter_get(&iter->current_iter);
+    struct hashmap* map = iter->map;
 
-    if (list_entry == NULL) {
+    if (iter->index < 0 || (size_t)iter->index >= map->entries_length
+        || !map->entries[iter->index].alive) {
         return NULL;
     }
 
-    return list_entry->data;
+    return &iter->map->entries[iter->index];
 }
@@ -22,23 +22,82 @@
 #ifndef MAGPIE_HASHMAP_H
 #define MAGPIE_HASHMAP_H
 
-#include <magpie/collections/array.h>
-#include <magpie/collections/list.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <magpie/collections/array.h>
 
 #ifndef MAGPIE_HASHMAP_INITIAL_BUCKETS
 #    define MAGPIE_HASHMAP_INITIAL_BUCKETS 256
 #endif
 
+/* Maps with no more than this many entries keep them in a flat array
+ * searched linearly, without a table; at most 16 */
+#ifndef MAGPIE_HASHMAP_SMALL_CAPACITY
+#    define MAGPIE_HASHMAP_SMALL_CAPACITY 8
+#endif
+
 #ifndef MAGPIE_HASHMAP_LOAD_THRESHOLD
-#    define MAGPIE_HASHMAP_LOAD_THRESHOLD 0.75
+#    define MAGPIE_HASHMAP_LOAD_THRESHOLD 0.875
 #endif
 
-struct hashmap {
-    struct array buckets;
-    size_t       n_entries;
-    uint64_t (*hash)(const void*);
-    int (*compare)(const void*, const void*);
+#ifndef MAGPIE_HASHMAP_REHASH_BUDGET
+#    define MAGPIE_HASHMAP_REHASH_BUDGET 0
+#endif
+
+#ifndef MAGPIE_HASHMAP_SHRINK_THRESHOLD
+#    define MAGPIE_HASHMAP_SHRINK_THRESHOLD 0.125
+#endif
+
+/* Define to 1 when building the library to maintain the operation
+ * counters in `struct hashmap_counters` */
+#ifndef MAGPIE_HASHMAP_STATS
+#    define MAGPIE_HASHMAP_STATS 0
+#endif
+
+/* Number of buckets in the probe length histogram of `struct
+ * hashmap_stats`; the last bucket also counts every longer probe */
+#ifndef MAGPIE_HASHMAP_STATS_BUCKETS
+#    define MAGPIE_HASHMAP_STATS_BUCKETS 16
+#endif
+
+/**
+ * Control byte values. Every slot in a hashmap has a matching control
+ * byte; a full slot stores the low 7 bits of its entry's hash (so the
+ * high bit is clear), an empty or deleted slot stores one of the
+ * values below.
+ *
+ * - `HASHMAP_CTRL_EMPTY` :: The slot has never held an entry since the
+ *   last rehash. Probing stops at empty slots.
+ * - `HASHMAP_CTRL_DELETED` :: Tombstone left behind by
+ *   `hashmap_remove()`. Probing continues past deleted slots.
+ */
+enum hashmap_ctrl {
+    HASHMAP_CTRL_EMPTY   = 0x80,
+    HASHMAP_CTRL_DELETED = 0xFE,
+};
+
+/**
+ * Specifies how a hash is reduced to the slot a probe starts from.
+ * Used in `hashmap_set_index()`.
+ *
+ * - `HASHMAP_INDEX_MASK` :: The table has a power-of-two capacity and
+ *   the hash is masked, after passing it through a finalizer so that
+ *   weak hash functions still spread keys across the table. The
+ *   default.
+ * - `HASHMAP_INDEX_FASTRANGE` :: The table may have any capacity, and
+ *   the high bits of the hash are scaled into range with a multiply
+ *   and a shift. Requires a well-distributed hash function.
+ * - `HASHMAP_INDEX_PRIME` :: The table has a prime capacity and the
+ *   hash is reduced modulo it, using a precomputed multiplier instead
+ *   of a division. Tolerates weak hash functions without a finalizer.
+ */
+enum hashmap_index {
+    HASHMAP_INDEX_MASK = 0,
+    HASHMAP_INDEX_FASTRANGE,
+    HASHMAP_INDEX_PRIME,
 };
 
 struct hashmap_entry {
@@ -48,26 +107,509 @@ struct hashmap_entry {
     int      alive;
 };
 
+/**
+ * An open-addressing index into a hashmap's entry pool.
+ *
+ * Each full slot holds the position of an entry in the pool. `ctrl` is
+ * a parallel array of one control byte per slot (see `enum
+ * hashmap_ctrl`), followed by a copy of its first few bytes so that
+ * groups of control bytes can be loaded without wrapping. Lookups scan
+ * the control bytes a group at a time (using SSE2 where available) and
+ * only touch the pool for tags matching the key's hash.
+ *
+ * - `ctrl` :: Control bytes, `capacity` plus the group width minus one
+ * - `slots` :: Pool indices, `capacity` entries of `slot_width` bytes
+ * - `slot_width` :: Size of a pool index: 1, 2, 4 or 8 bytes, the
+ *   smallest which can address every entry the pool may hold while
+ *   this table indexes it
+ * - `capacity` :: Number of slots, or 0 if the table is not allocated
+ * - `index` :: How hashes are reduced to slots (see `enum
+ *   hashmap_index`)
+ * - `index_magic` :: Precomputed multiplier for `HASHMAP_INDEX_PRIME`
+ * - `n_entries` :: Number of live entries
+ * - `n_tombstones` :: Number of deleted slots awaiting reuse
+ */
+struct hashmap_table {
+    uint8_t*           ctrl;
+    void*              slots;
+    size_t             slot_width;
+    size_t             capacity;
+    enum hashmap_index index;
+    uint64_t           index_magic;
+    size_t             n_entries;
+    size_t             n_tombstones;
+};
+
+/**
+ * Running totals of the work a hashmap has done since it was
+ * initialized.
+ *
+ * `n_rehashes` is always maintained. The other counters are only
+ * maintained if the library was built with `MAGPIE_HASHMAP_STATS`
+ * defined to 1, and are 0 otherwise.
+ *
+ * - `n_lookups` :: Number of keys looked up, including the lookups
+ *   made by `hashmap_set()` and `hashmap_remove()`
+ * - `n_probes` :: Number of groups of control bytes examined
+ * - `n_compares` :: Number of calls to the key comparison function
+ * - `n_rehashes` :: Number of times the table was rebuilt or began
+ *   migrating to a new table
+ * - `rehash_ns` :: Nanoseconds spent rebuilding and migrating tables
+ */
+struct hashmap_counters {
+    uint64_t n_lookups;
+    uint64_t n_probes;
+    uint64_t n_compares;
+    uint64_t n_rehashes;
+    uint64_t rehash_ns;
+};
+
+/**
+ * A hashmap.
+ *
+ * Entries are stored by value in `entries`, a pool kept in insertion
+ * order, so iteration is a linear sweep over it. The table only holds
+ * indices into the pool, using the narrowest integer type which can
+ * address it, so small maps have small tables. Insertions append to
+ * the pool and allocate nothing in the common case; growing the table
+ * rebuilds the indices in it without moving entry memory.
+ *
+ * Removing an entry leaves a hole in the pool (an entry with `alive`
+ * cleared). The pool has room for as many entries as the table can
+ * index before reaching its load threshold; when it fills up the
+ * holes are squeezed out and the table is rebuilt, at twice the
+ * capacity if more than half of the pool is still live.
+ *
+ * Normally every entry is indexed by `table`. When the map is
+ * configured with a non-zero `rehash_budget`, growing the map doesn't
+ * rehash every entry at once: the current table is moved to `old` and each
+ * subsequent `hashmap_set()` or `hashmap_remove()` migrates the next
+ * `rehash_budget` slots of it into the new `table`. Lookups consult
+ * both tables until the migration is complete. Holes in the pool are
+ * only reclaimed by rebuilding the table all at once.
+ *
+ * When removals bring the load below `shrink_threshold`, the table is
+ * rebuilt at a smaller capacity and the pool shrunk to match, so a map
+ * doesn't hold on to its peak footprint after being emptied.
+ *
+ * A map starts out small: it has no table, and nothing is allocated
+ * until the first insertion, which allocates a pool of
+ * `MAGPIE_HASHMAP_SMALL_CAPACITY` entries. While the map is small,
+ * `small_tags` holds a control byte for each pool position, and lookups
+ * match the whole array against the key's tag at once before touching
+ * any entries. The table is built once the pool fills up with live
+ * entries. `hashmap_shrink_to_fit()` returns a map to small mode if its
+ * entries fit.
+ *
+ * - `entries` :: Entry pool, live entries and holes in insertion order
+ * - `entries_length` :: Number of entries and holes in the pool
+ * - `entries_capacity` :: Number of entries the pool has room for
+ * - `table` :: The table new entries are inserted into, or a table with
+ *   a capacity of 0 while the map is small
+ * - `old` :: The table being migrated, if `old.capacity` is non-zero
+ * - `migrate_pos` :: Index of the next slot of `old` to migrate
+ * - `rehash_budget` :: Number of slots migrated per operation, or 0 to
+ *   rehash the whole table at once
+ * - `shrink_threshold` :: Load below which removals shrink the map, or
+ *   0 to never shrink it automatically
+ * - `n_entries` :: Total number of live entries
+ * - `counters` :: Operation counters (see `struct hashmap_counters`)
+ * - `small_tags` :: Control byte of each pool entry while the map is
+ *   small, padded to one full group with empty bytes
+ */
+struct hashmap {
+    struct hashmap_entry*   entries;
+    size_t                  entries_length;
+    size_t                  entries_capacity;
+    struct hashmap_table    table;
+    struct hashmap_table    old;
+    size_t                  migrate_pos;
+    size_t                  rehash_budget;
+    double                  shrink_threshold;
+    size_t                  n_entries;
+    struct hashmap_counters counters;
+    uint8_t                 small_tags[16];
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
 struct hashmap_iter {
-    struct array*    buckets;
-    size_t           bucket;
-    struct list_iter current_iter;
+    struct hashmap* map;
+    ssize_t         index;
+};
+
+/**
+ * A snapshot of a hashmap's shape, filled in by `hashmap_stats()`.
+ *
+ * The probe length of an entry is the number of groups of control
+ * bytes a lookup for its key examines before finding it. With a good
+ * hash function and a sensible load threshold nearly every entry is
+ * found in the first group; a long tail in `probe_lengths` points to a
+ * weak hash function or a load threshold set too high.
+ *
+ * - `n_entries` :: Number of live entries
+ * - `capacity` :: Number of slots in the table, or 0 if the map is small
+ * - `load` :: Fraction of the table's slots holding live entries
+ * - `n_tombstones` :: Number of deleted slots in the table
+ * - `n_holes` :: Number of removed entries still taking up room in
+ *   the entry pool
+ * - `bytes_allocated` :: Memory held by the pool and the table(s)
+ * - `probe_lengths` :: Histogram of probe lengths; bucket `i` counts
+ *   the entries with a probe length of `i + 1`
+ * - `max_probe_length` :: Longest probe length of any entry
+ * - `mean_probe_length` :: Average probe length over all entries
+ * - `counters` :: Copy of the map's operation counters
+ */
+struct hashmap_stats {
+    size_t                  n_entries;
+    size_t                  capacity;
+    double                  load;
+    size_t                  n_tombstones;
+    size_t                  n_holes;
+    size_t                  bytes_allocated;
+    size_t                  probe_lengths[MAGPIE_HASHMAP_STATS_BUCKETS];
+    size_t                  max_probe_length;
+    double                  mean_probe_length;
+    struct hashmap_counters counters;
 };
 
 int hashmap_init(struct hashmap* map,
                  uint64_t (*hash)(const void*),
                  int compare(const void*, const void*));
 
+/**
+ * Initializes a hashmap with room for `n_entries` entries, so that
+ * they can be inserted without the table being rebuilt.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hash` :: Hash function for keys.
+ * @param `compare` :: Comparison function for keys.
+ * @param `n_entries` :: Number of entries to make room for.
+ * @return 0 on error.
+ */
+int hashmap_init_with_capacity(struct hashmap* map,
+                               uint64_t (*hash)(const void*),
+                               int compare(const void*, const void*),
+                               size_t n_entries);
+
 void hashmap_destroy(struct hashmap* map);
 
+/**
+ * Sets the number of slots migrated per operation while the map is
+ * growing.
+ *
+ * With a budget of 0 (the default, `MAGPIE_HASHMAP_REHASH_BUDGET`),
+ * the insertion which crosses the load threshold rehashes every entry
+ * before returning. With a non-zero budget, growth is spread over the
+ * following insertions and removals instead, bounding the latency of
+ * any single operation. The budget is raised internally if needed to
+ * guarantee the migration completes before the new table fills up.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `budget` :: Slots to migrate per operation.
+ */
+void hashmap_set_rehash_budget(struct hashmap* map, size_t budget);
+
+/**
+ * Sets the load below which `hashmap_remove()` shrinks the map.
+ *
+ * Once the number of live entries falls below `threshold` times the
+ * capacity of the table, the table is rebuilt at a capacity which the
+ * remaining entries fill less than half of, but never smaller than the
+ * initial capacity. The default is `MAGPIE_HASHMAP_SHRINK_THRESHOLD`;
+ * a threshold of 0 disables automatic shrinking.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `threshold` :: Load factor between 0 and 1.
+ */
+void hashmap_set_shrink_threshold(struct hashmap* map, double threshold);
+
+/**
+ * Makes room for the map to hold `n_entries` entries in total, so that
+ * inserting up to that many doesn't rebuild the table.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `n_entries` :: Number of entries to make room for.
+ * @return 0 on error, in which case the map is left unchanged.
+ */
+int hashmap_reserve(struct hashmap* map, size_t n_entries);
+
+/**
+ * Shrinks the map to the smallest table which can hold its entries
+ * below the load threshold, and releases unused room in the entry
+ * pool. A map with no more than `MAGPIE_HASHMAP_SMALL_CAPACITY` entries
+ * goes back to being small, without a table.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @return 0 on error, in which case the map is left unchanged.
+ */
+int hashmap_shrink_to_fit(struct hashmap* map);
+
+/**
+ * Reclaims every tombstone in the table and every hole in the entry
+ * pool in a single rebuild, keeping the current capacity. Any
+ * outstanding migration is completed.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @return 0 on error, in which case the map is left unchanged.
+ */
+int hashmap_compact(struct hashmap* map);
+
+/**
+ * Removes every entry for which `pred` returns 0.
+ *
+ * `pred` is called once per entry, in insertion order, and may modify
+ * the entry's value but not its key. Entries are dropped with a single
+ * sweep over the table rather than a lookup per key. The map may then
+ * shrink, as it would after `hashmap_remove()`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `pred` :: Predicate deciding which entries to keep.
+ * @param `ctx` :: Passed through to `pred`.
+ * @return The number of entries removed.
+ */
+size_t hashmap_retain(struct hashmap* map,
+                      int (*pred)(struct hashmap_entry* entry, void* ctx),
+                      void* ctx);
+
+/**
+ * Changes how hashes are reduced to slots, rehashing the map into a
+ * table of a suitable capacity.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `index` :: The new indexing strategy.
+ * @return 0 on error, in which case the map is left unchanged.
+ */
+int hashmap_set_index(struct hashmap* map, enum hashmap_index index);
+
 void hashmap_set(struct hashmap* map, void* key, void* value);
 
+/**
+ * Sets `key` to `value` as `hashmap_set()` does, using `key_hash` in
+ * place of hashing the key.
+ *
+ * The `_prehashed` functions let a key be hashed once, possibly ahead
+ * of time on another thread, and the hash reused for any number of
+ * maps. `key_hash` must be exactly what the map's hash function
+ * returns for `key`; a map given any other hash for a key will not
+ * find that key again. For maps using `hash_str()`, the hash can be
+ * taken with `hash_str()` or with `hash_bytes()` over the string's
+ * bytes. Both depend on the seed set by `hash_seed()`, so the seed must
+ * be set before any hashes are taken and not changed while they or the
+ * maps are in use. The hashing functions themselves are pure, so they
+ * can be called from any thread.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to insert.
+ * @param `key_hash` :: The map's hash of `key`.
+ * @param `value` :: Value to associate with `key`.
+ */
+void hashmap_set_prehashed(struct hashmap* map,
+                           void*           key,
+                           uint64_t        key_hash,
+                           void*           value);
+
+/**
+ * Sets `n` entries at once, as though by calling `hashmap_set()` on
+ * each key/value pair in order.
+ *
+ * Room is reserved up front as though every key were new. Keys are
+ * then hashed a batch at a time, and the slots each key will probe are
+ * prefetched a few keys ahead of its insertion, so cache misses on the
+ * table overlap with useful work.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `keys` :: Array of `n` keys.
+ * @param `values` :: Array of `n` values, matching `keys`.
+ * @param `n` :: Number of entries to set.
+ * @return 0 on error, in which case only some of the entries may have
+ * been set.
+ */
+int hashmap_set_many(struct hashmap* map,
+                     void**          keys,
+                     void**          values,
+                     size_t          n);
+
+/**
+ * Initializes `map` with the elements of `keys` and `values`, using
+ * several threads. The result is the same as calling `hashmap_init()`
+ * and then `hashmap_set()` on each key/value pair in order, except that
+ * a key appearing more than once leaves a hole in the entry pool for
+ * each repeat (see `hashmap_compact()`).
+ *
+ * The table is sized for every key up front and split into one region
+ * per partition of the hash space. Each thread hashes a share of the
+ * keys straight into the entry pool, the keys are radix-partitioned by
+ * the region their probes start in, and each thread then indexes
+ * whole partitions into their own regions of the table. No locks are
+ * taken: the rare key whose probe would run past the end of its region
+ * is set aside and indexed afterwards by the calling thread.
+ *
+ * `hash` and `compare` are called from every thread at once, so must be
+ * safe to call concurrently.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hash` :: Hash function.
+ * @param `compare` :: Comparison function.
+ * @param `keys` :: Keys to insert.
+ * @param `values` :: Values matching `keys`, or `NULL` to map every key
+ * to `NULL`.
+ * @param `n_threads` :: Number of threads to use, or 0 for one per
+ * online CPU.
+ * @return 0 on error.
+ */
+int hashmap_build_parallel(struct hashmap* map,
+                           uint64_t (*hash)(const void*),
+                           int (*compare)(const void*, const void*),
+                           struct array* keys,
+                           struct array* values,
+                           size_t        n_threads);
+
+/**
+ * Finds the entry for `key`, inserting one with a `NULL` value if there
+ * is none. The key is hashed once and the table probed once, so this
+ * is cheaper than a `hashmap_get()` followed by a `hashmap_set()` for
+ * counting or accumulating into values.
+ *
+ * The entry's value may be changed freely. Its key may be replaced by
+ * one which compares equal and has the same hash, such as a copy of a
+ * temporary key made when the entry is inserted. The returned pointer
+ * is only valid until the next call which inserts into or removes from
+ * the map.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to find or insert.
+ * @param `inserted` :: Set to 1 if the entry was inserted, or 0 if it
+ * was already present. May be `NULL`.
+ * @return The entry for `key`, or `NULL` on error.
+ */
+struct hashmap_entry*
+hashmap_entry_or_insert(struct hashmap* map, void* key, int* inserted);
+
+/**
+ * `hashmap_entry_or_insert()` with a hash computed by the caller, as
+ * described for `hashmap_set_prehashed()`.
+ */
+struct hashmap_entry*
+hashmap_entry_or_insert_prehashed(struct hashmap* map,
+                                  void*           key,
+                                  uint64_t        key_hash,
+                                  int*            inserted);
+
+/**
+ * Finds or inserts the entry for `key` as `hashmap_entry_or_insert()`
+ * does, then passes it to `update`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to find or insert.
+ * @param `update` :: Called with the entry, 1 if it was just inserted
+ * (with a `NULL` value) or 0 if not, and `ctx`.
+ * @param `ctx` :: Passed to `update`.
+ * @return 0 on error, in which case `update` is not called.
+ */
+int hashmap_upsert(struct hashmap* map,
+                   void*           key,
+                   void (*update)(struct hashmap_entry* entry,
+                                  int                   inserted,
+                                  void*                 ctx),
+                   void* ctx);
+
+/**
+ * Looks up the entry for `key`.
+ *
+ * The returned pointer refers to storage owned by the map and is only
+ * valid until the next call which inserts into or removes from the
+ * map, since removals may shrink and rebuild the table.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @return The entry for `key`, or `NULL` if there is none.
+ */
 struct hashmap_entry* hashmap_lookup(struct hashmap* map, void* key);
 
+/**
+ * `hashmap_lookup()` with a hash computed by the caller, as described
+ * for `hashmap_set_prehashed()`. The returned pointer is likewise only
+ * valid until the next call which inserts into or removes from the
+ * map.
+ */
+struct hashmap_entry*
+hashmap_lookup_prehashed(struct hashmap* map, void* key, uint64_t key_hash);
+
 int hashmap_get(struct hashmap* map, void* key, void** value);
 
+/**
+ * `hashmap_get()` with a hash computed by the caller, as described for
+ * `hashmap_set_prehashed()`.
+ */
+int hashmap_get_prehashed(struct hashmap* map,
+                          void*           key,
+                          uint64_t        key_hash,
+                          void**          value);
+
+/**
+ * Looks up `n` keys at once, as though by calling `hashmap_get()` on
+ * each.
+ *
+ * Keys are resolved a batch at a time: every key in a batch is hashed
+ * and its slots prefetched before any of them are examined, so the
+ * cache misses of the whole batch are serviced in parallel. This is
+ * much faster than individual lookups when the map doesn't fit in
+ * cache.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `keys` :: Array of `n` keys to look up.
+ * @param `values` :: Array of `n` values, filled in with the value for
+ * each key, or `NULL` if the key isn't present.
+ * @param `n` :: Number of keys to look up.
+ * @return The number of keys which were present.
+ */
+size_t hashmap_get_many(struct hashmap* map,
+                        void**          keys,
+                        void**          values,
+                        size_t          n);
+
+/**
+ * Removes the entry for `key`, if there is one.
+ *
+ * If this brings the load below the map's shrink threshold (see
+ * `hashmap_set_shrink_threshold()`), the map is shrunk, which moves
+ * entries within the pool and so invalidates iterators. To remove
+ * entries while iterating, use `hashmap_retain()` instead.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to remove.
+ */
 void hashmap_remove(struct hashmap* map, void* key);
 
+/**
+ * `hashmap_remove()` with a hash computed by the caller, as described
+ * for `hashmap_set_prehashed()`.
+ */
+void
+hashmap_remove_prehashed(struct hashmap* map, void* key, uint64_t key_hash);
+
+/**
+ * Gathers statistics about a hashmap. This walks every slot of the
+ * table, so it takes time proportional to the map's capacity.
+ *
+ * Entries still waiting in a table being migrated are included, with
+ * probe lengths measured in that table.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `stats` :: Filled in with the map's statistics.
+ */
+void hashmap_stats(const struct hashmap* map, struct hashmap_stats* stats);
+
+/**
+ * Writes a human-readable summary of `stats`, including the probe
+ * length histogram, to `stream`.
+ *
+ * @param `stats` :: Statistics from `hashmap_stats()`.
+ * @param `stream` :: Stream to write to.
+ */
+void hashmap_stats_print(const struct hashmap_stats* stats, FILE* stream);
+
 struct hashmap_iter hashmap_iter(struct hashmap* map);
 
 int hashmap_iter_next(struct hashmap_iter* iter);
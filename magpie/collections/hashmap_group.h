@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Control byte groups shared by the open-addressing hashmaps.
+ *
+ * A group is a window of HASHMAP_GROUP_WIDTH consecutive control bytes
+ * (see `enum hashmap_ctrl`). Matching a group against a tag yields a
+ * bitmask with one bit per matching slot, which is walked with
+ * hashmap_mask_first()/hashmap_mask_next(). SSE2 is used where
+ * available, otherwise eight bytes are matched at a time in a 64-bit
+ * word.
+ */
+
+#ifndef MAGPIE_HASHMAP_GROUP_H
+#define MAGPIE_HASHMAP_GROUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <magpie/collections/hashmap.h>
+
+#if defined(__SSE2__)
+#    include <emmintrin.h>
+#    define HASHMAP_GROUP_WIDTH 16
+#else
+#    define HASHMAP_GROUP_WIDTH 8
+#endif
+
+#if defined(__SSE2__)
+
+typedef __m128i  hashmap_group;
+typedef uint32_t hashmap_group_mask;
+
+static inline hashmap_group
+hashmap_group_load(const uint8_t* ctrl)
+{
+    return _mm_loadu_si128((const __m128i*)ctrl);
+}
+
+static inline hashmap_group_mask
+hashmap_group_match(hashmap_group g, uint8_t tag)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)tag), g));
+}
+
+static inline hashmap_group_mask
+hashmap_group_match_empty(hashmap_group g)
+{
+    return hashmap_group_match(g, HASHMAP_CTRL_EMPTY);
+}
+
+static inline hashmap_group_mask
+hashmap_group_match_free(hashmap_group g)
+{
+    /* empty and deleted slots are the only ones with the high bit set */
+    return _mm_movemask_epi8(g);
+}
+
+static inline size_t
+hashmap_mask_first(hashmap_group_mask m)
+{
+    return __builtin_ctz(m);
+}
+
+static inline size_t
+hashmap_mask_leading_slots(hashmap_group_mask m)
+{
+    return m == 0 ? HASHMAP_GROUP_WIDTH
+                  : __builtin_clz(m) - (32 - HASHMAP_GROUP_WIDTH);
+}
+
+#else
+
+/* Portable fallback: treat 8 control bytes as one 64-bit word */
+typedef uint64_t hashmap_group;
+typedef uint64_t hashmap_group_mask;
+
+#    define HASHMAP_GROUP_LSBS 0x0101010101010101ULL
+#    define HASHMAP_GROUP_MSBS 0x8080808080808080ULL
+
+static inline hashmap_group
+hashmap_group_load(const uint8_t* ctrl)
+{
+    uint64_t g;
+
+    memcpy(&g, ctrl, sizeof(g));
+#    if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    g = __builtin_bswap64(g);
+#    endif
+
+    return g;
+}
+
+static inline hashmap_group_mask
+hashmap_group_match(hashmap_group g, uint8_t tag)
+{
+    /* May report a false positive in a byte following a true match;
+     * callers always confirm a match against the key itself */
+    uint64_t x = g ^ (HASHMAP_GROUP_LSBS * tag);
+    return (x - HASHMAP_GROUP_LSBS) & ~x & HASHMAP_GROUP_MSBS;
+}
+
+static inline hashmap_group_mask
+hashmap_group_match_empty(hashmap_group g)
+{
+    /* EMPTY is the only control byte with bit 7 set and bit 1 clear */
+    return g & ~(g << 6) & HASHMAP_GROUP_MSBS;
+}
+
+static inline hashmap_group_mask
+hashmap_group_match_free(hashmap_group g)
+{
+    return g & HASHMAP_GROUP_MSBS;
+}
+
+static inline size_t
+hashmap_mask_first(hashmap_group_mask m)
+{
+    return __builtin_ctzll(m) >> 3;
+}
+
+static inline size_t
+hashmap_mask_leading_slots(hashmap_group_mask m)
+{
+    return m == 0 ? HASHMAP_GROUP_WIDTH : __builtin_clzll(m) >> 3;
+}
+
+#endif
+
+static inline hashmap_group_mask
+hashmap_mask_next(hashmap_group_mask m)
+{
+    return m & (m - 1);
+}
+
+static inline size_t
+hashmap_mask_trailing_slots(hashmap_group_mask m)
+{
+    return m == 0 ? HASHMAP_GROUP_WIDTH : hashmap_mask_first(m);
+}
+
+/* The 7-bit tag stored in the control byte of a full slot */
+static inline uint8_t
+hashmap_hash_tag(uint64_t hash)
+{
+    return hash & 0x7F;
+}
+
+static inline int
+hashmap_ctrl_is_full(uint8_t ctrl)
+{
+    return (ctrl & 0x80) == 0;
+}
+
+/* The number of slots which may be filled before a table of
+ * `capacity` slots must be rehashed */
+static inline size_t
+hashmap_max_load(size_t capacity)
+{
+    size_t load = capacity * MAGPIE_HASHMAP_LOAD_THRESHOLD;
+
+    /* always leave at least one empty slot so probing terminates */
+    return load < capacity ? load : capacity - 1;
+}
+
+/* Sets the control byte for `slot` in a table of `capacity` slots */
+static inline void
+hashmap_ctrl_set(uint8_t* ctrl, size_t capacity, size_t slot, uint8_t value)
+{
+    ctrl[slot] = value;
+
+    /* keep the cloned bytes past the end in sync */
+    if (slot < HASHMAP_GROUP_WIDTH - 1) {
+        ctrl[capacity + slot] = value;
+    }
+}
+
+/*
+ * Whether the full slot `slot` can be marked empty when its entry is
+ * removed, rather than left as a tombstone. That's the case if every
+ * window of HASHMAP_GROUP_WIDTH slots covering it contains an empty
+ * slot, since no probe can then ever have continued past it.
+ */
+static inline int
+hashmap_ctrl_can_empty(const uint8_t* ctrl, size_t capacity, size_t slot)
+{
+    const size_t       width = HASHMAP_GROUP_WIDTH;
+    size_t             before;
+    hashmap_group      g;
+    hashmap_group_mask empty_before;
+    hashmap_group_mask empty_after;
+
+    before = slot >= width ? slot - width : slot + capacity - width;
+
+    g            = hashmap_group_load(ctrl + before);
+    empty_before = hashmap_group_match_empty(g);
+    g            = hashmap_group_load(ctrl + slot);
+    empty_after  = hashmap_group_match_empty(g);
+
+    return hashmap_mask_leading_slots(empty_before)
+               + hashmap_mask_trailing_slots(empty_after)
+           < width;
+}
+
+/* murmur3's 64-bit finalizer */
+static inline uint64_t
+hashmap_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+#endif /* MAGPIE_HASHMAP_GROUP_H */
@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_HASHMAP_TEMPLATE_H
+#define MAGPIE_HASHMAP_TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <magpie/collections/hashmap.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/ebuf.h>
+
+/**
+ * Defines a hashmap specialized for one key and value type.
+ *
+ * The generated map uses the same open-addressing scheme as `struct
+ * hashmap`, but stores keys and values by value in its slots and calls
+ * `HASH_FN` and `EQ_FN` directly, so both can be inlined. Every
+ * function is `static inline`, so the macro can be expanded in a
+ * header.
+ *
+ * `MAGPIE_HASHMAP_DEFINE(u64map, uint64_t, uint64_t, hash_u64, eq_u64)`
+ * defines:
+ *
+ * - `struct u64map` and `struct u64map_entry { key; value; }`
+ * - `int u64map_init(struct u64map* map)`
+ * - `int u64map_init_with_capacity(struct u64map* map, size_t n)`
+ * - `void u64map_destroy(struct u64map* map)`
+ * - `int u64map_set(struct u64map* map, uint64_t key, uint64_t value)`
+ * - `uint64_t* u64map_lookup(struct u64map* map, uint64_t key)`, valid
+ *   until the next call to `u64map_set()`
+ * - `int u64map_get(struct u64map* map, uint64_t key, uint64_t* value)`
+ * - `int u64map_remove(struct u64map* map, uint64_t key)`
+ * - `struct u64map_iter`, with `u64map_iter()`, `u64map_iter_next()`
+ *   and `u64map_iter_get()` as for `struct hashmap`
+ *
+ * Functions returning `int` return 0 on error or if the key wasn't
+ * found.
+ *
+ * @param `NAME` :: Name of the map type, and prefix of its functions.
+ * @param `KEY_T` :: Key type.
+ * @param `VALUE_T` :: Value type.
+ * @param `HASH_FN` :: Function or macro taking a `KEY_T` and returning
+ * a `uint64_t` hash. It is passed through a finalizer before use, so
+ * needn't mix its low bits well.
+ * @param `EQ_FN` :: Function or macro taking two `KEY_T`s and
+ * returning non-zero if they are equal.
+ */
+#define MAGPIE_HASHMAP_DEFINE(NAME, KEY_T, VALUE_T, HASH_FN, EQ_FN)           \
+    struct NAME##_entry {                                                     \
+        KEY_T   key;                                                          \
+        VALUE_T value;                                                        \
+    };                                                                        \
+                                                                              \
+    struct NAME {                                                             \
+        uint8_t*             ctrl;                                            \
+        struct NAME##_entry* slots;                                           \
+        size_t               capacity;                                        \
+        size_t               n_entries;                                       \
+        size_t               growth_left;                                     \
+    };                                                                        \
+                                                                              \
+    struct NAME##_iter {                                                      \
+        struct NAME* map;                                                     \
+        ssize_t      slot;                                                    \
+    };                                                                        \
+                                                                              \
+    static inline uint64_t NAME##_impl_hash(KEY_T key)                        \
+    {                                                                         \
+        return hashmap_mix64(HASH_FN(key));                                   \
+    }                                                                         \
+                                                                              \
+    static inline size_t NAME##_impl_probe_start(const struct NAME* map,      \
+                                                 uint64_t           hash)     \
+    {                                                                         \
+        return (hash >> 7) & (map->capacity - 1);                             \
+    }                                                                         \
+                                                                              \
+    static inline size_t NAME##_impl_probe_next(const struct NAME* map,       \
+                                                size_t             pos)       \
+    {                                                                         \
+        return (pos + HASHMAP_GROUP_WIDTH) & (map->capacity - 1);             \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_impl_alloc(struct NAME* map, size_t capacity)    \
+    {                                                                         \
+        size_t   ctrl_bytes = capacity + HASHMAP_GROUP_WIDTH - 1;             \
+        uint8_t* ctrl       = malloc(ctrl_bytes);                             \
+        struct NAME##_entry* slots = malloc(sizeof(*slots) * capacity);       \
+                                                                              \
+        if (ctrl == NULL || slots == NULL) {                                  \
+            ebuf_push("failed to allocate hashmap table",                     \
+                      __func__,                                               \
+                      __LINE__,                                               \
+                      map);                                                   \
+            free(ctrl);                                                       \
+            free(slots);                                                      \
+            return 0;                                                         \
+        }                                                                     \
+                                                                              \
+        memset(ctrl, HASHMAP_CTRL_EMPTY, ctrl_bytes);                         \
+                                                                              \
+        map->ctrl        = ctrl;                                              \
+        map->slots       = slots;                                             \
+        map->capacity    = capacity;                                          \
+        map->growth_left = hashmap_max_load(capacity);                        \
+                                                                              \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline ssize_t NAME##_impl_find(const struct NAME* map,            \
+                                           KEY_T              key,            \
+                                           uint64_t           hash)           \
+    {                                                                         \
+        uint8_t tag = hashmap_hash_tag(hash);                                 \
+        size_t  pos = NAME##_impl_probe_start(map, hash);                     \
+                                                                              \
+        for (size_t probed = 0; probed < map->capacity;                       \
+             probed += HASHMAP_GROUP_WIDTH) {                                 \
+            hashmap_group      g = hashmap_group_load(map->ctrl + pos);       \
+            hashmap_group_mask m = hashmap_group_match(g, tag);               \
+                                                                              \
+            while (m) {                                                       \
+                size_t slot = (pos + hashmap_mask_first(m))                   \
+                              & (map->capacity - 1);                          \
+                                                                              \
+                if (EQ_FN(map->slots[slot].key, key)) {                       \
+                    return slot;                                              \
+                }                                                             \
+                                                                              \
+                m = hashmap_mask_next(m);                                     \
+            }                                                                 \
+                                                                              \
+            if (hashmap_group_match_empty(g)) {                               \
+                break;                                                        \
+            }                                                                 \
+                                                                              \
+            pos = NAME##_impl_probe_next(map, pos);                           \
+        }                                                                     \
+                                                                              \
+        return -1;                                                            \
+    }                                                                         \
+                                                                              \
+    /* Inserts a key known not to be in the map, which has room for it */     \
+    static inline void NAME##_impl_place(struct NAME* map,                    \
+                                         KEY_T        key,                    \
+                                         VALUE_T      value,                  \
+                                         uint64_t     hash)                   \
+    {                                                                         \
+        size_t             pos = NAME##_impl_probe_start(map, hash);          \
+        uint8_t            tag = hashmap_hash_tag(hash);                      \
+        size_t             slot;                                              \
+        hashmap_group_mask m;                                                 \
+                                                                              \
+        while (!(m = hashmap_group_match_free(                                \
+                     hashmap_group_load(map->ctrl + pos)))) {                 \
+            pos = NAME##_impl_probe_next(map, pos);                           \
+        }                                                                     \
+                                                                              \
+        slot = (pos + hashmap_mask_first(m)) & (map->capacity - 1);           \
+                                                                              \
+        if (map->ctrl[slot] == HASHMAP_CTRL_EMPTY) {                          \
+            map->growth_left--;                                               \
+        }                                                                     \
+                                                                              \
+        hashmap_ctrl_set(map->ctrl, map->capacity, slot, tag);                \
+        map->slots[slot].key   = key;                                         \
+        map->slots[slot].value = value;                                       \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_impl_resize(struct NAME* map, size_t capacity)   \
+    {                                                                         \
+        struct NAME old = *map;                                               \
+                                                                              \
+        if (!NAME##_impl_alloc(map, capacity)) {                              \
+            *map = old;                                                       \
+            return 0;                                                         \
+        }                                                                     \
+                                                                              \
+        for (size_t i = 0; i < old.capacity; i++) {                           \
+            if (hashmap_ctrl_is_full(old.ctrl[i])) {                          \
+                KEY_T key = old.slots[i].key;                                 \
+                                                                              \
+                NAME##_impl_place(map,                                        \
+                                  key,                                        \
+                                  old.slots[i].value,                         \
+                                  NAME##_impl_hash(key));                     \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        free(old.ctrl);                                                       \
+        free(old.slots);                                                      \
+                                                                              \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_init_with_capacity(struct NAME* map,             \
+                                                size_t       n_entries)       \
+    {                                                                         \
+        size_t capacity = HASHMAP_GROUP_WIDTH;                                \
+                                                                              \
+        while (hashmap_max_load(capacity) < n_entries) {                      \
+            capacity *= 2;                                                    \
+        }                                                                     \
+                                                                              \
+        map->n_entries = 0;                                                   \
+                                                                              \
+        return NAME##_impl_alloc(map, capacity);                              \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_init(struct NAME* map)                           \
+    {                                                                         \
+        size_t n_entries = hashmap_max_load(MAGPIE_HASHMAP_INITIAL_BUCKETS);  \
+        return NAME##_init_with_capacity(map, n_entries);                     \
+    }                                                                         \
+                                                                              \
+    static inline void NAME##_destroy(struct NAME* map)                       \
+    {                                                                         \
+        free(map->ctrl);                                                      \
+        free(map->slots);                                                     \
+                                                                              \
+        map->ctrl      = NULL;                                                \
+        map->slots     = NULL;                                                \
+        map->capacity  = 0;                                                   \
+        map->n_entries = 0;                                                   \
+    }                                                                         \
+                                                                              \
+    static inline VALUE_T* NAME##_lookup(struct NAME* map, KEY_T key)         \
+    {                                                                         \
+        ssize_t slot = NAME##_impl_find(map, key, NAME##_impl_hash(key));     \
+        return slot < 0 ? NULL : &map->slots[slot].value;                     \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_get(struct NAME* map, KEY_T key, VALUE_T* value) \
+    {                                                                         \
+        VALUE_T* found = NAME##_lookup(map, key);                             \
+                                                                              \
+        if (found == NULL) {                                                  \
+            return 0;                                                         \
+        }                                                                     \
+                                                                              \
+        *value = *found;                                                      \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_set(struct NAME* map, KEY_T key, VALUE_T value)  \
+    {                                                                         \
+        uint64_t hash = NAME##_impl_hash(key);                                \
+        ssize_t  slot = NAME##_impl_find(map, key, hash);                     \
+                                                                              \
+        if (slot >= 0) {                                                      \
+            map->slots[slot].value = value;                                   \
+            return 1;                                                         \
+        }                                                                     \
+                                                                              \
+        if (map->growth_left == 0) {                                          \
+            /* If most of the used slots are tombstones, rehashing at the     \
+             * same capacity is enough to free them up */                     \
+            size_t capacity                                                   \
+                = map->n_entries <= hashmap_max_load(map->capacity) / 2       \
+                      ? map->capacity                                         \
+                      : map->capacity * 2;                                    \
+                                                                              \
+            if (!NAME##_impl_resize(map, capacity)) {                         \
+                return 0;                                                     \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        NAME##_impl_place(map, key, value, hash);                             \
+        map->n_entries++;                                                     \
+                                                                              \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_remove(struct NAME* map, KEY_T key)              \
+    {                                                                         \
+        ssize_t slot = NAME##_impl_find(map, key, NAME##_impl_hash(key));     \
+        uint8_t ctrl = HASHMAP_CTRL_DELETED;                                  \
+                                                                              \
+        if (slot < 0) {                                                       \
+            return 0;                                                         \
+        }                                                                     \
+                                                                              \
+        if (hashmap_ctrl_can_empty(map->ctrl, map->capacity, slot)) {         \
+            ctrl = HASHMAP_CTRL_EMPTY;                                        \
+            map->growth_left++;                                               \
+        }                                                                     \
+                                                                              \
+        hashmap_ctrl_set(map->ctrl, map->capacity, slot, ctrl);               \
+        map->n_entries--;                                                     \
+                                                                              \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline struct NAME##_iter NAME##_iter(struct NAME* map)            \
+    {                                                                         \
+        struct NAME##_iter iter = { .map = map, .slot = -1 };                 \
+        return iter;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline int NAME##_iter_next(struct NAME##_iter* iter)              \
+    {                                                                         \
+        while ((size_t)++iter->slot < iter->map->capacity) {                  \
+            if (hashmap_ctrl_is_full(iter->map->ctrl[iter->slot])) {          \
+                return 1;                                                     \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        iter->slot = iter->map->capacity;                                     \
+        return 0;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline struct NAME##_entry* NAME##_iter_get(                       \
+        struct NAME##_iter* iter)                                             \
+    {                                                                         \
+        if (iter->slot < 0 || (size_t)iter->slot >= iter->map->capacity) {    \
+            return NULL;                                                      \
+        }                                                                     \
+                                                                              \
+        return &iter->map->slots[iter->slot];                                 \
+    }                                                                         \
+                                                                              \
+    /* Redeclared so that the caller's semicolon ends a declaration */        \
+    static inline struct NAME##_entry* NAME##_iter_get(                       \
+        struct NAME##_iter* iter)
+
+#endif /* MAGPIE_HASHMAP_TEMPLATE_H */
@@ -0,0 +1,561 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/collections/hashset.h>
+#include <magpie/ebuf.h>
+
+/* Number of keys hashed or probed, with their slots prefetched, before
+ * any of them are examined */
+#define BATCH_SIZE 16
+
+static inline uint64_t
+key_hash(const struct hashset* set, void* key)
+{
+    /* mix so that weak hash functions still spread over the table */
+    return hashmap_mix64(set->hash(&key));
+}
+
+static inline size_t
+probe_start(const struct hashset* set, uint64_t hash)
+{
+    return (hash >> 7) & (set->capacity - 1);
+}
+
+static inline size_t
+probe_next(const struct hashset* set, size_t pos)
+{
+    return (pos + HASHMAP_GROUP_WIDTH) & (set->capacity - 1);
+}
+
+static inline void
+prefetch_probe(const struct hashset* set, uint64_t hash)
+{
+    size_t pos = probe_start(set, hash);
+
+    __builtin_prefetch(set->ctrl + pos);
+    __builtin_prefetch(set->slots + pos);
+}
+
+static size_t
+capacity_for(size_t n_entries)
+{
+    size_t capacity = HASHMAP_GROUP_WIDTH;
+
+    while (hashmap_max_load(capacity) < n_entries) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+static int
+table_alloc(struct hashset* set, size_t capacity)
+{
+    size_t                ctrl_bytes = capacity + HASHMAP_GROUP_WIDTH - 1;
+    uint8_t*              ctrl       = malloc(ctrl_bytes);
+    struct hashset_entry* slots      = malloc(sizeof(*slots) * capacity);
+
+    if (ctrl == NULL || slots == NULL) {
+        EBUF_PUSH("failed to allocate hashset table", set);
+        free(ctrl);
+        free(slots);
+        return 0;
+    }
+
+    memset(ctrl, HASHMAP_CTRL_EMPTY, ctrl_bytes);
+
+    set->ctrl        = ctrl;
+    set->slots       = slots;
+    set->capacity    = capacity;
+    set->growth_left = hashmap_max_load(capacity);
+
+    return 1;
+}
+
+static ssize_t
+find(const struct hashset* set, void* key, uint64_t hash)
+{
+    uint8_t tag = hashmap_hash_tag(hash);
+    size_t  pos;
+
+    if (set->capacity == 0) {
+        return -1;
+    }
+
+    pos = probe_start(set, hash);
+
+    for (size_t probed = 0; probed < set->capacity;
+         probed += HASHMAP_GROUP_WIDTH) {
+        hashmap_group      g = hashmap_group_load(set->ctrl + pos);
+        hashmap_group_mask m = hashmap_group_match(g, tag);
+
+        while (m) {
+            size_t slot = (pos + hashmap_mask_first(m)) & (set->capacity - 1);
+
+            if (set->slots[slot].hash == hash
+                && set->compare(&set->slots[slot].key, &key) == 0) {
+                return slot;
+            }
+
+            m = hashmap_mask_next(m);
+        }
+
+        if (hashmap_group_match_empty(g)) {
+            break;
+        }
+
+        pos = probe_next(set, pos);
+    }
+
+    return -1;
+}
+
+/* Inserts a key known not to be in the set, which has room for it */
+static void
+place(struct hashset* set, void* key, uint64_t hash)
+{
+    size_t             pos = probe_start(set, hash);
+    size_t             slot;
+    hashmap_group_mask m;
+
+    while (!(m = hashmap_group_match_free(
+                 hashmap_group_load(set->ctrl + pos)))) {
+        pos = probe_next(set, pos);
+    }
+
+    slot = (pos + hashmap_mask_first(m)) & (set->capacity - 1);
+
+    if (set->ctrl[slot] == HASHMAP_CTRL_EMPTY) {
+        set->growth_left--;
+    }
+
+    hashmap_ctrl_set(set->ctrl, set->capacity, slot, hashmap_hash_tag(hash));
+    set->slots[slot].key  = key;
+    set->slots[slot].hash = hash;
+    set->n_entries++;
+}
+
+static void
+erase(struct hashset* set, size_t slot)
+{
+    uint8_t ctrl = HASHMAP_CTRL_DELETED;
+
+    if (hashmap_ctrl_can_empty(set->ctrl, set->capacity, slot)) {
+        ctrl = HASHMAP_CTRL_EMPTY;
+        set->growth_left++;
+    }
+
+    hashmap_ctrl_set(set->ctrl, set->capacity, slot, ctrl);
+    set->n_entries--;
+}
+
+static int
+resize(struct hashset* set, size_t capacity)
+{
+    struct hashset old = *set;
+
+    if (!table_alloc(set, capacity)) {
+        *set = old;
+        return 0;
+    }
+
+    set->n_entries = 0;
+
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (hashmap_ctrl_is_full(old.ctrl[i])) {
+            place(set, old.slots[i].key, old.slots[i].hash);
+        }
+    }
+
+    free(old.ctrl);
+    free(old.slots);
+
+    return 1;
+}
+
+/* Makes sure `n` more keys can be placed without rehashing */
+static int
+make_room(struct hashset* set, size_t n)
+{
+    size_t capacity;
+
+    if (set->growth_left >= n) {
+        return 1;
+    }
+
+    capacity = capacity_for(set->n_entries + n);
+
+    /* If most of the used slots are tombstones, rehashing at the same
+     * capacity is enough to free them up */
+    if (capacity < set->capacity) {
+        capacity = set->capacity;
+    }
+    else if (capacity == set->capacity
+             && set->n_entries > hashmap_max_load(set->capacity) / 2) {
+        capacity *= 2;
+    }
+
+    return resize(set, capacity);
+}
+
+static int
+insert(struct hashset* set, void* key, uint64_t hash)
+{
+    if (find(set, key, hash) >= 0) {
+        return 1;
+    }
+
+    if (!make_room(set, 1)) {
+        return 0;
+    }
+
+    place(set, key, hash);
+    return 1;
+}
+
+/* Copies `src`'s table into `out`, which must not have one */
+static int
+clone(struct hashset* out, const struct hashset* src)
+{
+    if (src->capacity == 0) {
+        return 1;
+    }
+
+    if (!table_alloc(out, src->capacity)) {
+        return 0;
+    }
+
+    memcpy(out->ctrl, src->ctrl, src->capacity + HASHMAP_GROUP_WIDTH - 1);
+    memcpy(out->slots, src->slots, sizeof(*src->slots) * src->capacity);
+
+    out->n_entries   = src->n_entries;
+    out->growth_left = src->growth_left;
+
+    return 1;
+}
+
+/*
+ * Calls `visit` with each entry of `source` and the slot `target`
+ * holds it in, or -1 if `target` doesn't hold it. Entries are gathered
+ * a batch at a time and their probes into `target` prefetched before
+ * any of them are made, so the cache misses of a batch overlap.
+ * Stops early, returning 0, if `visit` returns 0.
+ */
+static int
+probe_all(const struct hashset* source,
+          const struct hashset* target,
+          int (*visit)(const struct hashset_entry* entry,
+                       ssize_t                     slot,
+                       void*                       ctx),
+          void* ctx)
+{
+    const struct hashset_entry* batch[BATCH_SIZE];
+    size_t                      n = 0;
+
+    for (size_t i = 0; i <= source->capacity; i++) {
+        if (i < source->capacity && hashmap_ctrl_is_full(source->ctrl[i])) {
+            batch[n++] = &source->slots[i];
+
+            if (target->capacity > 0) {
+                prefetch_probe(target, source->slots[i].hash);
+            }
+        }
+
+        if (n == BATCH_SIZE || (i == source->capacity && n > 0)) {
+            for (size_t j = 0; j < n; j++) {
+                ssize_t slot = find(target, batch[j]->key, batch[j]->hash);
+
+                if (!visit(batch[j], slot, ctx)) {
+                    return 0;
+                }
+            }
+
+            n = 0;
+        }
+    }
+
+    return 1;
+}
+
+static int
+add_missing(const struct hashset_entry* entry, ssize_t slot, void* ctx)
+{
+    if (slot < 0) {
+        place(ctx, entry->key, entry->hash);
+    }
+
+    return 1;
+}
+
+static int
+add_present(const struct hashset_entry* entry, ssize_t slot, void* ctx)
+{
+    if (slot >= 0) {
+        place(ctx, entry->key, entry->hash);
+    }
+
+    return 1;
+}
+
+static int
+erase_present(const struct hashset_entry* entry, ssize_t slot, void* ctx)
+{
+    (void)entry;
+
+    if (slot >= 0) {
+        erase(ctx, slot);
+    }
+
+    return 1;
+}
+
+static int
+require_present(const struct hashset_entry* entry, ssize_t slot, void* ctx)
+{
+    (void)entry;
+    (void)ctx;
+
+    return slot >= 0;
+}
+
+int
+hashset_init(struct hashset* set,
+             uint64_t (*hash)(const void*),
+             int (*compare)(const void*, const void*))
+{
+    return hashset_init_with_capacity(set, 0, hash, compare);
+}
+
+int
+hashset_init_with_capacity(struct hashset* set,
+                           size_t          n_entries,
+                           uint64_t (*hash)(const void*),
+                           int (*compare)(const void*, const void*))
+{
+    set->ctrl        = NULL;
+    set->slots       = NULL;
+    set->capacity    = 0;
+    set->n_entries   = 0;
+    set->growth_left = 0;
+    set->hash        = hash;
+    set->compare     = compare;
+
+    if (n_entries == 0) {
+        return 1;
+    }
+
+    return table_alloc(set, capacity_for(n_entries));
+}
+
+void
+hashset_destroy(struct hashset* set)
+{
+    free(set->ctrl);
+    free(set->slots);
+
+    set->ctrl        = NULL;
+    set->slots       = NULL;
+    set->capacity    = 0;
+    set->n_entries   = 0;
+    set->growth_left = 0;
+}
+
+int
+hashset_reserve(struct hashset* set, size_t n_entries)
+{
+    if (n_entries <= set->n_entries) {
+        return 1;
+    }
+
+    return make_room(set, n_entries - set->n_entries);
+}
+
+int
+hashset_insert(struct hashset* set, void* key)
+{
+    return insert(set, key, key_hash(set, key));
+}
+
+int
+hashset_insert_array(struct hashset* set, struct array* keys)
+{
+    uint64_t hashes[BATCH_SIZE];
+
+    if (!hashset_reserve(set, set->n_entries + keys->length)) {
+        return 0;
+    }
+
+    for (size_t start = 0; start < keys->length; start += BATCH_SIZE) {
+        size_t n = keys->length - start;
+
+        if (n > BATCH_SIZE) {
+            n = BATCH_SIZE;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            hashes[i] = key_hash(set, keys->elements[start + i]);
+            prefetch_probe(set, hashes[i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            void* key = keys->elements[start + i];
+
+            /* room was reserved for every key, so this can't fail */
+            if (find(set, key, hashes[i]) < 0) {
+                place(set, key, hashes[i]);
+            }
+        }
+    }
+
+    return 1;
+}
+
+int
+hashset_contains(const struct hashset* set, void* key)
+{
+    return set->capacity > 0 && find(set, key, key_hash(set, key)) >= 0;
+}
+
+int
+hashset_remove(struct hashset* set, void* key)
+{
+    ssize_t slot;
+
+    if (set->capacity == 0) {
+        return 0;
+    }
+
+    slot = find(set, key, key_hash(set, key));
+
+    if (slot < 0) {
+        return 0;
+    }
+
+    erase(set, slot);
+    return 1;
+}
+
+int
+hashset_union(struct hashset* out, struct hashset* a, struct hashset* b)
+{
+    struct hashset* large = a->n_entries >= b->n_entries ? a : b;
+    struct hashset* small = large == a ? b : a;
+
+    hashset_init(out, a->hash, a->compare);
+
+    if (!clone(out, large)) {
+        return 0;
+    }
+
+    if (!make_room(out, small->n_entries)) {
+        hashset_destroy(out);
+        return 0;
+    }
+
+    probe_all(small, out, add_missing, out);
+    return 1;
+}
+
+int
+hashset_intersection(struct hashset* out, struct hashset* a, struct hashset* b)
+{
+    struct hashset* large = a->n_entries >= b->n_entries ? a : b;
+    struct hashset* small = large == a ? b : a;
+
+    if (!hashset_init_with_capacity(
+            out, small->n_entries, a->hash, a->compare)) {
+        return 0;
+    }
+
+    probe_all(small, large, add_present, out);
+    return 1;
+}
+
+int
+hashset_difference(struct hashset* out, struct hashset* a, struct hashset* b)
+{
+    if (a->n_entries <= b->n_entries) {
+        if (!hashset_init_with_capacity(
+                out, a->n_entries, a->hash, a->compare)) {
+            return 0;
+        }
+
+        probe_all(a, b, add_missing, out);
+        return 1;
+    }
+
+    /* Copy `a` and remove what `b` has */
+    hashset_init(out, a->hash, a->compare);
+
+    if (!clone(out, a)) {
+        return 0;
+    }
+
+    probe_all(b, out, erase_present, out);
+
+    /* a table mostly emptied is worth rebuilding to fit */
+    if (out->capacity > HASHMAP_GROUP_WIDTH
+        && out->n_entries < hashmap_max_load(out->capacity) / 4) {
+        resize(out, capacity_for(out->n_entries));
+    }
+
+    return 1;
+}
+
+int
+hashset_is_subset(const struct hashset* a, const struct hashset* b)
+{
+    if (a->n_entries > b->n_entries) {
+        return 0;
+    }
+
+    return probe_all(a, b, require_present, NULL);
+}
+
+struct hashset_iter
+hashset_iter(struct hashset* set)
+{
+    struct hashset_iter iter = { .set = set, .slot = -1 };
+    return iter;
+}
+
+int
+hashset_iter_next(struct hashset_iter* iter)
+{
+    while ((size_t)++iter->slot < iter->set->capacity) {
+        if (hashmap_ctrl_is_full(iter->set->ctrl[iter->slot])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void*
+hashset_iter_get(struct hashset_iter* iter)
+{
+    return iter->set->slots[iter->slot].key;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_HASHSET_H
+#define MAGPIE_HASHSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <magpie/collections/array.h>
+
+/**
+ * A key in a hashset, with its hash (after mixing) so the set never
+ * needs to call the hash function again, and other sets can be probed
+ * for the key without hashing it.
+ */
+struct hashset_entry {
+    void*    key;
+    uint64_t hash;
+};
+
+/**
+ * A set of keys.
+ *
+ * The table works as `struct hashmap`'s does, with a control byte per
+ * slot holding a tag of the hash so that a group of slots can be
+ * matched against a key at once (see `hashmap_group.h`), but the slots
+ * hold the keys themselves. With no values, liveness flags or entry
+ * pool, an entry takes 16 bytes plus its control byte, half what a
+ * `struct hashmap` entry with a `NULL` value costs. No table is
+ * allocated until the first key is inserted.
+ *
+ * Keys are opaque and owned by the caller. As with `struct hashmap`,
+ * `hash` and `compare` are passed pointers to the keys.
+ *
+ * - `ctrl` :: Control bytes, `capacity` plus `HASHMAP_GROUP_WIDTH - 1`
+ *   mirrored bytes
+ * - `slots` :: Entries, one per slot
+ * - `capacity` :: Number of slots, a power of two, or 0 before anything
+ *   has been inserted
+ * - `n_entries` :: Number of keys
+ * - `growth_left` :: Number of empty slots which may be filled before
+ *   the table must be rehashed
+ * - `hash` :: Hash function
+ * - `compare` :: Comparison function, returning 0 if keys are equal
+ */
+struct hashset {
+    uint8_t*              ctrl;
+    struct hashset_entry* slots;
+    size_t                capacity;
+    size_t                n_entries;
+    size_t                growth_left;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
+struct hashset_iter {
+    struct hashset* set;
+    ssize_t         slot;
+};
+
+int hashset_init(struct hashset* set,
+                 uint64_t (*hash)(const void*),
+                 int (*compare)(const void*, const void*));
+
+/**
+ * Initializes a hashset with room for `n_entries` keys.
+ *
+ * @param `set` :: Pointer to the hashset.
+ * @param `n_entries` :: Number of keys to make room for.
+ * @param `hash` :: Hash function.
+ * @param `compare` :: Comparison function.
+ * @return 0 on error.
+ */
+int hashset_init_with_capacity(struct hashset* set,
+                               size_t          n_entries,
+                               uint64_t (*hash)(const void*),
+                               int (*compare)(const void*, const void*));
+
+void hashset_destroy(struct hashset* set);
+
+/**
+ * Makes room for the set to hold `n_entries` keys without rehashing.
+ *
+ * @param `set` :: Pointer to the hashset.
+ * @param `n_entries` :: Total number of keys to make room for.
+ * @return 0 on error.
+ */
+int hashset_reserve(struct hashset* set, size_t n_entries);
+
+/**
+ * Inserts `key`, unless an equal key is already present.
+ *
+ * @param `set` :: Pointer to the hashset.
+ * @param `key` :: Key to insert.
+ * @return 0 on error.
+ */
+int hashset_insert(struct hashset* set, void* key);
+
+/**
+ * Inserts every element of `keys`, as though by calling
+ * `hashset_insert()` on each.
+ *
+ * Room is reserved up front as though every key were new. Keys are
+ * then hashed a batch at a time, and the slots each will probe are
+ * prefetched before any of the batch is inserted.
+ *
+ * @param `set` :: Pointer to the hashset.
+ * @param `keys` :: Keys to insert.
+ * @return 0 on error, in which case only some of the keys may have
+ * been inserted.
+ */
+int hashset_insert_array(struct hashset* set, struct array* keys);
+
+/**
+ * @return Whether `key` is in the set.
+ */
+int hashset_contains(const struct hashset* set, void* key);
+
+/**
+ * Removes `key` from the set.
+ *
+ * @param `set` :: Pointer to the hashset.
+ * @param `key` :: Key to remove.
+ * @return 0 if `key` wasn't in the set.
+ */
+int hashset_remove(struct hashset* set, void* key);
+
+/*
+ * Set algebra. Each operation initializes `out` with the result, which
+ * holds the keys of `a` and `b` themselves, not copies; `out` must not
+ * be `a` or `b`, and must be destroyed by the caller. Both inputs must
+ * use the same hash and comparison functions.
+ *
+ * The operations iterate the smaller input and probe the larger, using
+ * the stored hashes, so keys are never rehashed, and probes are made a
+ * batch at a time with the slots they read prefetched. Where the larger
+ * input's keys are all part of the result, its table is copied
+ * wholesale rather than rebuilt.
+ */
+
+/**
+ * Computes the keys in `a`, `b` or both.
+ *
+ * @return 0 on error.
+ */
+int hashset_union(struct hashset* out, struct hashset* a, struct hashset* b);
+
+/**
+ * Computes the keys in both `a` and `b`.
+ *
+ * @return 0 on error.
+ */
+int hashset_intersection(struct hashset* out,
+                         struct hashset* a,
+                         struct hashset* b);
+
+/**
+ * Computes the keys in `a` but not in `b`.
+ *
+ * @return 0 on error.
+ */
+int hashset_difference(struct hashset* out,
+                       struct hashset* a,
+                       struct hashset* b);
+
+/**
+ * @return Whether every key in `a` is also in `b`.
+ */
+int hashset_is_subset(const struct hashset* a, const struct hashset* b);
+
+struct hashset_iter hashset_iter(struct hashset* set);
+
+int hashset_iter_next(struct hashset_iter* iter);
+
+void* hashset_iter_get(struct hashset_iter* iter);
+
+#endif /* MAGPIE_HASHSET_H */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/collections/intrusive_hashmap.h>
+#include <magpie/ebuf.h>
+
+static inline struct intrusive_hashmap_hook**
+bucket_for(struct intrusive_hashmap* map, uint64_t hash)
+{
+    /* mix so that weak hash functions still use every bucket */
+    return &map->buckets[hashmap_mix64(hash) & (map->n_buckets - 1)];
+}
+
+static inline void
+link_hook(struct intrusive_hashmap_hook** head,
+          struct intrusive_hashmap_hook*  hook)
+{
+    hook->next  = *head;
+    hook->pprev = head;
+
+    if (*head != NULL) {
+        (*head)->pprev = &hook->next;
+    }
+
+    *head = hook;
+}
+
+static inline void
+unlink_hook(struct intrusive_hashmap_hook* hook)
+{
+    *hook->pprev = hook->next;
+
+    if (hook->next != NULL) {
+        hook->next->pprev = hook->pprev;
+    }
+
+    hook->next  = NULL;
+    hook->pprev = NULL;
+}
+
+static struct intrusive_hashmap_hook*
+find(struct intrusive_hashmap* map, const void* key, uint64_t hash)
+{
+    struct intrusive_hashmap_hook* hook = *bucket_for(map, hash);
+
+    for (; hook != NULL; hook = hook->next) {
+        if (hook->hash == hash && map->compare(hook, key) == 0) {
+            return hook;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+resize_to(struct intrusive_hashmap* map, size_t n_buckets)
+{
+    struct intrusive_hashmap_hook** old_buckets   = map->buckets;
+    size_t                          old_n_buckets = map->n_buckets;
+    struct intrusive_hashmap_hook** buckets
+        = calloc(n_buckets, sizeof(*buckets));
+
+    if (buckets == NULL) {
+        EBUF_PUSH("failed to allocate hashmap buckets", map);
+        return 0;
+    }
+
+    map->buckets   = buckets;
+    map->n_buckets = n_buckets;
+
+    /* Hooks are relinked in place using their cached hashes */
+    for (size_t b = 0; b < old_n_buckets; b++) {
+        struct intrusive_hashmap_hook* hook = old_buckets[b];
+
+        while (hook != NULL) {
+            struct intrusive_hashmap_hook* next = hook->next;
+
+            link_hook(bucket_for(map, hook->hash), hook);
+            hook = next;
+        }
+    }
+
+    free(old_buckets);
+
+    return 1;
+}
+
+int
+intrusive_hashmap_init(
+    struct intrusive_hashmap* map,
+    uint64_t (*hash)(const void*),
+    int (*compare)(const struct intrusive_hashmap_hook*, const void*))
+{
+    map->buckets   = NULL;
+    map->n_buckets = 0;
+    map->n_entries = 0;
+    map->hash      = hash;
+    map->compare   = compare;
+
+    return resize_to(map, MAGPIE_INTRUSIVE_HASHMAP_INITIAL_BUCKETS);
+}
+
+void
+intrusive_hashmap_destroy(struct intrusive_hashmap* map)
+{
+    free(map->buckets);
+
+    map->buckets   = NULL;
+    map->n_buckets = 0;
+    map->n_entries = 0;
+}
+
+struct intrusive_hashmap_hook*
+intrusive_hashmap_insert(struct intrusive_hashmap*      map,
+                         struct intrusive_hashmap_hook* hook,
+                         const void*                    key)
+{
+    uint64_t                       hash = map->hash(key);
+    struct intrusive_hashmap_hook* old  = find(map, key, hash);
+
+    hook->hash = hash;
+
+    if (old != NULL) {
+        /* take the old hook's place in the chain */
+        hook->next  = old->next;
+        hook->pprev = old->pprev;
+        *hook->pprev = hook;
+
+        if (hook->next != NULL) {
+            hook->next->pprev = &hook->next;
+        }
+
+        old->next  = NULL;
+        old->pprev = NULL;
+
+        return old;
+    }
+
+    /* Growing is only an optimisation; if it fails the chains are just
+     * longer than they should be */
+    if (map->n_entries + 1
+        > map->n_buckets * MAGPIE_INTRUSIVE_HASHMAP_LOAD_THRESHOLD) {
+        resize_to(map, map->n_buckets * 2);
+    }
+
+    link_hook(bucket_for(map, hash), hook);
+    map->n_entries++;
+
+    return NULL;
+}
+
+struct intrusive_hashmap_hook*
+intrusive_hashmap_lookup(struct intrusive_hashmap* map, const void* key)
+{
+    return find(map, key, map->hash(key));
+}
+
+struct intrusive_hashmap_hook*
+intrusive_hashmap_remove(struct intrusive_hashmap* map, const void* key)
+{
+    struct intrusive_hashmap_hook* hook = find(map, key, map->hash(key));
+
+    if (hook != NULL) {
+        intrusive_hashmap_unlink(map, hook);
+    }
+
+    return hook;
+}
+
+void
+intrusive_hashmap_unlink(struct intrusive_hashmap*      map,
+                         struct intrusive_hashmap_hook* hook)
+{
+    unlink_hook(hook);
+    map->n_entries--;
+}
+
+struct intrusive_hashmap_iter
+intrusive_hashmap_iter(struct intrusive_hashmap* map)
+{
+    struct intrusive_hashmap_iter iter = {
+        .map    = map,
+        .bucket = 0,
+        .hook   = NULL,
+        .next   = map->n_buckets > 0 ? map->buckets[0] : NULL,
+    };
+
+    return iter;
+}
+
+int
+intrusive_hashmap_iter_next(struct intrusive_hashmap_iter* iter)
+{
+    struct intrusive_hashmap* map = iter->map;
+
+    /* `next` is read ahead so that the current hook can be unlinked */
+    while (iter->next == NULL) {
+        if (++iter->bucket >= map->n_buckets) {
+            iter->hook = NULL;
+            return 0;
+        }
+
+        iter->next = map->buckets[iter->bucket];
+    }
+
+    iter->hook = iter->next;
+    iter->next = iter->hook->next;
+
+    return 1;
+}
+
+struct intrusive_hashmap_hook*
+intrusive_hashmap_iter_get(struct intrusive_hashmap_iter* iter)
+{
+    return iter->hook;
+}
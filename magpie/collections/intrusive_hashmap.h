@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_INTRUSIVE_HASHMAP_H
+#define MAGPIE_INTRUSIVE_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MAGPIE_INTRUSIVE_HASHMAP_INITIAL_BUCKETS
+#    define MAGPIE_INTRUSIVE_HASHMAP_INITIAL_BUCKETS 64
+#endif
+
+/* Average chain length at which the bucket array is doubled */
+#ifndef MAGPIE_INTRUSIVE_HASHMAP_LOAD_THRESHOLD
+#    define MAGPIE_INTRUSIVE_HASHMAP_LOAD_THRESHOLD 1.0
+#endif
+
+/**
+ * Recovers a pointer to the object of type `TYPE` whose member `MEMBER`
+ * is the hook pointed to by `HOOK`.
+ */
+#define INTRUSIVE_HASHMAP_CONTAINER(HOOK, TYPE, MEMBER)                       \
+    ((TYPE*)((char*)(HOOK) - offsetof(TYPE, MEMBER)))
+
+/**
+ * Links an object into an intrusive hashmap. Embed one in each object
+ * to be stored, one per map the object may be in at a time. The map
+ * owns the hook's fields while the object is in it.
+ *
+ * - `next` :: Next hook in the same bucket
+ * - `pprev` :: The pointer which points to this hook, either a bucket
+ *   head or the previous hook's `next`, so a hook can be unlinked
+ *   without searching its bucket
+ * - `hash` :: Cached hash of the object's key
+ */
+struct intrusive_hashmap_hook {
+    struct intrusive_hashmap_hook*  next;
+    struct intrusive_hashmap_hook** pprev;
+    uint64_t                        hash;
+};
+
+/**
+ * A chained hashmap whose entries are hooks embedded in the caller's
+ * own objects, in the style of the Linux kernel's `hlist`.
+ *
+ * The map never allocates or frees anything on behalf of an entry, so
+ * objects can live in the caller's slabs or arenas, and inserting or
+ * removing one costs no more than relinking a few pointers. The only
+ * allocation is the bucket array, which is doubled once the average
+ * chain reaches `MAGPIE_INTRUSIVE_HASHMAP_LOAD_THRESHOLD`; if that
+ * fails, insertion carries on with longer chains, so insertion itself
+ * can't fail.
+ *
+ * The map doesn't know where the key is stored in an object, so keys
+ * are compared through a callback which is given a hook and a key.
+ *
+ * - `buckets` :: Head of each bucket's chain, `n_buckets` long
+ * - `n_buckets` :: Number of buckets (always a power of two)
+ * - `n_entries` :: Number of hooks in the map
+ */
+struct intrusive_hashmap {
+    struct intrusive_hashmap_hook** buckets;
+    size_t                          n_buckets;
+    size_t                          n_entries;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const struct intrusive_hashmap_hook*, const void*);
+};
+
+struct intrusive_hashmap_iter {
+    struct intrusive_hashmap*      map;
+    size_t                         bucket;
+    struct intrusive_hashmap_hook* hook;
+    struct intrusive_hashmap_hook* next;
+};
+
+/**
+ * Initializes an empty intrusive hashmap.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hash` :: Function for hashing a key. Receives the `key`
+ * argument given to the other functions, usually a pointer to the key.
+ * @param `compare` :: Function comparing the key of the object
+ * containing a hook with a key, returning zero if they are equal.
+ * @return 0 on error.
+ */
+int intrusive_hashmap_init(
+    struct intrusive_hashmap* map,
+    uint64_t (*hash)(const void*),
+    int (*compare)(const struct intrusive_hashmap_hook*, const void*));
+
+/**
+ * Deallocates an intrusive hashmap's buckets. The objects in it are
+ * left alone.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ */
+void intrusive_hashmap_destroy(struct intrusive_hashmap* map);
+
+/**
+ * Links `hook` into the map under `key`, which must be the key of the
+ * object containing `hook`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hook` :: Hook of the object to insert. Must not already be in
+ * a map.
+ * @param `key` :: The object's key.
+ * @return The hook of the object previously in the map under `key`,
+ * which is unlinked and replaced by `hook`, or `NULL` if there was
+ * none.
+ */
+struct intrusive_hashmap_hook*
+intrusive_hashmap_insert(struct intrusive_hashmap*      map,
+                         struct intrusive_hashmap_hook* hook,
+                         const void*                    key);
+
+/**
+ * Looks up the object stored under `key`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @return The object's hook, or `NULL` if there is none.
+ */
+struct intrusive_hashmap_hook*
+intrusive_hashmap_lookup(struct intrusive_hashmap* map, const void* key);
+
+/**
+ * Unlinks the object stored under `key`, if there is one.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to remove.
+ * @return The unlinked hook, or `NULL` if there was none.
+ */
+struct intrusive_hashmap_hook*
+intrusive_hashmap_remove(struct intrusive_hashmap* map, const void* key);
+
+/**
+ * Unlinks `hook`, which must be in `map`, without looking up its key.
+ * Takes constant time.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hook` :: Hook to unlink.
+ */
+void intrusive_hashmap_unlink(struct intrusive_hashmap*      map,
+                              struct intrusive_hashmap_hook* hook);
+
+/**
+ * Iterates over the hooks in a map. The current hook may be unlinked
+ * during iteration; nothing else may be inserted or removed.
+ */
+struct intrusive_hashmap_iter
+intrusive_hashmap_iter(struct intrusive_hashmap* map);
+
+int intrusive_hashmap_iter_next(struct intrusive_hashmap_iter* iter);
+
+struct intrusive_hashmap_hook*
+intrusive_hashmap_iter_get(struct intrusive_hashmap_iter* iter);
+
+#endif /* MAGPIE_INTRUSIVE_HASHMAP_H */
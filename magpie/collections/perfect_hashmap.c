@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/collections/perfect_hashmap.h>
+#include <magpie/ebuf.h>
+#include <magpie/hash.h>
+
+/* Fraction of buckets which are dense, and the fraction of keys (as a
+ * threshold on the high half of the hash) which go to them */
+#define DENSE_BUCKETS   0.3
+#define DENSE_THRESHOLD ((uint64_t)(0.6 * 4294967296.0))
+
+/* Give up on a seed when a bucket needs more pilots than this */
+#define MAX_PILOT    (1 << 20)
+#define MAX_ATTEMPTS 16
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+enum build_result {
+    BUILD_OK = 0,
+    BUILD_RETRY,
+    BUILD_DUPLICATE,
+    BUILD_NO_MEMORY,
+};
+
+/* Scratch space used while searching for pilots */
+struct builder {
+    uint64_t* hashes;
+    size_t*   positions;
+    size_t*   bucket_start;
+    size_t*   bucket_keys;
+    size_t*   order;
+    uint64_t* pilots;
+    uint8_t*  taken;
+    size_t*   candidate;
+};
+
+static inline uint64_t
+fastrange(uint64_t x, uint64_t range)
+{
+#if defined(__SIZEOF_INT128__)
+    return ((uint128)x * range) >> 64;
+#else
+    return ((x >> 32) * range) >> 32;
+#endif
+}
+
+static size_t
+bits_for(uint64_t value)
+{
+    size_t bits = 1;
+
+    while (bits < 64 && (value >> bits) != 0) {
+        bits++;
+    }
+
+    return bits;
+}
+
+/* Bit-packed arrays of `width`-bit integers. Reads and writes go
+ * through an unaligned 64-bit word, so widths are limited to 56 bits
+ * and the buffer is padded by a word. */
+static uint8_t*
+packed_alloc(size_t count, size_t width)
+{
+    return calloc((count * width + 7) / 8 + sizeof(uint64_t), 1);
+}
+
+static inline void
+packed_set(uint8_t* data, size_t width, size_t i, uint64_t value)
+{
+    size_t   bit = i * width;
+    uint64_t word;
+
+    memcpy(&word, data + bit / 8, sizeof(word));
+    word |= value << (bit % 8);
+    memcpy(data + bit / 8, &word, sizeof(word));
+}
+
+static inline uint64_t
+packed_get(const uint8_t* data, size_t width, size_t i)
+{
+    size_t   bit = i * width;
+    uint64_t word;
+
+    memcpy(&word, data + bit / 8, sizeof(word));
+    return (word >> (bit % 8)) & ((UINT64_C(1) << width) - 1);
+}
+
+static inline uint64_t
+hash_key(const struct perfect_hashmap* map, const void* key, uint64_t seed)
+{
+    const void* bytes;
+    size_t      length = map->encode(key, &bytes);
+
+    return hash_bytes_seeded(bytes, length, seed);
+}
+
+static int
+keys_equal(const struct perfect_hashmap* map, const void* a, const void* b)
+{
+    const void* a_bytes;
+    const void* b_bytes;
+    size_t      a_length = map->encode(a, &a_bytes);
+    size_t      b_length = map->encode(b, &b_bytes);
+
+    return a_length == b_length && memcmp(a_bytes, b_bytes, a_length) == 0;
+}
+
+static inline size_t
+bucket_of(const struct perfect_hashmap* map, uint64_t hash)
+{
+    /* The high half of the hash chooses between dense and sparse
+     * buckets, and the low half (rotated up, since fastrange() mostly
+     * uses the high bits) chooses the bucket */
+    uint64_t rotated = hash << 32 | hash >> 32;
+
+    if ((hash >> 32) < DENSE_THRESHOLD) {
+        return fastrange(rotated, map->n_dense_buckets);
+    }
+
+    return map->n_dense_buckets
+           + fastrange(rotated, map->n_buckets - map->n_dense_buckets);
+}
+
+static inline size_t
+position_of(const struct perfect_hashmap* map, uint64_t hash, uint64_t pilot)
+{
+    return fastrange(hashmap_mix64(hash ^ hashmap_mix64(pilot)),
+                     map->table_size);
+}
+
+static void
+builder_free(struct builder* b)
+{
+    free(b->hashes);
+    free(b->positions);
+    free(b->bucket_start);
+    free(b->bucket_keys);
+    free(b->order);
+    free(b->pilots);
+    free(b->taken);
+    free(b->candidate);
+}
+
+/* Groups keys by bucket and orders the buckets largest first. Returns
+ * the size of the largest bucket. */
+static size_t
+sort_buckets(struct perfect_hashmap* map, struct builder* b)
+{
+    size_t  max_size = 0;
+    size_t* by_size;
+
+    memset(b->bucket_start, 0, sizeof(size_t) * (map->n_buckets + 1));
+
+    for (size_t i = 0; i < map->n_entries; i++) {
+        b->bucket_start[bucket_of(map, b->hashes[i]) + 1]++;
+    }
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        size_t size = b->bucket_start[i + 1];
+
+        max_size = size > max_size ? size : max_size;
+        b->bucket_start[i + 1] += b->bucket_start[i];
+    }
+
+    /* Filling bucket i advances bucket_start[i] to the start of bucket
+     * i + 1, so shift everything back afterwards */
+    for (size_t i = 0; i < map->n_entries; i++) {
+        size_t bucket = bucket_of(map, b->hashes[i]);
+        b->bucket_keys[b->bucket_start[bucket]++] = i;
+    }
+
+    for (size_t i = map->n_buckets; i > 0; i--) {
+        b->bucket_start[i] = b->bucket_start[i - 1];
+    }
+
+    b->bucket_start[0] = 0;
+
+    /* Counting sort of the buckets by size, descending */
+    by_size = calloc(max_size + 2, sizeof(*by_size));
+    if (by_size == NULL) {
+        return SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        by_size[max_size - (b->bucket_start[i + 1] - b->bucket_start[i])
+                + 1]++;
+    }
+
+    for (size_t i = 0; i <= max_size; i++) {
+        by_size[i + 1] += by_size[i];
+    }
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        size_t size = b->bucket_start[i + 1] - b->bucket_start[i];
+        b->order[by_size[max_size - size]++] = i;
+    }
+
+    free(by_size);
+
+    return max_size;
+}
+
+/* Checks a bucket for keys with equal hashes, which no pilot can
+ * separate */
+static enum build_result
+check_bucket(struct perfect_hashmap* map,
+             struct builder*         b,
+             struct array*           keys,
+             const size_t*           members,
+             size_t                  size)
+{
+    for (size_t i = 0; i < size; i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (b->hashes[members[i]] != b->hashes[members[j]]) {
+                continue;
+            }
+
+            if (keys_equal(map,
+                           &keys->elements[members[i]],
+                           &keys->elements[members[j]])) {
+                return BUILD_DUPLICATE;
+            }
+
+            return BUILD_RETRY;
+        }
+    }
+
+    return BUILD_OK;
+}
+
+/* Searches for a pilot which sends every key of the bucket to a free
+ * position */
+static enum build_result
+place_bucket(struct perfect_hashmap* map,
+             struct builder*         b,
+             size_t                  bucket,
+             const size_t*           members,
+             size_t                  size)
+{
+    for (uint64_t pilot = 0; pilot < MAX_PILOT; pilot++) {
+        size_t placed = 0;
+
+        for (; placed < size; placed++) {
+            size_t pos = position_of(map, b->hashes[members[placed]], pilot);
+            size_t j   = 0;
+
+            if (b->taken[pos]) {
+                break;
+            }
+
+            while (j < placed && b->candidate[j] != pos) {
+                j++;
+            }
+
+            if (j < placed) {
+                break;
+            }
+
+            b->candidate[placed] = pos;
+        }
+
+        if (placed == size) {
+            for (size_t i = 0; i < size; i++) {
+                b->taken[b->candidate[i]] = 1;
+                b->positions[members[i]]  = b->candidate[i];
+            }
+
+            b->pilots[bucket] = pilot;
+            return BUILD_OK;
+        }
+    }
+
+    return BUILD_RETRY;
+}
+
+static enum build_result
+try_build(struct perfect_hashmap* map, struct builder* b, struct array* keys)
+{
+    size_t max_size;
+
+    for (size_t i = 0; i < map->n_entries; i++) {
+        b->hashes[i] = hash_key(map, &keys->elements[i], map->seed);
+    }
+
+    max_size = sort_buckets(map, b);
+    if (max_size == SIZE_MAX) {
+        return BUILD_NO_MEMORY;
+    }
+
+    free(b->candidate);
+    b->candidate = malloc(sizeof(*b->candidate) * (max_size + 1));
+    if (b->candidate == NULL) {
+        return BUILD_NO_MEMORY;
+    }
+
+    memset(b->taken, 0, map->table_size);
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        size_t            bucket  = b->order[i];
+        const size_t*     members = b->bucket_keys + b->bucket_start[bucket];
+        size_t            size    = b->bucket_start[bucket + 1]
+                                    - b->bucket_start[bucket];
+        enum build_result result;
+
+        if (size == 0) {
+            b->pilots[bucket] = 0;
+            continue;
+        }
+
+        result = check_bucket(map, b, keys, members, size);
+        if (result == BUILD_OK) {
+            result = place_bucket(map, b, bucket, members, size);
+        }
+
+        if (result != BUILD_OK) {
+            return result;
+        }
+    }
+
+    return BUILD_OK;
+}
+
+/* Packs the pilots, remaps positions past the end of the table into
+ * the holes below it, and moves the keys and values into place */
+static int
+finish_build(struct perfect_hashmap* map,
+             struct builder*         b,
+             struct array*           keys,
+             struct array*           values)
+{
+    const size_t n         = map->n_entries;
+    uint64_t     max_pilot = 0;
+    size_t       hole      = 0;
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        max_pilot = b->pilots[i] > max_pilot ? b->pilots[i] : max_pilot;
+    }
+
+    map->pilot_width = bits_for(max_pilot);
+    map->remap_width = bits_for(n > 0 ? n - 1 : 0);
+    map->pilots      = packed_alloc(map->n_buckets, map->pilot_width);
+    map->remap       = packed_alloc(map->table_size - n, map->remap_width);
+
+    if (map->pilots == NULL || map->remap == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < map->n_buckets; i++) {
+        packed_set(map->pilots, map->pilot_width, i, b->pilots[i]);
+    }
+
+    /* Exactly as many positions below n are free as there are keys
+     * past it, so pairing them up in order fills every hole */
+    for (size_t pos = n; pos < map->table_size; pos++) {
+        if (!b->taken[pos]) {
+            continue;
+        }
+
+        while (b->taken[hole]) {
+            hole++;
+        }
+
+        packed_set(map->remap, map->remap_width, pos - n, hole++);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = b->positions[i];
+        size_t index
+            = pos < n ? pos
+                      : packed_get(map->remap, map->remap_width, pos - n);
+
+        map->keys[index]   = keys->elements[i];
+        map->values[index] = values != NULL ? values->elements[i] : NULL;
+    }
+
+    return 1;
+}
+
+int
+perfect_hashmap_build(struct perfect_hashmap* map,
+                      struct array*           keys,
+                      struct array*           values,
+                      size_t (*encode)(const void*, const void**))
+{
+    const size_t      n      = keys->length;
+    struct builder    b      = { 0 };
+    enum build_result result = BUILD_RETRY;
+
+    memset(map, 0, sizeof(*map));
+    map->encode    = encode;
+    map->n_entries = n;
+    map->n_buckets
+        = MAGPIE_PERFECT_HASHMAP_BUCKET_FACTOR * n / bits_for(n) + 1;
+    map->n_dense_buckets = map->n_buckets * DENSE_BUCKETS;
+    map->table_size      = n / MAGPIE_PERFECT_HASHMAP_LOAD;
+    map->table_size      = map->table_size > n ? map->table_size : n;
+
+    if (values != NULL && values->length != n) {
+        EBUF_PUSH("perfect hashmap keys and values differ in length", map);
+        return 0;
+    }
+
+    map->keys      = malloc(sizeof(*map->keys) * (n + 1));
+    map->values    = malloc(sizeof(*map->values) * (n + 1));
+    b.hashes       = malloc(sizeof(*b.hashes) * (n + 1));
+    b.positions    = malloc(sizeof(*b.positions) * (n + 1));
+    b.bucket_start = malloc(sizeof(*b.bucket_start) * (map->n_buckets + 1));
+    b.bucket_keys  = malloc(sizeof(*b.bucket_keys) * (n + 1));
+    b.order        = malloc(sizeof(*b.order) * map->n_buckets);
+    b.pilots       = malloc(sizeof(*b.pilots) * map->n_buckets);
+    b.taken        = malloc(map->table_size + 1);
+
+    if (map->keys == NULL || map->values == NULL || b.hashes == NULL
+        || b.positions == NULL || b.bucket_start == NULL
+        || b.bucket_keys == NULL || b.order == NULL || b.pilots == NULL
+        || b.taken == NULL) {
+        EBUF_PUSH("failed to allocate perfect hashmap", map);
+        goto fail;
+    }
+
+    for (size_t attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        map->seed = hash_get_seed() + attempt * 0x9E3779B97F4A7C15ULL;
+        result    = try_build(map, &b, keys);
+
+        if (result != BUILD_RETRY) {
+            break;
+        }
+    }
+
+    if (result == BUILD_DUPLICATE) {
+        EBUF_PUSH("duplicate key in perfect hashmap", map);
+        goto fail;
+    }
+
+    if (result == BUILD_NO_MEMORY) {
+        EBUF_PUSH("failed to allocate perfect hashmap", map);
+        goto fail;
+    }
+
+    if (result == BUILD_RETRY) {
+        EBUF_PUSH("failed to find a perfect hash function", map);
+        goto fail;
+    }
+
+    if (!finish_build(map, &b, keys, values)) {
+        EBUF_PUSH("failed to allocate perfect hashmap", map);
+        goto fail;
+    }
+
+    builder_free(&b);
+    return 1;
+
+fail:
+    builder_free(&b);
+    perfect_hashmap_destroy(map);
+    return 0;
+}
+
+void
+perfect_hashmap_destroy(struct perfect_hashmap* map)
+{
+    free(map->keys);
+    free(map->values);
+    free(map->pilots);
+    free(map->remap);
+
+    map->keys      = NULL;
+    map->values    = NULL;
+    map->pilots    = NULL;
+    map->remap     = NULL;
+    map->n_entries = 0;
+}
+
+static inline size_t
+index_of(const struct perfect_hashmap* map, uint64_t hash)
+{
+    uint64_t pilot
+        = packed_get(map->pilots, map->pilot_width, bucket_of(map, hash));
+    size_t pos = position_of(map, hash, pilot);
+
+    if (pos < map->n_entries) {
+        return pos;
+    }
+
+    return packed_get(map->remap, map->remap_width, pos - map->n_entries);
+}
+
+size_t
+perfect_hashmap_index(const struct perfect_hashmap* map, void* key)
+{
+    if (map->n_entries == 0) {
+        return 0;
+    }
+
+    return index_of(map, hash_key(map, &key, map->seed));
+}
+
+int
+perfect_hashmap_get(const struct perfect_hashmap* map,
+                    void*                         key,
+                    void**                        value)
+{
+    size_t index;
+
+    *value = NULL;
+
+    if (map->n_entries == 0) {
+        return 0;
+    }
+
+    index = index_of(map, hash_key(map, &key, map->seed));
+
+    if (!keys_equal(map, &map->keys[index], &key)) {
+        return 0;
+    }
+
+    *value = map->values[index];
+    return 1;
+}
+
+double
+perfect_hashmap_bits_per_key(const struct perfect_hashmap* map)
+{
+    size_t bits = map->n_buckets * map->pilot_width
+                  + (map->table_size - map->n_entries) * map->remap_width;
+
+    return map->n_entries > 0 ? (double)bits / map->n_entries : 0;
+}
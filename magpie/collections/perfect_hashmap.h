@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_PERFECT_HASHMAP_H
+#define MAGPIE_PERFECT_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magpie/collections/array.h>
+
+/* Buckets hold log2(n) / this many keys on average; fewer buckets take
+ * less space but make building slower */
+#ifndef MAGPIE_PERFECT_HASHMAP_BUCKET_FACTOR
+#    define MAGPIE_PERFECT_HASHMAP_BUCKET_FACTOR 4.0
+#endif
+
+/* Fraction of the intermediate table the keys occupy before it is
+ * made minimal */
+#ifndef MAGPIE_PERFECT_HASHMAP_LOAD
+#    define MAGPIE_PERFECT_HASHMAP_LOAD 0.99
+#endif
+
+/**
+ * A read-only map over a fixed set of keys, indexed by a minimal
+ * perfect hash function: every key maps to a distinct position in
+ * `[0, n_entries)`, so a lookup reads exactly one slot and nothing
+ * needs to be probed.
+ *
+ * The function is built in the style of PTHash (Pibiri and Trani,
+ * "PTHash: Revisiting FCH Minimal Perfect Hashing", 2021). Each key
+ * is hashed once with XXH64 and assigned to a bucket; each bucket
+ * stores a small "pilot" value, chosen at build time so that mixing
+ * it into the hashes of the bucket's keys sends them to free
+ * positions of a table slightly larger than `n_entries`. Keys landing
+ * past the end are remapped to the holes left below it. Pilots and
+ * remapped positions are stored bit-packed, at the width of their
+ * largest value, which comes to about 3 bits per key.
+ *
+ * Keys are opaque, so an encoder turns each one into bytes for
+ * hashing and comparison; `frozen_hashmap_encode_str()` and
+ * `frozen_hashmap_encode_ptr()` can be used here too.
+ *
+ * - `keys` :: Keys, in the order of their perfect hash
+ * - `values` :: Values, matching `keys`
+ * - `n_entries` :: Number of keys
+ * - `seed` :: XXH64 seed the function was built with
+ * - `n_buckets` :: Number of buckets
+ * - `n_dense_buckets` :: Number of buckets at the front which receive
+ *   the majority of keys
+ * - `table_size` :: Size of the intermediate table
+ * - `pilots` :: Bit-packed pilot per bucket
+ * - `pilot_width` :: Width of a pilot in bits
+ * - `remap` :: Bit-packed final position per intermediate position
+ *   past `n_entries`
+ * - `remap_width` :: Width of a remapped position in bits
+ * - `encode` :: Key encoder
+ */
+struct perfect_hashmap {
+    void**   keys;
+    void**   values;
+    size_t   n_entries;
+    uint64_t seed;
+    size_t   n_buckets;
+    size_t   n_dense_buckets;
+    size_t   table_size;
+    uint8_t* pilots;
+    size_t   pilot_width;
+    uint8_t* remap;
+    size_t   remap_width;
+    size_t (*encode)(const void*, const void**);
+};
+
+/**
+ * Builds a perfect hashmap over the elements of `keys`.
+ *
+ * The arrays are only read; the map keeps its own copies of the key
+ * and value pointers. The seed set with `hash_seed()` is tried first,
+ * followed by others derived from it if building fails.
+ *
+ * @param `map` :: Pointer to the perfect hashmap.
+ * @param `keys` :: Distinct keys.
+ * @param `values` :: Values matching `keys`, or `NULL` to map every key
+ * to `NULL`.
+ * @param `encode` :: Sets `*bytes` to the encoding of the key pointed
+ * to by its first argument, and returns the encoding's length.
+ * @return 0 on error, including when two keys are equal.
+ */
+int perfect_hashmap_build(struct perfect_hashmap* map,
+                          struct array*           keys,
+                          struct array*           values,
+                          size_t (*encode)(const void*, const void**));
+
+void perfect_hashmap_destroy(struct perfect_hashmap* map);
+
+/**
+ * Evaluates the perfect hash function for `key`, without checking
+ * that `key` is one of the map's keys.
+ *
+ * @param `map` :: Pointer to the perfect hashmap.
+ * @param `key` :: Key to hash.
+ * @return The position of `key` in `map->keys` if it is present, or an
+ * arbitrary position below `n_entries` if not.
+ */
+size_t perfect_hashmap_index(const struct perfect_hashmap* map, void* key);
+
+/**
+ * Looks up the value for `key`.
+ *
+ * @param `map` :: Pointer to the perfect hashmap.
+ * @param `key` :: Key to look up.
+ * @param `value` :: Set to the value for `key`, or `NULL` if there is
+ * none.
+ * @return 0 if `key` is not one of the map's keys.
+ */
+int perfect_hashmap_get(const struct perfect_hashmap* map,
+                        void*                         key,
+                        void**                        value);
+
+/**
+ * @return The space taken by the hash function (pilots and remapped
+ * positions, but not keys or values), in bits per key.
+ */
+double perfect_hashmap_bits_per_key(const struct perfect_hashmap* map);
+
+#endif /* MAGPIE_PERFECT_HASHMAP_H */
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/collections/robin_hashmap.h>
+#include <magpie/ebuf.h>
+
+static size_t
+capacity_for(size_t n)
+{
+    size_t capacity = 8;
+
+    while (capacity < n) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+static inline size_t
+max_load(size_t capacity)
+{
+    size_t load = capacity * MAGPIE_ROBIN_HASHMAP_LOAD_THRESHOLD;
+    return load < capacity ? load : capacity - 1;
+}
+
+/* The stored hash is the user's; it is only finalized here, so weak
+ * hashes such as aligned pointers don't share a few home slots */
+static inline size_t
+home_slot(struct robin_hashmap* map, uint64_t key_hash)
+{
+    return hashmap_mix64(key_hash) & (map->capacity - 1);
+}
+
+static inline size_t
+next_slot(struct robin_hashmap* map, size_t slot)
+{
+    return (slot + 1) & (map->capacity - 1);
+}
+
+static ssize_t
+lookup_slot(struct robin_hashmap* map, void* key, uint64_t key_hash)
+{
+    size_t   slot = home_slot(map, key_hash);
+    uint32_t dist = 1;
+
+    /* Entries along a probe sequence are never closer to home than the
+     * key being looked up would be, so the search can stop as soon as
+     * it reaches one that is (or an empty slot, whose dist is 0). */
+    for (;;) {
+        struct robin_hashmap_entry* entry = &map->slots[slot];
+
+        if (entry->dist < dist) {
+            return -1;
+        }
+
+        if (entry->hash == key_hash && map->compare(&entry->key, &key) == 0) {
+            return slot;
+        }
+
+        slot = next_slot(map, slot);
+        dist++;
+    }
+}
+
+static void
+place(struct robin_hashmap* map, struct robin_hashmap_entry entry)
+{
+    size_t slot = home_slot(map, entry.hash);
+
+    entry.dist = 1;
+
+    for (;;) {
+        struct robin_hashmap_entry* current = &map->slots[slot];
+
+        if (current->dist == 0) {
+            *current = entry;
+            return;
+        }
+
+        /* take from the rich: the entry closer to home gives way */
+        if (current->dist < entry.dist) {
+            struct robin_hashmap_entry displaced = *current;
+
+            *current = entry;
+            entry    = displaced;
+        }
+
+        slot = next_slot(map, slot);
+        entry.dist++;
+    }
+}
+
+static int
+resize_to(struct robin_hashmap* map, size_t capacity)
+{
+    struct robin_hashmap_entry* old_slots    = map->slots;
+    size_t                      old_capacity = map->capacity;
+    struct robin_hashmap_entry* slots = calloc(capacity, sizeof(*slots));
+
+    if (slots == NULL) {
+        EBUF_PUSH("failed to allocate hashmap slots", map);
+        return 0;
+    }
+
+    map->slots    = slots;
+    map->capacity = capacity;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].dist != 0) {
+            place(map, old_slots[i]);
+        }
+    }
+
+    free(old_slots);
+
+    return 1;
+}
+
+int
+robin_hashmap_init(struct robin_hashmap* map,
+                   uint64_t (*hash)(const void*),
+                   int (*compare)(const void*, const void*))
+{
+    map->slots     = NULL;
+    map->capacity  = 0;
+    map->n_entries = 0;
+    map->hash      = hash;
+    map->compare   = compare;
+
+    return resize_to(map, capacity_for(MAGPIE_ROBIN_HASHMAP_INITIAL_CAPACITY));
+}
+
+void
+robin_hashmap_destroy(struct robin_hashmap* map)
+{
+    free(map->slots);
+
+    map->slots     = NULL;
+    map->capacity  = 0;
+    map->n_entries = 0;
+}
+
+void
+robin_hashmap_set(struct robin_hashmap* map, void* key, void* value)
+{
+    uint64_t key_hash = map->hash(&key);
+    ssize_t  slot     = lookup_slot(map, key, key_hash);
+
+    struct robin_hashmap_entry entry = {
+        .key   = key,
+        .value = value,
+        .hash  = key_hash,
+    };
+
+    if (slot >= 0) {
+        map->slots[slot].value = value;
+        return;
+    }
+
+    if (map->n_entries + 1 > max_load(map->capacity)) {
+        if (!resize_to(map, map->capacity * 2)) {
+            EBUF_PUSH("failed to insert hashmap entry", map);
+            return;
+        }
+    }
+
+    place(map, entry);
+    map->n_entries++;
+}
+
+struct robin_hashmap_entry*
+robin_hashmap_lookup(struct robin_hashmap* map, void* key)
+{
+    ssize_t slot = lookup_slot(map, key, map->hash(&key));
+    return slot < 0 ? NULL : &map->slots[slot];
+}
+
+int
+robin_hashmap_get(struct robin_hashmap* map, void* key, void** value)
+{
+    struct robin_hashmap_entry* entry = robin_hashmap_lookup(map, key);
+
+    if (entry == NULL) {
+        *value = NULL;
+        return 0;
+    }
+
+    *value = entry->value;
+    return 1;
+}
+
+void
+robin_hashmap_remove(struct robin_hashmap* map, void* key)
+{
+    ssize_t slot = lookup_slot(map, key, map->hash(&key));
+    size_t  next;
+
+    if (slot < 0) {
+        return;
+    }
+
+    /* Backward-shift deletion: pull every following entry that is away
+     * from its home slot back by one, until reaching an empty slot or
+     * an entry that is already home. */
+    next = next_slot(map, slot);
+    while (map->slots[next].dist > 1) {
+        map->slots[slot] = map->slots[next];
+        map->slots[slot].dist--;
+
+        slot = next;
+        next = next_slot(map, next);
+    }
+
+    map->slots[slot].dist = 0;
+    map->n_entries--;
+}
+
+struct robin_hashmap_iter
+robin_hashmap_iter(struct robin_hashmap* map)
+{
+    struct robin_hashmap_iter iter = {
+        .map  = map,
+        .slot = -1,
+    };
+
+    return iter;
+}
+
+int
+robin_hashmap_iter_next(struct robin_hashmap_iter* iter)
+{
+    struct robin_hashmap* map = iter->map;
+
+    while ((size_t)++iter->slot < map->capacity) {
+        if (map->slots[iter->slot].dist != 0) {
+            return 1;
+        }
+    }
+
+    iter->slot = map->capacity;
+    return 0;
+}
+
+struct robin_hashmap_entry*
+robin_hashmap_iter_get(struct robin_hashmap_iter* iter)
+{
+    struct robin_hashmap* map = iter->map;
+
+    if (iter->slot < 0 || (size_t)iter->slot >= map->capacity) {
+        return NULL;
+    }
+
+    return &map->slots[iter->slot];
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_ROBIN_HASHMAP_H
+#define MAGPIE_ROBIN_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef MAGPIE_ROBIN_HASHMAP_INITIAL_CAPACITY
+#    define MAGPIE_ROBIN_HASHMAP_INITIAL_CAPACITY 256
+#endif
+
+#ifndef MAGPIE_ROBIN_HASHMAP_LOAD_THRESHOLD
+#    define MAGPIE_ROBIN_HASHMAP_LOAD_THRESHOLD 0.9
+#endif
+
+/**
+ * A slot in a Robin Hood hashmap.
+ *
+ * - `dist` :: One more than the distance of the entry from its home
+ *   slot, or 0 if the slot is empty
+ */
+struct robin_hashmap_entry {
+    void*    key;
+    void*    value;
+    uint64_t hash;
+    uint32_t dist;
+};
+
+/**
+ * An open-addressing hashmap using Robin Hood hashing.
+ *
+ * On insertion an entry displaces any entry that sits closer to its
+ * own home slot, which keeps probe sequences short and ordered by
+ * distance. This lets a failed lookup stop as soon as it reaches an
+ * entry closer to home than the key would be, and lets removal shift
+ * the following entries back by one instead of leaving a tombstone.
+ * The map never holds dead entries, so lookup and iteration cost does
+ * not depend on how many keys have been removed.
+ *
+ * - `slots` :: Entry storage, `capacity` entries long
+ * - `capacity` :: Number of slots (always a power of two)
+ * - `n_entries` :: Number of live entries
+ */
+struct robin_hashmap {
+    struct robin_hashmap_entry* slots;
+    size_t                      capacity;
+    size_t                      n_entries;
+    uint64_t (*hash)(const void*);
+    int (*compare)(const void*, const void*);
+};
+
+struct robin_hashmap_iter {
+    struct robin_hashmap* map;
+    ssize_t               slot;
+};
+
+/**
+ * Initializes an empty Robin Hood hashmap.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `hash` :: Function for hashing a key. Receives a pointer to
+ * the key.
+ * @param `compare` :: Function for comparing two keys. Receives
+ * pointers to the keys and returns zero if they are equal.
+ * @return 0 on error.
+ */
+int robin_hashmap_init(struct robin_hashmap* map,
+                       uint64_t (*hash)(const void*),
+                       int (*compare)(const void*, const void*));
+
+/**
+ * Deallocates a Robin Hood hashmap. Keys and values are not freed.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ */
+void robin_hashmap_destroy(struct robin_hashmap* map);
+
+/**
+ * Associates `value` with `key`, replacing any existing value.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to insert.
+ * @param `value` :: Value to associate with `key`.
+ */
+void robin_hashmap_set(struct robin_hashmap* map, void* key, void* value);
+
+/**
+ * Looks up the entry for `key`.
+ *
+ * The returned pointer refers to storage owned by the map and is only
+ * valid until the next call which inserts into or removes from the
+ * map, since both may move entries.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @return The entry for `key`, or `NULL` if there is none.
+ */
+struct robin_hashmap_entry* robin_hashmap_lookup(struct robin_hashmap* map,
+                                                 void*                 key);
+
+/**
+ * Retrieves the value associated with `key`.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to look up.
+ * @param `value` :: Pointer to a `void*` to store the value into. Set
+ * to `NULL` if the key is not present.
+ * @return 0 if the key is not present.
+ */
+int robin_hashmap_get(struct robin_hashmap* map, void* key, void** value);
+
+/**
+ * Removes the entry for `key`, if there is one.
+ *
+ * @param `map` :: Pointer to the hashmap.
+ * @param `key` :: Key to remove.
+ */
+void robin_hashmap_remove(struct robin_hashmap* map, void* key);
+
+struct robin_hashmap_iter robin_hashmap_iter(struct robin_hashmap* map);
+
+int robin_hashmap_iter_next(struct robin_hashmap_iter* iter);
+
+struct robin_hashmap_entry*
+robin_hashmap_iter_get(struct robin_hashmap_iter* iter);
+
+#endif /* MAGPIE_ROBIN_HASHMAP_H */
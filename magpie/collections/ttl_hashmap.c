@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#define MAGPIE_INTERNAL 1
+#include <magpie/collections/ttl_hashmap.h>
+#include <magpie/ebuf.h>
+
+#define INITIAL_NODES 16
+#define SLOT_MASK     (TTL_HASHMAP_SLOTS - 1)
+
+/* The level holding the list of due entries */
+#define DUE_LEVEL TTL_HASHMAP_LEVELS
+
+static inline void*
+index_value(size_t index)
+{
+    return (void*)(uintptr_t)index;
+}
+
+static inline size_t
+value_index(void* value)
+{
+    return (size_t)(uintptr_t)value;
+}
+
+static size_t
+node_alloc(struct ttl_hashmap* map)
+{
+    size_t index;
+
+    if (map->free_node != TTL_HASHMAP_NIL) {
+        index          = map->free_node;
+        map->free_node = map->nodes[index].next;
+        return index;
+    }
+
+    if (map->nodes_length == map->nodes_capacity) {
+        size_t capacity = map->nodes_capacity > 0 ? map->nodes_capacity * 2
+                                                  : INITIAL_NODES;
+        struct ttl_hashmap_node* nodes
+            = realloc(map->nodes, capacity * sizeof(*nodes));
+
+        if (nodes == NULL) {
+            EBUF_PUSH("failed to allocate TTL hashmap nodes", map);
+            return TTL_HASHMAP_NIL;
+        }
+
+        map->nodes          = nodes;
+        map->nodes_capacity = capacity;
+    }
+
+    return map->nodes_length++;
+}
+
+static void
+node_free(struct ttl_hashmap* map, size_t index)
+{
+    map->nodes[index].next = map->free_node;
+    map->free_node         = index;
+}
+
+static inline size_t*
+list_head(struct ttl_hashmap* map, int level, int slot)
+{
+    return level == DUE_LEVEL ? &map->due : &map->slots[level][slot];
+}
+
+static void
+link_node(struct ttl_hashmap* map, size_t index, int level, int slot)
+{
+    struct ttl_hashmap_node* node = &map->nodes[index];
+    size_t*                  head = list_head(map, level, slot);
+
+    node->level = (uint8_t)level;
+    node->slot  = (uint8_t)slot;
+    node->prev  = TTL_HASHMAP_NIL;
+    node->next  = *head;
+
+    if (*head != TTL_HASHMAP_NIL) {
+        map->nodes[*head].prev = index;
+    }
+
+    *head = index;
+
+    if (level != DUE_LEVEL) {
+        map->occupied[level] |= (uint64_t)1 << slot;
+    }
+}
+
+static void
+unlink_node(struct ttl_hashmap* map, size_t index)
+{
+    struct ttl_hashmap_node* node = &map->nodes[index];
+    size_t* head = list_head(map, node->level, node->slot);
+
+    if (node->prev != TTL_HASHMAP_NIL) {
+        map->nodes[node->prev].next = node->next;
+    }
+    else {
+        *head = node->next;
+    }
+
+    if (node->next != TTL_HASHMAP_NIL) {
+        map->nodes[node->next].prev = node->prev;
+    }
+
+    if (*head == TTL_HASHMAP_NIL && node->level != DUE_LEVEL) {
+        map->occupied[node->level] &= ~((uint64_t)1 << node->slot);
+    }
+}
+
+/* Links a node into the wheel according to its deadline. The highest
+ * bit in which the deadline differs from the wheel's time picks the
+ * level; the deadline's digit at that level picks the slot. */
+static void
+schedule(struct ttl_hashmap* map, size_t index)
+{
+    uint64_t deadline = map->nodes[index].deadline;
+    int      level;
+
+    if (deadline <= map->now) {
+        link_node(map, index, DUE_LEVEL, 0);
+        return;
+    }
+
+    level = 63 - __builtin_clzll(deadline ^ map->now);
+    level /= TTL_HASHMAP_SLOT_BITS;
+    link_node(map,
+              index,
+              level,
+              (deadline >> (level * TTL_HASHMAP_SLOT_BITS)) & SLOT_MASK);
+}
+
+/* Finds the earliest occupied slot ahead of the wheel's time, returning
+ * 0 if the wheel is empty */
+static int
+next_slot(struct ttl_hashmap* map, int* level, int* slot, uint64_t* start)
+{
+    for (int l = 0; l < TTL_HASHMAP_LEVELS; l++) {
+        int      shift = l * TTL_HASHMAP_SLOT_BITS;
+        int      span  = shift + TTL_HASHMAP_SLOT_BITS;
+        int      digit = (map->now >> shift) & SLOT_MASK;
+        uint64_t ahead = map->occupied[l];
+        uint64_t base;
+
+        /* slots at or behind the current digit are empty: their
+         * entries were scheduled at a lower level */
+        ahead &= digit == SLOT_MASK ? 0 : ~(uint64_t)0 << (digit + 1);
+
+        if (ahead == 0) {
+            continue;
+        }
+
+        base   = span >= 64 ? 0 : map->now >> span << span;
+        *level = l;
+        *slot  = __builtin_ctzll(ahead);
+        *start = base | (uint64_t)*slot << shift;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+expire_node(struct ttl_hashmap* map, size_t index)
+{
+    struct ttl_hashmap_node* node  = &map->nodes[index];
+    void*                    key   = node->key;
+    void*                    value = node->value;
+
+    hashmap_remove_prehashed(&map->map, key, node->hash);
+    unlink_node(map, index);
+    node_free(map, index);
+    map->n_entries--;
+
+    if (map->on_expire != NULL) {
+        map->on_expire(key, value, map->ctx);
+    }
+}
+
+int
+ttl_hashmap_init(struct ttl_hashmap* map,
+                 uint64_t (*hash)(const void*),
+                 int (*compare)(const void*, const void*))
+{
+    map->nodes          = NULL;
+    map->nodes_length   = 0;
+    map->nodes_capacity = 0;
+    map->free_node      = TTL_HASHMAP_NIL;
+    map->n_entries      = 0;
+    map->now            = 0;
+    map->due            = TTL_HASHMAP_NIL;
+    map->on_expire      = NULL;
+    map->ctx            = NULL;
+
+    for (int l = 0; l < TTL_HASHMAP_LEVELS; l++) {
+        for (int s = 0; s < TTL_HASHMAP_SLOTS; s++) {
+            map->slots[l][s] = TTL_HASHMAP_NIL;
+        }
+
+        map->occupied[l] = 0;
+    }
+
+    if (!hashmap_init(&map->map, hash, compare)) {
+        EBUF_PUSH("failed to initialize TTL hashmap", map);
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+ttl_hashmap_set_expire_callback(struct ttl_hashmap* map,
+                                void (*on_expire)(void* key,
+                                                  void* value,
+                                                  void* ctx),
+                                void* ctx)
+{
+    map->on_expire = on_expire;
+    map->ctx       = ctx;
+}
+
+void
+ttl_hashmap_destroy(struct ttl_hashmap* map)
+{
+    hashmap_destroy(&map->map);
+    free(map->nodes);
+
+    map->nodes     = NULL;
+    map->n_entries = 0;
+}
+
+int
+ttl_hashmap_set(struct ttl_hashmap* map,
+                void*               key,
+                void*               value,
+                uint64_t            deadline)
+{
+    uint64_t              hash = map->map.hash(&key);
+    struct hashmap_entry* entry;
+    size_t                index;
+    int                   inserted;
+
+    entry = hashmap_entry_or_insert_prehashed(&map->map, key, hash, &inserted);
+
+    if (entry == NULL) {
+        EBUF_PUSH("failed to insert TTL hashmap entry", map);
+        return 0;
+    }
+
+    if (!inserted) {
+        index = value_index(entry->value);
+        unlink_node(map, index);
+    }
+    else {
+        index = node_alloc(map);
+
+        if (index == TTL_HASHMAP_NIL) {
+            hashmap_remove_prehashed(&map->map, key, hash);
+            return 0;
+        }
+
+        entry->value           = index_value(index);
+        map->nodes[index].key  = key;
+        map->nodes[index].hash = hash;
+        map->n_entries++;
+    }
+
+    map->nodes[index].value    = value;
+    map->nodes[index].deadline = deadline;
+    schedule(map, index);
+
+    return 1;
+}
+
+int
+ttl_hashmap_get(struct ttl_hashmap* map,
+                void*               key,
+                uint64_t            now,
+                void**              value)
+{
+    struct hashmap_entry* entry = hashmap_lookup(&map->map, key);
+    size_t                index;
+
+    *value = NULL;
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    index = value_index(entry->value);
+
+    if (map->nodes[index].deadline <= now) {
+        expire_node(map, index);
+        return 0;
+    }
+
+    *value = map->nodes[index].value;
+    return 1;
+}
+
+int
+ttl_hashmap_remove(struct ttl_hashmap* map, void* key)
+{
+    struct hashmap_entry* entry = hashmap_lookup(&map->map, key);
+    size_t                index;
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    index = value_index(entry->value);
+
+    hashmap_remove_prehashed(&map->map, key, map->nodes[index].hash);
+    unlink_node(map, index);
+    node_free(map, index);
+    map->n_entries--;
+
+    return 1;
+}
+
+size_t
+ttl_hashmap_expire_tick(struct ttl_hashmap* map,
+                        uint64_t            now,
+                        size_t              max_expired)
+{
+    size_t n_expired = 0;
+
+    for (;;) {
+        int      level;
+        int      slot;
+        uint64_t start;
+        size_t   index;
+
+        while (map->due != TTL_HASHMAP_NIL) {
+            if (n_expired == max_expired) {
+                return n_expired;
+            }
+
+            expire_node(map, map->due);
+            n_expired++;
+        }
+
+        if (!next_slot(map, &level, &slot, &start) || start > now) {
+            break;
+        }
+
+        /* Advance to the start of the slot and redistribute its
+         * entries: they all belong to lower levels now, or are due */
+        map->now = start;
+        index    = map->slots[level][slot];
+
+        map->slots[level][slot] = TTL_HASHMAP_NIL;
+        map->occupied[level] &= ~((uint64_t)1 << slot);
+
+        while (index != TTL_HASHMAP_NIL) {
+            size_t next = map->nodes[index].next;
+
+            schedule(map, index);
+            index = next;
+        }
+    }
+
+    /* Nothing is scheduled at or before `now`, so the wheel can jump */
+    if (now > map->now) {
+        map->now = now;
+    }
+
+    return n_expired;
+}
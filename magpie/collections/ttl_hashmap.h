@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_TTL_HASHMAP_H
+#define MAGPIE_TTL_HASHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <magpie/collections/hashmap.h>
+
+/* Each level of the timer wheel has 2^TTL_HASHMAP_SLOT_BITS slots, and
+ * there are enough levels to cover any 64-bit deadline */
+#define TTL_HASHMAP_SLOT_BITS 6
+#define TTL_HASHMAP_SLOTS     (1 << TTL_HASHMAP_SLOT_BITS)
+#define TTL_HASHMAP_LEVELS                                                    \
+    ((64 + TTL_HASHMAP_SLOT_BITS - 1) / TTL_HASHMAP_SLOT_BITS)
+
+/* Marks the end of a slot's list */
+#define TTL_HASHMAP_NIL SIZE_MAX
+
+/**
+ * An entry of a TTL hashmap.
+ *
+ * - `hash` :: Hash of the key
+ * - `deadline` :: Time at which the entry expires
+ * - `prev`, `next` :: Neighbours in the entry's slot, or
+ *   `TTL_HASHMAP_NIL`
+ * - `level`, `slot` :: The entry's slot in the timer wheel, or
+ *   `TTL_HASHMAP_LEVELS` for the list of entries already due
+ */
+struct ttl_hashmap_node {
+    void*    key;
+    void*    value;
+    uint64_t hash;
+    uint64_t deadline;
+    size_t   prev;
+    size_t   next;
+    uint8_t  level;
+    uint8_t  slot;
+};
+
+/**
+ * A hashmap whose entries expire at a deadline.
+ *
+ * Times are plain integers in whatever unit the caller chooses
+ * (milliseconds, say), and only need to be nondecreasing across calls.
+ * The map never reads a clock itself.
+ *
+ * Keys are looked up through a `struct hashmap` whose values are
+ * indices into a pool of nodes. Each node is also linked into a
+ * hierarchical timer wheel (Varghese and Lauck, "Hashed and
+ * Hierarchical Timing Wheels", 1987): level `l` splits time into
+ * slots of `TTL_HASHMAP_SLOTS^l` ticks, and an entry is kept at the
+ * lowest level whose current span contains its deadline. As time
+ * advances, the entries of each higher-level slot reached are
+ * redistributed to lower levels, and level 0 slots reached hold
+ * entries which are due. Every entry moves at most once per level, so
+ * expiry costs O(1) amortized per entry, and a bitmap of occupied slots
+ * per level lets the wheel skip idle stretches of time in one step.
+ *
+ * Expired entries are reclaimed in two ways: lazily, when a lookup
+ * finds its entry past its deadline, and in batches by
+ * `ttl_hashmap_expire_tick()`.
+ *
+ * - `map` :: Maps keys to node indices
+ * - `nodes` :: Node pool
+ * - `nodes_length` :: Number of nodes ever used in the pool
+ * - `nodes_capacity` :: Number of nodes the pool has room for
+ * - `free_node` :: Head of the list of free nodes, linked by `next`
+ * - `n_entries` :: Number of entries, expired or not
+ * - `now` :: Time the wheel has advanced to
+ * - `slots` :: First node of each slot of each level
+ * - `occupied` :: Bitmap of the non-empty slots of each level
+ * - `due` :: First node of the list of entries whose deadline has
+ *   passed, waiting to be reclaimed
+ * - `on_expire` :: Called with each expired key and value
+ * - `ctx` :: Passed to `on_expire`
+ */
+struct ttl_hashmap {
+    struct hashmap           map;
+    struct ttl_hashmap_node* nodes;
+    size_t                   nodes_length;
+    size_t                   nodes_capacity;
+    size_t                   free_node;
+    size_t                   n_entries;
+    uint64_t                 now;
+    size_t                   slots[TTL_HASHMAP_LEVELS][TTL_HASHMAP_SLOTS];
+    uint64_t                 occupied[TTL_HASHMAP_LEVELS];
+    size_t                   due;
+    void (*on_expire)(void* key, void* value, void* ctx);
+    void* ctx;
+};
+
+/**
+ * Initializes an empty TTL hashmap.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `hash` :: Hash function for keys (as for `struct hashmap`).
+ * @param `compare` :: Comparison function for keys.
+ * @return 0 on error.
+ */
+int ttl_hashmap_init(struct ttl_hashmap* map,
+                     uint64_t (*hash)(const void*),
+                     int (*compare)(const void*, const void*));
+
+/**
+ * Sets the function called with the key and value of each entry as it
+ * expires, so they can be freed.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `on_expire` :: The callback, or `NULL` for none.
+ * @param `ctx` :: Passed to `on_expire`.
+ */
+void ttl_hashmap_set_expire_callback(struct ttl_hashmap* map,
+                                     void (*on_expire)(void* key,
+                                                       void* value,
+                                                       void* ctx),
+                                     void* ctx);
+
+/**
+ * Deallocates the map. The expire callback is not called.
+ */
+void ttl_hashmap_destroy(struct ttl_hashmap* map);
+
+/**
+ * Sets `key` to `value`, expiring at `deadline`. If `key` is already
+ * present, its value is replaced and its deadline moved, even if it
+ * has expired but not yet been reclaimed.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `key` :: Key to insert.
+ * @param `value` :: Value to associate with `key`.
+ * @param `deadline` :: Time at which the entry expires.
+ * @return 0 on error.
+ */
+int ttl_hashmap_set(struct ttl_hashmap* map,
+                    void*               key,
+                    void*               value,
+                    uint64_t            deadline);
+
+/**
+ * Looks up the value for `key`. An entry whose deadline is at or before
+ * `now` is expired on the spot and not returned.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `key` :: Key to look up.
+ * @param `now` :: The current time.
+ * @param `value` :: Set to the value for `key`, or `NULL` if there is
+ * none.
+ * @return 0 if there is no live entry for `key`.
+ */
+int ttl_hashmap_get(struct ttl_hashmap* map,
+                    void*               key,
+                    uint64_t            now,
+                    void**              value);
+
+/**
+ * Removes the entry for `key`, without calling the expire callback.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `key` :: Key to remove.
+ * @return 0 if there was no entry for `key`.
+ */
+int ttl_hashmap_remove(struct ttl_hashmap* map, void* key);
+
+/**
+ * Advances the timer wheel to `now`, expiring the entries whose
+ * deadline is at or before it.
+ *
+ * At most `max_expired` entries are expired per call, so reclaiming a
+ * large number of entries can be spread over several calls; the wheel
+ * stops short of `now` if the limit is reached, and catches up on the
+ * next call.
+ *
+ * @param `map` :: Pointer to the TTL hashmap.
+ * @param `now` :: The current time.
+ * @param `max_expired` :: Maximum number of entries to expire, or
+ * `SIZE_MAX` for no limit.
+ * @return The number of entries expired.
+ */
+size_t ttl_hashmap_expire_tick(struct ttl_hashmap* map,
+                               uint64_t            now,
+                               size_t              max_expired);
+
+#endif /* MAGPIE_TTL_HASHMAP_H */
@@ -22,8 +22,11 @@
 #ifndef MAGPIE_COMPARE_H
 #define MAGPIE_COMPARE_H
 
+#include <stdint.h>
 #include <string.h>
 
+#include <magpie/strview.h>
+
 static inline int
 compare_str(const void* a, const void* b)
 {
@@ -33,4 +36,63 @@ compare_str(const void* a, const void* b)
     return strcmp(*str_a, *str_b);
 }
 
+/**
+ * Comparison function for keys which are pointers to a `struct
+ * strview`. Views of different lengths are ordered by length without
+ * reading either string, so this ordering is not lexicographic.
+ */
+static inline int
+compare_strview(const void* a, const void* b)
+{
+    const struct strview* view_a = *(const struct strview* const*)a;
+    const struct strview* view_b = *(const struct strview* const*)b;
+
+    if (view_a->length != view_b->length) {
+        return view_a->length < view_b->length ? -1 : 1;
+    }
+
+    return memcmp(view_a->ptr, view_b->ptr, view_a->length);
+}
+
+/**
+ * Comparison function for keys which are integers stored directly in
+ * the key pointer, to go with `hash_uint()`.
+ */
+static inline int
+compare_uint(const void* a, const void* b)
+{
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Comparison function for pointer keys compared by identity, to go
+ * with `hash_ptr()`.
+ */
+static inline int
+compare_ptr(const void* a, const void* b)
+{
+    return compare_uint(a, b);
+}
+
+/**
+ * Comparison function for 16-byte keys, to go with `hash_fixed16()`.
+ */
+static inline int
+compare_fixed16(const void* a, const void* b)
+{
+    return memcmp(*(const void* const*)a, *(const void* const*)b, 16);
+}
+
+/**
+ * Comparison function for 32-byte keys, to go with `hash_fixed32()`.
+ */
+static inline int
+compare_fixed32(const void* a, const void* b)
+{
+    return memcmp(*(const void* const*)a, *(const void* const*)b, 32);
+}
+
 #endif /* MAGPIE_COMPARE_H */
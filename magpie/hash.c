@@ -27,9 +27,36 @@
 #include <magpie/external/xxHash/xxhash.h>
 
 #include <magpie/hash.h>
+#include <magpie/strview.h>
 
 static uint64_t seed = 0;
 
+/* wyhash's default secret */
+#define MIX_P0 0xa0761d6478bd642fULL
+#define MIX_P1 0xe7037ed1a0b428dbULL
+
+/* 2^64 / golden ratio */
+#define PTR_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t
+mix_uint(uint64_t x, uint64_t s)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t)(x ^ MIX_P0) * (x ^ s ^ MIX_P1);
+
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    x ^= s;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+
+    return x;
+#endif
+}
+
 void
 hash_seed(uint64_t s)
 {
@@ -44,3 +71,57 @@ hash_str(const void* a)
     
     return XXH64(str, len, seed);
 }
+
+uint64_t
+hash_bytes(const void* data, size_t length)
+{
+    return XXH64(data, length, seed);
+}
+
+uint64_t
+hash_bytes_seeded(const void* data, size_t length, uint64_t s)
+{
+    return XXH64(data, length, s);
+}
+
+uint64_t
+hash_get_seed(void)
+{
+    return seed;
+}
+
+uint64_t
+hash_strview(const void* a)
+{
+    const struct strview* view = *(const struct strview* const*)a;
+    return view->hash;
+}
+
+uint64_t
+hash_uint(const void* a)
+{
+    return mix_uint((uintptr_t)*(void* const*)a, seed);
+}
+
+uint64_t
+hash_ptr(const void* a)
+{
+    uint64_t x = (uintptr_t)*(void* const*)a >> MAGPIE_HASH_PTR_ALIGN_BITS;
+
+    /* The product's high bits depend on all of x; fold them down so
+     * the low bits do too */
+    x = (x ^ seed) * PTR_MULTIPLIER;
+    return x ^ (x >> 32);
+}
+
+uint64_t
+hash_fixed16(const void* a)
+{
+    return XXH3_64bits_withSeed(*(const void* const*)a, 16, seed);
+}
+
+uint64_t
+hash_fixed32(const void* a)
+{
+    return XXH3_64bits_withSeed(*(const void* const*)a, 32, seed);
+}
@@ -22,9 +22,101 @@
 #ifndef MAGPIE_HASH_H
 #define MAGPIE_HASH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Number of low bits `hash_ptr()` discards, which are zero in any
+ * pointer aligned to 1 << this many bytes */
+#ifndef MAGPIE_HASH_PTR_ALIGN_BITS
+#    define MAGPIE_HASH_PTR_ALIGN_BITS 3
+#endif
+
+/**
+ * Hash function for keys which are NUL-terminated strings: `a` points
+ * to a `char*`. The hash depends only on the string's bytes and the
+ * seed set by `hash_seed()`, so it can be computed ahead of time, on
+ * any thread, and passed to the `_prehashed` hashmap functions.
+ */
 uint64_t hash_str(const void* a);
+
+/**
+ * Sets the seed used by `hash_str()` and `hash_bytes()`. The seed is
+ * shared by every thread; set it once, before taking any hashes which
+ * will be kept or given to a map.
+ */
 void hash_seed(uint64_t seed);
 
+/**
+ * Hashes `length` bytes at `data`, with the seed set by `hash_seed()`.
+ * Agrees with `hash_str()` for the bytes of a NUL-terminated string.
+ *
+ * @param `data` :: Bytes to hash.
+ * @param `length` :: Number of bytes.
+ * @return The hash.
+ */
+uint64_t hash_bytes(const void* data, size_t length);
+
+/**
+ * Hashes `length` bytes at `data` with an explicit seed, regardless of
+ * the one set by `hash_seed()`.
+ *
+ * @param `data` :: Bytes to hash.
+ * @param `length` :: Number of bytes.
+ * @param `seed` :: Seed to hash with.
+ * @return The hash.
+ */
+uint64_t hash_bytes_seeded(const void* data, size_t length, uint64_t seed);
+
+/**
+ * @return The seed set by the last call to `hash_seed()`, or 0.
+ */
+uint64_t hash_get_seed(void);
+
+/**
+ * Hash function for keys which are pointers to a `struct strview`.
+ * Returns the view's cached hash without reading the string.
+ */
+uint64_t hash_strview(const void* a);
+
+/**
+ * Hash function for keys which are integers stored directly in the key
+ * pointer: `a` points to a `void*` holding the integer.
+ *
+ * The integer is mixed with the seed set by `hash_seed()` through one
+ * full-width multiply, as in wyhash, whose high and low halves are
+ * folded together. Every bit of the key affects every bit of the hash,
+ * so it is much cheaper than passing the integer's bytes to
+ * `hash_bytes()`, which it does not agree with. Targets without a
+ * 128-bit product fall back to murmur3's finalizer.
+ */
+uint64_t hash_uint(const void* a);
+
+/**
+ * Hash function for keys which are pointers compared by identity: `a`
+ * points to the `void*` key.
+ *
+ * The low `MAGPIE_HASH_PTR_ALIGN_BITS` bits, always zero for aligned
+ * objects, are shifted out and the rest is scrambled with a single
+ * multiply, since the remaining bits of nearby objects already differ.
+ * Pointers which differ only in the discarded bits, such as pointers
+ * into a byte buffer, hash alike; use `hash_uint()` for those.
+ */
+uint64_t hash_ptr(const void* a);
+
+/**
+ * Hash function for fixed-width keys of 16 bytes, such as UUIDs or
+ * 128-bit digests: `a` points to a pointer to the key's bytes.
+ *
+ * Uses XXH3 with the seed set by `hash_seed()`. The length is known at
+ * compile time, so XXH3's short-input path is inlined without any
+ * branching on the length; the hash does not agree with
+ * `hash_bytes()`.
+ */
+uint64_t hash_fixed16(const void* a);
+
+/**
+ * As `hash_fixed16()`, for keys of 32 bytes, such as SHA-256 digests.
+ */
+uint64_t hash_fixed32(const void* a);
+
 #endif /* MAGPIE_HASH_H */
@@ -32,7 +32,7 @@ is_prime(size_t x)
         return 0;
     }
 
-    for (size_t i = 5; i * i < x; i += 6) {
+    for (size_t i = 5; i * i <= x; i += 6) {
         if (x % i == 0 || x % (i + 2) == 0) {
             return 0;
         }
@@ -60,3 +60,26 @@ next_prime(size_t after)
 
     return next;
 }
+
+/* The smallest prime at or above each power of two from 2^3 to 2^31 */
+static const size_t prime_table[] = {
+    11,        17,        37,        67,         131,        257,
+    521,       1031,      2053,      4099,       8209,       16411,
+    32771,     65537,     131101,    262147,     524309,     1048583,
+    2097169,   4194319,   8388617,   16777259,   33554467,   67108879,
+    134217757, 268435459, 536870923, 1073741827, 2147483659,
+};
+
+size_t
+prime_at_least(size_t n)
+{
+    const size_t n_primes = sizeof(prime_table) / sizeof(prime_table[0]);
+
+    for (size_t i = 0; i < n_primes; i++) {
+        if (prime_table[i] >= n) {
+            return prime_table[i];
+        }
+    }
+
+    return next_prime(n - 1);
+}
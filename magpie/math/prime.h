@@ -27,4 +27,11 @@
 int    is_prime(size_t x);
 size_t next_prime(size_t after);
 
+/**
+ * Returns a prime which is at least `n`, roughly the next power of two
+ * up. Uses a precomputed table rather than searching, so it is cheap
+ * enough to call whenever a hash table grows.
+ */
+size_t prime_at_least(size_t n);
+
 #endif /* MAGPIE_MATH_PRIME_H */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MAGPIE_STRVIEW_H
+#define MAGPIE_STRVIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A string key which knows its own length and hash.
+ *
+ * Use a pointer to a `struct strview` as a hashmap key, together with
+ * `hash_strview()` and `compare_strview()`. Hashing a view just returns
+ * the cached hash, and comparing two views checks their lengths before
+ * touching any bytes.
+ *
+ * - `ptr` :: The first byte of the string, which needn't be
+ *   NUL-terminated
+ * - `length` :: Length of the string in bytes
+ * - `hash` :: `hash_bytes(ptr, length)`, computed by `strview_init()`
+ */
+struct strview {
+    const char* ptr;
+    size_t      length;
+    uint64_t    hash;
+};
+
+/**
+ * Initializes a view of `length` bytes at `ptr`, hashing them.
+ *
+ * The hash depends on the seed set with `hash_seed()`, so views must
+ * not be initialized before the seed is set.
+ *
+ * @param `view` :: Pointer to the view.
+ * @param `ptr` :: The string.
+ * @param `length` :: Length of the string in bytes.
+ */
+void strview_init(struct strview* view, const char* ptr, size_t length);
+
+/**
+ * Initializes a view of a NUL-terminated string. The view's hash is
+ * the same as `hash_str()` gives for the string.
+ *
+ * @param `view` :: Pointer to the view.
+ * @param `str` :: The string.
+ */
+void strview_init_cstr(struct strview* view, const char* str);
+
+#endif /* MAGPIE_STRVIEW_H */
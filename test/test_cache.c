@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/cache.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+struct evictions {
+    size_t n_calls;
+    size_t last_key;
+    size_t key_sum;
+};
+
+static void
+count_eviction(void* key, void* value, void* ctx)
+{
+    struct evictions* evictions = ctx;
+
+    (void)value;
+    evictions->n_calls++;
+    evictions->last_key = (uintptr_t)key;
+    evictions->key_sum += (uintptr_t)key;
+}
+
+static int
+contains(struct cache* cache, size_t key)
+{
+    return hashmap_lookup(&cache->map, KEY(key)) != NULL;
+}
+
+void
+test_lru(void)
+{
+    struct cache     cache;
+    struct evictions evictions = { 0 };
+    void*            value;
+
+    CU_ASSERT_FATAL(
+        cache_init(&cache, CACHE_POLICY_LRU, 3, hash_uint, compare_uint));
+    cache_set_evict_callback(&cache, count_eviction, &evictions);
+
+    cache_put(&cache, KEY(1), KEY(10), 1);
+    cache_put(&cache, KEY(2), KEY(20), 1);
+    cache_put(&cache, KEY(3), KEY(30), 1);
+
+    /* 1 becomes the most recently used, so 2 goes first */
+    CU_ASSERT(cache_get(&cache, KEY(1), &value));
+    CU_ASSERT(value == KEY(10));
+
+    cache_put(&cache, KEY(4), KEY(40), 1);
+    CU_ASSERT(evictions.n_calls == 1);
+    CU_ASSERT(evictions.last_key == 2);
+    CU_ASSERT(!cache_get(&cache, KEY(2), &value));
+    CU_ASSERT(value == NULL);
+
+    cache_put(&cache, KEY(5), KEY(50), 1);
+    CU_ASSERT(evictions.last_key == 3);
+
+    CU_ASSERT(cache.n_entries == 3);
+    CU_ASSERT(cache.counters.n_hits == 1);
+    CU_ASSERT(cache.counters.n_misses == 1);
+    CU_ASSERT(cache.counters.n_evictions == 2);
+
+    cache_destroy(&cache);
+    CU_ASSERT(evictions.n_calls == 5);
+    CU_ASSERT(evictions.key_sum == 1 + 2 + 3 + 4 + 5);
+}
+
+void
+test_clock(void)
+{
+    struct cache     cache;
+    struct evictions evictions = { 0 };
+    void*            value;
+
+    cache_init(&cache, CACHE_POLICY_CLOCK, 4, hash_uint, compare_uint);
+    cache_set_evict_callback(&cache, count_eviction, &evictions);
+
+    for (size_t i = 1; i <= 4; i++) {
+        cache_put(&cache, KEY(i), KEY(i * 10), 1);
+    }
+
+    /* 1 and 2 are referenced, so the hand passes over them to 3 */
+    cache_get(&cache, KEY(1), &value);
+    cache_get(&cache, KEY(2), &value);
+
+    cache_put(&cache, KEY(5), KEY(50), 1);
+    CU_ASSERT(evictions.last_key == 3);
+
+    /* their second chance is used up, and 4 is next anyway */
+    cache_put(&cache, KEY(6), KEY(60), 1);
+    CU_ASSERT(evictions.last_key == 4);
+    cache_put(&cache, KEY(7), KEY(70), 1);
+    CU_ASSERT(evictions.last_key == 1);
+
+    CU_ASSERT(contains(&cache, 2));
+    CU_ASSERT(contains(&cache, 5));
+    CU_ASSERT(contains(&cache, 6));
+    CU_ASSERT(contains(&cache, 7));
+
+    cache_destroy(&cache);
+}
+
+void
+test_s3fifo_scan(void)
+{
+    const size_t     n_hot = 50;
+    struct cache     cache;
+    struct evictions evictions = { 0 };
+    void*            value;
+    size_t           n_hot_hits = 0;
+
+    cache_init(&cache, CACHE_POLICY_S3FIFO, 100, hash_uint, compare_uint);
+    cache_set_evict_callback(&cache, count_eviction, &evictions);
+
+    /* Establish a working set which is hit repeatedly */
+    for (size_t round = 0; round < 3; round++) {
+        for (size_t i = 0; i < n_hot; i++) {
+            if (!cache_get(&cache, KEY(i), &value)) {
+                cache_put(&cache, KEY(i), KEY(i), 1);
+            }
+        }
+    }
+
+    /* A scan of one-off keys much larger than the cache */
+    for (size_t i = 1000; i < 11000; i++) {
+        cache_put(&cache, KEY(i), KEY(i), 1);
+    }
+
+    for (size_t i = 0; i < n_hot; i++) {
+        n_hot_hits += contains(&cache, i);
+    }
+
+    CU_ASSERT(n_hot_hits == n_hot);
+    CU_ASSERT(cache.charge <= cache.capacity);
+    CU_ASSERT(cache.queues[2].length <= cache.n_entries);
+
+    cache_destroy(&cache);
+    CU_ASSERT(evictions.n_calls == n_hot + 10000);
+}
+
+void
+test_lru_scan(void)
+{
+    struct cache cache;
+    void*        value;
+    size_t       n_hot_hits = 0;
+
+    /* The same workload flushes an LRU cache, for comparison */
+    cache_init(&cache, CACHE_POLICY_LRU, 100, hash_uint, compare_uint);
+
+    for (size_t round = 0; round < 3; round++) {
+        for (size_t i = 0; i < 50; i++) {
+            if (!cache_get(&cache, KEY(i), &value)) {
+                cache_put(&cache, KEY(i), KEY(i), 1);
+            }
+        }
+    }
+
+    for (size_t i = 1000; i < 11000; i++) {
+        cache_put(&cache, KEY(i), KEY(i), 1);
+    }
+
+    for (size_t i = 0; i < 50; i++) {
+        n_hot_hits += contains(&cache, i);
+    }
+
+    CU_ASSERT(n_hot_hits == 0);
+
+    cache_destroy(&cache);
+}
+
+void
+test_s3fifo_ghost(void)
+{
+    struct cache cache;
+    void*        value;
+
+    cache_init(&cache, CACHE_POLICY_S3FIFO, 10, hash_uint, compare_uint);
+
+    for (size_t i = 0; i < 10; i++) {
+        cache_put(&cache, KEY(i), KEY(i), 1);
+    }
+
+    /* 0 falls out of the small queue unreferenced and leaves a ghost */
+    cache_put(&cache, KEY(10), KEY(10), 1);
+    CU_ASSERT(!contains(&cache, 0));
+    CU_ASSERT(cache.queues[2].length == 1);
+
+    /* so it comes back into the main queue */
+    cache_put(&cache, KEY(0), KEY(0), 1);
+    CU_ASSERT(cache.queues[2].length == 1);
+    CU_ASSERT(cache.nodes[(uintptr_t)hashmap_lookup(&cache.map, KEY(0))->value]
+                  .queue
+              == 0);
+    CU_ASSERT(cache_get(&cache, KEY(0), &value));
+
+    cache_destroy(&cache);
+}
+
+void
+test_charge(void)
+{
+    struct cache     cache;
+    struct evictions evictions = { 0 };
+    void*            value;
+
+    cache_init(&cache, CACHE_POLICY_LRU, 1000, hash_uint, compare_uint);
+    cache_set_evict_callback(&cache, count_eviction, &evictions);
+
+    cache_put(&cache, KEY(1), KEY(1), 400);
+    cache_put(&cache, KEY(2), KEY(2), 400);
+    CU_ASSERT(cache.charge == 800);
+
+    /* needs both gone */
+    cache_put(&cache, KEY(3), KEY(3), 900);
+    CU_ASSERT(cache.charge == 900);
+    CU_ASSERT(cache.n_entries == 1);
+    CU_ASSERT(evictions.n_calls == 2);
+
+    /* replacing passes the old pair on and adjusts the charge */
+    cache_put(&cache, KEY(3), KEY(33), 100);
+    CU_ASSERT(cache.charge == 100);
+    CU_ASSERT(evictions.n_calls == 3);
+    CU_ASSERT(cache_get(&cache, KEY(3), &value));
+    CU_ASSERT(value == KEY(33));
+
+    /* too big to ever fit */
+    cache_put(&cache, KEY(4), KEY(4), 1001);
+    CU_ASSERT(!contains(&cache, 4));
+    CU_ASSERT(evictions.last_key == 4);
+    CU_ASSERT(cache.charge == 100);
+
+    CU_ASSERT(cache_remove(&cache, KEY(3)));
+    CU_ASSERT(!cache_remove(&cache, KEY(3)));
+    CU_ASSERT(cache.charge == 0);
+    CU_ASSERT(cache.n_entries == 0);
+    CU_ASSERT(evictions.n_calls == 5);
+
+    cache_destroy(&cache);
+    CU_ASSERT(evictions.n_calls == 5);
+}
+
+void
+test_churn(void)
+{
+    enum cache_policy policies[]
+        = { CACHE_POLICY_LRU, CACHE_POLICY_CLOCK, CACHE_POLICY_S3FIFO };
+
+    for (size_t p = 0; p < 3; p++) {
+        struct cache     cache;
+        struct evictions evictions = { 0 };
+        size_t           n_puts    = 0;
+        uint64_t         x         = 88172645463325252ULL;
+        void*            value;
+
+        cache_init(&cache, policies[p], 500, hash_uint, compare_uint);
+        cache_set_evict_callback(&cache, count_eviction, &evictions);
+
+        for (size_t i = 0; i < 100000; i++) {
+            size_t key;
+
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            key = x % 2000;
+
+            if (cache_get(&cache, KEY(key), &value)) {
+                CU_ASSERT(value == KEY(key * 3));
+            }
+            else {
+                cache_put(&cache, KEY(key), KEY(key * 3), 1 + key % 4);
+                n_puts++;
+            }
+
+            CU_ASSERT(cache.charge <= cache.capacity);
+        }
+
+        CU_ASSERT(cache.map.n_entries == cache.n_entries);
+        CU_ASSERT(cache.counters.n_hits + cache.counters.n_misses == 100000);
+
+        cache_destroy(&cache);
+        CU_ASSERT(evictions.n_calls == n_puts);
+    }
+}
+
+static struct test_case tests[] = {
+    { .name = "test cache LRU", .test_function = test_lru },
+    { .name = "test cache CLOCK", .test_function = test_clock },
+    { .name = "test cache S3-FIFO scan", .test_function = test_s3fifo_scan },
+    { .name = "test cache LRU scan", .test_function = test_lru_scan },
+    { .name = "test cache S3-FIFO ghost", .test_function = test_s3fifo_ghost },
+    { .name = "test cache charge", .test_function = test_charge },
+    { .name = "test cache churn", .test_function = test_churn },
+};
+
+TEST_MAIN("caches", tests)
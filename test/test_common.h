@@ -26,6 +26,7 @@
 #include <CUnit/CUError.h>
 #include <CUnit/TestDB.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define TEST_MAIN(SUITE_NAME, TESTS)                                          \
     int main(void)                                                            \
@@ -33,6 +34,10 @@
         return run_tests((SUITE_NAME), (TESTS), sizeof(TESTS) / sizeof((TESTS)[0])); \
     }
 
+/* Integer keys are stored directly in the key pointer; hash and
+ * compare them with `hash_uint()` and `compare_uint()` */
+#define KEY(N) ((void*)(uintptr_t)(N))
+
 struct test_case {
     const char* name;
     void (*test_function)(void);
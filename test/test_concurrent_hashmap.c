@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/concurrent_hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#include "hashmap_entries.h"
+
+#define N_THREADS       4
+#define KEYS_PER_THREAD 20000
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+struct thread_args {
+    struct concurrent_hashmap* map;
+    uintptr_t                  first_key;
+    uintptr_t                  n_keys;
+    atomic_int*                done;
+    int                        failures;
+};
+
+/* Every value stored for an integer key is derived from the key, so
+ * readers can tell a torn or misplaced read from a correct one */
+static inline void*
+value_for(uintptr_t key)
+{
+    return (void*)(key * 3);
+}
+
+void
+test_insertion(void)
+{
+    struct concurrent_hashmap map;
+
+    CU_ASSERT(concurrent_hashmap_init(&map, 0, hash_str, compare_str));
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        CU_ASSERT(concurrent_hashmap_set(
+            &map, large_entries[i].key, large_entries[i].value));
+    }
+
+    CU_ASSERT(concurrent_hashmap_size(&map) == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        void* value;
+
+        CU_ASSERT(concurrent_hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value != NULL && strcmp(value, large_entries[i].value) == 0);
+    }
+
+    concurrent_hashmap_destroy(&map);
+}
+
+void
+test_update_remove(void)
+{
+    struct concurrent_hashmap map;
+
+    /* a single shard exercises growth and deletion the hardest */
+    CU_ASSERT(concurrent_hashmap_init(&map, 1, hash_str, compare_str));
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        concurrent_hashmap_set(
+            &map, large_entries[i].key, large_entries[i].value);
+        concurrent_hashmap_set(&map, large_entries[i].key, large_entries + i);
+    }
+
+    CU_ASSERT(concurrent_hashmap_size(&map) == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i += 2) {
+        concurrent_hashmap_remove(&map, large_entries[i].key);
+    }
+
+    CU_ASSERT(concurrent_hashmap_size(&map) == n_large_entries / 2);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        void* value;
+        int   found;
+
+        found = concurrent_hashmap_get(&map, large_entries[i].key, &value);
+
+        if (i % 2 == 0) {
+            CU_ASSERT(!found);
+            CU_ASSERT(value == NULL);
+        }
+        else {
+            CU_ASSERT(found);
+            CU_ASSERT(value == large_entries + i);
+        }
+    }
+
+    concurrent_hashmap_destroy(&map);
+}
+
+static void*
+writer(void* arg)
+{
+    struct thread_args* args = arg;
+
+    for (uintptr_t k = args->first_key; k < args->first_key + args->n_keys;
+         k++) {
+        if (!concurrent_hashmap_set(args->map, (void*)k, value_for(k))) {
+            args->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+static void*
+remover(void* arg)
+{
+    struct thread_args* args = arg;
+
+    for (uintptr_t k = args->first_key; k < args->first_key + args->n_keys;
+         k += 2) {
+        concurrent_hashmap_remove(args->map, (void*)k);
+    }
+
+    return NULL;
+}
+
+static void*
+reader(void* arg)
+{
+    struct thread_args* args = arg;
+    uintptr_t           k    = args->first_key;
+
+    while (!atomic_load(args->done)) {
+        void* value;
+
+        if (concurrent_hashmap_get(args->map, (void*)k, &value)
+            && value != value_for(k)) {
+            args->failures++;
+        }
+
+        k = args->first_key + (k * 7919 + 1) % args->n_keys;
+    }
+
+    return NULL;
+}
+
+static int
+run_threads(struct concurrent_hashmap* map, void* (*write)(void*))
+{
+    pthread_t          writers[N_THREADS];
+    pthread_t          readers[N_THREADS];
+    struct thread_args writer_args[N_THREADS];
+    struct thread_args reader_args[N_THREADS];
+    atomic_int         done     = 0;
+    int                failures = 0;
+
+    for (int i = 0; i < N_THREADS; i++) {
+        writer_args[i] = (struct thread_args) {
+            .map       = map,
+            .first_key = 1 + i * KEYS_PER_THREAD,
+            .n_keys    = KEYS_PER_THREAD,
+        };
+
+        reader_args[i] = (struct thread_args) {
+            .map       = map,
+            .first_key = 1,
+            .n_keys    = N_THREADS * KEYS_PER_THREAD,
+            .done      = &done,
+        };
+
+        pthread_create(&readers[i], NULL, reader, &reader_args[i]);
+    }
+
+    for (int i = 0; i < N_THREADS; i++) {
+        pthread_create(&writers[i], NULL, write, &writer_args[i]);
+    }
+
+    for (int i = 0; i < N_THREADS; i++) {
+        pthread_join(writers[i], NULL);
+        failures += writer_args[i].failures;
+    }
+
+    atomic_store(&done, 1);
+
+    for (int i = 0; i < N_THREADS; i++) {
+        pthread_join(readers[i], NULL);
+        failures += reader_args[i].failures;
+    }
+
+    return failures;
+}
+
+void
+test_concurrent(void)
+{
+    struct concurrent_hashmap map;
+    const uintptr_t           n_keys = N_THREADS * KEYS_PER_THREAD;
+
+    CU_ASSERT(concurrent_hashmap_init(&map, 8, hash_uint, compare_uint));
+
+    /* readers racing with inserting writers never see a wrong value */
+    CU_ASSERT(run_threads(&map, writer) == 0);
+    CU_ASSERT(concurrent_hashmap_size(&map) == n_keys);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        void* value;
+
+        CU_ASSERT(concurrent_hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT(value == value_for(k));
+    }
+
+    /* ... nor with removing writers */
+    CU_ASSERT(run_threads(&map, remover) == 0);
+    CU_ASSERT(concurrent_hashmap_size(&map) == n_keys / 2);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        void* value;
+        int   found = concurrent_hashmap_get(&map, (void*)k, &value);
+
+        CU_ASSERT(found == (k % 2 == 0));
+    }
+
+    concurrent_hashmap_destroy(&map);
+}
+
+static uint64_t
+hash_identity(const void* a)
+{
+    return (uintptr_t)(*(void* const*)a);
+}
+
+void
+test_weak_hash(void)
+{
+    struct concurrent_hashmap map;
+    size_t                    n_used = 0;
+
+    /* Keys spaced like 16-byte aligned pointers, hashed to themselves:
+     * every hash is far below 2^61, so without finalizing them they'd
+     * all share the first shard */
+    CU_ASSERT(concurrent_hashmap_init(&map, 8, hash_identity, compare_uint));
+
+    for (uintptr_t i = 1; i <= 4096; i++) {
+        CU_ASSERT(concurrent_hashmap_set(&map, (void*)(i * 16), (void*)i));
+    }
+
+    for (size_t i = 0; i < map.n_shards; i++) {
+        n_used += concurrent_hashmap_shard_size(&map, i) > 0;
+    }
+
+    CU_ASSERT(n_used == map.n_shards);
+
+    for (uintptr_t i = 1; i <= 4096; i += 2) {
+        concurrent_hashmap_remove(&map, (void*)(i * 16));
+    }
+
+    for (uintptr_t i = 1; i <= 4096; i++) {
+        void* value;
+        int   found = concurrent_hashmap_get(&map, (void*)(i * 16), &value);
+
+        CU_ASSERT(found == (i % 2 == 0));
+        CU_ASSERT(value == (found ? (void*)i : NULL));
+    }
+
+    concurrent_hashmap_destroy(&map);
+}
+
+static struct test_case tests[] = {
+    { .name = "test concurrent hashmap insertion", .test_function = test_insertion },
+    { .name = "test concurrent hashmap update and remove", .test_function = test_update_remove },
+    { .name = "test concurrent hashmap threads", .test_function = test_concurrent },
+    { .name = "test concurrent hashmap weak hash", .test_function = test_weak_hash },
+};
+
+TEST_MAIN("concurrent hashmaps", tests)
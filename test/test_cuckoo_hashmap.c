@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/cuckoo_hashmap.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/compare.h>
+#include <magpie/ebuf.h>
+#include <magpie/hash.h>
+
+#include "hashmap_entries.h"
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+static uint64_t
+hash_identity(const void* a)
+{
+    return (uintptr_t)(*(void* const*)a);
+}
+
+static uint64_t
+hash_const(const void* a)
+{
+    (void)a;
+    return 42;
+}
+
+struct cuckoo_hashmap
+make_hashmap(struct entry* entries, size_t n_entries)
+{
+    struct cuckoo_hashmap map;
+
+    cuckoo_hashmap_init(&map, hash_str, compare_str);
+    for (size_t i = 0; i < n_entries; i++) {
+        cuckoo_hashmap_set(&map, entries[i].key, entries[i].value);
+    }
+
+    return map;
+}
+
+/* Checks that every entry sits in one of its two buckets */
+int
+check_invariants(const struct cuckoo_hashmap* map)
+{
+    size_t n_entries = 0;
+    size_t mask      = map->n_buckets - 1;
+
+    for (size_t b = 0; b < map->n_buckets; b++) {
+        const struct cuckoo_hashmap_bucket* bucket = &map->buckets[b];
+
+        for (int s = 0; s < CUCKOO_HASHMAP_BUCKET_SIZE; s++) {
+            const struct cuckoo_hashmap_entry* e = &bucket->entries[s];
+
+            if (bucket->tags[s] == 0) {
+                continue;
+            }
+
+            n_entries++;
+
+            if ((hashmap_mix64(e->hash) & mask) != b
+                && cuckoo_hashmap_lookup((struct cuckoo_hashmap*)map, e->key)
+                       != e) {
+                return 0;
+            }
+        }
+    }
+
+    return n_entries == map->n_entries;
+}
+
+void
+test_insertion(void)
+{
+    struct cuckoo_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+    CU_ASSERT(check_invariants(&map));
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        struct cuckoo_hashmap_entry* entry
+            = cuckoo_hashmap_lookup(&map, large_entries[i].key);
+
+        CU_ASSERT(entry != NULL);
+        CU_ASSERT(strcmp(entry->key, large_entries[i].key) == 0);
+        CU_ASSERT(strcmp(entry->key, entry->value) == 0);
+    }
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_update(void)
+{
+    struct cuckoo_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        cuckoo_hashmap_set(&map, large_entries[i].key, large_entries + i);
+    }
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        void* value;
+
+        CU_ASSERT(cuckoo_hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value == large_entries + i);
+    }
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_remove(void)
+{
+    char* remove_keys[] = {
+        "tender", "forgetful", "boring", "overt", "save", "wooden", "acid"
+    };
+    const size_t n_remove_keys = sizeof(remove_keys) / sizeof(remove_keys[0]);
+    void*        value;
+
+    struct cuckoo_hashmap map = make_hashmap(large_entries, 100);
+
+    for (size_t i = 0; i < n_remove_keys; i++) {
+        CU_ASSERT(cuckoo_hashmap_lookup(&map, remove_keys[i]) != NULL);
+        cuckoo_hashmap_remove(&map, remove_keys[i]);
+        CU_ASSERT(check_invariants(&map));
+    }
+
+    for (size_t i = 0; i < n_remove_keys; i++) {
+        CU_ASSERT(cuckoo_hashmap_lookup(&map, remove_keys[i]) == NULL);
+        CU_ASSERT(!cuckoo_hashmap_get(&map, remove_keys[i], &value));
+        CU_ASSERT(value == NULL);
+    }
+
+    CU_ASSERT(map.n_entries == 100 - n_remove_keys);
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_iter(void)
+{
+    struct cuckoo_hashmap map = make_hashmap(large_entries, n_large_entries);
+    struct cuckoo_hashmap_iter it    = cuckoo_hashmap_iter(&map);
+    size_t                     count = 0;
+    int                        visited[n_large_entries];
+
+    memset(visited, 0, sizeof(visited));
+
+    while (cuckoo_hashmap_iter_next(&it)) {
+        struct cuckoo_hashmap_entry* e = cuckoo_hashmap_iter_get(&it);
+
+        count++;
+
+        for (size_t v = 0; v < n_large_entries; v++) {
+            if (strcmp(large_entries[v].key, e->key) == 0) {
+                CU_ASSERT(!visited[v]);
+                visited[v] = 1;
+                break;
+            }
+        }
+    }
+
+    CU_ASSERT(count == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        CU_ASSERT(visited[i]);
+    }
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_displacement(void)
+{
+    struct cuckoo_hashmap map;
+    size_t                n_buckets;
+    uintptr_t             n_keys;
+    void*                 value;
+
+    cuckoo_hashmap_init(&map, hash_uint, compare_uint);
+    n_buckets = map.n_buckets;
+    n_keys    = n_buckets * CUCKOO_HASHMAP_BUCKET_SIZE
+             * MAGPIE_CUCKOO_HASHMAP_LOAD_THRESHOLD;
+
+    /* Placing each key in whichever of its buckets has room only gets
+     * so far; filling the table to its load threshold without growing
+     * takes moving keys aside */
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        cuckoo_hashmap_set(&map, (void*)k, (void*)(k * 3));
+    }
+
+    CU_ASSERT(map.n_entries == n_keys);
+    CU_ASSERT(map.n_buckets == n_buckets);
+    CU_ASSERT(check_invariants(&map));
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        CU_ASSERT(cuckoo_hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT(value == (void*)(k * 3));
+    }
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_saturation(void)
+{
+    struct cuckoo_hashmap map;
+    size_t                n_buckets;
+    void*                 value;
+
+    cuckoo_hashmap_init(&map, hash_const, compare_uint);
+    n_buckets = map.n_buckets;
+
+    /* Keys which share a hash share both buckets, so only two buckets'
+     * worth of them fit */
+    for (uintptr_t k = 1; k <= 2 * CUCKOO_HASHMAP_BUCKET_SIZE; k++) {
+        cuckoo_hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    CU_ASSERT(map.n_entries == 2 * CUCKOO_HASHMAP_BUCKET_SIZE);
+    CU_ASSERT(ebuf_pop() == NULL);
+
+    cuckoo_hashmap_set(&map, (void*)1000, (void*)1000);
+
+    CU_ASSERT(ebuf_pop() != NULL);
+    CU_ASSERT(map.n_entries == 2 * CUCKOO_HASHMAP_BUCKET_SIZE);
+    CU_ASSERT(map.n_buckets == n_buckets);
+    CU_ASSERT(!cuckoo_hashmap_get(&map, (void*)1000, &value));
+
+    for (uintptr_t k = 1; k <= 2 * CUCKOO_HASHMAP_BUCKET_SIZE; k++) {
+        CU_ASSERT(cuckoo_hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT(value == (void*)k);
+    }
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_churn(void)
+{
+    struct cuckoo_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    for (int round = 0; round < 50; round++) {
+        for (size_t i = round % 3; i < n_large_entries; i += 3) {
+            cuckoo_hashmap_remove(&map, large_entries[i].key);
+        }
+
+        CU_ASSERT(check_invariants(&map));
+
+        for (size_t i = round % 3; i < n_large_entries; i += 3) {
+            CU_ASSERT(cuckoo_hashmap_lookup(&map, large_entries[i].key)
+                      == NULL);
+            cuckoo_hashmap_set(
+                &map, large_entries[i].key, large_entries[i].value);
+        }
+
+        CU_ASSERT(map.n_entries == n_large_entries);
+    }
+
+    CU_ASSERT(check_invariants(&map));
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+void
+test_weak_hash(void)
+{
+    static const uintptr_t spacings[] = { 1, 8, 64 };
+    const uintptr_t        n_keys     = 50000;
+
+    for (size_t i = 0; i < sizeof(spacings) / sizeof(spacings[0]); i++) {
+        struct cuckoo_hashmap map;
+        uint8_t               seen[256] = { 0 };
+        size_t                n_tags    = 0;
+
+        /* Small integers and aligned pointers, hashed to themselves */
+        cuckoo_hashmap_init(&map, hash_identity, compare_uint);
+
+        for (uintptr_t k = 1; k <= n_keys; k++) {
+            cuckoo_hashmap_set(&map, (void*)(k * spacings[i]), (void*)k);
+        }
+
+        CU_ASSERT(map.n_entries == n_keys);
+        CU_ASSERT(check_invariants(&map));
+
+        /* The table only grew for lack of space, not for clustering */
+        CU_ASSERT(map.n_entries * 2
+                  >= map.n_buckets * CUCKOO_HASHMAP_BUCKET_SIZE
+                         * MAGPIE_CUCKOO_HASHMAP_LOAD_THRESHOLD);
+
+        /* ... and the tags still tell keys apart */
+        for (size_t b = 0; b < map.n_buckets; b++) {
+            for (int s = 0; s < CUCKOO_HASHMAP_BUCKET_SIZE; s++) {
+                n_tags += !seen[map.buckets[b].tags[s]];
+                seen[map.buckets[b].tags[s]] = 1;
+            }
+        }
+
+        CU_ASSERT(n_tags > 128);
+
+        cuckoo_hashmap_destroy(&map);
+    }
+}
+
+void
+test_crowding(void)
+{
+    struct cuckoo_hashmap map;
+    const uintptr_t       n_keys     = 20000;
+    size_t                n_rejected = 0;
+    size_t                n_found    = 0;
+
+    /* hash_ptr() discards the low bits, so every eight consecutive
+     * integers share a hash and can only be held by a pair of buckets
+     * with nothing else in them. Most such groups can't be placed,
+     * however large the table, so it mustn't keep growing for them. */
+    cuckoo_hashmap_init(&map, hash_ptr, compare_ptr);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        cuckoo_hashmap_set(&map, (void*)k, (void*)k);
+        n_rejected += ebuf_pop() != NULL;
+    }
+
+    CU_ASSERT(map.n_buckets * CUCKOO_HASHMAP_BUCKET_SIZE <= 4 * n_keys);
+    CU_ASSERT(map.n_entries + n_rejected == n_keys);
+    CU_ASSERT(check_invariants(&map));
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        void* value;
+
+        if (cuckoo_hashmap_get(&map, (void*)k, &value)) {
+            CU_ASSERT(value == (void*)k);
+            n_found++;
+        }
+    }
+
+    CU_ASSERT(n_found == map.n_entries);
+
+    cuckoo_hashmap_destroy(&map);
+}
+
+static struct test_case tests[] = {
+    { .name          = "test cuckoo hashmap insertion",
+      .test_function = test_insertion },
+    { .name = "test cuckoo hashmap update", .test_function = test_update },
+    { .name = "test cuckoo hashmap remove", .test_function = test_remove },
+    { .name = "test cuckoo hashmap iterator", .test_function = test_iter },
+    { .name          = "test cuckoo hashmap displacement",
+      .test_function = test_displacement },
+    { .name          = "test cuckoo hashmap saturation",
+      .test_function = test_saturation },
+    { .name = "test cuckoo hashmap churn", .test_function = test_churn },
+    { .name          = "test cuckoo hashmap weak hash",
+      .test_function = test_weak_hash },
+    { .name          = "test cuckoo hashmap crowding",
+      .test_function = test_crowding },
+};
+
+TEST_MAIN("cuckoo hashmaps", tests)
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/frozen_hashmap.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#include "hashmap_entries.h"
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+/* Freezes `map` into a temporary file, returning its path */
+static char*
+freeze_to_file(struct hashmap* map,
+               size_t (*encode_key)(const void*, const void**),
+               size_t (*encode_value)(const void*, const void**))
+{
+    char  template[] = "/tmp/magpie_frozen_XXXXXX";
+    int   fd         = mkstemp(template);
+    FILE* stream;
+
+    CU_ASSERT_FATAL(fd >= 0);
+    stream = fdopen(fd, "wb");
+    CU_ASSERT_FATAL(stream != NULL);
+
+    CU_ASSERT(hashmap_freeze(map, stream, encode_key, encode_value));
+    CU_ASSERT(fclose(stream) == 0);
+
+    return strdup(template);
+}
+
+/* Reads the file at `path` into an 8-byte aligned buffer */
+static void*
+read_file(const char* path, size_t* size)
+{
+    FILE* stream = fopen(path, "rb");
+    void* data;
+
+    CU_ASSERT_FATAL(stream != NULL);
+    fseek(stream, 0, SEEK_END);
+    *size = ftell(stream);
+    rewind(stream);
+
+    data = malloc(*size);
+    CU_ASSERT_FATAL(data != NULL);
+    CU_ASSERT(fread(data, 1, *size, stream) == *size);
+    fclose(stream);
+
+    return data;
+}
+
+void
+test_strings(void)
+{
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_entry entry;
+    char*                       path;
+
+    hashmap_init(&map, hash_str, compare_str);
+    for (size_t i = 0; i < n_large_entries; i++) {
+        hashmap_set(&map, large_entries[i].key, large_entries[i].value);
+    }
+
+    /* Removed entries don't make it into the image */
+    hashmap_remove(&map, large_entries[0].key);
+
+    path = freeze_to_file(&map,
+                          frozen_hashmap_encode_str,
+                          frozen_hashmap_encode_str);
+    hashmap_destroy(&map);
+
+    CU_ASSERT_FATAL(frozen_hashmap_open(&frozen, path));
+    CU_ASSERT(frozen.header->n_entries == n_large_entries - 1);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        const char* key = large_entries[i].key;
+        int found = frozen_hashmap_get(&frozen, key, strlen(key), &entry);
+
+        CU_ASSERT(found == (i != 0));
+
+        if (found) {
+            /* Strings come back NUL-terminated and usable in place */
+            CU_ASSERT(entry.key_length == strlen(key));
+            CU_ASSERT(strcmp(entry.key, key) == 0);
+            CU_ASSERT(strcmp(entry.value, large_entries[i].value) == 0);
+        }
+    }
+
+    CU_ASSERT(!frozen_hashmap_get(&frozen, "not a key", 9, &entry));
+
+    /* A prefix of a key is a different key */
+    CU_ASSERT(!frozen_hashmap_get(&frozen, large_entries[1].key, 1, &entry)
+              || strlen(large_entries[1].key) == 1);
+
+    frozen_hashmap_close(&frozen);
+    unlink(path);
+    free(path);
+}
+
+void
+test_iter(void)
+{
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_iter  it;
+    struct frozen_hashmap_entry entry;
+    char*                       path;
+    size_t                      i = 0;
+
+    hashmap_init(&map, hash_str, compare_str);
+    for (size_t j = 0; j < n_large_entries; j++) {
+        hashmap_set(&map, large_entries[j].key, large_entries[j].value);
+    }
+
+    path = freeze_to_file(&map,
+                          frozen_hashmap_encode_str,
+                          frozen_hashmap_encode_str);
+    hashmap_destroy(&map);
+
+    CU_ASSERT_FATAL(frozen_hashmap_open(&frozen, path));
+
+    /* Entries keep their insertion order */
+    it = frozen_hashmap_iter(&frozen);
+    CU_ASSERT(!frozen_hashmap_iter_get(&it, &entry));
+
+    while (frozen_hashmap_iter_next(&it)) {
+        CU_ASSERT(frozen_hashmap_iter_get(&it, &entry));
+        CU_ASSERT(strcmp(entry.key, large_entries[i].key) == 0);
+        CU_ASSERT(strcmp(entry.value, large_entries[i].value) == 0);
+        i++;
+    }
+
+    CU_ASSERT(i == n_large_entries);
+    CU_ASSERT(!frozen_hashmap_iter_get(&it, &entry));
+
+    frozen_hashmap_close(&frozen);
+    unlink(path);
+    free(path);
+}
+
+void
+test_in_memory(void)
+{
+    const uintptr_t             n_keys = 10000;
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_entry entry;
+    char*                       path;
+    uint8_t*                    data;
+    size_t                      size;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)(k * 3));
+    }
+
+    path = freeze_to_file(&map,
+                          frozen_hashmap_encode_ptr,
+                          frozen_hashmap_encode_ptr);
+    hashmap_destroy(&map);
+
+    data = read_file(path, &size);
+    unlink(path);
+    free(path);
+
+    /* The image is relocatable, so a copy anywhere works as well */
+    CU_ASSERT_FATAL(frozen_hashmap_init(&frozen, data, size));
+
+    for (uintptr_t k = 1; k <= 2 * n_keys; k++) {
+        void* key = (void*)k;
+        void* value;
+        int   found = frozen_hashmap_get(&frozen, &key, sizeof(key), &entry);
+
+        CU_ASSERT(found == (k <= n_keys));
+
+        if (found) {
+            CU_ASSERT(entry.value_length == sizeof(value));
+            memcpy(&value, entry.value, sizeof(value));
+            CU_ASSERT(value == (void*)(k * 3));
+        }
+    }
+
+    frozen_hashmap_close(&frozen);
+
+    /* Damaged images are rejected */
+    CU_ASSERT(!frozen_hashmap_init(&frozen, data, size - 1));
+    CU_ASSERT(!frozen_hashmap_init(&frozen, data, 16));
+    data[0] ^= 0xFF;
+    CU_ASSERT(!frozen_hashmap_init(&frozen, data, size));
+
+    free(data);
+}
+
+void
+test_seed(void)
+{
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_entry entry;
+    char*                       path;
+    const char*                 key = large_entries[3].key;
+
+    hash_seed(0x5EED);
+
+    hashmap_init(&map, hash_str, compare_str);
+    for (size_t i = 0; i < n_large_entries; i++) {
+        hashmap_set(&map, large_entries[i].key, large_entries[i].value);
+    }
+
+    path = freeze_to_file(&map,
+                          frozen_hashmap_encode_str,
+                          frozen_hashmap_encode_str);
+    hashmap_destroy(&map);
+
+    /* The image carries its own seed, so it can be read whatever the
+     * process's current seed is */
+    hash_seed(0);
+
+    CU_ASSERT_FATAL(frozen_hashmap_open(&frozen, path));
+    CU_ASSERT(frozen.header->seed == 0x5EED);
+    CU_ASSERT(frozen_hashmap_get(&frozen, key, strlen(key), &entry));
+    CU_ASSERT(strcmp(entry.value, large_entries[3].value) == 0);
+
+    frozen_hashmap_close(&frozen);
+    unlink(path);
+    free(path);
+}
+
+void
+test_empty(void)
+{
+    struct hashmap              map;
+    struct frozen_hashmap       frozen;
+    struct frozen_hashmap_iter  it;
+    struct frozen_hashmap_entry entry;
+    char*                       path;
+
+    hashmap_init(&map, hash_str, compare_str);
+    path = freeze_to_file(&map,
+                          frozen_hashmap_encode_str,
+                          frozen_hashmap_encode_str);
+    hashmap_destroy(&map);
+
+    CU_ASSERT_FATAL(frozen_hashmap_open(&frozen, path));
+    CU_ASSERT(!frozen_hashmap_get(&frozen, "key", 3, &entry));
+
+    it = frozen_hashmap_iter(&frozen);
+    CU_ASSERT(!frozen_hashmap_iter_next(&it));
+
+    frozen_hashmap_close(&frozen);
+    unlink(path);
+    free(path);
+
+    CU_ASSERT(!frozen_hashmap_open(&frozen, "/nonexistent/frozen"));
+}
+
+static struct test_case tests[] = {
+    { .name = "test frozen hashmap strings", .test_function = test_strings },
+    { .name = "test frozen hashmap iterator", .test_function = test_iter },
+    { .name          = "test frozen hashmap in memory",
+      .test_function = test_in_memory },
+    { .name = "test frozen hashmap seed", .test_function = test_seed },
+    { .name = "test frozen hashmap empty", .test_function = test_empty },
+};
+
+TEST_MAIN("frozen hashmaps", tests)
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#define N_KEYS 10000
+
+static size_t
+count_distinct(uint64_t* hashes, size_t n, uint64_t mask)
+{
+    size_t distinct = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t j;
+
+        for (j = 0; j < i; j++) {
+            if ((hashes[j] & mask) == (hashes[i] & mask)) {
+                break;
+            }
+        }
+
+        distinct += j == i;
+    }
+
+    return distinct;
+}
+
+void
+test_uint(void)
+{
+    uint64_t hashes[256];
+
+    /* Consecutive integers spread over the low bits, which the hashmap
+     * uses for its control bytes */
+    for (size_t i = 0; i < 256; i++) {
+        void* key = (void*)(uintptr_t)i;
+
+        hashes[i] = hash_uint(&key);
+    }
+
+    CU_ASSERT(count_distinct(hashes, 256, ~0ULL) == 256);
+    CU_ASSERT(count_distinct(hashes, 256, 0x7f) > 64);
+
+    void*    key    = (void*)(uintptr_t)12345;
+    uint64_t before = hash_uint(&key);
+
+    hash_seed(42);
+    CU_ASSERT(hash_uint(&key) != before);
+    hash_seed(0);
+    CU_ASSERT(hash_uint(&key) == before);
+
+    void* other = (void*)(uintptr_t)12346;
+
+    CU_ASSERT(compare_uint(&key, &key) == 0);
+    CU_ASSERT(compare_uint(&key, &other) < 0);
+    CU_ASSERT(compare_uint(&other, &key) > 0);
+}
+
+void
+test_ptr(void)
+{
+    uint64_t  hashes[256];
+    uint64_t* objects = malloc(sizeof(*objects) * 256);
+
+    /* Neighbouring elements of an array differ only above the
+     * alignment bits */
+    for (size_t i = 0; i < 256; i++) {
+        void* key = &objects[i];
+
+        hashes[i] = hash_ptr(&key);
+    }
+
+    CU_ASSERT(count_distinct(hashes, 256, ~0ULL) == 256);
+    CU_ASSERT(count_distinct(hashes, 256, 0x7f) > 64);
+
+    void* a = &objects[0];
+    void* b = &objects[1];
+
+    CU_ASSERT(compare_ptr(&a, &a) == 0);
+    CU_ASSERT(compare_ptr(&a, &b) != 0);
+
+    free(objects);
+}
+
+void
+test_fixed(void)
+{
+    uint8_t  bytes[32] = { 0 };
+    uint8_t  copy[32]  = { 0 };
+    void*    key       = bytes;
+    void*    other     = copy;
+    uint64_t h16       = hash_fixed16(&key);
+    uint64_t h32       = hash_fixed32(&key);
+
+    CU_ASSERT(hash_fixed16(&other) == h16);
+    CU_ASSERT(hash_fixed32(&other) == h32);
+    CU_ASSERT(compare_fixed16(&key, &other) == 0);
+    CU_ASSERT(compare_fixed32(&key, &other) == 0);
+
+    /* Every byte of the key affects its hash, and nothing past it
+     * does */
+    for (size_t i = 0; i < 32; i++) {
+        bytes[i] = 1;
+
+        if (i < 16) {
+            CU_ASSERT(hash_fixed16(&key) != h16);
+            CU_ASSERT(compare_fixed16(&key, &other) > 0);
+        }
+        else {
+            CU_ASSERT(hash_fixed16(&key) == h16);
+            CU_ASSERT(compare_fixed16(&key, &other) == 0);
+        }
+
+        CU_ASSERT(hash_fixed32(&key) != h32);
+        CU_ASSERT(compare_fixed32(&key, &other) > 0);
+
+        bytes[i] = 0;
+    }
+}
+
+void
+test_hashmap_keys(void)
+{
+    struct hashmap map;
+    uint8_t*       digests = malloc(N_KEYS * 32);
+    uint64_t       state   = 1;
+
+    for (size_t i = 0; i < N_KEYS * 32; i++) {
+        state      = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        digests[i] = state >> 56;
+    }
+
+    /* Integer keys */
+    hashmap_init(&map, hash_uint, compare_uint);
+
+    for (size_t i = 0; i < N_KEYS; i++) {
+        hashmap_set(&map, (void*)(uintptr_t)(i << 20), (void*)(i + 1));
+    }
+
+    for (size_t i = 0; i < N_KEYS; i++) {
+        void* value;
+
+        CU_ASSERT(hashmap_get(&map, (void*)(uintptr_t)(i << 20), &value));
+        CU_ASSERT(value == (void*)(i + 1));
+    }
+
+    hashmap_destroy(&map);
+
+    /* Pointer keys, and 32-byte keys, whose first 16 bytes are used as
+     * 16-byte keys */
+    uint64_t (*hashes[])(const void*)
+        = { hash_ptr, hash_fixed16, hash_fixed32 };
+    int (*compares[])(const void*, const void*)
+        = { compare_ptr, compare_fixed16, compare_fixed32 };
+
+    for (size_t k = 0; k < 3; k++) {
+        uint8_t copy[32];
+
+        hashmap_init(&map, hashes[k], compares[k]);
+
+        for (size_t i = 0; i < N_KEYS; i++) {
+            hashmap_set(&map, digests + i * 32, (void*)(i + 1));
+        }
+
+        CU_ASSERT(map.n_entries == N_KEYS);
+
+        for (size_t i = 0; i < N_KEYS; i++) {
+            void* value;
+
+            /* Fixed-width keys are found by content, pointers by
+             * identity */
+            memcpy(copy, digests + i * 32, 32);
+            CU_ASSERT(hashmap_get(&map, k == 0 ? digests + i * 32 : copy,
+                                  &value));
+            CU_ASSERT(value == (void*)(i + 1));
+        }
+
+        hashmap_destroy(&map);
+    }
+
+    free(digests);
+}
+
+static struct test_case tests[] = {
+    { .name = "test integer hash", .test_function = test_uint },
+    { .name = "test pointer hash", .test_function = test_ptr },
+    { .name = "test fixed-width hash", .test_function = test_fixed },
+    { .name = "test hashmap keys", .test_function = test_hashmap_keys },
+};
+
+TEST_MAIN("hashes", tests)
@@ -24,9 +24,9 @@
 #include "test_common.h"
 #include <CUnit/Basic.h>
 #include <magpie/collections/hashmap.h>
-#include <magpie/collections/list.h>
 #include <magpie/compare.h>
 #include <magpie/hash.h>
+#include <magpie/math/prime.h>
 
 #include "hashmap_entries.h"
 
@@ -38,28 +38,19 @@ struct entry_visited {
 void
 print_hashmap(const struct hashmap* map)
 {
-    printf("\nHashmap has %zu buckets\n", map->buckets.length);
-    for (size_t i = 0; i < map->buckets.length; i++) {
-        struct list_iter it = list_iter(map->buckets.elements[i]);
+    printf("\nHashmap has %zu slots\n", map->table.capacity);
+    for (size_t i = 0; i < map->entries_length; i++) {
+        struct hashmap_entry* entry = &map->entries[i];
 
-        printf("  %zu =>\n", i);
-
-        list_iter_next(&it);
-        while (list_iter_next(&it)) {
-            struct list*          item  = list_iter_get(&it);
-            struct hashmap_entry* entry = item->data;
-
-            if (entry != NULL) {
-                printf("    - %s -> %s\n",
-                       (const char*)entry->key,
-                       (const char*)entry->value);
-            }
-            else {
-                printf("Dead entry -> ");
-            }
+        if (!entry->alive) {
+            printf("  %zu => dead\n", i);
+            continue;
         }
 
-        printf("\n");
+        printf("  %zu => %s -> %s\n",
+               i,
+               (const char*)entry->key,
+               (const char*)entry->value);
     }
 }
 
@@ -166,24 +157,22 @@ test_iter(void)
     }
 
     /* Manually kludge our way through the hashmap */
-    for (size_t i = 0; i < map.buckets.length; i++) {
-        struct list* l = map.buckets.elements[i];
-        l              = l->next;
-
-        while (l) {
-            struct hashmap_entry* e = l->data;
-            
-            for (size_t v = 0; v < n_entries; v++) {
-                if (strcmp(manual_visited[v].key, e->key) == 0) {
-                    CU_ASSERT(!manual_visited[v].visited);
-                    manual_visited[v].visited = 1;
-                    break;
-                }
-            }
+    for (size_t i = 0; i < map.entries_length; i++) {
+        struct hashmap_entry* e = &map.entries[i];
+
+        if (!e->alive) {
+            continue;
+        }
 
-            count_manual++;
-            l = l->next;
+        for (size_t v = 0; v < n_entries; v++) {
+            if (strcmp(manual_visited[v].key, e->key) == 0) {
+                CU_ASSERT(!manual_visited[v].visited);
+                manual_visited[v].visited = 1;
+                break;
+            }
         }
+
+        count_manual++;
     }
 
     /* Make sure all our size measurements agree */
@@ -240,11 +229,960 @@ test_iter_after_remove(void)
     hashmap_destroy(&map);
 }
 
+void
+test_update(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map     = make_hashmap(large_entries, n_entries);
+
+    for (size_t i = 0; i < n_entries; i += 2) {
+        hashmap_set(&map, large_entries[i].key, large_entries + i);
+    }
+
+    CU_ASSERT(map.n_entries == n_entries);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        void* value;
+
+        CU_ASSERT(hashmap_get(&map, large_entries[i].key, &value));
+
+        if (i % 2 == 0) {
+            CU_ASSERT(value == large_entries + i);
+        }
+        else {
+            CU_ASSERT(strcmp(value, large_entries[i].value) == 0);
+        }
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_remove_reinsert(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map     = make_hashmap(large_entries, n_entries);
+    size_t         capacity = map.table.capacity;
+
+    /* Repeatedly churn half of the keys; deleted slots must be reused
+     * (or purged) rather than growing the map */
+    for (int round = 0; round < 50; round++) {
+        size_t removed = 0;
+
+        for (size_t i = round % 2; i < n_entries; i += 2) {
+            hashmap_remove(&map, large_entries[i].key);
+            removed++;
+        }
+
+        CU_ASSERT(map.n_entries == n_entries - removed);
+
+        for (size_t i = round % 2; i < n_entries; i += 2) {
+            CU_ASSERT(hashmap_lookup(&map, large_entries[i].key) == NULL);
+            hashmap_set(&map, large_entries[i].key, large_entries[i].value);
+        }
+
+        CU_ASSERT(map.n_entries == n_entries);
+    }
+
+    CU_ASSERT(map.table.capacity == capacity);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        struct hashmap_entry* e = hashmap_lookup(&map, large_entries[i].key);
+        CU_ASSERT(e != NULL && strcmp(e->value, large_entries[i].value) == 0);
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_incremental_rehash(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map;
+    int            saw_migration = 0;
+
+    hashmap_init(&map, hash_str, compare_str);
+    hashmap_set_rehash_budget(&map, 4);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        hashmap_set(&map, large_entries[i].key, large_entries[i].value);
+
+        if (map.old.capacity != 0) {
+            struct hashmap_iter it    = hashmap_iter(&map);
+            size_t              count = 0;
+
+            saw_migration = 1;
+
+            /* Every entry must be visible, whichever table it is in */
+            for (size_t j = 0; j <= i; j++) {
+                CU_ASSERT(hashmap_lookup(&map, large_entries[j].key) != NULL);
+            }
+
+            while (hashmap_iter_next(&it)) {
+                count++;
+            }
+
+            CU_ASSERT(count == i + 1);
+            CU_ASSERT(map.table.n_entries + map.old.n_entries == i + 1);
+        }
+    }
+
+    CU_ASSERT(saw_migration);
+    CU_ASSERT(map.n_entries == n_entries);
+
+    /* Removing entries keeps the migration going until it completes */
+    for (size_t i = 0; i < n_entries && map.old.capacity != 0; i++) {
+        hashmap_remove(&map, large_entries[i].key);
+        CU_ASSERT(hashmap_lookup(&map, large_entries[i].key) == NULL);
+    }
+
+    CU_ASSERT(map.old.capacity == 0);
+
+    hashmap_destroy(&map);
+}
+
+void
+test_index_strategies(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    const enum hashmap_index strategies[] = {
+        HASHMAP_INDEX_MASK,
+        HASHMAP_INDEX_FASTRANGE,
+        HASHMAP_INDEX_PRIME,
+    };
+
+    for (size_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+        struct hashmap map;
+
+        hashmap_init(&map, hash_str, compare_str);
+        CU_ASSERT(hashmap_set_index(&map, strategies[s]));
+
+        for (size_t i = 0; i < n_entries; i++) {
+            hashmap_set(&map, large_entries[i].key, large_entries[i].value);
+
+            /* switching strategy part way through must keep every entry */
+            if (i == n_entries / 2) {
+                CU_ASSERT(hashmap_set_index(&map, strategies[(s + 1) % 3]));
+            }
+            else if (i == 3 * n_entries / 4) {
+                CU_ASSERT(hashmap_set_index(&map, strategies[s]));
+            }
+        }
+
+        for (size_t i = 0; i < n_entries; i += 2) {
+            hashmap_remove(&map, large_entries[i].key);
+        }
+
+        for (size_t i = 0; i < n_entries; i++) {
+            struct hashmap_entry* e
+                = hashmap_lookup(&map, large_entries[i].key);
+
+            CU_ASSERT((e == NULL) == (i % 2 == 0));
+        }
+
+        CU_ASSERT(map.table.index == strategies[s]);
+
+        if (strategies[s] == HASHMAP_INDEX_PRIME) {
+            CU_ASSERT(is_prime(map.table.capacity));
+        }
+        else if (strategies[s] == HASHMAP_INDEX_MASK) {
+            CU_ASSERT((map.table.capacity & (map.table.capacity - 1)) == 0);
+        }
+
+        hashmap_destroy(&map);
+    }
+}
+
+void
+test_insertion_order(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map     = make_hashmap(large_entries, n_entries);
+    struct hashmap_iter it;
+    size_t              rounds;
+
+    for (size_t i = 0; i < n_entries; i += 3) {
+        hashmap_remove(&map, large_entries[i].key);
+    }
+
+    /* Re-inserting a removed key moves it to the end */
+    hashmap_set(&map, large_entries[0].key, large_entries[0].value);
+
+    it = hashmap_iter(&map);
+    for (size_t i = 1; i < n_entries; i++) {
+        if (i % 3 == 0) {
+            continue;
+        }
+
+        CU_ASSERT(hashmap_iter_next(&it));
+        CU_ASSERT(hashmap_iter_get(&it)->key == large_entries[i].key);
+    }
+
+    CU_ASSERT(hashmap_iter_next(&it));
+    CU_ASSERT(hashmap_iter_get(&it)->key == large_entries[0].key);
+    CU_ASSERT(!hashmap_iter_next(&it));
+
+    /* Churn until the pool fills with holes and has to be compacted;
+     * order must survive it */
+    rounds = map.entries_capacity - map.entries_length + 1;
+    for (size_t round = 0; round < rounds; round++) {
+        hashmap_remove(&map, large_entries[1].key);
+        hashmap_set(&map, large_entries[1].key, large_entries[1].value);
+    }
+
+    CU_ASSERT(map.entries_length == map.n_entries);
+    CU_ASSERT(map.entries[map.entries_length - 1].key == large_entries[1].key);
+
+    it = hashmap_iter(&map);
+    for (size_t i = 2; i < n_entries; i++) {
+        if (i % 3 == 0) {
+            continue;
+        }
+
+        CU_ASSERT(hashmap_iter_next(&it));
+        CU_ASSERT(hashmap_iter_get(&it)->key == large_entries[i].key);
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_index_width(void)
+{
+    struct hashmap map;
+    const size_t   n_keys = 100000;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)(k * 2));
+
+        if (k == 100) {
+            CU_ASSERT(map.table.slot_width == 1);
+        }
+
+        if (k == 1000) {
+            CU_ASSERT(map.table.slot_width == 2);
+        }
+    }
+
+    CU_ASSERT(map.table.slot_width == 4);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        void* value;
+
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT((uintptr_t)value == k * 2);
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_reserve(void)
+{
+    const size_t   n_keys = 5000;
+    struct hashmap map;
+    size_t         capacity;
+
+    CU_ASSERT(
+        hashmap_init_with_capacity(&map, hash_uint, compare_uint, n_keys));
+    capacity = map.table.capacity;
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    /* Pre-sized maps never need to grow */
+    CU_ASSERT(map.table.capacity == capacity);
+
+    /* Reserving space for what's already there is a no-op */
+    CU_ASSERT(hashmap_reserve(&map, n_keys));
+    CU_ASSERT(map.table.capacity == capacity);
+
+    CU_ASSERT(hashmap_reserve(&map, 4 * n_keys));
+    capacity = map.table.capacity;
+
+    for (uintptr_t k = n_keys + 1; k <= 4 * n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    CU_ASSERT(map.table.capacity == capacity);
+    CU_ASSERT(map.n_entries == 4 * n_keys);
+
+    for (uintptr_t k = 1; k <= 4 * n_keys; k++) {
+        void* value;
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value) && value == (void*)k);
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_set_many(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map;
+    void*          keys[2 * n_entries];
+    void*          values[2 * n_entries];
+
+    /* Every key appears twice; the later value must win */
+    for (size_t i = 0; i < n_entries; i++) {
+        keys[i]               = large_entries[i].key;
+        values[i]             = NULL;
+        keys[n_entries + i]   = large_entries[i].key;
+        values[n_entries + i] = large_entries[i].value;
+    }
+
+    hashmap_init(&map, hash_str, compare_str);
+    hashmap_set(&map, large_entries[0].key, NULL);
+
+    CU_ASSERT(hashmap_set_many(&map, keys, values, 2 * n_entries));
+    CU_ASSERT(map.n_entries == n_entries);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        void* value;
+
+        CU_ASSERT(hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value == large_entries[i].value);
+    }
+
+    /* Insertion order is that of each key's first appearance */
+    for (size_t i = 0; i < n_entries; i++) {
+        CU_ASSERT(map.entries[i].key == large_entries[i].key);
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_get_many(void)
+{
+    const size_t n_keys = 2000;
+    struct hashmap map;
+    void*          keys[2 * n_keys];
+    void*          values[2 * n_keys];
+
+    hashmap_init(&map, hash_uint, compare_uint);
+    hashmap_set_rehash_budget(&map, 4);
+
+    /* Odd keys are present; key 1 maps to NULL */
+    for (uintptr_t k = 1; k <= 2 * n_keys; k += 2) {
+        hashmap_set(&map, (void*)k, k == 1 ? NULL : (void*)(k * 2));
+    }
+
+    for (size_t i = 0; i < 2 * n_keys; i++) {
+        keys[i] = (void*)(uintptr_t)(2 * n_keys - i);
+    }
+
+    /* Make sure some lookups have to consult a table being migrated */
+    for (uintptr_t k = 2 * n_keys + 1; map.old.capacity == 0; k += 2) {
+        hashmap_set(&map, (void*)k, (void*)(k * 2));
+    }
+
+    CU_ASSERT(hashmap_get_many(&map, keys, values, 2 * n_keys) == n_keys);
+
+    for (size_t i = 0; i < 2 * n_keys; i++) {
+        uintptr_t k = (uintptr_t)keys[i];
+
+        if (k % 2 == 0 || k == 1) {
+            CU_ASSERT(values[i] == NULL);
+        }
+        else {
+            CU_ASSERT(values[i] == (void*)(k * 2));
+        }
+    }
+
+    /* A batch may contain the same key more than once */
+    keys[0] = keys[1] = keys[2] = (void*)(uintptr_t)3;
+    CU_ASSERT(hashmap_get_many(&map, keys, values, 3) == 3);
+    CU_ASSERT(values[0] == (void*)6 && values[1] == (void*)6);
+    CU_ASSERT(values[2] == (void*)6);
+
+    CU_ASSERT(hashmap_get_many(&map, keys, values, 0) == 0);
+
+    hashmap_destroy(&map);
+}
+
+void
+test_shrink(void)
+{
+    const size_t   n_keys = 20000;
+    struct hashmap map;
+    size_t         capacity;
+    size_t         initial;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+    initial = map.table.capacity;
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    capacity = map.table.capacity;
+
+    /* Removing most entries shrinks the map by itself... */
+    for (uintptr_t k = 1; k <= n_keys - 100; k++) {
+        hashmap_remove(&map, (void*)k);
+    }
+
+    CU_ASSERT(map.n_entries == 100);
+    CU_ASSERT(map.table.capacity < capacity);
+    CU_ASSERT(map.table.capacity >= initial);
+    CU_ASSERT(map.entries_capacity < capacity);
+
+    for (uintptr_t k = n_keys - 99; k <= n_keys; k++) {
+        void* value;
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value) && value == (void*)k);
+    }
+
+    /* ...leaving some room to grow again, unless asked not to */
+    capacity = map.table.capacity;
+    CU_ASSERT(hashmap_shrink_to_fit(&map));
+    CU_ASSERT(map.table.capacity < capacity);
+    CU_ASSERT(map.entries_capacity >= map.n_entries);
+    CU_ASSERT(map.entries_length == map.n_entries);
+
+    for (uintptr_t k = n_keys - 99; k <= n_keys; k++) {
+        void* value;
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value) && value == (void*)k);
+    }
+
+    /* With no threshold the map keeps its size */
+    hashmap_set_shrink_threshold(&map, 0);
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    capacity = map.table.capacity;
+    for (uintptr_t k = 1; k < n_keys; k++) {
+        hashmap_remove(&map, (void*)k);
+    }
+
+    CU_ASSERT(map.table.capacity == capacity);
+    CU_ASSERT(hashmap_lookup(&map, (void*)n_keys) != NULL);
+
+    hashmap_destroy(&map);
+}
+
+void
+test_compact(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map     = make_hashmap(large_entries, n_entries);
+    struct hashmap_iter it;
+    size_t              capacity = map.table.capacity;
+
+    for (size_t i = 0; i < n_entries; i += 2) {
+        hashmap_remove(&map, large_entries[i].key);
+    }
+
+    CU_ASSERT(map.entries_length > map.n_entries);
+    CU_ASSERT(hashmap_compact(&map));
+    CU_ASSERT(map.table.n_tombstones == 0);
+    CU_ASSERT(map.entries_length == map.n_entries);
+    CU_ASSERT(map.table.capacity == capacity);
+
+    /* Compacting keeps insertion order */
+    it = hashmap_iter(&map);
+    for (size_t i = 1; i < n_entries; i += 2) {
+        CU_ASSERT(hashmap_iter_next(&it));
+        CU_ASSERT(hashmap_iter_get(&it)->key == large_entries[i].key);
+    }
+
+    CU_ASSERT(!hashmap_iter_next(&it));
+
+    /* A clean map has nothing to do */
+    CU_ASSERT(hashmap_compact(&map));
+    CU_ASSERT(map.table.capacity == capacity);
+
+    hashmap_destroy(&map);
+}
+
+static int
+keep_odd(struct hashmap_entry* entry, void* ctx)
+{
+    size_t* calls = ctx;
+
+    (*calls)++;
+    entry->value = (void*)((uintptr_t)entry->value + 1);
+
+    return (uintptr_t)entry->key % 2 == 1;
+}
+
+void
+test_retain(void)
+{
+    const size_t   n_keys = 3000;
+    struct hashmap map;
+    size_t         calls = 0;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+    hashmap_set_rehash_budget(&map, 4);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    /* Make sure some entries are still in the table being migrated */
+    for (uintptr_t k = n_keys + 1; map.old.capacity == 0; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+        hashmap_remove(&map, (void*)k);
+    }
+
+    CU_ASSERT(hashmap_retain(&map, keep_odd, &calls) == n_keys / 2);
+    CU_ASSERT(calls == n_keys);
+    CU_ASSERT(map.n_entries == n_keys / 2);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        void* value;
+
+        if (k % 2 == 0) {
+            CU_ASSERT(hashmap_lookup(&map, (void*)k) == NULL);
+        }
+        else {
+            CU_ASSERT(hashmap_get(&map, (void*)k, &value));
+            CU_ASSERT(value == (void*)(k + 1));
+        }
+    }
+
+    /* The iterator only sees the survivors, in insertion order */
+    {
+        struct hashmap_iter it = hashmap_iter(&map);
+
+        for (uintptr_t k = 1; k <= n_keys; k += 2) {
+            CU_ASSERT(hashmap_iter_next(&it));
+            CU_ASSERT(hashmap_iter_get(&it)->key == (void*)k);
+        }
+
+        CU_ASSERT(!hashmap_iter_next(&it));
+    }
+
+    /* Dropping nearly everything shrinks the map */
+    calls = 0;
+    hashmap_set(&map, (void*)2, (void*)2);
+    CU_ASSERT(hashmap_retain(&map, keep_odd, &calls) == 1);
+    CU_ASSERT(hashmap_retain(&map, keep_odd, &calls) == 0);
+
+    hashmap_destroy(&map);
+}
+
+static uint64_t
+hash_weak(const void* a)
+{
+    return (uintptr_t)(*(void* const*)a) % 4;
+}
+
+void
+test_stats(void)
+{
+    const size_t         n_keys = 5000;
+    struct hashmap       map;
+    struct hashmap_stats stats;
+    size_t               total = 0;
+    double               mean;
+    FILE*                out;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    for (uintptr_t k = 1; k <= n_keys; k += 5) {
+        hashmap_remove(&map, (void*)k);
+    }
+
+    hashmap_stats(&map, &stats);
+
+    CU_ASSERT(stats.n_entries == map.n_entries);
+    CU_ASSERT(stats.capacity == map.table.capacity);
+    CU_ASSERT(stats.n_tombstones == map.table.n_tombstones);
+    CU_ASSERT(stats.n_holes == n_keys / 5);
+    CU_ASSERT(stats.load > 0 && stats.load < 1);
+    CU_ASSERT(stats.bytes_allocated
+              >= map.entries_capacity * sizeof(struct hashmap_entry)
+                     + map.table.capacity);
+    CU_ASSERT(stats.counters.n_rehashes > 0);
+
+    for (size_t i = 0; i < MAGPIE_HASHMAP_STATS_BUCKETS; i++) {
+        total += stats.probe_lengths[i];
+    }
+
+    /* Every entry lands in the histogram, mostly in the first bucket */
+    CU_ASSERT(total == stats.n_entries);
+    CU_ASSERT(stats.probe_lengths[0] > stats.n_entries / 2);
+    CU_ASSERT(stats.mean_probe_length >= 1);
+    mean = stats.mean_probe_length;
+
+    out = tmpfile();
+    hashmap_stats_print(&stats, out);
+    CU_ASSERT(ftell(out) > 0);
+    fclose(out);
+
+    hashmap_destroy(&map);
+
+    /* A hash function with only a handful of values stands out */
+    hashmap_init(&map, hash_weak, compare_uint);
+
+    for (uintptr_t k = 1; k <= 500; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    hashmap_stats(&map, &stats);
+    CU_ASSERT(stats.max_probe_length > 4);
+    CU_ASSERT(stats.mean_probe_length > mean);
+
+    hashmap_destroy(&map);
+}
+
+void
+test_entry_or_insert(void)
+{
+    struct hashmap map;
+    void*          value;
+
+    hashmap_init(&map, hash_uint, compare_uint);
+    hashmap_set_rehash_budget(&map, 4);
+
+    /* Count every key three times, growing (and migrating) on the way */
+    for (int round = 0; round < 3; round++) {
+        for (uintptr_t k = 1; k <= 3000; k++) {
+            int                   inserted;
+            struct hashmap_entry* e
+                = hashmap_entry_or_insert(&map, (void*)k, &inserted);
+
+            CU_ASSERT_FATAL(e != NULL);
+            CU_ASSERT(inserted == (round == 0));
+            CU_ASSERT(e->key == (void*)k);
+            CU_ASSERT(inserted ? e->value == NULL : e->value != NULL);
+
+            e->value = (void*)((uintptr_t)e->value + 1);
+        }
+    }
+
+    CU_ASSERT(map.n_entries == 3000);
+
+    for (uintptr_t k = 1; k <= 3000; k++) {
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT(value == (void*)3);
+    }
+
+    /* Reuses the slots freed by removals */
+    for (uintptr_t k = 1; k <= 3000; k += 2) {
+        hashmap_remove(&map, (void*)k);
+    }
+
+    for (uintptr_t k = 1; k <= 3000; k++) {
+        int inserted;
+
+        CU_ASSERT(hashmap_entry_or_insert(&map, (void*)k, &inserted) != NULL);
+        CU_ASSERT(inserted == (k % 2 == 1));
+    }
+
+    CU_ASSERT(map.n_entries == 3000);
+    CU_ASSERT(hashmap_entry_or_insert(&map, (void*)1, NULL) != NULL);
+    CU_ASSERT(map.n_entries == 3000);
+
+    hashmap_destroy(&map);
+}
+
+static void
+count_word(struct hashmap_entry* entry, int inserted, void* ctx)
+{
+    size_t* n_inserted = ctx;
+
+    *n_inserted += inserted;
+    entry->value = (void*)((uintptr_t)entry->value + 1);
+}
+
+void
+test_upsert(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    struct hashmap map;
+    size_t         n_inserted = 0;
+    void*          value;
+
+    hashmap_init(&map, hash_str, compare_str);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        for (size_t j = 0; j <= i % 4; j++) {
+            CU_ASSERT(hashmap_upsert(
+                &map, large_entries[i].key, count_word, &n_inserted));
+        }
+    }
+
+    CU_ASSERT(n_inserted == n_entries);
+    CU_ASSERT(map.n_entries == n_entries);
+
+    for (size_t i = 0; i < n_entries; i++) {
+        CU_ASSERT(hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value == (void*)(i % 4 + 1));
+    }
+
+    hashmap_destroy(&map);
+}
+
+void
+test_prehashed(void)
+{
+    const size_t n_entries = sizeof(large_entries) / sizeof(large_entries[0]);
+    uint64_t*    hashes    = malloc(sizeof(*hashes) * n_entries);
+    struct hashmap maps[2];
+    void*          value;
+
+    /* Hash each key once and share the hash between both maps */
+    for (size_t i = 0; i < n_entries; i++) {
+        char* key = large_entries[i].key;
+
+        hashes[i] = hash_str(&key);
+        CU_ASSERT(hashes[i] == hash_bytes(key, strlen(key)));
+    }
+
+    for (int m = 0; m < 2; m++) {
+        hashmap_init(&maps[m], hash_str, compare_str);
+
+        for (size_t i = 0; i < n_entries; i++) {
+            hashmap_set_prehashed(
+                &maps[m], large_entries[i].key, hashes[i], (void*)(i + m));
+        }
+
+        CU_ASSERT(maps[m].n_entries == n_entries);
+    }
+
+    for (size_t i = 0; i < n_entries; i++) {
+        char* key = large_entries[i].key;
+
+        CU_ASSERT(hashmap_get_prehashed(&maps[0], key, hashes[i], &value));
+        CU_ASSERT(value == (void*)i);
+        CU_ASSERT(hashmap_get(&maps[1], key, &value));
+        CU_ASSERT(value == (void*)(i + 1));
+        CU_ASSERT(hashmap_lookup_prehashed(&maps[1], key, hashes[i])
+                  == hashmap_lookup(&maps[1], key));
+    }
+
+    for (size_t i = 0; i < n_entries; i += 2) {
+        int inserted;
+
+        hashmap_remove_prehashed(&maps[0], large_entries[i].key, hashes[i]);
+        CU_ASSERT(hashmap_lookup(&maps[0], large_entries[i].key) == NULL);
+
+        CU_ASSERT(hashmap_entry_or_insert_prehashed(
+                      &maps[0], large_entries[i].key, hashes[i], &inserted)
+                  != NULL);
+        CU_ASSERT(inserted);
+    }
+
+    CU_ASSERT(maps[0].n_entries == n_entries);
+
+    hashmap_destroy(&maps[0]);
+    hashmap_destroy(&maps[1]);
+    free(hashes);
+}
+
+void
+test_small(void)
+{
+    const size_t   small = MAGPIE_HASHMAP_SMALL_CAPACITY;
+    struct hashmap map;
+    void*          value;
+    uintptr_t      expected;
+
+    /* Nothing is allocated until the first insertion */
+    hashmap_init(&map, hash_uint, compare_uint);
+    CU_ASSERT(map.entries == NULL);
+    CU_ASSERT(map.table.capacity == 0);
+
+    for (uintptr_t k = 1; k <= small; k++) {
+        hashmap_set(&map, (void*)k, (void*)(k * 2));
+    }
+
+    CU_ASSERT(map.table.capacity == 0);
+    CU_ASSERT(map.entries_capacity == small);
+    CU_ASSERT(map.n_entries == small);
+
+    for (uintptr_t k = 1; k <= small; k++) {
+        CU_ASSERT(hashmap_get(&map, (void*)k, &value));
+        CU_ASSERT(value == (void*)(k * 2));
+    }
+
+    CU_ASSERT(!hashmap_get(&map, (void*)(small + 1), &value));
+
+    /* Refilling the holes left by removals compacts the pool in place */
+    hashmap_remove(&map, (void*)1);
+    hashmap_remove(&map, (void*)3);
+    hashmap_set(&map, (void*)100, (void*)200);
+    hashmap_set(&map, (void*)101, (void*)202);
+
+    CU_ASSERT(map.table.capacity == 0);
+    CU_ASSERT(map.n_entries == small);
+    CU_ASSERT(!hashmap_get(&map, (void*)1, &value));
+    CU_ASSERT(hashmap_get(&map, (void*)101, &value));
+    CU_ASSERT(value == (void*)202);
+
+    /* Switching strategies retags the small map */
+    CU_ASSERT(hashmap_set_index(&map, HASHMAP_INDEX_PRIME));
+    CU_ASSERT(hashmap_get(&map, (void*)100, &value));
+    CU_ASSERT(value == (void*)200);
+
+    /* One more entry builds the table */
+    hashmap_set(&map, (void*)102, (void*)204);
+    CU_ASSERT(map.table.capacity > 0);
+    CU_ASSERT(map.n_entries == small + 1);
+
+    for (uintptr_t k = 1000; k < 1100; k++) {
+        hashmap_set(&map, (void*)k, (void*)k);
+    }
+
+    for (uintptr_t k = 1000; k < 1100; k++) {
+        hashmap_remove(&map, (void*)k);
+    }
+
+    hashmap_remove(&map, (void*)102);
+
+    /* and shrinking back down drops it again, keeping the order */
+    CU_ASSERT(hashmap_shrink_to_fit(&map));
+    CU_ASSERT(map.table.capacity == 0);
+    CU_ASSERT(map.entries_capacity == small);
+
+    expected = 2;
+    for (size_t i = 0; i < map.entries_length; i++) {
+        struct hashmap_entry* e = &map.entries[i];
+
+        CU_ASSERT(e->alive);
+        CU_ASSERT(hashmap_get(&map, e->key, &value));
+        CU_ASSERT(value == e->value);
+
+        if (i < small - 2) {
+            CU_ASSERT(e->key == (void*)expected);
+            expected += expected == 2 ? 2 : 1;
+        }
+    }
+
+    CU_ASSERT(map.n_entries == small);
+
+    hashmap_destroy(&map);
+}
+
+static uint64_t
+hash_clustered(const void* a)
+{
+    /* few distinct hashes, so probes run long and cross regions */
+    return hash_uint(a) % 5000;
+}
+
+/* Checks that `map` matches `expected`, built with hashmap_set() */
+static void
+check_built(struct hashmap* map, struct hashmap* expected)
+{
+    struct hashmap_iter it = hashmap_iter(expected);
+    size_t              i  = 0;
+
+    CU_ASSERT(map->n_entries == expected->n_entries);
+
+    while (hashmap_iter_next(&it)) {
+        struct hashmap_entry* e = hashmap_iter_get(&it);
+        void*                 value;
+
+        CU_ASSERT(hashmap_get(map, e->key, &value));
+        CU_ASSERT(value == e->value);
+
+        /* same insertion order, skipping the holes left by repeats */
+        while (i < map->entries_length && !map->entries[i].alive) {
+            i++;
+        }
+
+        CU_ASSERT(i < map->entries_length && map->entries[i].key == e->key);
+        i++;
+    }
+}
+
+void
+test_build_parallel(void)
+{
+    const size_t n        = 200000;
+    size_t       threads[] = { 0, 1, 3, 8 };
+    uint64_t (*hashes[])(const void*) = { hash_uint, hash_clustered };
+    struct array keys;
+    struct array values;
+
+    array_init_with_capacity(&keys, n);
+    array_init_with_capacity(&values, n);
+
+    /* a quarter of the keys are repeats, with later values */
+    for (size_t i = 0; i < n; i++) {
+        array_push(&keys, (void*)((i * 7919) % (n * 3 / 4) + 1));
+        array_push(&values, (void*)(i + 1));
+    }
+
+    for (size_t h = 0; h < 2; h++) {
+        struct hashmap expected;
+
+        hashmap_init(&expected, hashes[h], compare_uint);
+        for (size_t i = 0; i < n; i++) {
+            hashmap_set(&expected, keys.elements[i], values.elements[i]);
+        }
+
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            struct hashmap map;
+
+            CU_ASSERT_FATAL(hashmap_build_parallel(
+                &map, hashes[h], compare_uint, &keys, &values, threads[t]));
+            check_built(&map, &expected);
+
+            /* the map carries on like any other */
+            hashmap_set(&map, (void*)(n * 2), NULL);
+            hashmap_remove(&map, keys.elements[0]);
+            CU_ASSERT(map.n_entries == expected.n_entries);
+
+            hashmap_destroy(&map);
+        }
+
+        hashmap_destroy(&expected);
+    }
+
+    /* no values, and too few keys to be worth threads */
+    {
+        struct hashmap map;
+        void*          value;
+
+        keys.length = 100;
+        CU_ASSERT(hashmap_build_parallel(
+            &map, hash_uint, compare_uint, &keys, NULL, 4));
+        CU_ASSERT(map.n_entries == 100);
+        CU_ASSERT(hashmap_get(&map, keys.elements[99], &value));
+        CU_ASSERT(value == NULL);
+        hashmap_destroy(&map);
+    }
+
+    array_destroy(&keys);
+    array_destroy(&values);
+}
+
 static struct test_case tests[] = {
     { .name = "test hashmap insertion",    .test_function = test_insertion},
     { .name = "test hashmap remove", .test_function = test_remove },
     { .name = "test hashmap iterator", .test_function = test_iter },
     { .name = "test hashmap iterator after remove", .test_function = test_iter_after_remove },
+    { .name = "test hashmap update", .test_function = test_update },
+    { .name = "test hashmap remove and reinsert", .test_function = test_remove_reinsert },
+    { .name = "test hashmap incremental rehash", .test_function = test_incremental_rehash },
+    { .name = "test hashmap index strategies", .test_function = test_index_strategies },
+    { .name = "test hashmap insertion order", .test_function = test_insertion_order },
+    { .name = "test hashmap index width", .test_function = test_index_width },
+    { .name = "test hashmap reserve", .test_function = test_reserve },
+    { .name = "test hashmap set many", .test_function = test_set_many },
+    { .name = "test hashmap get many", .test_function = test_get_many },
+    { .name = "test hashmap shrink", .test_function = test_shrink },
+    { .name = "test hashmap compact", .test_function = test_compact },
+    { .name = "test hashmap retain", .test_function = test_retain },
+    { .name = "test hashmap stats", .test_function = test_stats },
+    { .name = "test hashmap entry or insert", .test_function = test_entry_or_insert },
+    { .name = "test hashmap upsert", .test_function = test_upsert },
+    { .name = "test hashmap prehashed", .test_function = test_prehashed },
+    { .name = "test hashmap small", .test_function = test_small },
+    { .name = "test hashmap build parallel", .test_function = test_build_parallel },
 };
 
 TEST_MAIN("hashmaps", tests)
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/hashmap_template.h>
+#include <magpie/hash.h>
+
+#include "hashmap_entries.h"
+
+/* Deliberately weak, to check the map copes with poorly mixed hashes */
+#define HASH_U64(KEY) (KEY)
+#define EQ_U64(A, B)  ((A) == (B))
+
+static inline uint64_t
+hash_string(const char* key)
+{
+    return hash_str(&key);
+}
+
+static inline int
+eq_string(const char* a, const char* b)
+{
+    return strcmp(a, b) == 0;
+}
+
+MAGPIE_HASHMAP_DEFINE(u64map, uint64_t, uint64_t, HASH_U64, EQ_U64);
+MAGPIE_HASHMAP_DEFINE(strmap, const char*, size_t, hash_string, eq_string);
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+void
+test_insertion(void)
+{
+    struct strmap map;
+
+    CU_ASSERT(strmap_init(&map));
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        CU_ASSERT(strmap_set(&map, large_entries[i].key, i));
+    }
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        size_t value = 0;
+
+        /* Look up through a copy, so keys are compared by content */
+        char* key = strdup(large_entries[i].key);
+
+        CU_ASSERT(strmap_get(&map, key, &value));
+        CU_ASSERT(value == i);
+
+        free(key);
+    }
+
+    CU_ASSERT(strmap_lookup(&map, "not a key") == NULL);
+
+    strmap_destroy(&map);
+}
+
+void
+test_update_remove(void)
+{
+    struct strmap map;
+    size_t*       value;
+
+    strmap_init(&map);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        strmap_set(&map, large_entries[i].key, i);
+    }
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        strmap_set(&map, large_entries[i].key, i * 2);
+    }
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i += 2) {
+        CU_ASSERT(strmap_remove(&map, large_entries[i].key));
+        CU_ASSERT(!strmap_remove(&map, large_entries[i].key));
+    }
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        value = strmap_lookup(&map, large_entries[i].key);
+
+        if (i % 2 == 0) {
+            CU_ASSERT(value == NULL);
+        }
+        else {
+            CU_ASSERT(value != NULL && *value == i * 2);
+        }
+    }
+
+    strmap_destroy(&map);
+}
+
+void
+test_iter(void)
+{
+    struct u64map      map;
+    struct u64map_iter it;
+    uint64_t           sum   = 0;
+    size_t             count = 0;
+
+    u64map_init_with_capacity(&map, 1000);
+
+    for (uint64_t k = 1; k <= 1000; k++) {
+        u64map_set(&map, k, k * k);
+    }
+
+    it = u64map_iter(&map);
+    while (u64map_iter_next(&it)) {
+        struct u64map_entry* e = u64map_iter_get(&it);
+
+        CU_ASSERT(e->value == e->key * e->key);
+        sum += e->key;
+        count++;
+    }
+
+    CU_ASSERT(count == 1000);
+    CU_ASSERT(sum == 1000 * 1001 / 2);
+    CU_ASSERT(u64map_iter_get(&it) == NULL);
+
+    u64map_destroy(&map);
+}
+
+void
+test_churn(void)
+{
+    const size_t  range = 3000;
+    struct u64map map;
+    uint64_t*     reference = malloc(sizeof(*reference) * range);
+    uint64_t      state     = 1;
+
+    /* Keys which are multiples of a power of two collide heavily
+     * without a finalizer */
+    u64map_init(&map);
+    memset(reference, 0, sizeof(*reference) * range);
+
+    for (int op = 0; op < 200000; op++) {
+        uint64_t k;
+
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        k     = (state >> 33) % range;
+
+        if ((state >> 20) % 3 == 0) {
+            u64map_remove(&map, k << 16);
+            reference[k] = 0;
+        }
+        else {
+            u64map_set(&map, k << 16, op + 1);
+            reference[k] = op + 1;
+        }
+    }
+
+    for (uint64_t k = 0; k < range; k++) {
+        uint64_t value = 0;
+        int      found = u64map_get(&map, k << 16, &value);
+
+        CU_ASSERT(found == (reference[k] != 0));
+        CU_ASSERT(value == reference[k]);
+    }
+
+    u64map_destroy(&map);
+    free(reference);
+}
+
+static struct test_case tests[] = {
+    { .name          = "test typed hashmap insertion",
+      .test_function = test_insertion },
+    { .name          = "test typed hashmap update and remove",
+      .test_function = test_update_remove },
+    { .name = "test typed hashmap iterator", .test_function = test_iter },
+    { .name = "test typed hashmap churn", .test_function = test_churn },
+};
+
+TEST_MAIN("typed hashmaps", tests)
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/hashset.h>
+#include <magpie/compare.h>
+
+static uint64_t
+hash_int(const void* key)
+{
+    /* deliberately weak; the set mixes hashes itself */
+    return (uintptr_t) * (void* const*)key;
+}
+
+/* Fills `set` with the multiples of `step` in [1, n] */
+static void
+fill(struct hashset* set, size_t n, size_t step)
+{
+    hashset_init(set, hash_int, compare_uint);
+
+    for (size_t i = step; i <= n; i += step) {
+        CU_ASSERT(hashset_insert(set, KEY(i)));
+    }
+}
+
+static size_t
+count_iter(struct hashset* set)
+{
+    struct hashset_iter it    = hashset_iter(set);
+    size_t              count = 0;
+
+    while (hashset_iter_next(&it)) {
+        CU_ASSERT(hashset_contains(set, hashset_iter_get(&it)));
+        count++;
+    }
+
+    return count;
+}
+
+void
+test_insertion(void)
+{
+    struct hashset set;
+
+    hashset_init(&set, hash_int, compare_uint);
+
+    /* nothing is allocated until the first insertion */
+    CU_ASSERT(set.capacity == 0);
+    CU_ASSERT(!hashset_contains(&set, KEY(1)));
+    CU_ASSERT(!hashset_remove(&set, KEY(1)));
+
+    for (size_t i = 1; i <= 10000; i++) {
+        CU_ASSERT(hashset_insert(&set, KEY(i)));
+    }
+
+    /* duplicates are ignored */
+    for (size_t i = 1; i <= 10000; i += 3) {
+        CU_ASSERT(hashset_insert(&set, KEY(i)));
+    }
+
+    CU_ASSERT(set.n_entries == 10000);
+    CU_ASSERT(count_iter(&set) == 10000);
+
+    for (size_t i = 1; i <= 10000; i++) {
+        CU_ASSERT(hashset_contains(&set, KEY(i)));
+    }
+
+    CU_ASSERT(!hashset_contains(&set, KEY(10001)));
+
+    hashset_destroy(&set);
+}
+
+void
+test_remove(void)
+{
+    struct hashset set;
+
+    fill(&set, 1000, 1);
+
+    for (size_t i = 2; i <= 1000; i += 2) {
+        CU_ASSERT(hashset_remove(&set, KEY(i)));
+    }
+
+    CU_ASSERT(!hashset_remove(&set, KEY(2)));
+    CU_ASSERT(set.n_entries == 500);
+
+    for (size_t i = 1; i <= 1000; i++) {
+        CU_ASSERT(hashset_contains(&set, KEY(i)) == (i % 2 == 1));
+    }
+
+    /* churn through tombstones without growing without bound */
+    for (size_t round = 0; round < 50; round++) {
+        for (size_t i = 0; i < 100; i++) {
+            hashset_insert(&set, KEY(100000 + i));
+        }
+
+        for (size_t i = 0; i < 100; i++) {
+            CU_ASSERT(hashset_remove(&set, KEY(100000 + i)));
+        }
+    }
+
+    CU_ASSERT(set.n_entries == 500);
+    CU_ASSERT(set.capacity <= 2048);
+    CU_ASSERT(count_iter(&set) == 500);
+
+    hashset_destroy(&set);
+}
+
+void
+test_insert_array(void)
+{
+    struct hashset set;
+    struct array   keys;
+
+    array_init(&keys);
+
+    for (size_t i = 0; i < 5000; i++) {
+        /* every key twice */
+        array_push(&keys, KEY(i % 2500 + 1));
+    }
+
+    fill(&set, 100, 1);
+    CU_ASSERT(hashset_insert_array(&set, &keys));
+    CU_ASSERT(set.n_entries == 2500);
+
+    for (size_t i = 1; i <= 2500; i++) {
+        CU_ASSERT(hashset_contains(&set, KEY(i)));
+    }
+
+    hashset_destroy(&set);
+    array_destroy(&keys);
+}
+
+void
+test_union(void)
+{
+    struct hashset twos, threes, out;
+
+    fill(&twos, 6000, 2);
+    fill(&threes, 6000, 3);
+
+    /* both argument orders, so either set can be the smaller */
+    for (int order = 0; order < 2; order++) {
+        if (order == 0) {
+            CU_ASSERT(hashset_union(&out, &twos, &threes));
+        }
+        else {
+            CU_ASSERT(hashset_union(&out, &threes, &twos));
+        }
+
+        CU_ASSERT(out.n_entries == 3000 + 2000 - 1000);
+        CU_ASSERT(count_iter(&out) == out.n_entries);
+
+        for (size_t i = 1; i <= 6000; i++) {
+            CU_ASSERT(hashset_contains(&out, KEY(i))
+                      == (i % 2 == 0 || i % 3 == 0));
+        }
+
+        hashset_destroy(&out);
+    }
+
+    hashset_destroy(&twos);
+    hashset_destroy(&threes);
+}
+
+void
+test_intersection(void)
+{
+    struct hashset twos, threes, empty, out;
+
+    fill(&twos, 6000, 2);
+    fill(&threes, 6000, 3);
+    hashset_init(&empty, hash_int, compare_uint);
+
+    for (int order = 0; order < 2; order++) {
+        if (order == 0) {
+            CU_ASSERT(hashset_intersection(&out, &twos, &threes));
+        }
+        else {
+            CU_ASSERT(hashset_intersection(&out, &threes, &twos));
+        }
+
+        CU_ASSERT(out.n_entries == 1000);
+
+        for (size_t i = 1; i <= 6000; i++) {
+            CU_ASSERT(hashset_contains(&out, KEY(i)) == (i % 6 == 0));
+        }
+
+        hashset_destroy(&out);
+    }
+
+    CU_ASSERT(hashset_intersection(&out, &twos, &empty));
+    CU_ASSERT(out.n_entries == 0);
+    hashset_destroy(&out);
+
+    hashset_destroy(&twos);
+    hashset_destroy(&threes);
+    hashset_destroy(&empty);
+}
+
+void
+test_difference(void)
+{
+    struct hashset twos, threes, most, out;
+
+    fill(&twos, 6000, 2);
+    fill(&threes, 6000, 3);
+
+    /* the larger minus the smaller copies then erases */
+    CU_ASSERT(hashset_difference(&out, &twos, &threes));
+    CU_ASSERT(out.n_entries == 2000);
+
+    for (size_t i = 1; i <= 6000; i++) {
+        CU_ASSERT(hashset_contains(&out, KEY(i))
+                  == (i % 2 == 0 && i % 3 != 0));
+    }
+
+    CU_ASSERT(count_iter(&out) == 2000);
+    hashset_destroy(&out);
+
+    /* the smaller minus the larger filters */
+    CU_ASSERT(hashset_difference(&out, &threes, &twos));
+    CU_ASSERT(out.n_entries == 1000);
+
+    for (size_t i = 1; i <= 6000; i++) {
+        CU_ASSERT(hashset_contains(&out, KEY(i))
+                  == (i % 3 == 0 && i % 2 != 0));
+    }
+
+    hashset_destroy(&out);
+
+    /* removing nearly everything shrinks the copy */
+    fill(&most, 5990, 2);
+    CU_ASSERT(hashset_difference(&out, &twos, &most));
+    CU_ASSERT(out.n_entries == 5);
+    CU_ASSERT(out.capacity < twos.capacity);
+    CU_ASSERT(hashset_contains(&out, KEY(6000)));
+    hashset_destroy(&out);
+
+    hashset_destroy(&twos);
+    hashset_destroy(&threes);
+    hashset_destroy(&most);
+}
+
+void
+test_is_subset(void)
+{
+    struct hashset twos, fours, threes, empty;
+
+    fill(&twos, 6000, 2);
+    fill(&fours, 6000, 4);
+    fill(&threes, 6000, 3);
+    hashset_init(&empty, hash_int, compare_uint);
+
+    CU_ASSERT(hashset_is_subset(&fours, &twos));
+    CU_ASSERT(!hashset_is_subset(&twos, &fours));
+    CU_ASSERT(!hashset_is_subset(&threes, &twos));
+    CU_ASSERT(hashset_is_subset(&twos, &twos));
+    CU_ASSERT(hashset_is_subset(&empty, &twos));
+    CU_ASSERT(hashset_is_subset(&empty, &empty));
+    CU_ASSERT(!hashset_is_subset(&twos, &empty));
+
+    hashset_destroy(&twos);
+    hashset_destroy(&fours);
+    hashset_destroy(&threes);
+    hashset_destroy(&empty);
+}
+
+static struct test_case tests[] = {
+    { .name = "test hashset insertion", .test_function = test_insertion },
+    { .name = "test hashset remove", .test_function = test_remove },
+    { .name          = "test hashset insert array",
+      .test_function = test_insert_array },
+    { .name = "test hashset union", .test_function = test_union },
+    { .name          = "test hashset intersection",
+      .test_function = test_intersection },
+    { .name = "test hashset difference", .test_function = test_difference },
+    { .name = "test hashset is subset", .test_function = test_is_subset },
+};
+
+TEST_MAIN("hashsets", tests)
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/intrusive_hashmap.h>
+
+struct connection {
+    uint64_t                      id;
+    int                           state;
+    struct intrusive_hashmap_hook hook;
+};
+
+static uint64_t
+hash_id(const void* key)
+{
+    return *(const uint64_t*)key;
+}
+
+static int
+compare_id(const struct intrusive_hashmap_hook* hook, const void* key)
+{
+    const struct connection* c
+        = INTRUSIVE_HASHMAP_CONTAINER(hook, struct connection, hook);
+
+    return c->id != *(const uint64_t*)key;
+}
+
+static struct connection*
+lookup(struct intrusive_hashmap* map, uint64_t id)
+{
+    struct intrusive_hashmap_hook* hook = intrusive_hashmap_lookup(map, &id);
+
+    return hook == NULL
+               ? NULL
+               : INTRUSIVE_HASHMAP_CONTAINER(hook, struct connection, hook);
+}
+
+void
+test_insertion(void)
+{
+    const size_t             n    = 10000;
+    struct connection*       slab = calloc(n, sizeof(*slab));
+    struct intrusive_hashmap map;
+
+    CU_ASSERT_FATAL(slab != NULL);
+    CU_ASSERT(intrusive_hashmap_init(&map, hash_id, compare_id));
+
+    for (size_t i = 0; i < n; i++) {
+        slab[i].id    = i * 7919;
+        slab[i].state = i;
+        CU_ASSERT(intrusive_hashmap_insert(&map, &slab[i].hook, &slab[i].id)
+                  == NULL);
+    }
+
+    CU_ASSERT(map.n_entries == n);
+    CU_ASSERT(map.n_buckets >= n);
+
+    for (size_t i = 0; i < n; i++) {
+        CU_ASSERT(lookup(&map, i * 7919) == &slab[i]);
+    }
+
+    CU_ASSERT(lookup(&map, 1) == NULL);
+
+    intrusive_hashmap_destroy(&map);
+    free(slab);
+}
+
+void
+test_replace(void)
+{
+    struct connection        a = { .id = 42, .state = 1 };
+    struct connection        b = { .id = 42, .state = 2 };
+    struct connection        c = { .id = 43, .state = 3 };
+    struct intrusive_hashmap map;
+
+    intrusive_hashmap_init(&map, hash_id, compare_id);
+
+    CU_ASSERT(intrusive_hashmap_insert(&map, &a.hook, &a.id) == NULL);
+    CU_ASSERT(intrusive_hashmap_insert(&map, &c.hook, &c.id) == NULL);
+    CU_ASSERT(intrusive_hashmap_insert(&map, &b.hook, &b.id) == &a.hook);
+
+    CU_ASSERT(map.n_entries == 2);
+    CU_ASSERT(lookup(&map, 42) == &b);
+    CU_ASSERT(lookup(&map, 43) == &c);
+    CU_ASSERT(a.hook.pprev == NULL);
+
+    intrusive_hashmap_destroy(&map);
+}
+
+void
+test_remove(void)
+{
+    const size_t             n    = 1000;
+    struct connection*       slab = calloc(n, sizeof(*slab));
+    struct intrusive_hashmap map;
+
+    CU_ASSERT_FATAL(slab != NULL);
+    intrusive_hashmap_init(&map, hash_id, compare_id);
+
+    for (size_t i = 0; i < n; i++) {
+        slab[i].id = i;
+        intrusive_hashmap_insert(&map, &slab[i].hook, &slab[i].id);
+    }
+
+    /* Remove by key and by hook alternately */
+    for (uint64_t i = 0; i < n; i += 2) {
+        if (i % 4 == 0) {
+            CU_ASSERT(intrusive_hashmap_remove(&map, &i) == &slab[i].hook);
+        }
+        else {
+            intrusive_hashmap_unlink(&map, &slab[i].hook);
+        }
+    }
+
+    CU_ASSERT(map.n_entries == n / 2);
+
+    for (uint64_t i = 0; i < n; i++) {
+        CU_ASSERT((lookup(&map, i) != NULL) == (i % 2 == 1));
+    }
+
+    CU_ASSERT(intrusive_hashmap_remove(&map, &(uint64_t){ 0 }) == NULL);
+
+    intrusive_hashmap_destroy(&map);
+    free(slab);
+}
+
+void
+test_iter(void)
+{
+    const size_t                  n     = 500;
+    struct connection*            slab  = calloc(n, sizeof(*slab));
+    size_t                        count = 0;
+    struct intrusive_hashmap      map;
+    struct intrusive_hashmap_iter it;
+
+    CU_ASSERT_FATAL(slab != NULL);
+    intrusive_hashmap_init(&map, hash_id, compare_id);
+
+    for (size_t i = 0; i < n; i++) {
+        slab[i].id = i;
+        intrusive_hashmap_insert(&map, &slab[i].hook, &slab[i].id);
+    }
+
+    /* Unlink every odd connection while iterating */
+    it = intrusive_hashmap_iter(&map);
+    while (intrusive_hashmap_iter_next(&it)) {
+        struct intrusive_hashmap_hook* hook = intrusive_hashmap_iter_get(&it);
+        struct connection*             c
+            = INTRUSIVE_HASHMAP_CONTAINER(hook, struct connection, hook);
+
+        CU_ASSERT(!c->state);
+        c->state = 1;
+        count++;
+
+        if (c->id % 2 == 1) {
+            intrusive_hashmap_unlink(&map, hook);
+        }
+    }
+
+    CU_ASSERT(count == n);
+    CU_ASSERT(map.n_entries == n / 2);
+
+    count = 0;
+    it    = intrusive_hashmap_iter(&map);
+    while (intrusive_hashmap_iter_next(&it)) {
+        struct connection* c = INTRUSIVE_HASHMAP_CONTAINER(
+            intrusive_hashmap_iter_get(&it), struct connection, hook);
+
+        CU_ASSERT(c->id % 2 == 0);
+        count++;
+    }
+
+    CU_ASSERT(count == n / 2);
+
+    intrusive_hashmap_destroy(&map);
+    free(slab);
+}
+
+static struct test_case tests[] = {
+    { .name          = "test intrusive hashmap insertion",
+      .test_function = test_insertion },
+    { .name          = "test intrusive hashmap replace",
+      .test_function = test_replace },
+    { .name = "test intrusive hashmap remove", .test_function = test_remove },
+    { .name = "test intrusive hashmap iterator", .test_function = test_iter },
+};
+
+TEST_MAIN("intrusive hashmaps", tests)
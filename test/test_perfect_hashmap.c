@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/array.h>
+#include <magpie/collections/frozen_hashmap.h>
+#include <magpie/collections/perfect_hashmap.h>
+
+#include "hashmap_entries.h"
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+void
+test_strings(void)
+{
+    struct array           keys;
+    struct array           values;
+    struct perfect_hashmap map;
+    int*                   seen = calloc(n_large_entries, sizeof(int));
+    void*                  value;
+
+    array_init(&keys);
+    array_init(&values);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        array_push(&keys, large_entries[i].key);
+        array_push(&values, large_entries[i].value);
+    }
+
+    CU_ASSERT_FATAL(perfect_hashmap_build(&map,
+                                          &keys,
+                                          &values,
+                                          frozen_hashmap_encode_str));
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        size_t index = perfect_hashmap_index(&map, large_entries[i].key);
+
+        /* Every key has a position of its own */
+        CU_ASSERT(index < n_large_entries);
+        CU_ASSERT(!seen[index]);
+        seen[index] = 1;
+
+        CU_ASSERT(map.keys[index] == large_entries[i].key);
+        CU_ASSERT(perfect_hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value == large_entries[i].value);
+    }
+
+    CU_ASSERT(!perfect_hashmap_get(&map, "not a key", &value));
+    CU_ASSERT(value == NULL);
+
+    perfect_hashmap_destroy(&map);
+    array_destroy(&keys);
+    array_destroy(&values);
+    free(seen);
+}
+
+void
+test_integers(void)
+{
+    const uintptr_t        n_keys = 200000;
+    struct array           keys;
+    struct perfect_hashmap map;
+    void*                  value;
+
+    array_init_with_capacity(&keys, n_keys);
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        array_push(&keys, (void*)(k * 7));
+    }
+
+    /* Without values, every key maps to NULL */
+    CU_ASSERT_FATAL(
+        perfect_hashmap_build(&map, &keys, NULL, frozen_hashmap_encode_ptr));
+
+    for (uintptr_t k = 1; k <= n_keys; k++) {
+        CU_ASSERT(perfect_hashmap_get(&map, (void*)(k * 7), &value));
+        CU_ASSERT(value == NULL);
+        CU_ASSERT(!perfect_hashmap_get(&map, (void*)(k * 7 + 1), &value));
+    }
+
+    CU_ASSERT(perfect_hashmap_bits_per_key(&map) < 4);
+
+    perfect_hashmap_destroy(&map);
+    array_destroy(&keys);
+}
+
+void
+test_small(void)
+{
+    struct array           keys;
+    struct perfect_hashmap map;
+    void*                  value;
+
+    array_init(&keys);
+
+    CU_ASSERT(
+        perfect_hashmap_build(&map, &keys, NULL, frozen_hashmap_encode_str));
+    CU_ASSERT(!perfect_hashmap_get(&map, "key", &value));
+    perfect_hashmap_destroy(&map);
+
+    array_push(&keys, "key");
+    CU_ASSERT(
+        perfect_hashmap_build(&map, &keys, NULL, frozen_hashmap_encode_str));
+    CU_ASSERT(perfect_hashmap_get(&map, "key", &value));
+    CU_ASSERT(!perfect_hashmap_get(&map, "other", &value));
+    perfect_hashmap_destroy(&map);
+
+    array_destroy(&keys);
+}
+
+void
+test_duplicates(void)
+{
+    struct array           keys;
+    struct perfect_hashmap map;
+    char*                  copy = strdup(large_entries[10].key);
+
+    array_init(&keys);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        array_push(&keys, large_entries[i].key);
+    }
+
+    /* An equal key at a different address is still a duplicate */
+    array_push(&keys, copy);
+
+    CU_ASSERT(
+        !perfect_hashmap_build(&map, &keys, NULL, frozen_hashmap_encode_str));
+
+    array_destroy(&keys);
+    free(copy);
+}
+
+static struct test_case tests[] = {
+    { .name = "test perfect hashmap strings", .test_function = test_strings },
+    { .name          = "test perfect hashmap integers",
+      .test_function = test_integers },
+    { .name = "test perfect hashmap small", .test_function = test_small },
+    { .name          = "test perfect hashmap duplicates",
+      .test_function = test_duplicates },
+};
+
+TEST_MAIN("perfect hashmaps", tests)
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/hashmap_group.h>
+#include <magpie/collections/robin_hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+#include "hashmap_entries.h"
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+struct robin_hashmap
+make_hashmap(struct entry* entries, size_t n_entries)
+{
+    struct robin_hashmap map;
+
+    robin_hashmap_init(&map, hash_str, compare_str);
+    for (size_t i = 0; i < n_entries; i++) {
+        robin_hashmap_set(&map, entries[i].key, entries[i].value);
+    }
+
+    return map;
+}
+
+/* Checks that every entry's recorded distance matches its position and
+ * that no entry is further from home than the one after it allows */
+int
+check_invariants(const struct robin_hashmap* map)
+{
+    size_t n_entries = 0;
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        const struct robin_hashmap_entry* e = &map->slots[i];
+        const struct robin_hashmap_entry* next
+            = &map->slots[(i + 1) & (map->capacity - 1)];
+        size_t home = hashmap_mix64(e->hash) & (map->capacity - 1);
+
+        if (e->dist == 0) {
+            continue;
+        }
+
+        n_entries++;
+
+        if (((i - home) & (map->capacity - 1)) + 1 != e->dist) {
+            return 0;
+        }
+
+        if (next->dist > e->dist + 1) {
+            return 0;
+        }
+    }
+
+    return n_entries == map->n_entries;
+}
+
+void
+test_insertion(void)
+{
+    struct robin_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+    CU_ASSERT(check_invariants(&map));
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        struct robin_hashmap_entry* entry
+            = robin_hashmap_lookup(&map, large_entries[i].key);
+
+        CU_ASSERT(entry != NULL);
+        CU_ASSERT(strcmp(entry->key, large_entries[i].key) == 0);
+        CU_ASSERT(strcmp(entry->key, entry->value) == 0);
+    }
+
+    robin_hashmap_destroy(&map);
+}
+
+void
+test_update(void)
+{
+    struct robin_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        robin_hashmap_set(&map, large_entries[i].key, large_entries + i);
+    }
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        void* value;
+
+        CU_ASSERT(robin_hashmap_get(&map, large_entries[i].key, &value));
+        CU_ASSERT(value == large_entries + i);
+    }
+
+    robin_hashmap_destroy(&map);
+}
+
+void
+test_remove(void)
+{
+    char* remove_keys[] = {
+        "tender", "forgetful", "boring", "overt", "save", "wooden", "acid"
+    };
+    const size_t n_remove_keys = sizeof(remove_keys) / sizeof(remove_keys[0]);
+    void*        value;
+
+    struct robin_hashmap map = make_hashmap(large_entries, 100);
+
+    for (size_t i = 0; i < n_remove_keys; i++) {
+        CU_ASSERT(robin_hashmap_lookup(&map, remove_keys[i]) != NULL);
+        robin_hashmap_remove(&map, remove_keys[i]);
+        CU_ASSERT(check_invariants(&map));
+    }
+
+    for (size_t i = 0; i < n_remove_keys; i++) {
+        CU_ASSERT(robin_hashmap_lookup(&map, remove_keys[i]) == NULL);
+        CU_ASSERT(!robin_hashmap_get(&map, remove_keys[i], &value));
+        CU_ASSERT(value == NULL);
+    }
+
+    CU_ASSERT(map.n_entries == 100 - n_remove_keys);
+
+    robin_hashmap_destroy(&map);
+}
+
+void
+test_remove_all(void)
+{
+    struct robin_hashmap map = make_hashmap(large_entries, n_large_entries);
+
+    /* Removing everything must leave no trace behind */
+    for (size_t i = 0; i < n_large_entries; i++) {
+        robin_hashmap_remove(&map, large_entries[i].key);
+    }
+
+    CU_ASSERT(map.n_entries == 0);
+
+    for (size_t i = 0; i < map.capacity; i++) {
+        CU_ASSERT(map.slots[i].dist == 0);
+    }
+
+    robin_hashmap_destroy(&map);
+}
+
+void
+test_iter(void)
+{
+    struct robin_hashmap      map = make_hashmap(large_entries, n_large_entries);
+    struct robin_hashmap_iter it  = robin_hashmap_iter(&map);
+    size_t                    count = 0;
+    int                       visited[n_large_entries];
+
+    memset(visited, 0, sizeof(visited));
+
+    while (robin_hashmap_iter_next(&it)) {
+        struct robin_hashmap_entry* e = robin_hashmap_iter_get(&it);
+
+        count++;
+
+        for (size_t v = 0; v < n_large_entries; v++) {
+            if (strcmp(large_entries[v].key, e->key) == 0) {
+                CU_ASSERT(!visited[v]);
+                visited[v] = 1;
+                break;
+            }
+        }
+    }
+
+    CU_ASSERT(count == n_large_entries);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        CU_ASSERT(visited[i]);
+    }
+
+    robin_hashmap_destroy(&map);
+}
+
+void
+test_churn(void)
+{
+    struct robin_hashmap map = make_hashmap(large_entries, n_large_entries);
+    size_t               capacity = map.capacity;
+
+    for (int round = 0; round < 50; round++) {
+        for (size_t i = round % 3; i < n_large_entries; i += 3) {
+            robin_hashmap_remove(&map, large_entries[i].key);
+        }
+
+        CU_ASSERT(check_invariants(&map));
+
+        for (size_t i = round % 3; i < n_large_entries; i += 3) {
+            CU_ASSERT(robin_hashmap_lookup(&map, large_entries[i].key) == NULL);
+            robin_hashmap_set(
+                &map, large_entries[i].key, large_entries[i].value);
+        }
+
+        CU_ASSERT(map.n_entries == n_large_entries);
+    }
+
+    CU_ASSERT(map.capacity == capacity);
+    CU_ASSERT(check_invariants(&map));
+
+    robin_hashmap_destroy(&map);
+}
+
+static uint64_t
+hash_identity(const void* a)
+{
+    return (uintptr_t)(*(void* const*)a);
+}
+
+void
+test_weak_hash(void)
+{
+    struct robin_hashmap map;
+    uint32_t             max_dist = 0;
+
+    /* Keys spaced like 16-byte aligned pointers, hashed to themselves */
+    robin_hashmap_init(&map, hash_identity, compare_uint);
+
+    for (uintptr_t i = 1; i <= 4096; i++) {
+        robin_hashmap_set(&map, (void*)(i * 16), (void*)i);
+    }
+
+    CU_ASSERT(check_invariants(&map));
+
+    for (size_t i = 0; i < map.capacity; i++) {
+        if (map.slots[i].dist > max_dist) {
+            max_dist = map.slots[i].dist;
+        }
+    }
+
+    CU_ASSERT(max_dist < 32);
+
+    for (uintptr_t i = 1; i <= 4096; i++) {
+        void* value;
+
+        CU_ASSERT(robin_hashmap_get(&map, (void*)(i * 16), &value));
+        CU_ASSERT(value == (void*)i);
+    }
+
+    robin_hashmap_destroy(&map);
+}
+
+static struct test_case tests[] = {
+    { .name = "test robin hashmap insertion", .test_function = test_insertion },
+    { .name = "test robin hashmap update", .test_function = test_update },
+    { .name = "test robin hashmap remove", .test_function = test_remove },
+    { .name = "test robin hashmap remove all", .test_function = test_remove_all },
+    { .name = "test robin hashmap iterator", .test_function = test_iter },
+    { .name = "test robin hashmap churn", .test_function = test_churn },
+    { .name = "test robin hashmap weak hash", .test_function = test_weak_hash },
+};
+
+TEST_MAIN("robin hashmaps", tests)
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+#include <magpie/strview.h>
+
+#include "hashmap_entries.h"
+
+static const size_t n_large_entries
+    = sizeof(large_entries) / sizeof(large_entries[0]);
+
+void
+test_hash(void)
+{
+    const char*    text = "prefix:tender:suffix";
+    const char*    word = "tender";
+    struct strview whole;
+    struct strview part;
+    struct strview copy;
+
+    strview_init_cstr(&whole, text);
+    strview_init(&part, text + 7, 6);
+    strview_init_cstr(&copy, word);
+
+    CU_ASSERT(whole.length == strlen(text));
+    CU_ASSERT(whole.hash == hash_str(&text));
+
+    /* A view of part of a string hashes like a copy of that part */
+    CU_ASSERT(part.hash == copy.hash);
+    CU_ASSERT(part.hash == hash_str(&word));
+    CU_ASSERT(part.hash == hash_bytes(word, 6));
+
+    /* Hashing a view doesn't look at the string at all */
+    const struct strview* key = &part;
+    part.ptr                  = NULL;
+    CU_ASSERT(hash_strview(&key) == copy.hash);
+}
+
+void
+test_compare(void)
+{
+    const char*    text = "abcabd";
+    struct strview a, b, c, d;
+
+    strview_init(&a, text, 3);
+    strview_init(&b, text + 3, 3);
+    strview_init(&c, text, 2);
+    strview_init(&d, "abc", 3);
+
+    const struct strview* pa = &a;
+    const struct strview* pb = &b;
+    const struct strview* pc = &c;
+    const struct strview* pd = &d;
+
+    CU_ASSERT(compare_strview(&pa, &pd) == 0);
+    CU_ASSERT(compare_strview(&pa, &pb) < 0);
+    CU_ASSERT(compare_strview(&pb, &pa) > 0);
+
+    /* Shorter views order first, whatever their contents */
+    CU_ASSERT(compare_strview(&pc, &pb) < 0);
+    CU_ASSERT(compare_strview(&pb, &pc) > 0);
+}
+
+void
+test_hashmap_keys(void)
+{
+    struct hashmap  map;
+    struct strview* views = malloc(sizeof(*views) * n_large_entries);
+    size_t          length = 0;
+    char*           buffer;
+    char*           p;
+
+    /* Pack every word into one buffer, separated by commas, so that no
+     * key is NUL-terminated where it ends */
+    for (size_t i = 0; i < n_large_entries; i++) {
+        length += strlen(large_entries[i].key) + 1;
+    }
+
+    buffer = malloc(length);
+    p      = buffer;
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        size_t key_length = strlen(large_entries[i].key);
+
+        memcpy(p, large_entries[i].key, key_length);
+        p[key_length] = ',';
+
+        strview_init(&views[i], p, key_length);
+        p += key_length + 1;
+    }
+
+    hashmap_init(&map, hash_strview, compare_strview);
+
+    for (size_t i = 0; i < n_large_entries; i++) {
+        hashmap_set(&map, &views[i], large_entries[i].value);
+    }
+
+    CU_ASSERT(map.n_entries == n_large_entries);
+
+    /* Look each key up through a different view of the same bytes */
+    for (size_t i = 0; i < n_large_entries; i++) {
+        struct strview view;
+        void*          value;
+
+        strview_init_cstr(&view, large_entries[i].key);
+
+        CU_ASSERT(hashmap_get(&map, &view, &value));
+        CU_ASSERT(value == large_entries[i].value);
+    }
+
+    struct strview missing;
+    void*          value;
+
+    strview_init_cstr(&missing, "tende");
+    CU_ASSERT(!hashmap_get(&map, &missing, &value));
+
+    hashmap_destroy(&map);
+    free(views);
+    free(buffer);
+}
+
+static struct test_case tests[] = {
+    { .name = "test strview hash", .test_function = test_hash },
+    { .name = "test strview compare", .test_function = test_compare },
+    { .name = "test strview hashmap keys", .test_function = test_hashmap_keys },
+};
+
+TEST_MAIN("strviews", tests)
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2023  Alister Sanders
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+#include <CUnit/Basic.h>
+#include <magpie/collections/ttl_hashmap.h>
+#include <magpie/compare.h>
+#include <magpie/hash.h>
+
+/* Checks that entries never expire early */
+struct expiry {
+    uint64_t  now;
+    uint64_t* deadlines;
+    size_t    n_expired;
+    size_t    n_early;
+};
+
+static void
+on_expire(void* key, void* value, void* ctx)
+{
+    struct expiry* expiry = ctx;
+
+    (void)value;
+    expiry->n_expired++;
+
+    if (expiry->deadlines != NULL
+        && expiry->deadlines[(uintptr_t)key] > expiry->now) {
+        expiry->n_early++;
+    }
+}
+
+void
+test_expiry(void)
+{
+    struct ttl_hashmap map;
+    struct expiry      expiry = { 0 };
+    void*              value;
+
+    CU_ASSERT_FATAL(ttl_hashmap_init(&map, hash_uint, compare_uint));
+    ttl_hashmap_set_expire_callback(&map, on_expire, &expiry);
+
+    CU_ASSERT(ttl_hashmap_set(&map, KEY(1), KEY(10), 100));
+    CU_ASSERT(ttl_hashmap_set(&map, KEY(2), KEY(20), 5000));
+    CU_ASSERT(ttl_hashmap_set(&map, KEY(3), KEY(30), 1000000));
+    CU_ASSERT(map.n_entries == 3);
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 99, SIZE_MAX) == 0);
+    CU_ASSERT(ttl_hashmap_get(&map, KEY(1), 99, &value));
+    CU_ASSERT(value == KEY(10));
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 100, SIZE_MAX) == 1);
+    CU_ASSERT(!ttl_hashmap_get(&map, KEY(1), 100, &value));
+    CU_ASSERT(value == NULL);
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 4999, SIZE_MAX) == 0);
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 999999, SIZE_MAX) == 1);
+    CU_ASSERT(ttl_hashmap_get(&map, KEY(3), 999999, &value));
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, UINT64_MAX, SIZE_MAX) == 1);
+
+    CU_ASSERT(map.n_entries == 0);
+    CU_ASSERT(map.map.n_entries == 0);
+    CU_ASSERT(expiry.n_expired == 3);
+
+    /* deadlines already passed are due straight away */
+    ttl_hashmap_set(&map, KEY(4), KEY(40), 7);
+    CU_ASSERT(map.due != TTL_HASHMAP_NIL);
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, UINT64_MAX, SIZE_MAX) == 1);
+
+    ttl_hashmap_destroy(&map);
+}
+
+void
+test_lazy_expiry(void)
+{
+    struct ttl_hashmap map;
+    struct expiry      expiry = { 0 };
+    void*              value;
+
+    ttl_hashmap_init(&map, hash_uint, compare_uint);
+    ttl_hashmap_set_expire_callback(&map, on_expire, &expiry);
+
+    ttl_hashmap_set(&map, KEY(1), KEY(10), 50);
+    ttl_hashmap_set(&map, KEY(2), KEY(20), 60);
+
+    /* a lookup past the deadline reclaims the entry without a tick */
+    CU_ASSERT(!ttl_hashmap_get(&map, KEY(1), 55, &value));
+    CU_ASSERT(expiry.n_expired == 1);
+    CU_ASSERT(map.n_entries == 1);
+    CU_ASSERT(ttl_hashmap_get(&map, KEY(2), 55, &value));
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 100, SIZE_MAX) == 1);
+    CU_ASSERT(expiry.n_expired == 2);
+
+    ttl_hashmap_destroy(&map);
+}
+
+void
+test_reschedule(void)
+{
+    struct ttl_hashmap map;
+    struct expiry      expiry = { 0 };
+    void*              value;
+
+    ttl_hashmap_init(&map, hash_uint, compare_uint);
+    ttl_hashmap_set_expire_callback(&map, on_expire, &expiry);
+
+    ttl_hashmap_set(&map, KEY(1), KEY(10), 100);
+    ttl_hashmap_set(&map, KEY(2), KEY(20), 100);
+
+    /* extend one, remove the other */
+    ttl_hashmap_set(&map, KEY(1), KEY(11), 10000);
+    CU_ASSERT(ttl_hashmap_remove(&map, KEY(2)));
+    CU_ASSERT(!ttl_hashmap_remove(&map, KEY(2)));
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 9999, SIZE_MAX) == 0);
+    CU_ASSERT(ttl_hashmap_get(&map, KEY(1), 9999, &value));
+    CU_ASSERT(value == KEY(11));
+    CU_ASSERT(expiry.n_expired == 0);
+
+    CU_ASSERT(ttl_hashmap_expire_tick(&map, 10000, SIZE_MAX) == 1);
+    CU_ASSERT(map.n_entries == 0);
+
+    ttl_hashmap_destroy(&map);
+}
+
+void
+test_bounded_tick(void)
+{
+    const size_t       n = 10000;
+    struct ttl_hashmap map;
+    size_t             n_expired = 0;
+    size_t             n_calls   = 0;
+
+    ttl_hashmap_init(&map, hash_uint, compare_uint);
+
+    for (size_t i = 0; i < n; i++) {
+        ttl_hashmap_set(&map, KEY(i), NULL, 1000 + i % 100);
+    }
+
+    for (;;) {
+        size_t batch = ttl_hashmap_expire_tick(&map, 5000, 256);
+
+        CU_ASSERT(batch <= 256);
+        n_expired += batch;
+        n_calls++;
+
+        if (batch < 256) {
+            break;
+        }
+    }
+
+    CU_ASSERT(n_expired == n);
+    CU_ASSERT(n_calls == (n + 255) / 256);
+    CU_ASSERT(map.n_entries == 0);
+    CU_ASSERT(map.now == 5000);
+
+    ttl_hashmap_destroy(&map);
+}
+
+void
+test_churn(void)
+{
+    const size_t       n         = 5000;
+    uint64_t*          deadlines = calloc(n, sizeof(*deadlines));
+    struct ttl_hashmap map;
+    struct expiry      expiry = { .deadlines = deadlines };
+    uint64_t           x      = 88172645463325252ULL;
+    uint64_t           swept  = 0;
+
+    CU_ASSERT_FATAL(deadlines != NULL);
+    ttl_hashmap_init(&map, hash_uint, compare_uint);
+    ttl_hashmap_set_expire_callback(&map, on_expire, &expiry);
+
+    /* deadlines spread over several levels of the wheel, with time
+     * advancing in uneven steps */
+    for (size_t i = 0; i < 200000; i++) {
+        size_t key;
+        void*  value;
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        key = x % n;
+
+        switch (x >> 60 & 3) {
+        case 0:
+            deadlines[key]
+                = expiry.now + 1 + (x >> 20) % ((uint64_t)1 << (x >> 8 & 31));
+            CU_ASSERT(
+                ttl_hashmap_set(&map, KEY(key), KEY(key), deadlines[key]));
+            break;
+        case 1:
+            /* nothing survives a full tick past its deadline */
+            if (hashmap_lookup(&map.map, KEY(key)) != NULL) {
+                CU_ASSERT(deadlines[key] > swept);
+            }
+
+            if (ttl_hashmap_get(&map, KEY(key), expiry.now, &value)) {
+                CU_ASSERT(deadlines[key] > expiry.now);
+                CU_ASSERT(value == KEY(key));
+            }
+            break;
+        case 2:
+            expiry.now += ((x >> 24) % 64) << (x >> 40 & 15);
+
+            if (x >> 32 & 1) {
+                ttl_hashmap_expire_tick(&map, expiry.now, SIZE_MAX);
+                swept = expiry.now;
+            }
+            else {
+                ttl_hashmap_expire_tick(&map, expiry.now, (x >> 33) % 64);
+            }
+            break;
+        default:
+            ttl_hashmap_remove(&map, KEY(key));
+            break;
+        }
+
+        CU_ASSERT(map.n_entries == map.map.n_entries);
+    }
+
+    expiry.now = UINT64_MAX;
+    ttl_hashmap_expire_tick(&map, expiry.now, SIZE_MAX);
+    CU_ASSERT(map.n_entries == 0);
+    CU_ASSERT(expiry.n_early == 0);
+
+    ttl_hashmap_destroy(&map);
+    free(deadlines);
+}
+
+static struct test_case tests[] = {
+    { .name = "test TTL hashmap expiry", .test_function = test_expiry },
+    { .name          = "test TTL hashmap lazy expiry",
+      .test_function = test_lazy_expiry },
+    { .name          = "test TTL hashmap reschedule",
+      .test_function = test_reschedule },
+    { .name          = "test TTL hashmap bounded tick",
+      .test_function = test_bounded_tick },
+    { .name = "test TTL hashmap churn", .test_function = test_churn },
+};
+
+TEST_MAIN("TTL hashmaps", tests)